@@ -0,0 +1,142 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "Matrix.h"
+#include "Environment.h"
+
+namespace BaseML::RL
+{
+	// Base of the synthetic environments shipped for benchmarking and testing the algorithms. Every player
+	// simulates an independent copy of the system, so the number of players sets the width of the batched
+	// interface. The environments are deterministic: the initial states are generated from 'seed' with a
+	// counter-based generator, so the same seed, actions and number of players always give the same data.
+	// An episode ends for a player when its system reaches a terminal state, and for all of the players
+	// after 'maxEpisodeSteps' updates.
+	class BenchmarkEnvironment : public Environment
+	{
+	protected:
+		std::vector<std::string> players;
+		std::vector<Matrix> states, actions; // Column matrices of every player
+		std::vector<float> rewards;
+		std::vector<unsigned char> dones;
+
+		size_t maxEpisodeSteps, episodeStep;
+		uint64_t seed, episode; // The initial states of episode 'episode' are generated from the stream of 'seed'
+
+		bool initialized, renderMode;
+
+		BenchmarkEnvironment(size_t observationDim, size_t actionDim, size_t numPlayers, size_t maxEpisodeSteps,
+			uint64_t seed, float deltaTime);
+
+		// Fill 'dest' with 'count' uniformly distributed random numbers in [min, max) for the initial state of
+		// the player with the given index. The numbers depend only on the seed, the episode and the player.
+		void sampleInitialValues(size_t playerIndex, float* dest, size_t count, float min, float max) const;
+
+		// Set the initial state of the player with the given index
+		virtual void resetPlayer(size_t playerIndex) = 0;
+
+		// Advance the system of the player with the given index by 'deltaTime' using its action in 'actions',
+		// then set its reward and its done flag. Called in parallel for different players.
+		virtual void stepPlayer(size_t playerIndex) = 0;
+
+	public:
+		const std::vector<std::string>& getPlayers() const override;
+
+		void update() override;
+
+		const Matrix& getState(const char* playerId) const override;
+
+		void setAction(const char* playerId, const Matrix& action) override;
+
+		float getReward(const char* playerId) const override;
+
+		void initialize(bool renderMode = false) override;
+
+		bool isInitialized() override;
+
+		// Returns true when all of the players reached a terminal state
+		bool isFinished() override;
+
+		void close() override;
+
+		void reset() override;
+
+		// Prints the states of all of the players
+		void render() override;
+
+		const Matrix& getPlayerState(size_t playerIndex) const override;
+
+		void setPlayerAction(size_t playerIndex, const Matrix& action) override;
+
+		float getPlayerReward(size_t playerIndex) const override;
+
+		bool isPlayerFinished(size_t playerIndex) override;
+
+		void observeBatch(EnvironmentBatch& batch) override;
+
+		void stepBatch(const Matrix& actions, EnvironmentBatch& batch) override;
+	};
+
+	// The classic cart-pole balancing task (Barto, Sutton and Anderson 1983) with a continuous action. The
+	// observation is (cart position, cart velocity, pole angle, pole angular velocity) and the action is the
+	// force applied to the cart, scaled to [-1, 1]. The reward is 1 for every step in which the pole stays up and
+	// the episode ends when the pole falls past 12 degrees or the cart leaves the track.
+	class CartPoleEnvironment : public BenchmarkEnvironment
+	{
+	private:
+		static constexpr float GRAVITY = 9.8f, CART_MASS = 1.0f, POLE_MASS = 0.1f, POLE_HALF_LENGTH = 0.5f;
+		static constexpr float FORCE_MAGNITUDE = 10.0f;
+		static constexpr float MAX_ANGLE = 0.2094395f, MAX_POSITION = 2.4f; // 12 degrees and the end of the track
+
+	protected:
+		void resetPlayer(size_t playerIndex) override;
+
+		void stepPlayer(size_t playerIndex) override;
+
+	public:
+		CartPoleEnvironment(size_t numPlayers = 1, size_t maxEpisodeSteps = 500, uint64_t seed = 0);
+	};
+
+	// Swinging up and holding an inverted pendulum with a limited torque. The observation is (cos angle,
+	// sin angle, angular velocity) and the action is the torque, clipped to [-2, 2]. The reward is the negative
+	// cost of the angle from the top, the velocity and the torque, and episodes only end at the step limit.
+	class PendulumEnvironment : public BenchmarkEnvironment
+	{
+	private:
+		static constexpr float GRAVITY = 10.0f, MASS = 1.0f, LENGTH = 1.0f;
+		static constexpr float MAX_TORQUE = 2.0f, MAX_SPEED = 8.0f;
+		static constexpr float PI = 3.14159265359f;
+
+	protected:
+		void resetPlayer(size_t playerIndex) override;
+
+		void stepPlayer(size_t playerIndex) override;
+
+	public:
+		PendulumEnvironment(size_t numPlayers = 1, size_t maxEpisodeSteps = 200, uint64_t seed = 0);
+	};
+
+	// A damped point mass in 'dimension' dimensions that should be brought to the origin and stopped there.
+	// The observation is the position followed by the velocity and the action is the acceleration, clipped to
+	// [-1, 1] in every dimension. The reward is the negative squared distance from the origin minus a small
+	// cost of the action, and episodes only end at the step limit. The dimension scales the size of the
+	// networks' inputs and outputs without changing the difficulty of the task.
+	class PointMassEnvironment : public BenchmarkEnvironment
+	{
+	private:
+		static constexpr float DAMPING = 0.1f, ACTION_COST = 0.01f;
+
+		size_t dimension;
+
+	protected:
+		void resetPlayer(size_t playerIndex) override;
+
+		void stepPlayer(size_t playerIndex) override;
+
+	public:
+		PointMassEnvironment(size_t dimension = 2, size_t numPlayers = 1, size_t maxEpisodeSteps = 200, uint64_t seed = 0);
+	};
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <vector>
+#include <span>
+
+#include "Matrix.h"
+#include "UtilsFunctions.h"
+
+namespace BaseML
+{
+	// A layer of filters that slide over a grid of values (a sequence in Conv1DLayer, an image in Conv2DLayer).
+	// Every filter shares its weights between all of the positions of the grid, so the layer has far fewer weights
+	// than a dense Layer over the same values and it doesn't have to learn the same feature at every position.
+	//
+	// A data point is a column of 'channels * height * width' values, channel by channel and every channel row by
+	// row: value (c, y, x) is at row (c * height + y) * width + x. The outputs are laid out the same way, with a
+	// channel per filter. 1D layers have a height of 1.
+	//
+	// The convolutions are computed directly from the inputs (without unfolding them into a matrix of patches).
+	// The weights of one input value to all of the filters are contiguous, so the inner loops of the kernels run
+	// over the filters (output channels) with unit stride, and the data points of a batch are spread between the
+	// threads.
+	class ConvolutionLayer
+	{
+	private:
+		size_t inputChannels, inputHeight, inputWidth;
+		size_t filterCount, kernelHeight, kernelWidth;
+		size_t strideHeight, strideWidth, paddingHeight, paddingWidth;
+		size_t outputHeight, outputWidth;
+		size_t inputCount, outputCount, batchSize;
+
+		// A row per input value of a filter (channel, then kernel row, then kernel column) and a column per filter
+		Matrix weights, biases;
+
+		// The outputs are column-major, so every data point is contiguous. The gradients (before the activation
+		// functions) have a column per position of every data point (data point by data point) and a row per filter.
+		Matrix outputs, gradients;
+
+		// Column-major copy of the inputs of the last forward pass, when they were row-major
+		Matrix inputColumns;
+
+		const Matrix* inputRef; // The (column-major) inputs of the last forward pass. This class doesn't manage this memory!
+		float (*activationFunc)(float), (*activationFuncDerivative)(float);
+
+		// Adam Optimizer matrices
+		Matrix mWeights, vWeights, mBiases, vBiases;
+
+		// Resize the gradients to fit the outputs of the last batch. Kept between batches, so allocated from the
+		// heap even inside a MatrixArena scope.
+		void resizeGradients();
+
+		// Run the filters over the column-major data point at 'input' and write the outputs (after the activation
+		// function) to column 'column' of 'outputs'. 'sums' is scratch memory of filterCount values.
+		void convolve(const float* input, Matrix& outputs, size_t column, float* sums) const;
+
+		// Apply one Adam Optimizer step to the parameters using the given (batch averaged) gradients, laid out like in getParameters()
+		void adamUpdate(const float* gradients, float learningRate, size_t timestep, float beta1, float beta2, float epsilon);
+
+		// Add the gradients of the parameters, summed over the data points of the last batch and multiplied by 'scale',
+		// to 'dest' (laid out like in getParameters()). Every thread sums the data points it is given and the partial
+		// sums are added at the end.
+		void accumulateParameterGradients(float* dest, float scale) const;
+
+	protected:
+		// Creates a layer of 'numFilters' filters of 'kernelRows' x 'kernelColumns' values over inputs of 'channels'
+		// grids of 'rows' x 'columns' values
+		ConvolutionLayer(size_t channels, size_t rows, size_t columns, size_t numFilters, size_t kernelRows, size_t kernelColumns,
+			size_t strideRows, size_t strideColumns, size_t paddingRows, size_t paddingColumns,
+			float (*activationFunction)(float), float (*activationFunctionDerivative)(float));
+
+	public:
+		// Default constructor for creating an empty object
+		ConvolutionLayer();
+
+		// Set the activation function of this layer
+		void setActivationFunction(float (*activationFunction)(float),
+			float (*activationFunctionDerivative)(float));
+
+		// Returns the number of inputs (channels * height * width) of this layer
+		size_t getInputCount() const;
+
+		// Returns the number of outputs (filters * output height * output width) of this layer
+		size_t getOutputCount() const;
+
+		// Returns the number of channels of the inputs
+		size_t getInputChannels() const;
+
+		// Returns the number of filters (channels of the outputs)
+		size_t getFilterCount() const;
+
+		// Returns the height of the grid of outputs of every filter (1 in a 1D layer)
+		size_t getOutputHeight() const;
+
+		// Returns the width of the grid of outputs of every filter (the length of the outputs in a 1D layer)
+		size_t getOutputWidth() const;
+
+		// Returns the number data points the layer is currently configured to process together
+		size_t getCurrentBatchSize() const;
+
+		// Returns the outputs of this layer
+		const Matrix& getOutputs() const;
+
+		// Returns the weights of this layer
+		const Matrix& getWeights() const;
+
+		// Returns the biases of this layer
+		const Matrix& getBiases() const;
+
+		// Returns the gradients of this layer
+		const Matrix& getGradients() const;
+
+		// Perform forward propagation on this layer with the specified inputs. The outputs are column-major in both
+		// layouts of the inputs (row-major inputs are copied to column-major memory first).
+		void calculateOutputs(const Matrix* inputs);
+
+		// Perform forward propagation with the specified inputs and write the results to 'outputs' without
+		// changing the state of the layer, so it can be called from several threads at once. 'outputs' is
+		// only reallocated (column-major) if it doesn't have the right size.
+		void calculateOutputs(const Matrix& inputs, Matrix& outputs) const;
+
+		// Calculate the gradients of the last layer based on the loss function and the expected outputs
+		void calculateLastLayerGradientsToTarget(const Matrix& expectedOutputs, float (*lossFunctionDerivative)(float, float));
+
+		// Calculate the gradients of this layer based on the gradients of the optimization objective with respect to
+		// its outputs: the external gradients in the last layer, or the input gradients of the next layer.
+		void calculateLastLayerGradients(const Matrix& externalGradients);
+
+		// Returns the gradients of the optimization objective with respect to the inputs of this layer (column-major).
+		// Assumes that the gradients of this layer were already calculated.
+		Matrix calculateInputGradients() const;
+
+		// Update the parameters according to the gradients using Adam Optimizer. 'timestep' is the number of times the
+		// layer's parameters have been updated before.
+		void adamGradientDescent(float learningRate, size_t timestep, float beta1 = 0.9f, float beta2 = 0.999f, float epsilon = 1.0e-8f);
+
+		// Returns the number of parameters (weights and biases) of this layer
+		size_t getParameterCount() const;
+
+		// Copy the parameters of this layer to 'dest' (the weights followed by the biases, as they are saved)
+		void getParameters(float* dest) const;
+
+		// Replace the parameters of this layer with the values in 'src' (laid out like in getParameters())
+		void setParameters(const float* src);
+
+		// Append views of the parameters of this layer to 'spans', in the order of getParameters()
+		void getParameterSpans(std::vector<std::span<float>>& spans);
+
+		// Add the gradients of the parameters, summed over the data points of the last batch, to 'dest' (laid out
+		// like in getParameters()). Assumes that the gradients of this layer were already calculated.
+		void addParameterGradients(float* dest) const;
+
+		// Update the parameters with Adam Optimizer using the given gradients (laid out like in getParameters()
+		// and averaged over the data points they were calculated from) instead of the layer's own gradients
+		void applyParameterGradients(const float* gradients, float learningRate, size_t timestep, float beta1 = 0.9f,
+			float beta2 = 0.999f, float epsilon = 1.0e-8f);
+
+		// Save the layer to disk. Assumes a binary output stream
+		void save(std::ofstream& outFile);
+
+		// Load the layer from disk. Assumes a binary input stream
+		void load(std::ifstream& inFile, float (*activationFunction)(float) = &Utils::leakyReLU,
+			float (*activationFunctionDerivative)(float) = &Utils::leakyReLUDerivative);
+	};
+
+	// A convolution over sequences: 'channels' sequences of 'length' values per data point
+	class Conv1DLayer : public ConvolutionLayer
+	{
+	public:
+		// Default constructor for creating an empty object
+		Conv1DLayer();
+
+		// Creates a layer of 'numFilters' filters of 'kernelSize' values that move by 'stride' values over inputs of
+		// 'channels' sequences of 'length' values, with 'padding' zeros at both ends of the sequences. Throws
+		// std::invalid_argument if 'stride' is 0 or the kernel is longer than the padded sequences.
+		Conv1DLayer(size_t channels, size_t length, size_t numFilters, size_t kernelSize, size_t stride = 1, size_t padding = 0,
+			float (*activationFunction)(float) = &Utils::leakyReLU, float (*activationFunctionDerivative)(float) = &Utils::leakyReLUDerivative);
+	};
+
+	// A convolution over images: 'channels' grids of 'height' x 'width' values per data point
+	class Conv2DLayer : public ConvolutionLayer
+	{
+	public:
+		// Default constructor for creating an empty object
+		Conv2DLayer();
+
+		// Creates a layer of 'numFilters' filters of 'kernelSize' x 'kernelSize' values that move by 'stride' values
+		// in both directions over inputs of 'channels' grids of 'height' x 'width' values, with 'padding' rows and
+		// columns of zeros around the grids. Throws std::invalid_argument if 'stride' is 0 or the kernel is larger
+		// than the padded grids.
+		Conv2DLayer(size_t channels, size_t height, size_t width, size_t numFilters, size_t kernelSize, size_t stride = 1,
+			size_t padding = 0, float (*activationFunction)(float) = &Utils::leakyReLU,
+			float (*activationFunctionDerivative)(float) = &Utils::leakyReLUDerivative);
+	};
+}
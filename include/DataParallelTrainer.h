@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+
+#include "Matrix.h"
+#include "NeuralNetwork.h"
+
+namespace BaseML
+{
+	// Trains a Neural Network with data parallelism across threads. A batch is split between the threads, 
+	// each thread runs the forward and backward passes of its shard on a private copy (replica) of the network 
+	// and sums the parameter gradients to a private buffer. The buffers are then combined with an all-reduce 
+	// and a single optimizer step is applied to the trained network, so the result is the same as training 
+	// on the whole batch at once.
+	// Gradients can also be accumulated over several calls to accumulate() (micro-batches) before calling 
+	// step(), to train on batches that are too large to pass through the network at once.
+	// The trained network should not be changed by other means while the trainer is used, unless 
+	// synchronize() is called afterwards.
+	class DataParallelTrainer
+	{
+	private:
+		NeuralNetwork& network;
+
+		std::vector<NeuralNetwork> replicas; // Copy of the network for every thread
+		std::vector<std::vector<float>> gradientBuffers; // Summed parameter gradients of every replica
+		std::vector<float> parameters; // Buffer for copying the parameters to the replicas
+
+		size_t parameterCount;
+		size_t accumulatedDataPoints; // Number of data points whose gradients were accumulated since the last step
+
+		// Copy the columns ['begin', 'end') of 'mat' to a new Matrix
+		static Matrix getColumns(const Matrix& mat, size_t begin, size_t end);
+
+	public:
+		// Create a trainer for 'network' that uses 'numThreads' threads (0 means the OpenMP default). The 
+		// trainer keeps a reference to the network, so the network should outlive it.
+		DataParallelTrainer(NeuralNetwork& network, size_t numThreads = 0);
+
+		// Returns the number of threads (and replicas) used
+		size_t getThreadCount() const;
+
+		// Copy the parameters of the trained network to all of the replicas. Call after the network was 
+		// changed outside of the trainer.
+		void synchronize();
+
+		// Pass the data through the replicas and add the gradients of the loss to the accumulated gradients 
+		// without updating the parameters. Returns the average loss of the data points.
+		float accumulate(const Matrix& inputs, const Matrix& expectedOutputs);
+
+		// Combine the gradients accumulated by all of the threads, apply one Adam Optimizer step to the trained 
+		// network with their average and copy the new parameters to the replicas. Does nothing if no gradients 
+		// were accumulated.
+		void step(float learningRate = 0.001f);
+
+		// Accumulate the gradients of the whole batch and apply a single optimizer step. If 'microBatchSize' isn't 
+		// 0 the batch is passed through the network in parts of at most this many data points. Returns the 
+		// average loss of the data points.
+		float learn(const Matrix& inputs, const Matrix& expectedOutputs, float learningRate = 0.001f, size_t microBatchSize = 0);
+	};
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+#include "Matrix.h"
+#include "MappedFile.h"
+
+namespace BaseML
+{
+	// A source of data points for supervised training. Every data point has an input of getInputDimension() 
+	// values and an expected output of getOutputDimension() values. Sources are read by one thread at a time.
+	class DatasetSource
+	{
+	public:
+		virtual ~DatasetSource() = default;
+
+		// Returns the number of data points
+		virtual size_t size() const = 0;
+
+		virtual size_t getInputDimension() const = 0;
+
+		virtual size_t getOutputDimension() const = 0;
+
+		// Returns the number of consecutive data points that are read together from the storage of the source. 
+		// Shuffling permutes whole chunks and the data points inside every chunk, so a source that loads one 
+		// chunk at a time is read sequentially. Sources with cheap random access return size().
+		virtual size_t getChunkSize() const
+		{
+			return size();
+		}
+
+		// Copy the data points at 'indices' to the columns of 'inputs' and 'expectedOutputs' (data point 
+		// indices[i] to column i). The matrices should have at least 'count' columns.
+		virtual void readBatch(const size_t* indices, size_t count, Matrix& inputs, Matrix& expectedOutputs) = 0;
+	};
+
+	// A dataset held in memory as two matrices with a data point in each column
+	class InMemoryDataset : public DatasetSource
+	{
+	private:
+		Matrix inputs, expectedOutputs;
+
+	public:
+		// Create a dataset from matrices with a data point in each column
+		InMemoryDataset(Matrix inputs, Matrix expectedOutputs);
+
+		// Create a dataset from pairs of input and expected output column vectors (the format used by 
+		// NeuralNetwork::learn())
+		InMemoryDataset(const std::vector<std::pair<Matrix, Matrix>>& data);
+
+		size_t size() const override;
+
+		size_t getInputDimension() const override;
+
+		size_t getOutputDimension() const override;
+
+		void readBatch(const size_t* indices, size_t count, Matrix& inputs, Matrix& expectedOutputs) override;
+	};
+
+	// Binary dataset files start with this header, followed by the data points starting at 'dataOffset'. Every 
+	// data point is stored as its input values followed by its expected output values (32-bit floats).
+	struct DatasetFileHeader
+	{
+		static constexpr uint32_t MAGIC = 0x444c4d42; // "BMLD"
+		static constexpr uint32_t VERSION = 1;
+		static constexpr uint64_t DATA_OFFSET = 64;
+
+		uint32_t magic;
+		uint32_t version;
+		uint64_t inputDimension;
+		uint64_t outputDimension;
+		uint64_t count;
+		uint64_t dataOffset;
+	};
+
+	// Writes a binary dataset file by appending data points. The file can be larger than the memory.
+	class DatasetFileWriter
+	{
+	private:
+		std::ofstream file;
+		DatasetFileHeader header;
+		std::vector<float> record;
+
+		void writeHeader();
+
+	public:
+		// Create (or overwrite) the dataset file at 'path'
+		DatasetFileWriter(const char* path, size_t inputDimension, size_t outputDimension);
+
+		// Completes the file if close() wasn't called
+		~DatasetFileWriter();
+
+		// Append the data points in the columns of 'inputs' and 'expectedOutputs'
+		void append(const Matrix& inputs, const Matrix& expectedOutputs);
+
+		// Returns the number of data points written so far
+		size_t size() const;
+
+		// Write the final number of data points to the header and close the file
+		void close();
+	};
+
+	// A dataset read from a binary dataset file mapped to memory. Only the pages of the data points that are 
+	// used are loaded, and the operating system can evict them under memory pressure.
+	class MemoryMappedDataset : public DatasetSource
+	{
+	private:
+		Utils::MappedFile file;
+		DatasetFileHeader header;
+		const float* records;
+
+	public:
+		// Map the dataset file at 'path'. Throws if it isn't a valid dataset file.
+		MemoryMappedDataset(const char* path);
+
+		size_t size() const override;
+
+		size_t getInputDimension() const override;
+
+		size_t getOutputDimension() const override;
+
+		void readBatch(const size_t* indices, size_t count, Matrix& inputs, Matrix& expectedOutputs) override;
+	};
+
+	// A dataset read from a binary dataset file with regular file reads, one chunk of consecutive data points 
+	// at a time. Only one chunk is held in memory. Use where memory mapping isn't available or desired (for 
+	// example on network file systems).
+	class ChunkedFileDataset : public DatasetSource
+	{
+	private:
+		static constexpr size_t DEFAULT_CHUNK_SIZE = 4096;
+
+		std::ifstream file;
+		DatasetFileHeader header;
+		size_t chunkSize;
+
+		std::vector<float> chunk; // The records of the loaded chunk
+		size_t loadedChunk; // Index of the loaded chunk (SIZE_MAX if none)
+
+		// Returns the record of data point 'index', loading its chunk if needed
+		const float* getRecord(size_t index);
+
+	public:
+		// Open the dataset file at 'path'. Throws if it isn't a valid dataset file.
+		ChunkedFileDataset(const char* path, size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+		size_t size() const override;
+
+		size_t getInputDimension() const override;
+
+		size_t getOutputDimension() const override;
+
+		size_t getChunkSize() const override;
+
+		void readBatch(const size_t* indices, size_t count, Matrix& inputs, Matrix& expectedOutputs) override;
+	};
+}
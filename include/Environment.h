@@ -2,11 +2,23 @@
 
 #include <vector>
 #include <string>
+#include <stdexcept>
 
 #include "Matrix.h"
+#include "MatrixArena.h"
 
 namespace BaseML::RL
 {
+	// Buffers for the data of all of the players of an environment, filled by Environment::observeBatch() and 
+	// Environment::stepBatch(). Each player is addressed by its index in Environment::getPlayers() and its data 
+	// is stored in the column with that index, so every feature of the players is contiguous in memory.
+	struct EnvironmentBatch
+	{
+		Matrix observations; // Observation dimension x number of players
+		Matrix rewards; // Row vector with the reward of every player
+		std::vector<unsigned char> dones; // 1 for every player that reached a terminal state, 0 otherwise
+	};
+
 	class Environment
 	{
 	protected:
@@ -15,6 +27,8 @@ namespace BaseML::RL
 		// 'deltaTime' is the amount of time to assume that have passed since the last update
 		float deltaTime; 
 
+		Matrix playerAction; // The action of one player in the default stepBatch(), reused between steps
+
 	public:
 		Environment(size_t observationDim, size_t actionDim)
 			:obsDim(observationDim), actDim(actionDim)
@@ -67,5 +81,123 @@ namespace BaseML::RL
 
 		// Display the current state of the environment. Environment must be in "render mode".
 		virtual void render() = 0;
+
+		// Batched interface. Players are addressed by their index in getPlayers(). The default implementations 
+		// adapt the per-player functions above, environments with many players should override them to avoid 
+		// a virtual call and a name lookup for every player.
+
+		// Returns the number of players in the environment
+		size_t getPlayerCount() const
+		{
+			return getPlayers().size();
+		}
+
+		// Returns the index of the player with the given id or throws if there is no such player
+		size_t getPlayerIndex(const char* playerId) const
+		{
+			const std::vector<std::string>& players = getPlayers();
+
+			for (size_t i = 0; i < players.size(); i++)
+			{
+				if (players[i] == playerId)
+					return i;
+			}
+
+			throw std::runtime_error("Unknown player id");
+		}
+
+		// Get the current state of the player with the given index as a column matrix
+		virtual const Matrix& getPlayerState(size_t playerIndex) const
+		{
+			return getState(getPlayers()[playerIndex].c_str());
+		}
+
+		// Set the action that the player with the given index will perform in the next update
+		virtual void setPlayerAction(size_t playerIndex, const Matrix& action)
+		{
+			setAction(getPlayers()[playerIndex].c_str(), action);
+		}
+
+		// Get the reward of the current state of the player with the given index
+		virtual float getPlayerReward(size_t playerIndex) const
+		{
+			return getReward(getPlayers()[playerIndex].c_str());
+		}
+
+		// Check if the player with the given index reached a terminal state. By default every player 
+		// finishes together with the environment.
+		virtual bool isPlayerFinished(size_t)
+		{
+			return isFinished();
+		}
+
+		// Write the current observations of all of the players to 'batch'. The buffers of 'batch' are 
+		// resized if they don't fit the environment.
+		virtual void observeBatch(EnvironmentBatch& batch)
+		{
+			prepareBatch(batch);
+
+			for (size_t p = 0; p < batch.dones.size(); p++)
+			{
+				const Matrix& state = getPlayerState(p);
+
+				for (size_t i = 0; i < obsDim; i++)
+				{
+					batch.observations(i, p) = state(i);
+				}
+			}
+		}
+
+		// Set the actions of all of the players (column p of 'actions' is the action of player p), update the 
+		// environment and write the new observations, the rewards and the done flags of all of the players 
+		// to 'batch'. The buffers of 'batch' are resized if they don't fit the environment.
+		virtual void stepBatch(const Matrix& actions, EnvironmentBatch& batch)
+		{
+			size_t numPlayers = getPlayerCount();
+
+			if (playerAction.rowsCount() != actions.rowsCount() || playerAction.columnsCount() != 1)
+			{
+				MatrixArena::HeapScope heap;
+				playerAction = Matrix(actions.rowsCount(), 1);
+			}
+
+			for (size_t p = 0; p < numPlayers; p++)
+			{
+				for (size_t i = 0; i < actions.rowsCount(); i++)
+				{
+					playerAction(i) = actions(i, p);
+				}
+
+				setPlayerAction(p, playerAction);
+			}
+
+			update();
+
+			observeBatch(batch);
+
+			for (size_t p = 0; p < numPlayers; p++)
+			{
+				batch.rewards(p) = getPlayerReward(p);
+				batch.dones[p] = isPlayerFinished(p) ? 1 : 0;
+			}
+		}
+
+	protected:
+		// Resize the buffers of 'batch' to fit the dimensions and the number of players of the environment
+		void prepareBatch(EnvironmentBatch& batch) const
+		{
+			size_t numPlayers = getPlayerCount();
+
+			if (batch.observations.rowsCount() != obsDim || batch.observations.columnsCount() != numPlayers)
+				batch.observations = Matrix(obsDim, numPlayers);
+
+			if (batch.rewards.columnsCount() != numPlayers)
+			{
+				batch.rewards = Matrix(1, numPlayers);
+				batch.rewards.clear();
+			}
+
+			batch.dones.resize(numPlayers, 0);
+		}
 	};
 }
\ No newline at end of file
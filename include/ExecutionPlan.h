@@ -0,0 +1,120 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "Matrix.h"
+#include "NeuralNetwork.h"
+
+namespace BaseML
+{
+	// A NeuralNetwork compiled for a maximum batch size into a flat list of fused kernels that run on buffers
+	// planned ahead of time. Every intermediate value (the activations and, when training, the gradients of the
+	// layers) gets a slice of one arena, and values whose lifetimes don't overlap share a slice: an inference plan
+	// needs only two ping-pong slices, so its memory is about two layers' worth of activations regardless of the
+	// depth of the network. Running a plan never allocates.
+	// The plan reads the parameters of the network when it runs (so the network can keep being trained by other
+	// means), but it depends on the layers of the network: compile a new plan after the layers are replaced.
+	// Plans are compiled from networks of dense layers (Layer) only.
+	// A plan is not thread-safe, every thread should compile its own.
+	class ExecutionPlan
+	{
+	public:
+		enum class Mode
+		{
+			Inference, // Forward passes only
+			Training // Forward and backward passes and parameter updates
+		};
+
+	private:
+		enum class StepType
+		{
+			Dense, // The weighted sum of the inputs, the bias and the activation function of a layer
+			OutputGradients, // The loss of the last layer and its derivative through the activation function
+			HiddenGradients, // The transposed weights times the gradients of the next layer, through the activation function
+			ParameterGradients // The gradients of the weights and biases of a layer (both computed from one pass over the gradients)
+		};
+
+		// An intermediate value with the data points as columns
+		struct Value
+		{
+			size_t rows;
+			size_t slice; // Index in 'sliceOffsets'
+			size_t firstStep, lastStep; // The value is written in 'firstStep' and last read in 'lastStep'
+		};
+
+		// The network's input and the expected outputs are read from the caller's matrices
+		static constexpr size_t INPUT_VALUE = (size_t)-1, TARGET_VALUE = (size_t)-2;
+
+		struct Step
+		{
+			StepType type;
+			size_t layer;
+			size_t input, output; // Indices in 'values' (or INPUT_VALUE and TARGET_VALUE)
+			size_t activations; // The outputs of the layer, for the derivative of its activation function
+			size_t parameterOffset; // Position of the layer's parameters in the flat gradients buffer
+		};
+
+		NeuralNetwork& network;
+		Mode mode;
+		size_t maxBatchSize;
+
+		std::vector<Value> values;
+		std::vector<Step> steps;
+		std::vector<size_t> sliceOffsets; // Position of every slice in the arena, in floats
+		std::vector<float> arena;
+		std::vector<float> parameterGradients; // Training only, laid out like NeuralNetwork::getParameters()
+
+		size_t outputValue;
+		size_t currentBatch;
+
+		// Add a value with 'rows' rows that is written in step 'firstStep'. Returns its index.
+		size_t addValue(size_t rows, size_t firstStep);
+
+		// Mark 'value' as read in step 'step'
+		void useValue(size_t value, size_t step);
+
+		// Assign the values to slices of the arena with a linear scan over their lifetimes: a value takes a slice
+		// freed by a value that died before it was written (preferring the smallest slice that fits, else growing
+		// the largest free one) and only gets a new slice when no slice is free
+		void allocateSlices();
+
+		// Returns the memory of a value (or of the caller's input and expected outputs) for 'currentBatch' columns
+		const float* getData(size_t value, const Matrix& inputs, const Matrix& expectedOutputs) const;
+		float* getData(size_t value);
+
+		// Returns dense layer 'index' of the network
+		const Layer& getLayer(size_t index) const;
+
+		// Run the steps in [first, end)
+		void runSteps(size_t first, size_t end, const Matrix& inputs, const Matrix& expectedOutputs, float& loss);
+
+		void runDense(const Step& step, const Matrix& inputs);
+		float runOutputGradients(const Step& step, const Matrix& expectedOutputs);
+		void runHiddenGradients(const Step& step);
+		void runParameterGradients(const Step& step, const Matrix& inputs);
+
+	public:
+		// Compile 'network' for batches of up to 'maxBatchSize' data points
+		ExecutionPlan(NeuralNetwork& network, size_t maxBatchSize, Mode mode = Mode::Inference);
+
+		// Run the inputs (up to the maximum batch size of data points, as columns, in either layout) through the
+		// network. Returns the outputs, which are a row-major view of the arena that stays valid until the plan
+		// runs again.
+		Matrix infer(const Matrix& inputs);
+
+		// Run a forward and a backward pass and apply one Adam Optimizer step to the network with the gradients
+		// averaged over the batch, like NeuralNetwork::learn(). Only for plans compiled in training mode. Returns
+		// the average loss of the batch.
+		float learn(const Matrix& inputs, const Matrix& expectedOutputs, float learningRate = 0.001f);
+
+		// Returns the size of the arena of the intermediate values in bytes
+		size_t getArenaSize() const;
+
+		// Returns the number of kernels the plan runs
+		size_t getStepCount() const;
+
+		// Returns a description of the steps and of the slices of the arena they use
+		std::string describe() const;
+	};
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Matrix.h"
+#include "Policy.h"
+#include "MPSCQueue.h"
+
+namespace BaseML
+{
+	// Answers inference requests from many threads with batched forward passes of a trained policy. Requests 
+	// are submitted through lock-free queues and collected by worker threads into micro-batches: a worker 
+	// starts a batch with the oldest waiting request and adds requests until the batch is full or the oldest 
+	// request has waited the maximum latency, then runs one forward pass for the whole batch and completes the 
+	// futures of its requests. The observations of the batch are normalized inside the pass with the statistics 
+	// of the policy, so requests carry raw observations (followed by the state in a recurrent policy, see Policy).
+	// The workers share the parameters of the policy and never change it, so the policy must not be changed 
+	// or destroyed while the server runs.
+	class InferenceServer
+	{
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		struct Request : Utils::MPSCNode
+		{
+			Matrix input;
+			std::promise<Matrix> result;
+			Clock::time_point submitTime;
+		};
+
+		struct Worker
+		{
+			Utils::MPSCQueue queue;
+			std::atomic<uint32_t> signal{ 0 }; // Changed whenever a request is submitted or the server stops
+			std::thread thread;
+
+			Matrix batchInputs;
+			RL::PolicyWorkspace workspace;
+			std::vector<Request*> batch;
+		};
+
+		const RL::Policy& policy;
+		size_t maxBatchSize;
+		Clock::duration maxLatency;
+		int threadsPerWorker; // OpenMP threads used by each worker for its forward passes
+
+		std::vector<std::unique_ptr<Worker>> workers;
+		std::atomic<size_t> nextWorker; // Requests are distributed between the workers in turns
+		std::atomic<bool> stopping;
+
+		std::atomic<size_t> processedRequests, processedBatches;
+
+		// Requests accepted by submit() and requests whose futures were completed (with a result or an error).
+		// The server stops only when they are equal.
+		std::atomic<size_t> submittedRequests, completedRequests;
+
+		// The loop of a worker thread
+		void workerMain(Worker& worker);
+
+		// Run the forward pass of the batch collected by 'worker' and complete its requests
+		void processBatch(Worker& worker);
+
+	public:
+		// Start a server for 'policy' with 'numWorkers' worker threads (0 for one per hardware thread). Each 
+		// batch has at most 'maxBatchSize' requests and a request waits at most 'maxLatency' for other requests 
+		// to join its batch. The cores are divided between the workers for their forward passes. A single 
+		// network is served by wrapping it in a Policy.
+		InferenceServer(const RL::Policy& policy, size_t maxBatchSize = 64, 
+			std::chrono::microseconds maxLatency = std::chrono::microseconds(200), size_t numWorkers = 1);
+
+		// Stops the server. Requests already submitted are completed first, and the futures of requests submitted 
+		// while the server stops get an error.
+		~InferenceServer();
+
+		InferenceServer(const InferenceServer&) = delete;
+		InferenceServer& operator=(const InferenceServer&) = delete;
+
+		// Submit an input (a column vector of Policy::getInputCount() values) for inference. Can be called from 
+		// any thread. The returned future gets the output of the policy for the input.
+		std::future<Matrix> submit(const Matrix& input);
+
+		// Submit an input and wait for its output
+		Matrix infer(const Matrix& input);
+
+		// Returns the average number of requests in the batches processed so far
+		float getAverageBatchSize() const;
+	};
+}
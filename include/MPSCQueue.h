@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+
+namespace BaseML::Utils
+{
+	// Base of the elements of an MPSCQueue. The queue links the elements through this node, so pushing 
+	// doesn't allocate.
+	struct MPSCNode
+	{
+		std::atomic<MPSCNode*> next{ nullptr };
+	};
+
+	// Lock-free intrusive queue for many producer threads and a single consumer thread (Vyukov's algorithm). 
+	// A push is one atomic exchange. The queue doesn't own the elements.
+	class MPSCQueue
+	{
+	private:
+		alignas(64) std::atomic<MPSCNode*> head; // Last pushed node, written by the producers
+		alignas(64) MPSCNode* tail; // Next node to pop, only used by the consumer
+		MPSCNode stub; // Placeholder node that keeps the queue non-empty
+
+	public:
+		MPSCQueue();
+
+		MPSCQueue(const MPSCQueue&) = delete;
+		MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+		// Add a node to the queue. Can be called from any thread.
+		void push(MPSCNode* node);
+
+		// Remove the oldest node from the queue. Returns null if the queue is empty, or if the next node is 
+		// still being pushed by another thread. Only one thread may pop.
+		MPSCNode* pop();
+	};
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+
+namespace BaseML::Utils
+{
+	// A view of a whole file mapped to memory. The pages are loaded by the operating system when they are 
+	// accessed, so files larger than the available memory can be used. The file is never modified.
+	class MappedFile
+	{
+	private:
+		const char* data;
+		size_t fileSize;
+
+#ifdef _WIN32
+		void* fileHandle;
+		void* mappingHandle;
+#endif // _WIN32
+
+		void unmap();
+
+	public:
+		// Create an empty mapping
+		MappedFile();
+
+		// Map the file at 'path'. If 'copyOnWrite' is true the mapped memory can be written (see getWritableData()) 
+		// and the changes stay private to this mapping. Throws if the file can't be opened or mapped.
+		explicit MappedFile(const char* path, bool copyOnWrite = false);
+
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		MappedFile(MappedFile&& other) noexcept;
+		MappedFile& operator=(MappedFile&& other) noexcept;
+
+		// Returns the beginning of the mapped file
+		const char* getData() const;
+
+		// Returns the beginning of the mapped file for writing. Only valid for copy-on-write mappings.
+		char* getWritableData() const;
+
+		// Returns the size of the file in bytes
+		size_t size() const;
+
+		// Tell the operating system that the file will be read sequentially (a hint, may do nothing)
+		void adviseSequential() const;
+	};
+}
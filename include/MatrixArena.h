@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace BaseML
+{
+	// A chunk of the memory of a MatrixArena. The arena holds one reference to each of its blocks and every
+	// Matrix allocated from a block holds another, so a block outlives the arena if matrices allocated from it
+	// are still alive.
+	struct ArenaBlock
+	{
+		std::atomic<size_t> references;
+		size_t capacity, used; // In floats
+		float* data;
+	};
+
+	// Bump-pointer allocator for short-lived matrices. While a MatrixArena::Scope is active on a thread, the
+	// matrices created on that thread take their memory from the arena instead of the heap: an allocation is an
+	// aligned pointer increment and freeing is a reference count decrement. When the scope ends the arena is
+	// reset and its memory is reused by the next scope, so a loop that runs one scope per iteration stops
+	// allocating once the arena has grown to the peak usage of an iteration.
+	// Matrices may escape the scope (be moved to a longer-lived object or another thread): a block that still
+	// has live matrices when the arena is reset is handed over to them and freed with the last one, and the
+	// arena continues with a new block. This is safe but costs a new block, so long-lived buffers that are
+	// (re)allocated inside a scope should be created in a HeapScope.
+	// An arena should be active in one scope on one thread at a time. Matrices allocated from it can be
+	// destroyed on any thread.
+	class MatrixArena
+	{
+	private:
+		std::vector<ArenaBlock*> blocks; // The last block is the one being filled
+		size_t nextCapacity; // Capacity of the next block, in floats
+		size_t escapedBlocks; // Blocks handed over to matrices that outlived a scope
+
+		static thread_local MatrixArena* active;
+
+		// Allocate a block with room for at least 'count' values
+		void addBlock(size_t count);
+
+	public:
+		// Makes 'arena' the source of the matrices created on this thread until the scope ends, and then
+		// resets it. Scopes can be nested (the inner scope's arena is used inside it), but not with the same arena.
+		class Scope
+		{
+		private:
+			MatrixArena& arena;
+			MatrixArena* previous;
+
+		public:
+			Scope(MatrixArena& arena);
+			~Scope();
+
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+		};
+
+		// Makes the matrices created on this thread until the scope ends take their memory from the heap, for
+		// buffers that outlive the active arena's scope
+		class HeapScope
+		{
+		private:
+			MatrixArena* previous;
+
+		public:
+			HeapScope();
+			~HeapScope();
+
+			HeapScope(const HeapScope&) = delete;
+			HeapScope& operator=(const HeapScope&) = delete;
+		};
+
+		// Create an arena whose first block holds 'initialSize' bytes (it grows as needed)
+		MatrixArena(size_t initialSize = 1 << 20);
+
+		// Blocks that still have live matrices are freed with the last of them
+		~MatrixArena();
+
+		MatrixArena(const MatrixArena&) = delete;
+		MatrixArena& operator=(const MatrixArena&) = delete;
+
+		// Returns the arena of the innermost scope active on this thread, or null if matrices are allocated
+		// from the heap
+		static MatrixArena* getActive();
+
+		// Returns memory for 'count' values, aligned to a cache line, and sets 'block' to the block it belongs
+		// to. The memory should be given back with release().
+		float* allocate(size_t count, ArenaBlock*& block);
+
+		// Drop a reference to 'block' (give back memory allocated with allocate()), freeing the block with its
+		// last reference. Can be called from any thread.
+		static void release(ArenaBlock* block);
+
+		// Make all of the memory of the arena available again. Blocks that still have live matrices are handed
+		// over to them. When the arena needed more than one block since the last reset, the blocks are replaced
+		// by one block as large as all of them together, so in a steady state a reset only rewinds one pointer.
+		void reset();
+
+		// Returns the number of bytes in the blocks of the arena
+		size_t getCapacity() const;
+
+		// Returns the number of bytes allocated since the last reset
+		size_t getUsed() const;
+
+		// Returns the number of blocks that were handed over to matrices that were alive when the arena was reset
+		size_t getEscapedBlockCount() const;
+	};
+}
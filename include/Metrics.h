@@ -0,0 +1,177 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "MPSCQueue.h"
+
+namespace BaseML::Utils
+{
+	// A set of named values measured at one step of a process (for example one iteration of training)
+	struct MetricsRecord
+	{
+		std::string category; // The kind of the record, records of the same category have the same values
+		uint64_t step;
+		double time; // Seconds since the logger was created, set by the logger
+		std::vector<std::pair<std::string, double>> values;
+
+		MetricsRecord(std::string category, uint64_t step)
+			:category(std::move(category)), step(step), time(0.0)
+		{
+		}
+
+		// Add a value to the record. Returns the record for chaining.
+		MetricsRecord& add(std::string name, double value)
+		{
+			values.emplace_back(std::move(name), value);
+			return *this;
+		}
+	};
+
+	// Destination of the records of a MetricsLogger. The functions are only called from the writer thread
+	// of the logger.
+	class MetricsSink
+	{
+	public:
+		virtual ~MetricsSink() = default;
+
+		virtual void write(const MetricsRecord& record) = 0;
+
+		// Called when the writer thread has no more records to write
+		virtual void flush()
+		{
+		}
+	};
+
+	// Writes the records as lines of comma separated values. The columns are time, category, step and the values
+	// of the first record written, named in a header line. Values of later records are matched to the columns by
+	// name: missing values are left empty and values without a column are dropped, so a file should be used for
+	// one category of records.
+	class CsvMetricsSink : public MetricsSink
+	{
+	private:
+		std::ofstream file;
+		std::vector<std::string> columns;
+		bool headerWritten;
+
+	public:
+		// Create the file at 'path', or add to it if 'append' is true (the header is written only to an empty file)
+		CsvMetricsSink(const char* path, bool append = false);
+
+		void write(const MetricsRecord& record) override;
+
+		void flush() override;
+	};
+
+	// Writes every record as a JSON object on its own line
+	class JsonLinesMetricsSink : public MetricsSink
+	{
+	private:
+		std::ofstream file;
+
+	public:
+		// Create the file at 'path', or add to it if 'append' is true
+		JsonLinesMetricsSink(const char* path, bool append = false);
+
+		void write(const MetricsRecord& record) override;
+
+		void flush() override;
+	};
+
+	// Keeps the last 'capacity' records in memory, for monitoring a run from the process itself
+	class RingBufferMetricsSink : public MetricsSink
+	{
+	private:
+		mutable std::mutex mutex;
+		std::deque<MetricsRecord> records;
+		size_t capacity;
+
+	public:
+		RingBufferMetricsSink(size_t capacity = 1024);
+
+		void write(const MetricsRecord& record) override;
+
+		// Returns a copy of the records kept, oldest first. Can be called from any thread.
+		std::vector<MetricsRecord> getRecords() const;
+
+		// Returns the most recent value with the given name in a record of 'category', or 'defaultValue' if
+		// there is none. Can be called from any thread.
+		double getLatest(const std::string& category, const std::string& name, double defaultValue = 0.0) const;
+	};
+
+	// Writes every record as a line of "name=value" pairs
+	class ConsoleMetricsSink : public MetricsSink
+	{
+	private:
+		std::ostream& out;
+
+	public:
+		ConsoleMetricsSink(std::ostream& out = std::cout);
+
+		void write(const MetricsRecord& record) override;
+
+		void flush() override;
+	};
+
+	// Delivers records to sinks on a background thread, so the threads that log never wait for I/O. Logging
+	// pushes the record to a lock-free queue and wakes the writer thread, which writes the records in the order
+	// they were logged and flushes the sinks when the queue is empty. Records logged before the logger is
+	// destroyed are all written.
+	class MetricsLogger
+	{
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		struct Entry : MPSCNode
+		{
+			MetricsRecord record;
+
+			Entry(MetricsRecord&& record)
+				:record(std::move(record))
+			{
+			}
+		};
+
+		MPSCQueue queue;
+		std::atomic<uint32_t> signal; // Changed whenever a record is logged or the logger stops
+		std::atomic<bool> stopping;
+		std::atomic<uint64_t> loggedCount, writtenCount;
+
+		std::mutex sinksMutex; // Guards 'sinks' against changes while the writer thread uses them
+		std::vector<std::unique_ptr<MetricsSink>> sinks;
+
+		Clock::time_point startTime;
+		std::thread writer;
+
+		// The loop of the writer thread
+		void writerMain();
+
+	public:
+		MetricsLogger();
+
+		// Writes the remaining records and stops the writer thread
+		~MetricsLogger();
+
+		MetricsLogger(const MetricsLogger&) = delete;
+		MetricsLogger& operator=(const MetricsLogger&) = delete;
+
+		// Send the records to 'sink' as well. Records logged before the sink was added may be missed.
+		void addSink(std::unique_ptr<MetricsSink> sink);
+
+		// Queue the record for writing. Can be called from any thread.
+		void log(MetricsRecord record);
+
+		// Block until all of the records logged so far were written and the sinks were flushed
+		void flush();
+	};
+}
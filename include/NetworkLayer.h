@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <variant>
+#include <concepts>
+#include <fstream>
+
+#include "Matrix.h"
+#include "Layer.h"
+#include "ConvolutionLayer.h"
+#include "NormalizationLayer.h"
+#include "ResidualLayer.h"
+
+namespace BaseML
+{
+	// The interface of a layer of a NeuralNetwork:
+	// - Sizes: the number of values in a data point of the inputs and of the outputs.
+	// - Forward: calculateOutputs() keeps the outputs (and what the backward pass needs) in the layer, and the
+	//   const overload writes them to a caller's matrix for thread-safe inference.
+	// - Backward: the gradients of the layer from the gradients of its outputs (or from the expected outputs in the
+	//   last layer), and the gradients of its inputs for the layer before it.
+	// - Parameters: a flat buffer of the parameters (copied, or as views of the layer's own matrices), the gradients
+	//   in the same layout and Adam Optimizer steps.
+	// - Serialization: save() and load() of binary streams. Layers with an activation function also take it in
+	//   load() and setActivationFunction().
+	template <typename T>
+	concept NetworkLayerType = requires(T layer, const T constLayer, const Matrix& matrix, Matrix& outputs, float* dest, const float* src,
+		float (*lossFunctionDerivative)(float, float), std::vector<std::span<float>>& spans, std::ofstream& outFile, std::ifstream& inFile)
+	{
+		{ constLayer.getInputCount() } -> std::convertible_to<size_t>;
+		{ constLayer.getOutputCount() } -> std::convertible_to<size_t>;
+		{ constLayer.getOutputs() } -> std::same_as<const Matrix&>;
+
+		layer.calculateOutputs(&matrix);
+		constLayer.calculateOutputs(matrix, outputs);
+
+		layer.calculateLastLayerGradientsToTarget(matrix, lossFunctionDerivative);
+		layer.calculateLastLayerGradients(matrix);
+		{ constLayer.calculateInputGradients() } -> std::same_as<Matrix>;
+
+		{ constLayer.getParameterCount() } -> std::convertible_to<size_t>;
+		constLayer.getParameters(dest);
+		layer.setParameters(src);
+		layer.getParameterSpans(spans);
+		constLayer.addParameterGradients(dest);
+		layer.applyParameterGradients(src, 0.001f, size_t(1));
+		layer.adamGradientDescent(0.001f, size_t(1));
+
+		layer.save(outFile);
+		layer.load(inFile);
+	};
+
+	// Layers whose outputs pass through an activation function
+	template <typename T>
+	concept ActivatedLayerType = requires(T layer, float (*function)(float))
+	{
+		layer.setActivationFunction(function, function);
+	};
+
+	// A layer of a NeuralNetwork. The network calls the layers through std::visit, so the type of a layer is resolved
+	// once per call and the kernels run without indirect calls. Files of networks store the index of the type of
+	// every layer, so new layer types are added at the end.
+	using NetworkLayer = std::variant<Layer, Conv1DLayer, Conv2DLayer, NormalizationLayer, ResidualLayer>;
+
+	template <typename Variant>
+	struct IsNetworkLayerVariant;
+
+	template <typename... Types>
+	struct IsNetworkLayerVariant<std::variant<Types...>> : std::bool_constant<(NetworkLayerType<Types> && ...)>
+	{
+	};
+
+	static_assert(IsNetworkLayerVariant<NetworkLayer>::value, "Every type of NetworkLayer should have the interface of NetworkLayerType");
+}
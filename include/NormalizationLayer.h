@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+#include <span>
+
+#include "Matrix.h"
+#include "UtilsFunctions.h"
+
+namespace BaseML
+{
+	// Layer normalization: the values of every data point are shifted and scaled to a mean of 0 and a variance of 1,
+	// and then every value is multiplied by a gain and shifted by a bias of its own (both learned). Keeps the scale
+	// of the activations of deep stacks of layers (like residual layers) stable. The outputs have the size of the inputs.
+	class NormalizationLayer
+	{
+	private:
+		size_t count, batchSize;
+		float epsilon; // Added to the variance to avoid division by zero
+
+		Matrix gains, biases;
+
+		// The outputs and the gradients of the objective with respect to them have the layout of the inputs
+		Matrix outputs, gradients;
+
+		// Values of the last forward pass that the backward pass needs: the normalized inputs (before the gains
+		// and biases) and one over the standard deviation of every data point
+		Matrix normalized;
+		std::vector<float> inverseDeviations;
+
+		// Adam Optimizer matrices
+		Matrix mGains, vGains, mBiases, vBiases;
+
+		// Normalize the data points of 'inputs' and write the results to 'outputs'. When 'normalized' isn't null the
+		// normalized inputs and the inverse standard deviations are also written to it and to 'deviations'.
+		void normalize(const Matrix& inputs, Matrix& outputs, Matrix* normalized, float* deviations) const;
+
+		// Apply one Adam Optimizer step to the parameters using the given (batch averaged) gradients, laid out like in getParameters()
+		void adamUpdate(const float* gradients, float learningRate, size_t timestep, float beta1, float beta2, float epsilon);
+
+		// Add the gradients of the parameters, summed over the data points of the last batch and multiplied by 'scale',
+		// to 'dest' (laid out like in getParameters())
+		void accumulateParameterGradients(float* dest, float scale) const;
+
+	public:
+		// Default constructor for creating an empty object
+		NormalizationLayer();
+
+		// Creates a layer that normalizes data points of 'size' values
+		NormalizationLayer(size_t size, float varianceEpsilon = 1.0e-5f);
+
+		// Returns the number of inputs of this layer
+		size_t getInputCount() const;
+
+		// Returns the number of outputs of this layer (the number of inputs)
+		size_t getOutputCount() const;
+
+		// Returns the number data points the layer is currently configured to process together
+		size_t getCurrentBatchSize() const;
+
+		// Returns the outputs of this layer
+		const Matrix& getOutputs() const;
+
+		// Perform forward propagation on this layer with the specified inputs. The outputs have the layout of the inputs.
+		void calculateOutputs(const Matrix* inputs);
+
+		// Perform forward propagation with the specified inputs and write the results to 'outputs' without
+		// changing the state of the layer, so it can be called from several threads at once. 'outputs' is
+		// only reallocated (in the layout of the inputs) if it doesn't have the right size.
+		void calculateOutputs(const Matrix& inputs, Matrix& outputs) const;
+
+		// Calculate the gradients of the last layer based on the loss function and the expected outputs
+		void calculateLastLayerGradientsToTarget(const Matrix& expectedOutputs, float (*lossFunctionDerivative)(float, float));
+
+		// Calculate the gradients of this layer based on the gradients of the optimization objective with respect to
+		// its outputs: the external gradients in the last layer, or the input gradients of the next layer.
+		void calculateLastLayerGradients(const Matrix& externalGradients);
+
+		// Returns the gradients of the optimization objective with respect to the inputs of this layer.
+		// Assumes that the gradients of this layer were already calculated.
+		Matrix calculateInputGradients() const;
+
+		// Update the parameters according to the gradients using Adam Optimizer. 'timestep' is the number of times the
+		// layer's parameters have been updated before.
+		void adamGradientDescent(float learningRate, size_t timestep, float beta1 = 0.9f, float beta2 = 0.999f, float epsilon = 1.0e-8f);
+
+		// Returns the number of parameters (gains and biases) of this layer
+		size_t getParameterCount() const;
+
+		// Copy the parameters of this layer to 'dest' (the gains followed by the biases, as they are saved)
+		void getParameters(float* dest) const;
+
+		// Replace the parameters of this layer with the values in 'src' (laid out like in getParameters())
+		void setParameters(const float* src);
+
+		// Append views of the parameters of this layer to 'spans', in the order of getParameters()
+		void getParameterSpans(std::vector<std::span<float>>& spans);
+
+		// Add the gradients of the parameters, summed over the data points of the last batch, to 'dest' (laid out
+		// like in getParameters()). Assumes that the gradients of this layer were already calculated.
+		void addParameterGradients(float* dest) const;
+
+		// Update the parameters with Adam Optimizer using the given gradients (laid out like in getParameters()
+		// and averaged over the data points they were calculated from) instead of the layer's own gradients
+		void applyParameterGradients(const float* gradients, float learningRate, size_t timestep, float beta1 = 0.9f,
+			float beta2 = 0.999f, float epsilon = 1.0e-8f);
+
+		// Save the layer to disk. Assumes a binary output stream
+		void save(std::ofstream& outFile);
+
+		// Load the layer from disk. Assumes a binary input stream
+		void load(std::ifstream& inFile);
+	};
+}
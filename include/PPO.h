@@ -2,60 +2,269 @@
 
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "NeuralNetwork.h"
+#include "RecurrentLayer.h"
+#include "MatrixArena.h"
 #include "Environment.h"
 #include "RLAlgorithm.h"
 #include "UtilsRandom.h"
+#include "UtilsGeneral.h"
+#include "DataParallelTrainer.h"
+#include "RolloutFile.h"
+#include "Policy.h"
 
 namespace BaseML::RL
 {
+	// Statistics of the policy updates performed in one iteration of PPO
+	struct PolicyUpdateStats
+	{
+		float clipFraction = 0.0f; // Fraction of the data points whose probability ratio is outside the clip range
+		float approxKL = 0.0f; // Estimated KL divergence between the old and the current policy
+		float policyLoss = 0.0f; // Negative clipped surrogate objective
+		float valueLoss = 0.0f; // Loss of the critic's estimates of the rewards-to-go
+		float entropy = 0.0f; // Entropy of the policy's action distribution after the updates
+	};
+
+	// Statistics of the episodes collected in one iteration of PPO
+	struct EpisodeStats
+	{
+		size_t episodes = 0; // Number of episodes (counted separately for every player in self-play)
+		float averageReward = 0.0f; // Average sum of the raw rewards of an episode
+		float averageLength = 0.0f; // Average number of timesteps of an episode
+	};
+
+	// Wall-clock time (in seconds) spent in each phase of one iteration of PPO and the amount of data processed
+	struct IterationTimings
+	{
+		double collection = 0.0; // Running the policy in the environment
+		double advantage = 0.0; // Normalizing the data, estimating the advantages and updating the running statistics
+		double policyUpdate = 0.0; // Updating the actor (the trunk and both heads in shared-trunk mode)
+		double valueFit = 0.0; // Fitting the critic (included in 'policyUpdate' in shared-trunk mode)
+		double checkpoint = 0.0; // Saving the networks and recording the rollouts
+		size_t environmentSteps = 0; // Data points collected by this process
+		size_t updateSamples = 0; // Data points used by the updates, counted once for every epoch
+	};
+
 	class PPO : public RLAlgorithm
 	{
 	private:
 		static constexpr size_t DEFAULT_HIDDEN_LAYER_SIZE = 64;
 
+		// Approximate per-core L2 cache size. Used to pick a mini-batch size for which the activations 
+		// and gradients of both networks stay cache-resident during an update.
+		static constexpr size_t L2_CACHE_BYTES = 256 * 1024;
+		static constexpr size_t MIN_AUTO_MINIBATCH_SIZE = 32;
+
+		// Number of data points processed together by the fused policy gradient kernel
+		static constexpr size_t POLICY_KERNEL_BLOCK = 64;
+
+		// Bounds of the learned log standard deviation of the actions
+		static constexpr float MIN_ACTION_LOG_STD = -5.0f, MAX_ACTION_LOG_STD = 2.0f;
+
 		std::string criticNetFile, actorNetFile;
 
 		NeuralNetwork criticNetwork, actorNetwork;
 
+		// In shared-trunk mode the observations pass through 'trunkNetwork' once and 'actorNetwork' and 
+		// 'criticNetwork' are heads that take the output of the trunk as their input
+		bool sharedTrunk;
+		NeuralNetwork trunkNetwork;
+		float valueLossCoefficient; // Weight of the critic's loss in the combined loss of the trunk (or of the recurrent core)
+
+		// In recurrent mode the observations pass through 'recurrentCore' (a layer of LSTM or GRU cells) and 
+		// 'actorNetwork' and 'criticNetwork' are heads that take its outputs as their input. The networks are 
+		// trained on segments of up to 'segmentLength' timesteps of the episodes, each starting from the state 
+		// the core had when the segment was collected.
+		bool recurrent;
+		RecurrentLayer recurrentCore;
+		size_t segmentLength;
+		size_t recurrentCoreTimestep; // Number of Adam Optimizer steps applied to the core, plus one
+		Matrix coreStates, coreOutputs; // The state of the core for every player while running the policy (a column per player)
+
 		Utils::GaussianSampler sampler;
 
+		// Log of the standard deviation of every action dimension (a column vector). This is a parameter of 
+		// the policy and is trained together with the actor network unless it is frozen.
+		Matrix actionLogStd;
+		Matrix mActionLogStd, vActionLogStd; // Adam Optimizer moments of 'actionLogStd'
+		size_t actionLogStdTimestep;
+		bool learnActionSigma;
+
 		float learningRate, rewardDiscountFactor, clipThreshold;
 		int timestepsPerBatch, maxTimestepsPerEpisode, updatesPerIter;
 
+		size_t minibatchSize; // 0 means the size is chosen automatically from the network sizes
+		std::vector<size_t> sampleOrder; // Shuffled order of the data points for the current epoch
+
 		size_t timestepsLearned;
 
+		// Running statistics of the observations and rewards. When enabled, observations are normalized before 
+		// they enter the networks and rewards are scaled by their standard deviation. The statistics are updated 
+		// at the end of every iteration, so they stay fixed while the data of an iteration is collected and used.
+		bool observationNormalization, rewardNormalization;
+		Utils::RunningStatistics observationStats, rewardStats;
+
+		PolicyUpdateStats lastPolicyStats;
+		EpisodeStats lastEpisodeStats;
+		IterationTimings lastTimings;
+
+		// Data-parallel trainer of the critic network, created on first use when more than one thread is 
+		// requested. Reset whenever the critic network is replaced.
+		size_t criticTrainingThreads;
+		std::unique_ptr<DataParallelTrainer> criticTrainer;
+
+		std::unique_ptr<RolloutWriter> rolloutWriter; // Records the collected data when set
+
+		// Memory of the temporary matrices of a training iteration (trajectories, advantages, mini-batches and 
+		// the intermediate results of the updates), reset at the end of every iteration
+		MatrixArena iterationArena;
+
 	public:
 		PPO(std::unique_ptr<Environment> environment, const char* criticFileName, const char* actorFileName, float learningRate = 0.005f,
 			float discountFactor = 0.95f, float clipThreshold = 0.2f, int timestepsPerBatch = 4800, int maxTimestepsPerEpisode = 1600, 
-			int updatesPerIteration = 5, float actionSigma = 0.5f);
+			int updatesPerIteration = 5, float actionSigma = 0.5f, size_t minibatchSize = 0);
+
+		// Set the number of epochs (full passes over the collected data) performed in each iteration
+		void setEpochsPerIteration(int epochs);
+
+		// Set the number of data points in each mini-batch used for updating the networks. Every epoch 
+		// the collected data is shuffled and split to mini-batches of this size. Set to 0 to choose a 
+		// size automatically so that the intermediate results of an update fit in the L2 cache.
+		void setMinibatchSize(size_t size);
 
-		// Set the standard deviation of the distribution from which the algorithm samples actions during training
+		// Set the standard deviation of the distribution from which the algorithm samples actions during training. 
+		// This sets the standard deviation of every action dimension and restarts its training.
 		void setActionSigma(float actionSigma);
 
+		// Choose whether the standard deviation of the actions is learned together with the actor network 
+		// (the default) or stays fixed at the value set with setActionSigma()
+		void setLearnActionSigma(bool learn);
+
+		// Returns the log of the current standard deviation of every action dimension as a column vector
+		const Matrix& getActionLogStd() const;
+
+		// Normalize the observations with their running mean and standard deviation before passing them to 
+		// the networks. The statistics are saved with the networks (and with the actor in its own file).
+		void setObservationNormalization(bool normalize);
+
+		// Scale the rewards by their running standard deviation before computing the rewards-to-go. The 
+		// statistics are saved with the networks.
+		void setRewardNormalization(bool normalize);
+
+		// Fit the critic network with data parallelism over the given number of threads: every mini-batch is 
+		// split between the threads and their gradients are combined into a single update (see 
+		// DataParallelTrainer). Worthwhile for large mini-batches. Set to 1 (the default) to fit the critic on 
+		// one replica and to 0 to use the OpenMP default number of threads. Ignored in shared-trunk mode.
+		void setCriticTrainingThreads(size_t threads);
+
+		// Record the data collected in every iteration (with the raw observations and rewards) to the rollout file 
+		// at 'path', one chunk per iteration. New data is added after the rollouts already in the file. Set 
+		// 'bfloat16' to halve the size of the file at the cost of precision. Pass null to stop recording.
+		void recordRollouts(const char* path, bool bfloat16 = false);
+
 		// Set the layer sizes of the critic network. 
-		// Warning! This function deletes the old network parameters and resets the network's settings.
+		// Warning! This function deletes the old network parameters and resets the network's settings. 
+		// Disables the shared-trunk and recurrent modes.
 		void setCriticNetworkLayers(std::initializer_list<size_t> layerSizes);
 
 		// Set the layer sizes of the actor network. 
-		// Warning! This function deletes the old network parameters and resets the network's settings.
+		// Warning! This function deletes the old network parameters and resets the network's settings. 
+		// Disables the shared-trunk and recurrent modes.
 		void setActorNetworkLayers(std::initializer_list<size_t> layerSizes);
 
+		// Use a single network (the trunk) with the layer sizes given for both the actor and the critic, topped 
+		// by a linear policy head and a linear value head. Both heads are computed from one forward pass of the 
+		// trunk and the trunk is trained with one backward pass of the combined loss, in which the critic's loss 
+		// is weighted by 'valueLossCoef'. The first layer size should be the observation dimension. Disables the 
+		// recurrent mode.
+		// Warning! This function deletes the old parameters of both networks and resets their settings.
+		void setSharedTrunkLayers(std::initializer_list<size_t> layerSizes, float valueLossCoef = 0.5f);
+
+		// Give the policy a memory: the observations pass through a layer of 'hiddenSize' LSTM or GRU cells whose 
+		// outputs feed an actor head and a critic head (each with one hidden layer). Both heads and the recurrent 
+		// layer are trained with one backward pass of the combined loss, in which the critic's loss is weighted by 
+		// 'valueLossCoef'. The episodes are split into segments of up to 'segmentLength' timesteps, and the 
+		// gradients are back propagated through the time of each segment from the state the recurrent layer had 
+		// when the segment was collected. Mini-batches are made of whole segments.
+		// Warning! This function deletes the old parameters of both networks and resets their settings.
+		void setRecurrentCore(RecurrentLayer::Cell cell, size_t hiddenSize, size_t segmentLength = 16, float valueLossCoef = 0.5f);
+
 		// Set the output activation function of the actor network
 		void setActorOutputActivationFunction(float (*activationFunction)(float),
 			float (*activationFunctionDerivative)(float));
 
 		// Loads the Networks from the files. Notice that the critic network file has additional data 
-		// not related to the network. Returns true if successful and false if failed.
+		// not related to the network, and the actor file ends with the observation normalization that the 
+		// actor was trained with (which is restored too). Returns true if successful and false if failed.
 		bool loadFromFiles();
 
+		// Returns a copy of the current actor (with the trunk or the recurrent core in the modes that have one) and 
+		// of the observation normalization, for inference outside of training (see Policy and InferenceServer). 
+		// Policy::loadFromFile() loads the same policy from the actor file.
+		Policy getPolicy() const;
+
+		// In distributed mode (see RLAlgorithm::setTransport()) the parameters of the process of rank 0 are copied 
+		// to the other processes when learning starts, 'maxTimesteps' counts the timesteps collected by all of the 
+		// processes and only the process of rank 0 saves the networks. The critic is fitted on one thread per process.
 		void learn(size_t maxTimesteps) override;
 
-		// Render and show the agent's performance in the environment in real time
+		// Returns the average policy update statistics of the last training iteration
+		const PolicyUpdateStats& getLastPolicyUpdateStats() const;
+
+		// Returns the time spent in each phase of the last training iteration
+		const IterationTimings& getLastIterationTimings() const;
+
+		// Returns the statistics of the episodes collected in the last training iteration
+		const EpisodeStats& getLastEpisodeStats() const;
+
+		// Returns the arena of the temporary matrices of the training iterations
+		const MatrixArena& getIterationArena() const;
+
+		// Render and show the agent's performance in the environment in real time. The reward and the length of 
+		// the episode are sent to the metrics logger as a "ppo_evaluation" record.
 		void showRealTime();
 
 	private:
+		// Run the observations through the actor (and through the trunk first in shared-trunk mode). In recurrent 
+		// mode the observations are the next timestep of the players (a column per player) and advance their 
+		// states in the core. Returns the action means.
+		const Matrix& actorForward(const Matrix& observations);
+
+		// Run the observations through the critic (and through the trunk first in shared-trunk mode). 
+		// Returns the estimated values of the states. Not for recurrent mode.
+		const Matrix& criticForward(const Matrix& observations);
+
+		// Start new episodes for 'players' players in recurrent mode: zero the states of the core
+		void resetCoreStates(size_t players);
+
+		// Record the start of a segment at the next data point of a player in recurrent mode: append the state 
+		// of the core of the player to 'states'
+		void recordSegmentState(std::vector<float>& states, size_t player) const;
+
+		// Arrange the data points of the segments 'segments' of 'data' for the recurrent core: the segments are 
+		// sorted by decreasing length and packed timestep by timestep (see RecurrentLayer). Writes the positions of 
+		// the packed data points in 'data' to 'indices' and the number of segments in every timestep to 'batchSizes', 
+		// and returns the states of the core at the start of the sorted segments.
+		Matrix packSegments(const RLTrainingData& data, const size_t* segments, size_t count, std::vector<size_t>& indices, 
+			std::vector<size_t>& batchSizes) const;
+
+		// Write whether the observations are normalized and their running statistics, after the networks in the actor file
+		void saveObservationNormalization(std::ofstream& outFile) const;
+
+		// Read what saveObservationNormalization() wrote. Enables or disables the normalization of the observations.
+		void loadObservationNormalization(std::ifstream& inFile);
+
+		// Normalize observations in place with the running observation statistics (if enabled)
+		void normalizeObservations(Matrix& observations) const;
+
+		// Returns the reward scaled by the running reward statistics (if enabled)
+		float normalizeReward(float reward) const;
+
+		// Add the raw observations and rewards of an iteration to the running statistics
+		void updateNormalizationStatistics(const Matrix& rawObservations, const Matrix& rewards);
+
 		// Get an action and its log probability from an observation. The first element in the returned pair 
 		// is the action and the second is its log probability.
 		std::pair<Matrix, float> getAction(const Matrix& observation);
@@ -74,20 +283,88 @@ namespace BaseML::RL
 		// number of simulated timesteps.
 		std::pair<RLTrainingData, size_t> collectTrajectories();
 
+		// Run the actor for every player of the environment and collect the data of all of the players. The 
+		// actions of all of the players are computed by one batched forward pass every timestep. Returns a pair 
+		// of the data collected and the number of data points collected (timesteps times players).
+		std::pair<RLTrainingData, size_t> collectAllPlayersTrajectories();
+
+		// Convert data points stored one after the other ('rows' values each) to a Matrix with a data point 
+		// in each column
+		Matrix columnDataToMatrix(const std::vector<float>& data, size_t rows);
+
+		// Returns the mini-batch size to use for a batch of 'batchSize' data points
+		size_t getMinibatchSize(size_t batchSize) const;
+
+		// Gather the data points at positions ['begin', 'end') of 'sampleOrder' into a mini-batch. 
+		// The advantages of the mini-batch are written to 'minibatchAdvantages'.
+		RLTrainingData gatherMinibatch(const RLTrainingData& data, const Matrix& advantages, size_t begin, size_t end,
+			Matrix& minibatchAdvantages) const;
+
+		// Gather the data points at 'indices' into a mini-batch. The advantages of the mini-batch are written to 
+		// 'minibatchAdvantages'.
+		RLTrainingData gatherDataPoints(const RLTrainingData& data, const Matrix& advantages, const size_t* indices, size_t count,
+			Matrix& minibatchAdvantages) const;
+
+		// Gather the segments at positions ['begin', 'end') of 'sampleOrder' into a mini-batch for recurrent mode, 
+		// packed like in packSegments() (the states at the start of the segments are the mini-batch's segment states). 
+		// The number of segments in every timestep is written to 'batchSizes'.
+		RLTrainingData gatherSegments(const RLTrainingData& data, const Matrix& advantages, size_t begin, size_t end,
+			Matrix& minibatchAdvantages, std::vector<size_t>& batchSizes) const;
+
+		// Returns the number of mini-batches to split a batch of 'batchSize' data points to. In distributed mode all 
+		// of the processes use the number of the process of rank 0, so they perform the same number of updates.
+		size_t getMinibatchCount(size_t batchSize);
+
+		// Copy the parameters of the networks and the action log standard deviations of the process of rank 0 to 
+		// all of the processes. Does nothing when not in distributed mode.
+		void synchronizeParameters();
+
+		// Apply one optimizer step to 'networks' (whose gradients were calculated from 'dataPoints' data points) 
+		// and, if 'logStdGradients' isn't null, to the action log standard deviations. In distributed mode the 
+		// gradients of all of the networks are first averaged over all of the processes with one all-reduce. 
+		// A process without data for the update should call this with 0 data points and zero log standard 
+		// deviation gradients. In recurrent mode 'core' is the recurrent core, updated after the networks.
+		void applyUpdate(std::initializer_list<NeuralNetwork*> networks, const Matrix* logStdGradients, size_t dataPoints, 
+			RecurrentLayer* core = nullptr);
+
 		// Compute the estimated advantage using the critic network
 		Matrix computeAdvantageEstimates(const RLTrainingData& data);
 
-		// Get the current action means from the actor based on the observations and calculate the log probabilities 
-		// of the current network choosing the given actions for the given observations. The first element in the returned 
-		// pair is the action means and the second is the log probabilities.
-		std::pair<Matrix, Matrix> checkActorUnderCurrentPolicy(const Matrix& observations, const Matrix& actions);
+		// Calculate the gradients of the PPO-Clip objective with respect to the action means and the action log 
+		// standard deviations in a single pass over the data. For every data point this computes the log probability 
+		// of the action under the current policy, the probability ratio to the old policy and the clipped surrogate 
+		// gradient. The gradients of the means are written to 'gradients' (which should have the size of the actions 
+		// matrix), the batch-averaged gradients of the log standard deviations are written to 'logStdGradients' (a 
+		// column vector) and the clip fraction, KL estimate and policy loss of the batch are returned.
+		PolicyUpdateStats computePolicyGradients(const Matrix& actionMeans, const RLTrainingData& data, 
+			const Matrix& advantages, Matrix& gradients, Matrix& logStdGradients) const;
+
+		// The unit tests check computePolicyGradients() against a reference implementation
+		friend struct PPOTestAccess;
+
+		// Apply an Adam Optimizer step to the action log standard deviations
+		void updateActionLogStd(const Matrix& logStdGradients, float beta1 = 0.9f, float beta2 = 0.999f, float epsilon = 1.0e-8f);
 
-		// Calculate the gradients of the PPO-Clip objective and update the parameters of the actor network
-		void updatePolicy(const RLTrainingData& data, const Matrix& advantages);
+		// Calculate the gradients of the PPO-Clip objective and update the parameters of the actor network. 
+		// Returns the statistics of the update.
+		PolicyUpdateStats updatePolicy(const RLTrainingData& data, const Matrix& advantages);
 
 		// Calculate the gradient of the mean-squared error to the real value of the states and update the 
-		// parameters of the critic network
-		void fitValueFunction(const RLTrainingData& data);
+		// parameters of the critic network. Returns the loss of the critic before the update.
+		float fitValueFunction(const RLTrainingData& data);
+
+		// Update the trunk and both heads in shared-trunk mode with one forward and one backward pass of the 
+		// trunk. Replaces updatePolicy() and fitValueFunction() in this mode. Returns the statistics of the 
+		// policy update.
+		PolicyUpdateStats updateSharedNetwork(const RLTrainingData& data, const Matrix& advantages);
+
+		// Update the recurrent core and both heads in recurrent mode with one forward and one backward pass (through 
+		// time) of the core over the packed segments of a mini-batch (see gatherSegments()). Returns the statistics 
+		// of the policy update.
+		PolicyUpdateStats updateRecurrentNetwork(const RLTrainingData& data, const Matrix& advantages, const std::vector<size_t>& batchSizes);
+
+		// Send the statistics of the last iteration to the metrics logger (if set) as a "ppo_iteration" record
+		void logIterationMetrics();
 
 		// Save Neural Networks to disk. Assumes a binary output stream
 		void save();
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Matrix.h"
+#include "NeuralNetwork.h"
+#include "RecurrentLayer.h"
+#include "UtilsGeneral.h"
+
+namespace BaseML::RL
+{
+	// Caller-owned buffers for Policy::infer(). Reusing a workspace for passes of the same batch size avoids
+	// allocations, and threads that run passes at the same time should each use their own workspace.
+	class PolicyWorkspace
+	{
+	private:
+		friend class Policy;
+
+		Matrix observations, states, coreOutputs, outputs;
+		InferenceWorkspace trunk, head;
+	};
+
+	// A trained actor for acting outside of training: the observations are normalized with the statistics the
+	// actor was trained with and pass through the shared trunk or the recurrent core (in the modes of PPO that
+	// have one) and the policy head, whose outputs are the means of the actions.
+	//
+	// A recurrent policy doesn't keep the states of its sequences. Its inputs are the observations followed by
+	// the states of the recurrent core, and its outputs are the actions followed by the new states, which the
+	// caller passes with the next observations of the same sequence (zeros at the start of a sequence).
+	class Policy
+	{
+	public:
+		// How the networks of an actor file are connected (the modes of PPO)
+		enum class Structure
+		{
+			Actor, // A single actor network
+			SharedTrunk, // The trunk followed by the policy head
+			Recurrent // The recurrent core followed by the policy head
+		};
+
+	private:
+		Structure structure;
+		NeuralNetwork trunk, head;
+		RecurrentLayer core;
+
+		bool observationNormalization;
+		Utils::RunningStatistics observationStats;
+
+	public:
+		// Default constructor for creating an empty object
+		Policy();
+
+		// A policy of a single network. The observations are normalized with 'observationStats' if it isn't null.
+		Policy(NeuralNetwork actor, const Utils::RunningStatistics* observationStats = nullptr);
+
+		// A policy of a trunk followed by a head. The observations are normalized with 'observationStats' if it isn't null.
+		Policy(NeuralNetwork trunk, NeuralNetwork head, const Utils::RunningStatistics* observationStats = nullptr);
+
+		// A policy of a recurrent core followed by a head. The observations are normalized with 'observationStats'
+		// if it isn't null.
+		Policy(RecurrentLayer core, NeuralNetwork head, const Utils::RunningStatistics* observationStats = nullptr);
+
+		// Returns how the networks of the policy are connected
+		Structure getStructure() const;
+
+		// Returns the number of values in an observation
+		size_t getObservationDimension() const;
+
+		// Returns the number of values in an action
+		size_t getActionDimension() const;
+
+		// Returns the number of values in the state of a sequence of a recurrent policy (0 in other policies)
+		size_t getStateSize() const;
+
+		// Returns the number of values in a data point of the inputs (the observation and the state)
+		size_t getInputCount() const;
+
+		// Returns the number of values in a data point of the outputs (the action and the new state)
+		size_t getOutputCount() const;
+
+		// Normalize observations in place with the statistics of the policy (if it has them)
+		void normalizeObservations(Matrix& observations) const;
+
+		// Compute the outputs of a batch of inputs (a column per data point, see the class description) into
+		// 'workspace' and return them. Doesn't change the policy, so it can be called from several threads at once.
+		const Matrix& infer(const Matrix& inputs, PolicyWorkspace& workspace) const;
+
+		// Load the actor file saved by PPO in the mode of 'structure', with the observation normalization saved
+		// after its networks. The output activation function of an actor of the Actor structure isn't saved in the
+		// file, so it is given here (PPO's actor is linear unless it was changed with
+		// PPO::setActorOutputActivationFunction()). Returns true if successful and false if failed.
+		bool loadFromFile(const char* fileName, Structure structure, float (*outputActivationFunction)(float) = &Utils::linear,
+			float (*outputActivationFunctionDerivative)(float) = &Utils::linearDerivative);
+	};
+}
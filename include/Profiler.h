@@ -0,0 +1,138 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+#include <chrono>
+
+// Instrumentation of the library's hot paths. The BASEML_PROFILE_* macros below compile to nothing unless
+// BASEML_ENABLE_PROFILING is defined (set the BASEML_ENABLE_PROFILING CMake option), so the instrumentation
+// costs nothing in normal builds. The query and export functions of Profiler are always available and report
+// no data when profiling is compiled out.
+
+#ifdef BASEML_ENABLE_PROFILING
+
+#define BASEML_PROFILE_CONCAT_INNER(a, b) a##b
+#define BASEML_PROFILE_CONCAT(a, b) BASEML_PROFILE_CONCAT_INNER(a, b)
+
+// Time the rest of the enclosing scope under 'name' (a string literal)
+#define BASEML_PROFILE_SCOPE(name) \
+	BaseML::Utils::ScopedTimer BASEML_PROFILE_CONCAT(profileScope, __LINE__)(name)
+
+// Time the rest of the enclosing scope under 'name', kept apart from the other scopes of that name by 'id'
+// (for example the index of a layer)
+#define BASEML_PROFILE_SCOPE_ID(name, id) \
+	BaseML::Utils::ScopedTimer BASEML_PROFILE_CONCAT(profileScope, __LINE__)(name, (long long)(id))
+
+// Time the rest of the enclosing scope as an operation that performs 'flops' floating point operations and
+// moves 'bytes' bytes
+#define BASEML_PROFILE_OPERATION(name, flops, bytes) \
+	BaseML::Utils::ScopedTimer BASEML_PROFILE_CONCAT(profileScope, __LINE__)(name, -1, (double)(flops), (double)(bytes))
+
+// Count an allocation of 'bytes' bytes
+#define BASEML_PROFILE_ALLOCATION(bytes) BaseML::Utils::Profiler::countAllocation(bytes)
+
+// Name the calling thread in the trace
+#define BASEML_PROFILE_THREAD_NAME(name) BaseML::Utils::Profiler::setThreadName(name)
+
+#else
+
+#define BASEML_PROFILE_SCOPE(name) ((void)0)
+#define BASEML_PROFILE_SCOPE_ID(name, id) ((void)0)
+#define BASEML_PROFILE_OPERATION(name, flops, bytes) ((void)0)
+#define BASEML_PROFILE_ALLOCATION(bytes) ((void)0)
+#define BASEML_PROFILE_THREAD_NAME(name) ((void)0)
+
+#endif // BASEML_ENABLE_PROFILING
+
+namespace BaseML::Utils
+{
+	// The totals of one profiled scope (a name and an id) over all of the threads
+	struct ProfileEntry
+	{
+		std::string name;
+		long long id; // -1 for scopes without an id
+		uint64_t calls;
+		double seconds; // Total time, including the time of nested scopes
+		double maxSeconds; // Longest single call
+		double flops, bytes; // Totals of operations (0 for plain scopes)
+	};
+
+	struct ProfileSummary
+	{
+		std::vector<ProfileEntry> entries; // Sorted by total time
+		uint64_t allocations, allocatedBytes;
+		size_t threads; // Number of threads that recorded data
+		double elapsedSeconds; // Time since profiling started or was last reset
+
+		// Print a table of the entries, with the throughput of operations
+		void print(std::ostream& out) const;
+	};
+
+	// Collects the data of the profiled scopes. Every thread records to its own counters (behind a mutex that
+	// only contends while the data is read) and the counters of all of the threads are merged when they are
+	// queried. The data of threads that exited is kept.
+	class Profiler
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		// Returns true if the library was compiled with BASEML_ENABLE_PROFILING
+		static bool isEnabled();
+
+		// Record a call of a scope. Used by ScopedTimer.
+		static void record(const char* name, long long id, double flops, double bytes, Clock::time_point start, Clock::time_point end);
+
+		// Count an allocation of 'bytes' bytes
+		static void countAllocation(size_t bytes);
+
+		// Name the calling thread in the trace
+		static void setThreadName(const std::string& name);
+
+		// Returns the data of all of the threads merged
+		static ProfileSummary getSummary();
+
+		// Print the summary to 'out'
+		static void printSummary(std::ostream& out);
+
+		// Print the summary to 'out' every 'seconds' seconds while scopes are recorded (the thread that records
+		// the first scope after the interval passed prints it). Set to 0 to stop.
+		static void setSummaryInterval(double seconds, std::ostream& out);
+
+		// Record every call of a scope as an event of the trace, keeping at most 'maxEventsPerThread' events for
+		// every thread. Tracing is off by default since the events take memory.
+		static void setTracing(bool enabled, size_t maxEventsPerThread = 1 << 20);
+
+		// Write the recorded events in the Chrome trace event format (viewable in chrome://tracing and Perfetto),
+		// with a track for every thread. Returns false if the file couldn't be written.
+		static bool writeChromeTrace(const char* path);
+
+		// Clear the data of all of the threads and restart the clock of the trace
+		static void reset();
+	};
+
+	// Times the scope it is created in (see BASEML_PROFILE_SCOPE). Records the call when destroyed.
+	class ScopedTimer
+	{
+	private:
+		const char* name;
+		long long id;
+		double flops, bytes;
+		Profiler::Clock::time_point start;
+
+	public:
+		ScopedTimer(const char* name, long long id = -1, double flops = 0.0, double bytes = 0.0)
+			:name(name), id(id), flops(flops), bytes(bytes), start(Profiler::Clock::now())
+		{
+		}
+
+		~ScopedTimer()
+		{
+			Profiler::record(name, id, flops, bytes, start, Profiler::Clock::now());
+		}
+
+		ScopedTimer(const ScopedTimer&) = delete;
+		ScopedTimer& operator=(const ScopedTimer&) = delete;
+	};
+}
@@ -2,9 +2,13 @@
 
 #include <string>
 #include <deque>
+#include <memory>
+#include <vector>
 
 #include "Matrix.h"
 #include "Environment.h"
+#include "Transport.h"
+#include "Metrics.h"
 
 namespace BaseML::RL
 {
@@ -13,11 +17,38 @@ namespace BaseML::RL
 	protected:
 		std::unique_ptr<Environment> environment;
 		std::string playerId;
+		size_t playerIndex; // Index of 'playerId' in the environment's players
+
+		// When true the algorithm controls every player of the environment with the same policy 
+		// (self-play) instead of only 'playerId'
+		bool trainAllPlayers;
+
+		// Connection to the other processes of a distributed training run, or null when training alone
+		std::shared_ptr<Transport> transport;
+
+		// Receives the training metrics, or null to not record them. Use getMetricsLogger(), which creates the 
+		// default logger.
+		std::shared_ptr<Utils::MetricsLogger> metrics;
+		bool defaultMetrics; // True until a logger is set with setMetricsLogger()
+
+		// Returns the logger of the training metrics, or null to not record them. The default logger writes to the 
+		// console and is created on first use, so its thread doesn't exist before the training starts (and isn't 
+		// inherited by processes forked before that). In distributed mode only the process of rank 0 has one.
+		Utils::MetricsLogger* getMetricsLogger()
+		{
+			if (defaultMetrics && !metrics && (!transport || transport->getRank() == 0))
+			{
+				metrics = std::make_shared<Utils::MetricsLogger>();
+				metrics->addSink(std::make_unique<Utils::ConsoleMetricsSink>());
+			}
+
+			return metrics.get();
+		}
 
 	public:
 		// Create a new RLAlgorithm. Takes ownership on 'environment'.
 		RLAlgorithm(std::unique_ptr<Environment> environment, const char* playerId = NULL)
-			:environment(std::move(environment)) 
+			:environment(std::move(environment)), trainAllPlayers(false), defaultMetrics(true)
 		{
 			if (!this->environment->isInitialized())
 				this->environment->initialize();
@@ -26,6 +57,8 @@ namespace BaseML::RL
 				this->playerId = playerId;
 			else
 				this->playerId = this->environment->getPlayers().at(0);
+
+			playerIndex = this->environment->getPlayerIndex(this->playerId.c_str());
 		}
 
 		virtual ~RLAlgorithm()
@@ -36,9 +69,36 @@ namespace BaseML::RL
 
 		void setPlayerId(const char* id)
 		{
+			playerIndex = environment->getPlayerIndex(id);
 			playerId = id;
 		}
 
+		// Control all of the players returned by the environment's getPlayers() with the same policy and learn 
+		// from the experience of all of them, or only control the player set with setPlayerId()
+		void setTrainAllPlayers(bool trainAll)
+		{
+			trainAllPlayers = trainAll;
+		}
+
+		// Train together with other processes connected by 'transport'. Every process collects data from its own 
+		// environment and the processes keep identical parameters by averaging their gradients. All of the 
+		// processes should use the same settings and call learn() with the same arguments. Set to null to train 
+		// alone.
+		void setTransport(std::shared_ptr<Transport> transport)
+		{
+			this->transport = std::move(transport);
+		}
+
+		// Send the training metrics to 'logger' (which may be shared with other algorithms) instead of the console. 
+		// The metrics are written on the logger's thread, so recording them doesn't slow down the training. Set to 
+		// null to not record metrics. In distributed mode every process that is given a logger records its own 
+		// metrics, while by default only the process of rank 0 writes them to the console.
+		void setMetricsLogger(std::shared_ptr<Utils::MetricsLogger> logger)
+		{
+			metrics = std::move(logger);
+			defaultMetrics = false;
+		}
+
 		// Learn the environment using the algorithm for 'maxIter' iterations.
 		virtual void learn(size_t maxIter) = 0;
 	};
@@ -50,5 +110,13 @@ namespace BaseML::RL
 		Matrix actions;
 		Matrix logProbabilities;
 		Matrix rtgs; // Rewards-to-go
+		Matrix rewards; // The rewards received, before any normalization
+		Matrix dones; // 1 for the last timestep of every episode and 0 for the others
+
+		// Recurrent policies only: the first data point of every segment the episodes are split to for back 
+		// propagation through time, and the state of the recurrent layer at the start of every segment (a column 
+		// per segment)
+		std::vector<size_t> segmentStarts;
+		Matrix segmentStates;
 	};
 }
\ No newline at end of file
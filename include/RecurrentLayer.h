@@ -0,0 +1,149 @@
+#pragma once
+
+#include <vector>
+
+#include "Matrix.h"
+
+namespace BaseML
+{
+	// A layer of LSTM or GRU cells that processes batches of sequences. The projections of the inputs of all of
+	// the timesteps of a batch are computed together in one pass over the inputs before the timesteps are run, so
+	// only the recurrent part (the hidden state times the recurrent weights and the gates) is computed timestep by
+	// timestep, in one fused kernel per data point. The gradients are back propagated through time over the
+	// sequences of the last forward pass (truncated BPTT: the gradients stop at the first timestep of every
+	// sequence), so a long episode is trained as segments that start from states saved while it was collected.
+	//
+	// The sequences of a batch are packed timestep by timestep: the columns of timestep t are the data points of
+	// the sequences that are longer than t, in the same order in every timestep. The sequences should therefore be
+	// sorted by decreasing length, and the number of sequences in each timestep ('batchSizes') doesn't increase.
+	//
+	// The state of a sequence is a column of getStateSize() values: the hidden state (the output), followed by the
+	// cell state in an LSTM layer.
+	class RecurrentLayer
+	{
+	public:
+		enum class Cell
+		{
+			LSTM, // Input, forget, cell and output gates and a cell state besides the hidden state
+			GRU // Reset, update and candidate gates. The reset gate scales the recurrent part of the candidate after its weights.
+		};
+
+	private:
+		Cell cell;
+		size_t inputCount, hiddenCount, gateCount;
+
+		// The rows of gate g are [g * hiddenCount, (g + 1) * hiddenCount). The weights are column-major, so the weights
+		// of one input (or hidden unit) to all of the gates are contiguous.
+		Matrix inputWeights, recurrentWeights;
+		Matrix biases; // Of the gates, and in a GRU layer also of the recurrent part of the candidate (the last 'hiddenCount' rows)
+
+		// Adam Optimizer matrices
+		Matrix mInputWeights, vInputWeights, mRecurrentWeights, vRecurrentWeights, mBiases, vBiases;
+
+		// The batch of the last forward pass
+		std::vector<size_t> batchSizes, timestepOffsets; // Sequences in each timestep and the first column of each timestep
+		const Matrix* inputRef; // The inputs of the last forward pass. This class doesn't manage this memory!
+		Matrix initialStates;
+
+		// Values of the last forward pass that the backward pass needs, with a column per data point (column-major):
+		// the gates after their activation functions, the hidden states and, for each data point, the cell state
+		// (LSTM) or the recurrent part of the candidate before the reset gate scales it (GRU)
+		Matrix gates, outputs, cellValues;
+
+		// Gradients of the objective with respect to the gates before their activation functions (with the candidate
+		// through the reset gate in a GRU layer) and, in a GRU layer, with respect to the recurrent part of the candidate
+		Matrix gateGradients, candidateGradients;
+
+		// Returns the memory of the state of data point 'column' of timestep 't' - 1 (of the initial states for t = 0)
+		const float* previousHidden(size_t t, size_t column) const;
+
+		// Add the input projections of the data points in 'inputs' to the biases in 'destination' (a column per data point)
+		void projectInputs(const Matrix& inputs, float* destination) const;
+
+		// Run the recurrent part of one timestep for one data point: the hidden state times the recurrent weights and
+		// the gate kernel. 'gateValues' holds the input projections and is replaced by the gates after their activation
+		// functions. The new state is written to 'hidden' and 'cellState' (in a GRU layer 'cellState' receives the
+		// recurrent part of the candidate and 'previousCell' isn't read), which may be the memory of the previous state.
+		// 'recurrentPart' is scratch memory of gateCount * hiddenCount values.
+		void recurrentStep(float* gateValues, const float* previousHidden, const float* previousCell, float* hidden, float* cellState,
+			float* recurrentPart) const;
+
+		// Apply one Adam Optimizer step to the parameters using the given (batch averaged) gradients, laid out like in getParameters()
+		void adamUpdate(const float* gradients, float learningRate, size_t timestep, float beta1, float beta2, float epsilon);
+
+		// Add the gradients of the parameters, summed over the data points of the last batch and multiplied by 'scale',
+		// to 'dest' (laid out like in getParameters()). The sums over all of the timesteps are computed together after
+		// the backward pass, one parameter column per thread.
+		void accumulateParameterGradients(float* dest, float scale) const;
+
+	public:
+		// Default constructor for creating an empty object
+		RecurrentLayer();
+
+		// Creates a layer of 'numHidden' cells of type 'cellType' with 'numInputs' inputs
+		RecurrentLayer(Cell cellType, size_t numInputs, size_t numHidden);
+
+		// Returns the type of the cells of this layer
+		Cell getCell() const;
+
+		// Returns the number of inputs of this layer
+		size_t getInputCount() const;
+
+		// Returns the number of outputs (cells) of this layer
+		size_t getOutputCount() const;
+
+		// Returns the number of values in the state of a sequence
+		size_t getStateSize() const;
+
+		// Returns the outputs of the last forward pass, packed like its inputs
+		const Matrix& getOutputs() const;
+
+		// Run a batch of packed sequences (see the class description) through the layer. 'batchSizes' holds the number
+		// of sequences in every timestep and 'initialStates' the state of every sequence before its first timestep (a
+		// column per sequence), or null to start all of the sequences from zero states. Returns the hidden states of
+		// all of the timesteps, packed like the inputs.
+		const Matrix& forwardPropagate(const Matrix& inputs, const std::vector<size_t>& batchSizes, const Matrix* initialStates = nullptr);
+
+		// Run one timestep of a batch of independent sequences, whose states (a column per sequence) are read from and
+		// written back to 'states', and write the outputs to 'outputs' (reallocated if it doesn't have the right size).
+		// Doesn't change the state of the layer, so it can be used to collect data between training passes.
+		void step(const Matrix& inputs, Matrix& states, Matrix& outputs) const;
+
+		// Calculate the gradients of the layer from the gradients of the objective with respect to the outputs of the
+		// last forward pass, by back propagation through the time of its sequences
+		void calculateGradients(const Matrix& outputGradients);
+
+		// Returns the gradients of the optimization objective with respect to the inputs of the last forward pass.
+		// Assumes that the gradients of this layer were already calculated.
+		Matrix calculateInputGradients() const;
+
+		// Update the parameters according to the gradients using Adam Optimizer. 'timestep' is the number of times the
+		// layer's parameters have been updated before.
+		void adamGradientDescent(float learningRate, size_t timestep, float beta1 = 0.9f, float beta2 = 0.999f, float epsilon = 1.0e-8f);
+
+		// Returns the number of parameters (weights and biases) of this layer
+		size_t getParameterCount() const;
+
+		// Copy the parameters of this layer to 'dest' (the input weights, the recurrent weights and the biases, each in
+		// the order in which it is stored)
+		void getParameters(float* dest) const;
+
+		// Replace the parameters of this layer with the values in 'src' (laid out like in getParameters())
+		void setParameters(const float* src);
+
+		// Add the gradients of the parameters, summed over the data points of the last batch, to 'dest' (laid out
+		// like in getParameters()). Assumes that the gradients of this layer were already calculated.
+		void addParameterGradients(float* dest) const;
+
+		// Update the parameters with Adam Optimizer using the given gradients (laid out like in getParameters()
+		// and averaged over the data points they were calculated from) instead of the layer's own gradients
+		void applyParameterGradients(const float* gradients, float learningRate, size_t timestep, float beta1 = 0.9f,
+			float beta2 = 0.999f, float epsilon = 1.0e-8f);
+
+		// Save the layer to disk. Assumes a binary output stream
+		void save(std::ofstream& outFile);
+
+		// Load the layer from disk. Assumes a binary input stream. Throws if the type of the cells isn't LSTM or GRU.
+		void load(std::ifstream& inFile);
+	};
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vector>
+#include <span>
+
+#include "Matrix.h"
+#include "Layer.h"
+#include "UtilsFunctions.h"
+
+namespace BaseML
+{
+	// A dense layer with a skip connection: the outputs are the inputs plus the outputs of a dense Layer of the same
+	// size over them. The gradients reach the inputs through the skip connection unchanged, so deep stacks of
+	// residual layers keep training where a plain stack of dense layers stops.
+	class ResidualLayer
+	{
+	private:
+		Layer block; // The dense part (as many inputs as outputs)
+
+		// The outputs and the gradients of the objective with respect to them, in the layout of the inputs
+		Matrix outputs, outputGradients;
+
+		// Add the values of 'inputs' to 'outputs' (the outputs of the dense part), which have the same size
+		static void addSkip(const Matrix& inputs, Matrix& outputs);
+
+	public:
+		// Default constructor for creating an empty object
+		ResidualLayer();
+
+		// Creates a residual layer over data points of 'size' values. The dense part uses the given activation function.
+		ResidualLayer(size_t size, float (*activationFunction)(float) = &Utils::leakyReLU,
+			float (*activationFunctionDerivative)(float) = &Utils::leakyReLUDerivative);
+
+		// Set the activation function of the dense part of this layer
+		void setActivationFunction(float (*activationFunction)(float),
+			float (*activationFunctionDerivative)(float));
+
+		// Returns the number of inputs of this layer
+		size_t getInputCount() const;
+
+		// Returns the number of outputs of this layer (the number of inputs)
+		size_t getOutputCount() const;
+
+		// Returns the number data points the layer is currently configured to process together
+		size_t getCurrentBatchSize() const;
+
+		// Returns the outputs of this layer
+		const Matrix& getOutputs() const;
+
+		// Returns the dense part of this layer
+		const Layer& getBlock() const;
+
+		// Perform forward propagation on this layer with the specified inputs. The outputs have the layout of the inputs.
+		void calculateOutputs(const Matrix* inputs);
+
+		// Perform forward propagation with the specified inputs and write the results to 'outputs' without
+		// changing the state of the layer, so it can be called from several threads at once. 'outputs' is
+		// only reallocated (in the layout of the inputs) if it doesn't have the right size.
+		void calculateOutputs(const Matrix& inputs, Matrix& outputs) const;
+
+		// Calculate the gradients of the last layer based on the loss function and the expected outputs
+		void calculateLastLayerGradientsToTarget(const Matrix& expectedOutputs, float (*lossFunctionDerivative)(float, float));
+
+		// Calculate the gradients of this layer based on the gradients of the optimization objective with respect to
+		// its outputs: the external gradients in the last layer, or the input gradients of the next layer.
+		void calculateLastLayerGradients(const Matrix& externalGradients);
+
+		// Returns the gradients of the optimization objective with respect to the inputs of this layer.
+		// Assumes that the gradients of this layer were already calculated.
+		Matrix calculateInputGradients() const;
+
+		// Update the parameters according to the gradients using Adam Optimizer. 'timestep' is the number of times the
+		// layer's parameters have been updated before.
+		void adamGradientDescent(float learningRate, size_t timestep, float beta1 = 0.9f, float beta2 = 0.999f, float epsilon = 1.0e-8f);
+
+		// Returns the number of parameters (weights and biases of the dense part) of this layer
+		size_t getParameterCount() const;
+
+		// Copy the parameters of this layer to 'dest' (laid out like in Layer::getParameters())
+		void getParameters(float* dest) const;
+
+		// Replace the parameters of this layer with the values in 'src' (laid out like in getParameters())
+		void setParameters(const float* src);
+
+		// Append views of the parameters of this layer to 'spans', in the order of getParameters()
+		void getParameterSpans(std::vector<std::span<float>>& spans);
+
+		// Add the gradients of the parameters, summed over the data points of the last batch, to 'dest' (laid out
+		// like in getParameters()). Assumes that the gradients of this layer were already calculated.
+		void addParameterGradients(float* dest) const;
+
+		// Update the parameters with Adam Optimizer using the given gradients (laid out like in getParameters()
+		// and averaged over the data points they were calculated from) instead of the layer's own gradients
+		void applyParameterGradients(const float* gradients, float learningRate, size_t timestep, float beta1 = 0.9f,
+			float beta2 = 0.999f, float epsilon = 1.0e-8f);
+
+		// Save the layer to disk. Assumes a binary output stream
+		void save(std::ofstream& outFile);
+
+		// Load the layer from disk. Assumes a binary input stream
+		void load(std::ifstream& inFile, float (*activationFunction)(float) = &Utils::leakyReLU,
+			float (*activationFunctionDerivative)(float) = &Utils::leakyReLUDerivative);
+	};
+}
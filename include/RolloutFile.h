@@ -0,0 +1,132 @@
+#pragma once
+
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+#include "Matrix.h"
+#include "MappedFile.h"
+#include "RLAlgorithm.h"
+
+namespace BaseML::RL
+{
+	// The columns stored in a rollout file. Every column is a matrix with a data point (timestep) in each column: 
+	// the observations have the observation dimension rows, the actions the action dimension rows and the others 
+	// one row.
+	enum class RolloutColumn
+	{
+		Observations,
+		Actions,
+		Rewards,
+		LogProbabilities,
+		Dones,
+		Count // Number of columns
+	};
+
+	// Rollout files store RLTrainingData in chunks, one chunk for every append. Inside a chunk every column is 
+	// stored contiguously (row by row, like a Matrix) starting at an offset aligned to 64 bytes, as 32-bit floats 
+	// or as bfloat16 values. An index of the chunks follows the last chunk, and the header holds its offset. 
+	// Every append writes the new chunk and a new index after the current index and updates the header last, so 
+	// the file is complete at every point of an append and can be read while it is still being written. The 
+	// indexes replaced by later appends stay in the file unused.
+	struct RolloutFileHeader
+	{
+		static constexpr uint32_t MAGIC = 0x524c4d42; // "BMLR"
+		static constexpr uint32_t VERSION = 1;
+		static constexpr size_t ALIGNMENT = 64;
+
+		enum ValueType : uint32_t
+		{
+			Float32 = 0,
+			BFloat16 = 1
+		};
+
+		uint32_t magic;
+		uint32_t version;
+		uint64_t observationDimension;
+		uint64_t actionDimension;
+		uint32_t valueType;
+		uint32_t reserved;
+		uint64_t chunkCount;
+		uint64_t indexOffset;
+		uint64_t dataPointCount; // Number of data points in all of the chunks
+	};
+
+	// An entry of the chunk index
+	struct RolloutChunkEntry
+	{
+		uint64_t count; // Number of data points in the chunk
+		uint64_t columnOffsets[(size_t)RolloutColumn::Count];
+	};
+
+	// Writes rollouts to a rollout file
+	class RolloutWriter
+	{
+	private:
+		std::fstream file;
+		RolloutFileHeader header;
+		std::vector<RolloutChunkEntry> chunks;
+		std::vector<uint16_t> conversionBuffer; // Used for converting columns to bfloat16
+
+		// Write 'values' at the end of the chunks (aligned) in the value type of the file. Returns the offset.
+		uint64_t writeColumn(const Matrix& values);
+
+		// Write the chunk index after the last chunk and update the header
+		void writeIndex();
+
+	public:
+		// Open the rollout file at 'path' for data with the given dimensions. If 'append' is true and the file 
+		// exists, new rollouts are added after the rollouts already in it (the dimensions and the value type 
+		// should match). Otherwise the file is overwritten. Set 'bfloat16' to store the values as bfloat16, 
+		// which halves the size of the file but keeps only about 3 significant digits.
+		RolloutWriter(const char* path, size_t observationDimension, size_t actionDimension, bool bfloat16 = false, bool append = false);
+
+		// Append the observations, actions, rewards, log probabilities and done flags of 'data' as a new chunk. 
+		// The rewards-to-go aren't stored.
+		void append(const RLTrainingData& data);
+
+		// Returns the number of chunks in the file
+		size_t getChunkCount() const;
+
+		void close();
+	};
+
+	// Reads a rollout file mapped to memory. Columns stored as 32-bit floats are returned as views of the 
+	// mapped file, without copying or parsing them. The views are valid while the reader exists, and writing 
+	// to them doesn't change the file.
+	class RolloutReader
+	{
+	private:
+		Utils::MappedFile file;
+		RolloutFileHeader header;
+		const RolloutChunkEntry* chunks;
+
+	public:
+		// Map the rollout file at 'path'. Throws if it isn't a valid rollout file, including when an entry of its index
+		// points outside of the file.
+		RolloutReader(const char* path);
+
+		size_t getObservationDimension() const;
+
+		size_t getActionDimension() const;
+
+		// Returns true if the values are stored as bfloat16
+		bool isBFloat16() const;
+
+		// Returns the number of chunks (appends) in the file
+		size_t getChunkCount() const;
+
+		// Returns the number of data points in the given chunk
+		size_t getChunkSize(size_t chunk) const;
+
+		// Returns the number of data points in all of the chunks
+		size_t size() const;
+
+		// Returns a column of the given chunk with a data point in each column. A view of the file for 32-bit 
+		// float files, and a new Matrix converted from the stored values for bfloat16 files.
+		Matrix getColumn(size_t chunk, RolloutColumn column) const;
+
+		// Returns all of the columns of the given chunk. The rewards-to-go of the returned data are empty.
+		RLTrainingData readChunk(size_t chunk) const;
+	};
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+
+#include "Transport.h"
+
+namespace BaseML
+{
+	// Transport between processes on the same machine through a named shared memory segment. Every process 
+	// owns a slot in the segment: for an all-reduce each process copies its buffer to its slot, then sums 
+	// its share of the elements over all of the slots (a reduce-scatter) and finally every process copies 
+	// the whole result. Buffers larger than the slots are processed in chunks. The processes synchronize 
+	// with a spinning barrier on atomics in the segment.
+	// The process of rank 0 creates the segment and the others attach to it, so the processes can be 
+	// started in any order. The name should be unique to the training run: rank 0 fails if the segment 
+	// already exists, and the other ranks fail if they attach to a segment whose rank 0 exited. The name 
+	// is removed once all of the processes are attached. Only supported on Linux.
+	class SharedMemoryTransport : public Transport
+	{
+	private:
+		static constexpr size_t DEFAULT_SLOT_BYTES = 4 * 1024 * 1024;
+
+		struct Header;
+
+		std::string name;
+		size_t rank, worldSize;
+		size_t slotBytes;
+
+		void* sharedMemory;
+		size_t sharedMemorySize;
+
+		Header* getHeader() const;
+
+		// Returns the slot of the process 'slotRank'. The slot of rank 'worldSize' holds the results.
+		char* getSlot(size_t slotRank) const;
+
+		// Blocks until all of the processes reach the barrier
+		void barrier();
+
+	protected:
+		void allReduceElements(void* data, size_t count, ElementType type) override;
+
+		void broadcastBytes(void* data, size_t bytes, size_t root) override;
+
+	public:
+		// Create (rank 0) or attach to (other ranks) the shared memory segment named 'name'. Blocks until 
+		// all of the 'worldSize' processes are attached. 'slotBytes' is the size of the chunks exchanged. 
+		// Throws if rank 0 finds a segment with this name or another rank finds one left by an earlier run.
+		SharedMemoryTransport(const char* name, size_t rank, size_t worldSize, size_t slotBytes = DEFAULT_SLOT_BYTES);
+
+		~SharedMemoryTransport() override;
+
+		SharedMemoryTransport(const SharedMemoryTransport&) = delete;
+		SharedMemoryTransport& operator=(const SharedMemoryTransport&) = delete;
+
+		size_t getRank() const override;
+
+		size_t getWorldSize() const override;
+	};
+}
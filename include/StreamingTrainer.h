@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#include "Matrix.h"
+#include "NeuralNetwork.h"
+#include "Dataset.h"
+
+namespace BaseML
+{
+	// Trains a Neural Network on a dataset that is streamed from a DatasetSource in mini-batches, so the 
+	// dataset doesn't have to fit in memory. A background thread reads the shuffled mini-batches from the 
+	// source into two contiguous buffers: while the network trains on one buffer the next mini-batch is 
+	// assembled in the other.
+	class StreamingTrainer
+	{
+	private:
+		// A mini-batch assembled by the prefetch thread
+		struct Batch
+		{
+			Matrix inputs, expectedOutputs;
+			bool ready = false;
+			bool last = false; // Last mini-batch of the epoch
+		};
+
+		NeuralNetwork& network;
+		DatasetSource& source;
+		size_t minibatchSize;
+		bool shuffle;
+
+		std::vector<size_t> order; // Order of the data points in the current epoch
+
+		Batch buffers[2];
+		std::mutex mutex;
+		std::condition_variable bufferChanged;
+		std::exception_ptr prefetchError;
+		bool stopPrefetch; // Set when training stops before the end of the epoch, so the prefetch thread returns
+
+		// Body of the prefetch thread: assemble the mini-batches of the epoch in order, alternating between 
+		// the buffers
+		void prefetch();
+
+	public:
+		// Create a trainer of 'network' on the data of 'source'. Both should outlive the trainer. If 'shuffle' 
+		// is true the order of the data points changes every epoch (chunk by chunk, see DatasetSource).
+		StreamingTrainer(NeuralNetwork& network, DatasetSource& source, size_t minibatchSize, bool shuffle = true);
+
+		// Train on every data point of the source once. Returns the average loss of the data points.
+		float trainEpoch(float learningRate = 0.001f);
+
+		// Train for 'epochs' epochs. Returns the average loss of the last epoch.
+		float train(size_t epochs, float learningRate = 0.001f);
+	};
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+#include "Matrix.h"
+#include "Environment.h"
+
+namespace BaseML::RL
+{
+	// An environment that runs copies of another environment in separate worker processes. Use it for
+	// environments that wrap simulators which are not thread-safe, to simulate several copies of them on
+	// different cores. Every worker creates its own environment with the factory given, and the players of
+	// all of the workers are exposed as the players of this environment (the player "id" of worker k is
+	// named "k/id").
+	// Observations, actions, rewards and done flags are exchanged through ring buffers in shared memory and
+	// the processes wake each other with eventfd notifications, so no data is serialized. The batched
+	// interface (observeBatch() and stepBatch()) copies directly between the caller's buffers and the shared
+	// memory. A worker whose environment finished is not updated until the next reset(), and this environment
+	// is finished when all of the workers are. A worker whose environment throws exits, and the next call
+	// that waits for it throws in this process. The workers are killed when this process dies.
+	// Only supported on Linux. The workers are forked in the constructor, so create this environment before
+	// the process starts any threads of its own. Every worker runs its environment on one thread.
+	class SubprocessEnvironment : public Environment
+	{
+	public:
+		// Function that creates the environment simulated by a worker. Called once in every worker process.
+		using EnvironmentFactory = std::function<std::unique_ptr<Environment>()>;
+
+	private:
+		static constexpr size_t RING_SLOTS = 2; // Number of commands a worker can have queued
+		static constexpr size_t CACHE_LINE_SIZE = 64;
+		static constexpr int WORKER_CHECK_MILLISECONDS = 100; // How often a wait for a worker checks that it is still running
+
+		// Commands sent to the workers
+		enum class Command : int
+		{
+			Initialize,
+			Reset,
+			Step,
+			Render,
+			Close,
+			Exit
+		};
+
+		// Shared memory of one worker. The header is followed by RING_SLOTS slots, each holding a command and
+		// the buffers of its data.
+		struct ChannelHeader;
+
+		struct Worker
+		{
+			int processId; // -1 before the worker is forked and after it was reaped
+			int commandEvent, resultEvent; // eventfd descriptors for notifying the worker and the parent
+			void* sharedMemory;
+			size_t sharedMemorySize;
+			uint64_t commandsSent; // Number of commands sent to the worker so far
+			bool finished;
+		};
+
+		std::vector<Worker> workers;
+		size_t playersPerWorker;
+		std::vector<std::string> players;
+
+		// Layout of a ring slot (offsets are in bytes from the beginning of the slot)
+		size_t actionsOffset, observationsOffset, rewardsOffset, donesOffset, slotSize;
+
+		// Copies of the last data received from the workers and the actions set for the next update,
+		// used by the per-player interface. The states are only copied when they are requested.
+		mutable std::vector<Matrix> states;
+		mutable bool statesValid;
+		std::vector<float> rewards;
+		std::vector<unsigned char> dones;
+		Matrix pendingActions;
+
+		bool initialized;
+
+		// Uses 'probe' (an environment created by the factory in this process) to learn the dimensions and
+		// the players of the environment, then destroys it before forking the workers
+		SubprocessEnvironment(EnvironmentFactory& factory, size_t numWorkers, std::unique_ptr<Environment> probe);
+
+		// Wait for the worker processes to exit (after killing them if 'kill' is true), reap them and release
+		// their channels
+		void stopWorkers(bool kill);
+
+		// Block until 'worker' notifies its result event. Throws if the worker process exited.
+		void waitForResult(Worker& worker);
+
+		// Returns the beginning of the given ring slot in the shared memory of 'worker'
+		char* getSlot(const Worker& worker, uint64_t commandIndex) const;
+
+		// Write a command to the next ring slot of every worker and wake the workers. The actions of the players
+		// of each worker are copied from 'actions' for Step commands. Argument is the render mode for Initialize.
+		void sendToAll(Command command, const Matrix* actions = nullptr, int argument = 0);
+
+		// Wait until all of the workers have completed the last command sent to them and copy the rewards and
+		// done flags they returned. If 'batch' isn't null, all of the data returned is also copied to it.
+		// Throws if a worker exited.
+		void waitForAll(EnvironmentBatch* batch);
+
+		// Copy the observations returned by the last command of every worker to 'states'
+		void cacheStates() const;
+
+		// The loop of a worker process. Never returns: the worker exits when its environment throws or when the
+		// channel to the parent fails.
+		[[noreturn]] static void workerMain(EnvironmentFactory& factory, Worker worker, size_t obsDim, size_t actDim,
+			size_t numPlayers, size_t actionsOffset, size_t observationsOffset, size_t rewardsOffset, size_t donesOffset, size_t slotSize);
+
+	public:
+		// Create 'numWorkers' worker processes, each simulating an environment created by 'factory'. All of the
+		// environments should have the same dimensions and the same number of players.
+		SubprocessEnvironment(EnvironmentFactory factory, size_t numWorkers);
+
+		// Stops the worker processes
+		~SubprocessEnvironment() override;
+
+		SubprocessEnvironment(const SubprocessEnvironment&) = delete;
+		SubprocessEnvironment& operator=(const SubprocessEnvironment&) = delete;
+
+		const std::vector<std::string>& getPlayers() const override;
+
+		void update() override;
+
+		const Matrix& getState(const char* playerId) const override;
+
+		void setAction(const char* playerId, const Matrix& action) override;
+
+		float getReward(const char* playerId) const override;
+
+		void initialize(bool renderMode = false) override;
+
+		bool isInitialized() override;
+
+		bool isFinished() override;
+
+		void close() override;
+
+		void reset() override;
+
+		// Renders the environments of all of the workers
+		void render() override;
+
+		const Matrix& getPlayerState(size_t playerIndex) const override;
+
+		void setPlayerAction(size_t playerIndex, const Matrix& action) override;
+
+		float getPlayerReward(size_t playerIndex) const override;
+
+		bool isPlayerFinished(size_t playerIndex) override;
+
+		void observeBatch(EnvironmentBatch& batch) override;
+
+		void stepBatch(const Matrix& actions, EnvironmentBatch& batch) override;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Transport.h"
+
+namespace BaseML
+{
+	// Transport between processes over TCP sockets (for example on the loopback interface to run several 
+	// processes on one machine). The process of rank 0 listens on the given address and the other processes 
+	// connect to it. The collective operations go through rank 0: for an all-reduce every process sends its 
+	// buffer to rank 0, which sums them in rank order and sends the result back.
+	// Only supported on Linux.
+	class TcpTransport : public Transport
+	{
+	private:
+		static constexpr int CONNECT_TIMEOUT_MS = 30000;
+
+		size_t rank, worldSize;
+
+		// Rank 0 holds a socket for every rank (the entry of rank 0 is unused), the other ranks hold one 
+		// socket connected to rank 0
+		std::vector<int> sockets;
+
+		std::vector<char> receiveBuffer;
+
+		void sendAll(int socket, const void* data, size_t bytes);
+
+		void receiveAll(int socket, void* data, size_t bytes);
+
+	protected:
+		void allReduceElements(void* data, size_t count, ElementType type) override;
+
+		void broadcastBytes(void* data, size_t bytes, size_t root) override;
+
+	public:
+		// Connect the 'worldSize' processes. Rank 0 listens on 'host':'port' and the others connect to it, 
+		// retrying until rank 0 is listening. Blocks until all of the processes are connected.
+		TcpTransport(size_t rank, size_t worldSize, unsigned short port, const char* host = "127.0.0.1");
+
+		~TcpTransport() override;
+
+		TcpTransport(const TcpTransport&) = delete;
+		TcpTransport& operator=(const TcpTransport&) = delete;
+
+		size_t getRank() const override;
+
+		size_t getWorldSize() const override;
+	};
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+
+namespace BaseML
+{
+	// Communication between the processes of a distributed training run. Every process has a rank in 
+	// [0, getWorldSize()) and all of the processes call the collective operations in the same order with 
+	// buffers of the same size. The operations block until the data of all of the processes is available.
+	class Transport
+	{
+	protected:
+		enum class ElementType
+		{
+			Float,
+			Double
+		};
+
+		// Sum 'count' elements of the given type element-wise over all of the processes, in place
+		virtual void allReduceElements(void* data, size_t count, ElementType type) = 0;
+
+		// Copy 'bytes' bytes from the buffer of the process 'root' to the buffers of all of the processes
+		virtual void broadcastBytes(void* data, size_t bytes, size_t root) = 0;
+
+		// Add 'count' elements of 'src' to 'dest'
+		static void addElements(void* dest, const void* src, size_t count, ElementType type)
+		{
+			if (type == ElementType::Float)
+			{
+				float* d = static_cast<float*>(dest);
+				const float* s = static_cast<const float*>(src);
+
+				for (size_t i = 0; i < count; i++)
+					d[i] += s[i];
+			}
+			else
+			{
+				double* d = static_cast<double*>(dest);
+				const double* s = static_cast<const double*>(src);
+
+				for (size_t i = 0; i < count; i++)
+					d[i] += s[i];
+			}
+		}
+
+		static size_t elementSize(ElementType type)
+		{
+			return type == ElementType::Float ? sizeof(float) : sizeof(double);
+		}
+
+	public:
+		virtual ~Transport() = default;
+
+		// Returns the rank of this process
+		virtual size_t getRank() const = 0;
+
+		// Returns the number of processes
+		virtual size_t getWorldSize() const = 0;
+
+		// Sum the buffers of all of the processes element-wise. Every process receives the sum in 'data'. 
+		// The elements are added in rank order, so all of the processes get bitwise identical results.
+		void allReduceSum(float* data, size_t count)
+		{
+			allReduceElements(data, count, ElementType::Float);
+		}
+
+		void allReduceSum(double* data, size_t count)
+		{
+			allReduceElements(data, count, ElementType::Double);
+		}
+
+		// Replace the buffers of all of the processes with the buffer of the process 'root'
+		void broadcast(float* data, size_t count, size_t root = 0)
+		{
+			broadcastBytes(data, count * sizeof(float), root);
+		}
+
+		void broadcast(double* data, size_t count, size_t root = 0)
+		{
+			broadcastBytes(data, count * sizeof(double), root);
+		}
+
+		// Returns true for the process of rank 0, which is responsible for work done only once (like saving files)
+		bool isRoot() const
+		{
+			return getRank() == 0;
+		}
+	};
+}
@@ -5,6 +5,9 @@ namespace BaseML::Utils
 	float sigmoid(float input);
 	float sigmoidDerivative(float neuronOutput);
 
+	float linear(float input);
+	float linearDerivative(float neuronOutput);
+
 	float leakyReLU(float input);
 	float leakyReLUDerivative(float neuronOutput);
 
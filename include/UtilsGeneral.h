@@ -1,8 +1,73 @@
 #pragma once
 
+#include <vector>
+#include <fstream>
+
 #include "Matrix.h"
 
 namespace BaseML::Utils
 {
 	Matrix zScoreNormalize(const Matrix& mat);
+
+	// Running mean and variance of every row of a stream of data points, where every data point is a column. 
+	// Uses Welford's algorithm for numerically stable updates and Chan's formula to merge statistics that were 
+	// computed separately (for example by different threads or rollout workers).
+	class RunningStatistics
+	{
+	private:
+		static constexpr float EPSILON = 1.0e-8f;
+
+		double count;
+		std::vector<double> mean, m2; // m2 is the sum of squared distances from the mean
+
+		// Merge the statistics of 'otherCount' data points with the given mean and m2 (both of the statistics' 
+		// dimension) into these statistics
+		void merge(double otherCount, const double* otherMean, const double* otherM2);
+
+	public:
+		// Create empty statistics for data points with 'dimension' values
+		RunningStatistics(size_t dimension = 0);
+
+		// Returns the number of values in every data point
+		size_t getDimension() const;
+
+		// Returns the number of data points seen so far
+		double getCount() const;
+
+		// Returns the mean of the given row
+		float getMean(size_t row) const;
+
+		// Returns the variance of the given row
+		float getVariance(size_t row) const;
+
+		// Add the data points (the columns of 'data') to the statistics. The columns are split between 
+		// threads and the statistics of the threads are merged.
+		void update(const Matrix& data);
+
+		// Add statistics that were computed separately to these statistics
+		void merge(const RunningStatistics& other);
+
+		// Returns the number of values written by getState()
+		size_t getStateSize() const;
+
+		// Write the statistics to 'dest' as getStateSize() values (the count, the means and the sums of squared 
+		// distances). Used to exchange statistics between processes.
+		void getState(double* dest) const;
+
+		// Add statistics written by getState() (with the same dimension) to these statistics
+		void mergeState(const double* src);
+
+		// Subtract the mean from every row of 'data' and divide by the standard deviation. The results are 
+		// clipped to ['-clip', 'clip'].
+		void normalize(Matrix& data, float clip = 10.0f) const;
+
+		// Divide every row of 'data' by its standard deviation without centering it
+		void scale(Matrix& data) const;
+
+		// Save the statistics to disk. Assumes a binary output stream
+		void save(std::ofstream& outFile) const;
+
+		// Load the statistics from disk. Assumes a binary input stream
+		void load(std::ifstream& inFile);
+	};
 }
\ No newline at end of file
@@ -1,32 +1,74 @@
 #pragma once
 
 #include <random>
+#include <array>
+#include <cstdint>
+#include <vector>
 
 #include "Matrix.h"
 
 namespace BaseML::Utils
 {
+	// Counter-based random number generator (Philox4x32-10, Salmon et al. 2011). Every call maps a 
+	// (counter, key) pair to 4 independent random 32 bit integers without any internal state, so 
+	// any block of the random stream can be computed directly and in parallel.
+	class Philox4x32
+	{
+	private:
+		static constexpr uint32_t MULTIPLIER_0 = 0xD2511F53, MULTIPLIER_1 = 0xCD9E8D57;
+		static constexpr uint32_t WEYL_0 = 0x9E3779B9, WEYL_1 = 0xBB67AE85;
+		static constexpr int ROUNDS = 10;
+
+	public:
+		// Generate the block of 4 random integers at position 'counter' of stream 'stream' for the given seed
+		static std::array<uint32_t, 4> generate(uint64_t seed, uint64_t stream, uint64_t counter);
+	};
+
 	class GaussianSampler
 	{
 	private:
 		static constexpr float PI = 3.14159265359f;
 
-		std::mt19937 gen; // RNG engine
-		std::normal_distribution<float> distrib;
+		float sigma;
+
+		// The position of the sampler in the random stream. Every block of 4 samples consumes one counter 
+		// value, so the samples are fully determined by (seed, stream, offset) and don't depend on the 
+		// number of threads used to generate them.
+		uint64_t seed, stream, offset;
+
+		// Convert a block of 4 random integers to 4 standard normal samples (Box-Muller transform)
+		static void boxMuller(const std::array<uint32_t, 4>& bits, float* dest);
 
 	public:
-		// Create a new normal distribution with the given standard deviation
+		// Create a new normal distribution with the given standard deviation. The seed is chosen randomly.
 		GaussianSampler(float stddev);
 
+		// Create a new normal distribution with the given standard deviation that generates the random 
+		// stream identified by 'seed' and 'stream'. Samplers with different streams generate independent 
+		// samples for the same seed.
+		GaussianSampler(float stddev, uint64_t seed, uint64_t stream = 0);
+
 		// Get the standard deviation of the sampler
-		float getSigma();
+		float getSigma() const;
+
+		// Move the sampler to the given position in its random stream
+		void setOffset(uint64_t newOffset);
+
+		// Get the current position of the sampler in its random stream
+		uint64_t getOffset() const;
 
 		// Sample a value randomly from the normal distribution
 		float sample(float mean);
 
-		// Sample a vector of values randomly from the normal distribution
+		// Sample a vector of values randomly from the normal distribution. The samples are generated in 
+		// parallel and are the same regardless of the number of threads.
 		Matrix sample(const Matrix& mean);
 
+		// Sample a vector of values randomly from normal distributions with a different standard deviation 
+		// for each row. 'logStddevs' is a column vector holding the log of the standard deviation of every 
+		// row of 'mean'. The samples are the same regardless of the number of threads.
+		Matrix sample(const Matrix& mean, const Matrix& logStddevs);
+
 		// Get the log probability density of a sample given the mean of the distibution
 		float logProbabiltiy(float mean, float sample);
 
@@ -38,8 +80,24 @@ namespace BaseML::Utils
 		// of the distributions is the same. The function returns a row vector (as a Matrix) of the 
 		// log-probabilities of the actions.
 		Matrix batchLogProbabilities(const Matrix& means, const Matrix& samples);
+
+		// Get the log probability density of a sample given the mean of the distribution and the log of the 
+		// standard deviation of every dimension ('logStddevs' is a column vector)
+		float logProbabiltiy(const Matrix& mean, const Matrix& sample, const Matrix& logStddevs);
+
+		// Get the log probability density of samples given the means of the distibutions, where each mean and 
+		// sample is a column in the matrices and 'logStddevs' is a column vector with the log of the standard 
+		// deviation of every dimension. Returns a row vector (as a Matrix) of the log-probabilities.
+		Matrix batchLogProbabilities(const Matrix& means, const Matrix& samples, const Matrix& logStddevs);
 	};
 
 	float getRandomFloat(float min, float max);
 	float initFromNumInputs(int inputNum);
+
+	// Fill 'indices' with the numbers 0 to 'count' - 1 in a random order
+	void randomPermutation(std::vector<size_t>& indices, size_t count);
+
+	// Fill 'indices' with a random permutation of [0, 'count') that keeps chunks of 'chunkSize' consecutive 
+	// numbers together: the order of the chunks and the order inside every chunk are shuffled
+	void randomChunkedPermutation(std::vector<size_t>& indices, size_t count, size_t chunkSize);
 }
\ No newline at end of file
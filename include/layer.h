@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <span>
 
 #include "Matrix.h"
 #include "UtilsFunctions.h"
@@ -10,6 +11,8 @@ namespace BaseML
 	class Layer
 	{
 	private:
+		friend class ExecutionPlan;
+
 		size_t inputCount, outputCount, batchSize;
 		Matrix weights, biases, outputs, gradients;
 		const Matrix* inputRef; // A pointer to the output of last layer. This class doesn't manage this memory!
@@ -18,6 +21,15 @@ namespace BaseML
 		// Adam Optimizer matrices
 		Matrix mWeights, vWeights, mBiases, vBiases;
 
+		// Resize the gradients to fit the outputs of the last batch (in the layout of the outputs). Kept between 
+		// batches, so allocated from the heap even inside a MatrixArena scope.
+		void resizeGradients();
+
+		// Apply one Adam Optimizer step to the parameters using the given (batch averaged) gradients of the 
+		// weights and the biases (laid out like the 'weights' and 'biases' matrices)
+		void adamUpdate(const float* weightsGrads, const float* biasesGrads, float learningRate, size_t timestep, 
+			float beta1, float beta2, float epsilon);
+
 	public:
 		// Default constructor for creating an empty object
 		Layer(); 
@@ -55,9 +67,15 @@ namespace BaseML
 		// Returns the gradients of this layer
 		const Matrix& getGradients() const;
 
-		// Perform forward propagation on this layer with the specified inputs
+		// Perform forward propagation on this layer with the specified inputs. The outputs and the gradients 
+		// of the layer have the layout of the inputs.
 		void calculateOutputs(const Matrix* inputs); 
 
+		// Perform forward propagation with the specified inputs and write the results to 'outputs' without 
+		// changing the state of the layer, so it can be called from several threads at once. 'outputs' is 
+		// only reallocated (in the layout of the inputs) if it doesn't have the right size.
+		void calculateOutputs(const Matrix& inputs, Matrix& outputs) const;
+
 		// Calculate the gradients of the last layer based on the loss function and the expected outputs
 		void calculateLastLayerGradientsToTarget(const Matrix& expectedOutputs, float (*lossFunctionDerivative)(float, float));
 
@@ -68,6 +86,10 @@ namespace BaseML
 		// Calculate the gradients of this layer based on the gradients of the next layer
 		void calculateGradients(const Layer& nextLayer);
 
+		// Returns the gradients of the optimization objective with respect to the inputs of this layer. 
+		// Assumes that the gradients of this layer were already calculated.
+		Matrix calculateInputGradients() const;
+
 		// Update the parameters according to the gradients to minimize the loss function
 		void gradientDescent(float learningRate);
 
@@ -77,6 +99,27 @@ namespace BaseML
 		// 'epsilon' is a small positive constant to avoid devision by zero. 
 		void adamGradientDescent(float learningRate, size_t timestep, float beta1 = 0.9f, float beta2 = 0.999f, float epsilon = 1.0e-8f);
 
+		// Returns the number of parameters (weights and biases) of this layer
+		size_t getParameterCount() const;
+
+		// Copy the parameters of this layer to 'dest' (the weights followed by the biases, as they are saved)
+		void getParameters(float* dest) const;
+
+		// Replace the parameters of this layer with the values in 'src' (laid out like in getParameters())
+		void setParameters(const float* src);
+
+		// Append views of the parameters of this layer to 'spans', in the order of getParameters()
+		void getParameterSpans(std::vector<std::span<float>>& spans);
+
+		// Add the gradients of the parameters, summed over the data points of the last batch, to 'dest' (laid out 
+		// like in getParameters()). Assumes that the gradients of this layer were already calculated.
+		void addParameterGradients(float* dest) const;
+
+		// Update the parameters with Adam Optimizer using the given gradients (laid out like in getParameters() 
+		// and averaged over the data points they were calculated from) instead of the layer's own gradients
+		void applyParameterGradients(const float* gradients, float learningRate, size_t timestep, float beta1 = 0.9f, 
+			float beta2 = 0.999f, float epsilon = 1.0e-8f);
+
 		// Save Layer to disk. Assumes a binary output stream
 		void save(std::ofstream& outFile);
 
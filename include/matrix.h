@@ -9,18 +9,41 @@
 
 namespace BaseML
 {
+    struct ArenaBlock;
+
+    // A 2 dimensional Matrix of floats. The elements are stored row by row by default, or column by column in 
+    // column-major matrices. In this library data points are the columns of matrices, so the values of one data 
+    // point are contiguous in a column-major Matrix, while the values of one feature over a batch are contiguous 
+    // in a row-major one. All of the operations accept both layouts.
     class Matrix
     {
+    public:
+        enum class Layout
+        {
+            RowMajor, // Element (i, j) is at index i * columns + j
+            ColumnMajor // Element (i, j) is at index j * rows + i
+        };
+
     private:
         size_t rows, cols;
         float* data;
+        Layout layout = Layout::RowMajor;
+        bool ownsData = true; // False for views of memory owned by someone else
+        ArenaBlock* block = nullptr; // The MatrixArena block that holds the data, or null for memory from the heap
+
+        // Allocate the memory of 'count' elements, from the arena active on this thread if there is one (see 
+        // MatrixArena)
+        float* allocate(size_t count);
+
+        // Free the memory of the Matrix if it owns it
+        void release();
 
     public:
         // Default constructor for creating an empty object
         Matrix(); 
 
         // Create an empty Matrix with 'numOfRows' rows and 'numOfCols' columns
-        Matrix(size_t numOfRows, size_t numOfCols);
+        Matrix(size_t numOfRows, size_t numOfCols, Layout layout = Layout::RowMajor);
 
         // Create a Matrix from a 2 dimensional initializer list. The length of every 
         // row in the initializer list should be the same. Set 'transposed' to true to 
@@ -44,6 +67,17 @@ namespace BaseML
         // to 'false'.
         Matrix(std::vector<float>& vec, bool columnVector = true);
 
+        // Create a Matrix that uses the memory at 'data' ('numOfRows' * 'numOfCols' values, row by row or column 
+        // by column according to 'layout') without copying it. The view doesn't free the memory, so it should 
+        // outlive the view. Copies of a view and matrices assigned to a view own their memory.
+        static Matrix view(float* data, size_t numOfRows, size_t numOfCols, Layout layout = Layout::RowMajor);
+
+        // Returns true if this Matrix is a view of memory it doesn't own
+        bool isView() const;
+
+        // Returns true if the data of this Matrix was allocated from a MatrixArena
+        bool isArenaAllocated() const;
+
         // Destructor
         ~Matrix();
 
@@ -67,10 +101,10 @@ namespace BaseML
         // Const access operator
         const float& operator()(size_t row, size_t col) const; 
 
-        // 1D access operator
+        // 1D access operator. Indexes the elements in the order in which they are stored (see Layout).
         float& operator()(size_t index);
 
-        // 1D const access operator
+        // 1D const access operator. Indexes the elements in the order in which they are stored (see Layout).
         const float& operator()(size_t index) const;
 
         // Matrix addition. This function assumes that the matrices have the 
@@ -90,6 +124,7 @@ namespace BaseML
         // Matrix multiplication. This function assumes that the sizes of the matrices 
         // are compatible with each other.
         // Two matrices are compatible only if mat1.columnsCount() == mat2.rowsCount().
+        // The result is row-major.
         // Warning: this function doesn't check for the correctness of the input!
         Matrix operator*(const Matrix& other) const;
 
@@ -104,7 +139,17 @@ namespace BaseML
         // Returns the number of elements in the Matrix
         size_t size() const;
 
-        // Returns the transposition of the Matrix
+        // Returns the order in which the elements are stored
+        Layout getLayout() const;
+
+        // Returns a copy of the Matrix with its elements stored in the given layout
+        Matrix toLayout(Layout newLayout) const;
+
+        // Copy the elements of 'other', which should have the same size, into this Matrix without reallocating 
+        // it. The matrices may have different layouts.
+        void copyFrom(const Matrix& other);
+
+        // Returns the transposition of the Matrix (with the same layout)
         Matrix transpose() const;
 
         // Add a column vector to each column of the Matrix.
@@ -125,16 +170,22 @@ namespace BaseML
         // Warning: this function doesn't check for the correctness of the input!
         Matrix multElementwise(const Matrix& other) const;
 
+        // Build a new Matrix from 'count' columns of this Matrix. The i-th column of the 
+        // result is the column of this Matrix at index 'columnIndices[i]'. Useful for 
+        // gathering shuffled mini-batches of data points.
+        // Warning: this function doesn't check for the correctness of the input!
+        Matrix gatherColumns(const size_t* columnIndices, size_t count) const;
+
         // Apply the given function on every element of the Matrix
         void applyToElements(float (*func)(float));
 
         // Replaces all of the values of the Matrix with 0
         void clear();
 
-        // Save Matrix to disk. Assumes a binary output stream
+        // Save Matrix to disk. Assumes a binary output stream. The elements are saved row by row in both layouts.
         void save(std::ofstream& outFile);
 
-        // Load Matrix from disk. Assumes a binary input stream
+        // Load Matrix from disk. Assumes a binary input stream. The loaded Matrix is row-major.
         void load(std::ifstream& inFile);
 
         // Prints the Matrix to the console
@@ -1,21 +1,44 @@
 #pragma once
 
 #include <vector>
+#include <span>
 
 #include "Layer.h"
+#include "NetworkLayer.h"
 #include "UtilsFunctions.h"
 
 namespace BaseML
 {
+	// Caller-owned buffers for the activations of NeuralNetwork::infer(). Reusing a workspace for passes 
+	// with the same batch size doesn't allocate. Every thread that runs inference needs its own workspace.
+	class InferenceWorkspace
+	{
+	private:
+		friend class NeuralNetwork;
+
+		std::vector<Matrix> activations; // The outputs of every layer in the last pass
+
+	public:
+		// Returns the output of the network in the last pass. Throws if the workspace wasn't used for a pass yet.
+		const Matrix& getOutput() const;
+	};
+
 	class NeuralNetwork
 	{
 	private:
-		std::vector<Layer> layers;
+		friend class ExecutionPlan;
+
+		std::vector<NetworkLayer> layers;
 		Matrix networkInput;
 		float (*lossFunc)(float, float), (*lossFuncDerivative)(float, float); // Function to minimize
 
 		size_t learningTimestep;
 
+		Matrix::Layout layout; // Layout of the activations and the gradients of the layers
+
+		// Calculate the gradients of the layers before the last one, from the gradients of the last layer
+		void calculateHiddenGradients();
+
 	public:
 		// Create an empty Neural Network
 		NeuralNetwork();
@@ -38,16 +61,34 @@ namespace BaseML
 		NeuralNetwork(std::initializer_list<size_t> layerSizes, float (*activationFunction)(float),
 			float (*activationFunctionDerivative)(float), float (*lossFunction)(float, float), float (*lossFunctionDerivative)(float, float));
 
-		// Set the last layer's activation function
+		// Create a Neural Network from the given layers, which can be of any of the types of NetworkLayer (the outputs 
+		// of every layer are the inputs of the next one, so their sizes should match). Uses the loss function provided.
+		NeuralNetwork(std::vector<NetworkLayer> networkLayers, float (*lossFunction)(float, float) = &Utils::squareError,
+			float (*lossFunctionDerivative)(float, float) = &Utils::squareErrorDerivative);
+
+		// Add a layer after the last layer of the network. Its inputs should be the outputs of the last layer.
+		void addLayer(NetworkLayer layer);
+
+		// Set the last layer's activation function (if it has one)
 		void setOutputActivationFunction(float (*activationFunction)(float),
 			float (*activationFunctionDerivative)(float));
 
-		// Set the activation function of the hidden layers
+		// Set the activation function of the hidden layers (of the ones that have one)
 		void setHiddenActivationFunction(float (*activationFunction)(float),
 			float (*activationFunctionDerivative)(float));
 
 		// Returns the layers of the Neural Network
-		const std::vector<Layer>& getLayers() const;
+		const std::vector<NetworkLayer>& getLayers() const;
+
+		// Set the layout in which the layers keep their activations and gradients during forwardPropagate() and 
+		// the back propagation. Row-major (the default) makes the values of one neuron over a batch contiguous, 
+		// which suits large batches. Column-major makes the values of every data point contiguous, so the 
+		// output of the network can be read data point by data point with unit stride. The inputs can be in 
+		// either layout.
+		void setLayout(Matrix::Layout newLayout);
+
+		// Returns the layout of the activations and gradients of the layers
+		Matrix::Layout getLayout() const;
 
 		// Returns the number of inputs of this network
 		size_t getInputCount() const;
@@ -59,11 +100,20 @@ namespace BaseML
 		const Matrix& getOutput() const;
 
 		// Returns the index of neuron with highest output. Assumes that the network output contains one data point
-		int getClassify();
+		int getClassify() const;
+
+		// Returns the index of the largest value in column 'column' of 'outputs' (the class predicted for a data 
+		// point of the outputs of a network)
+		static int classify(const Matrix& outputs, size_t column = 0);
 
 		// Runs the input through the network
 		const Matrix& forwardPropagate(const Matrix& inputs);
 
+		// Runs the input through the network without changing it, keeping the activations in 'workspace'. Several 
+		// threads can run inference with the same network at once, as long as it isn't trained at the same time. 
+		// Returns the output, which stays in the workspace until its next use.
+		const Matrix& infer(const Matrix& inputs, InferenceWorkspace& workspace) const;
+
 		// Calculates the sum of the loss function over all of the last layer's outputs
 		float calculateSumLoss(const Matrix& expectedOutputs);
 
@@ -76,6 +126,45 @@ namespace BaseML
 		// propagation of the network for the update to occur correctly.
 		void backPropagation(const Matrix& externalGradients, float learningRate = 0.001f);
 
+		// Calculate the gradients of every layer of the Neural Network to fit the network to the expected outputs 
+		// without updating the parameters
+		void calculateGradientsToTarget(const Matrix& expectedOutputs);
+
+		// Calculate the gradients of every layer of the Neural Network from the gradients of the optimization objective 
+		// with respect to the network's output, without updating the parameters
+		void calculateGradients(const Matrix& externalGradients);
+
+		// Returns the gradients of the optimization objective with respect to the network's input. Assumes that 
+		// the gradients were already calculated. Used to continue back propagation into a network whose output 
+		// is the input of this network.
+		Matrix calculateInputGradients() const;
+
+		// Apply gradient descent on every layer of the Neural Network using the last calculated gradients
+		void applyGradients(float learningRate = 0.001f);
+
+		// Returns the number of parameters (weights and biases) of all of the layers
+		size_t getParameterCount() const;
+
+		// Copy the parameters of all of the layers to 'dest' as one flat buffer, layer after layer in the 
+		// order in which they are saved (the weights of each layer followed by its biases)
+		void getParameters(float* dest) const;
+
+		// Replace the parameters of all of the layers with the values in 'src' (laid out like in getParameters())
+		void setParameters(const float* src);
+
+		// Returns views of the parameter matrices of all of the layers, in the order of getParameters(), for reading 
+		// or changing the parameters in place without copying them
+		std::vector<std::span<float>> getParameterSpans();
+
+		// Add the gradients of all of the parameters, summed over the data points of the last batch, to 'dest' 
+		// (laid out like in getParameters()). Assumes that the gradients were already calculated. Used to 
+		// accumulate gradients over several batches or several copies of the network.
+		void addParameterGradients(float* dest) const;
+
+		// Apply one Adam Optimizer step to all of the parameters using the given gradients (laid out like in 
+		// getParameters() and averaged over the data points they were calculated from)
+		void applyParameterGradients(const float* gradients, float learningRate = 0.001f);
+
 		// Pass the data through the Neural Network and perform gradient descent. Returns the loss
 		float learn(const Matrix& inputs, const Matrix& expectedOutputs, float learningRate = 0.001f);
 
@@ -84,10 +173,11 @@ namespace BaseML
 		// the expected outputs of the batch. Each column represents a data point which means that the size of the 
 		// matrices should be inputNeuronCount rows and batchSize columns for the first Matrix and outputNeuronCount 
 		// rows and batchSize columns for the second Matrix (e.g. (inputs x batch) and (outputs x batch)).
-		// Returns the loss of the last batch
+		// Returns the loss of the last batch. For datasets that don't fit in memory use a StreamingTrainer.
 		float learn(const std::vector<std::pair<Matrix, Matrix>>& data, float learningRate = 0.001f);
 
-		// Save Neural Network to disk. Assumes a binary output stream
+		// Save Neural Network to disk. Assumes a binary output stream. Networks of dense layers are saved in the 
+		// format of the dense layers alone, other networks save the type of every layer before it.
 		void save(std::ofstream& outFile);
 
 		// Save The Neuaral Network in its current state to the specified file (if the file doesn't exist, it will be created)
@@ -96,7 +186,8 @@ namespace BaseML
 		// Save The Neuaral Network to a file. The name of the file will be generated automatically
 		void saveParams(const char* networkName = "neural_network", float networkScore = -1.0f, bool includeTime = true);
 
-		// Load Neural Network from disk. Assumes a binary input stream
+		// Load Neural Network from disk. Assumes a binary input stream. The activation functions are given to the 
+		// layers that have one.
 		void load(std::ifstream& inFile, float (*hiddenActFunc)(float) = &Utils::leakyReLU,
 			float (*hiddenActFuncDerivative)(float) = &Utils::leakyReLUDerivative, float (*activationFunction)(float) = &Utils::sigmoid,
 			float (*activationFunctionDerivative)(float) = &Utils::sigmoidDerivative, float (*lossFunction)(float, float) = &Utils::squareError, 
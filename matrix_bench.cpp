@@ -0,0 +1,329 @@
+// Microbenchmarks of the Matrix operations. Every operation is timed at every thread count of the sweep and
+// reported in GFLOP/s and GB/s next to the peak of the machine (measured at start) and the roofline bound
+// min(peak GFLOP/s, arithmetic intensity * peak GB/s). The peak bandwidth is the memory bandwidth, so operations 
+// whose data stays in the caches can exceed 100% of the roofline.
+//
+// Usage: baseml_bench [--threads 1,2,4] [--min-time seconds] [--json file] [--csv file]
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#include <omp.h>
+
+#include "Matrix.h"
+#include "UtilsFunctions.h"
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	struct Benchmark
+	{
+		std::string operation;
+		std::string shape;
+		double flops; // Floating point operations per run
+		double bytes; // Bytes read and written per run (compulsory traffic)
+		std::function<void()> run;
+	};
+
+	struct Result
+	{
+		std::string operation, shape;
+		int threads;
+		double seconds; // Median time of a run
+		double gflops, gbs;
+		double peakGflops, peakGbs;
+		double rooflineFraction; // Fraction of the roofline bound achieved
+	};
+
+	// Prevents the compiler from removing the computations
+	volatile float sink;
+
+	BaseML::Matrix randomMatrix(size_t rows, size_t cols)
+	{
+		BaseML::Matrix mat(rows, cols);
+
+		for (size_t i = 0; i < mat.size(); i++)
+			mat(i) = (float)((i * 2654435761u) % 1000) / 1000.0f - 0.5f;
+
+		return mat;
+	}
+
+	// Run 'func' repeatedly for at least 'minTime' seconds and return the median time of a run
+	double timeRuns(const std::function<void()>& func, double minTime)
+	{
+		// Warm up the caches and the thread pool
+		func();
+
+		std::vector<double> times;
+		double total = 0.0;
+
+		while (total < minTime || times.size() < 5)
+		{
+			auto start = Clock::now();
+			func();
+			double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+			times.push_back(elapsed);
+			total += elapsed;
+		}
+
+		std::sort(times.begin(), times.end());
+
+		return times[times.size() / 2];
+	}
+
+	// Peak arithmetic throughput: independent multiply-add chains that fit in registers
+	double measurePeakGflops(int threads, double minTime)
+	{
+		constexpr int LANES = 64, ITERATIONS = 1 << 16;
+
+		double seconds = timeRuns([threads]()
+			{
+				float total = 0.0f;
+
+				#pragma omp parallel num_threads(threads) reduction(+:total)
+				{
+					float acc[LANES];
+
+					for (int l = 0; l < LANES; l++)
+						acc[l] = (float)l * 1.0e-3f;
+
+					for (int it = 0; it < ITERATIONS; it++)
+					{
+						#pragma omp simd
+						for (int l = 0; l < LANES; l++)
+							acc[l] = acc[l] * 0.9999f + 1.0e-4f;
+					}
+
+					for (int l = 0; l < LANES; l++)
+						total += acc[l];
+				}
+
+				sink = total;
+			}, minTime);
+
+		return 2.0 * LANES * ITERATIONS * threads / seconds * 1.0e-9;
+	}
+
+	// Peak memory bandwidth: a STREAM-like triad over arrays much larger than the caches
+	double measurePeakGbs(int threads, double minTime)
+	{
+		const size_t count = 16 * 1024 * 1024;
+
+		std::vector<float> a(count, 1.0f), b(count, 2.0f), c(count, 0.0f);
+
+		double seconds = timeRuns([&, threads]()
+			{
+				#pragma omp parallel for num_threads(threads)
+				for (long long i = 0; i < (long long)count; i++)
+					c[i] = a[i] + 0.5f * b[i];
+
+				sink = c[count / 2];
+			}, minTime);
+
+		return 3.0 * count * sizeof(float) / seconds * 1.0e-9;
+	}
+
+	std::string shapeString(std::initializer_list<size_t> dims)
+	{
+		std::ostringstream out;
+		bool first = true;
+
+		for (size_t dim : dims)
+		{
+			out << (first ? "" : "x") << dim;
+			first = false;
+		}
+
+		return out.str();
+	}
+
+	std::vector<Benchmark> createBenchmarks()
+	{
+		std::vector<Benchmark> benchmarks;
+
+		// GEMM shapes (M x K times K x N). The first ones are the PPO shapes: the forward passes of 64 unit layers
+		// over a 4800 timestep batch, the weight gradients (gradients times the transposed inputs) and the
+		// single observation passes during collection.
+		const size_t gemmShapes[][3] = {
+			{ 64, 8, 4800 }, { 64, 64, 4800 }, { 1, 64, 4800 }, { 64, 4800, 64 }, { 64, 4800, 8 },
+			{ 64, 8, 1 }, { 64, 64, 1 }, { 4, 64, 1 },
+			{ 128, 128, 128 }, { 256, 256, 256 }, { 512, 512, 512 }
+		};
+
+		for (const auto& shape : gemmShapes)
+		{
+			size_t m = shape[0], k = shape[1], n = shape[2];
+
+			auto a = std::make_shared<BaseML::Matrix>(randomMatrix(m, k));
+			auto b = std::make_shared<BaseML::Matrix>(randomMatrix(k, n));
+
+			benchmarks.push_back({ "gemm", shapeString({ m, k, n }), 2.0 * m * k * n, 4.0 * (m * k + k * n + m * n),
+				[a, b]() { sink = ((*a) * (*b))(0); } });
+		}
+
+		// Element-wise and reduction operations on PPO batch shapes
+		const size_t elementShapes[][2] = { { 64, 4800 }, { 4800, 64 }, { 1, 4800 } };
+
+		for (const auto& shape : elementShapes)
+		{
+			size_t rows = shape[0], cols = shape[1];
+			double elements = (double)rows * cols;
+			std::string name = shapeString({ rows, cols });
+
+			auto a = std::make_shared<BaseML::Matrix>(randomMatrix(rows, cols));
+			auto b = std::make_shared<BaseML::Matrix>(randomMatrix(rows, cols));
+			auto column = std::make_shared<BaseML::Matrix>(randomMatrix(rows, 1));
+
+			auto indices = std::make_shared<std::vector<size_t>>(cols);
+
+			for (size_t j = 0; j < cols; j++)
+				(*indices)[j] = (j * 7919) % cols;
+
+			benchmarks.push_back({ "transpose", name, 0.0, 8.0 * elements, [a]() { sink = a->transpose()(0); } });
+			benchmarks.push_back({ "add", name, elements, 12.0 * elements, [a, b]() { sink = ((*a) + (*b))(0); } });
+			benchmarks.push_back({ "subtract", name, elements, 12.0 * elements, [a, b]() { sink = ((*a) - (*b))(0); } });
+			benchmarks.push_back({ "scale", name, elements, 8.0 * elements, [a]() { sink = ((*a) * 0.5f)(0); } });
+			benchmarks.push_back({ "multElementwise", name, elements, 12.0 * elements, [a, b]() { sink = a->multElementwise(*b)(0); } });
+			benchmarks.push_back({ "sumRows", name, elements, 4.0 * (elements + rows), [a]() { sink = a->sumRows()(0); } });
+			benchmarks.push_back({ "addToColumns", name, elements, 4.0 * (2.0 * elements + rows), [a, column]() { sink = a->addToColumns(*column)(0); } });
+			benchmarks.push_back({ "applyToElements", name, elements, 8.0 * elements, [a]() { a->applyToElements(&BaseML::Utils::leakyReLU); sink = (*a)(0); } });
+			benchmarks.push_back({ "gatherColumns", name, 0.0, 8.0 * elements, [a, indices]() { sink = a->gatherColumns(indices->data(), indices->size())(0); } });
+		}
+
+		return benchmarks;
+	}
+
+	std::vector<int> parseThreads(const std::string& list)
+	{
+		std::vector<int> threads;
+		std::stringstream stream(list);
+		std::string item;
+
+		while (std::getline(stream, item, ','))
+			threads.push_back(std::stoi(item));
+
+		return threads;
+	}
+
+	void writeJson(const std::string& path, const std::vector<Result>& results)
+	{
+		std::ofstream out(path);
+
+		out << "{\n  \"maxThreads\": " << omp_get_max_threads() << ",\n  \"results\": [\n";
+
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const Result& r = results[i];
+
+			out << "    { \"operation\": \"" << r.operation << "\", \"shape\": \"" << r.shape << "\", \"threads\": " << r.threads
+				<< ", \"seconds\": " << r.seconds << ", \"gflops\": " << r.gflops << ", \"gbs\": " << r.gbs
+				<< ", \"peakGflops\": " << r.peakGflops << ", \"peakGbs\": " << r.peakGbs
+				<< ", \"rooflineFraction\": " << r.rooflineFraction << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+
+		out << "  ]\n}\n";
+	}
+
+	void writeCsv(const std::string& path, const std::vector<Result>& results)
+	{
+		std::ofstream out(path);
+
+		out << "operation,shape,threads,seconds,gflops,gbs,peak_gflops,peak_gbs,roofline_fraction\n";
+
+		for (const Result& r : results)
+		{
+			out << r.operation << "," << r.shape << "," << r.threads << "," << r.seconds << "," << r.gflops << "," << r.gbs << ","
+				<< r.peakGflops << "," << r.peakGbs << "," << r.rooflineFraction << "\n";
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<int> threadCounts;
+	double minTime = 0.2;
+	std::string jsonPath = "baseml_bench.json", csvPath = "baseml_bench.csv";
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		std::string option = argv[i];
+
+		if (option == "--threads")
+			threadCounts = parseThreads(argv[i + 1]);
+		else if (option == "--min-time")
+			minTime = std::stod(argv[i + 1]);
+		else if (option == "--json")
+			jsonPath = argv[i + 1];
+		else if (option == "--csv")
+			csvPath = argv[i + 1];
+		else
+		{
+			std::cout << "Unknown option " << option << std::endl;
+			return 1;
+		}
+	}
+
+	// Default sweep: powers of 2 up to the number of threads available, and the maximum itself
+	if (threadCounts.empty())
+	{
+		for (int t = 1; t < omp_get_max_threads(); t *= 2)
+			threadCounts.push_back(t);
+
+		threadCounts.push_back(omp_get_max_threads());
+	}
+
+	std::vector<Benchmark> benchmarks = createBenchmarks();
+	std::vector<Result> results;
+
+	for (int threads : threadCounts)
+	{
+		omp_set_num_threads(threads);
+
+		double peakGflops = measurePeakGflops(threads, minTime);
+		double peakGbs = measurePeakGbs(threads, minTime);
+
+		std::cout << "Threads: " << threads << "  peak " << peakGflops << " GFLOP/s, " << peakGbs << " GB/s" << std::endl;
+
+		for (const Benchmark& benchmark : benchmarks)
+		{
+			double seconds = timeRuns(benchmark.run, minTime);
+
+			Result result;
+
+			result.operation = benchmark.operation;
+			result.shape = benchmark.shape;
+			result.threads = threads;
+			result.seconds = seconds;
+			result.gflops = benchmark.flops / seconds * 1.0e-9;
+			result.gbs = benchmark.bytes / seconds * 1.0e-9;
+			result.peakGflops = peakGflops;
+			result.peakGbs = peakGbs;
+
+			// Roofline bound of the operation's arithmetic intensity
+			double bound = std::min(peakGflops, benchmark.flops / benchmark.bytes * peakGbs);
+			result.rooflineFraction = benchmark.flops > 0.0 ? result.gflops / bound : result.gbs / peakGbs;
+
+			std::cout << "  " << result.operation << " " << result.shape << ": " << seconds * 1.0e6 << " us, "
+				<< result.gflops << " GFLOP/s, " << result.gbs << " GB/s, " << result.rooflineFraction * 100.0 << "% of roofline" << std::endl;
+
+			results.push_back(result);
+		}
+	}
+
+	writeJson(jsonPath, results);
+	writeCsv(csvPath, results);
+
+	std::cout << "Results written to " << jsonPath << " and " << csvPath << std::endl;
+
+	return 0;
+}
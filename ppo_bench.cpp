@@ -0,0 +1,196 @@
+// End-to-end benchmark of PPO on the synthetic benchmark environments. Runs a fixed number of training iterations
+// and reports the environment steps per second of the collection, the samples per second of the updates and the
+// time spent in every phase of an iteration (see PPO::getLastIterationTimings()). The first iterations are a
+// warm-up and are not counted. The environments are deterministic, so the same options always simulate the same
+// systems. In builds with BASEML_ENABLE_PROFILING the profile of the measured iterations is printed as well, and
+// '--trace' writes their timeline in the Chrome trace format. '--core' trains a recurrent policy (see
+// PPO::setRecurrentCore()) with 64 cells and segments of 16 timesteps.
+//
+// Usage: ppo_bench [--env cartpole|pendulum|pointmass] [--dimension n] [--players n] [--batch timesteps]
+//                  [--iterations n] [--warmup n] [--epochs n] [--threads n] [--trace file] [--core lstm|gru]
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+
+#include <omp.h>
+
+#include "PPO.h"
+#include "BenchmarkEnvironments.h"
+#include "Profiler.h"
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	const char* CRITIC_FILE = "ppo_bench_critic.bin";
+	const char* ACTOR_FILE = "ppo_bench_actor.bin";
+
+	std::unique_ptr<BaseML::RL::Environment> createEnvironment(const std::string& name, size_t dimension, size_t players)
+	{
+		if (name == "cartpole")
+			return std::make_unique<BaseML::RL::CartPoleEnvironment>(players);
+
+		if (name == "pendulum")
+			return std::make_unique<BaseML::RL::PendulumEnvironment>(players);
+
+		if (name == "pointmass")
+			return std::make_unique<BaseML::RL::PointMassEnvironment>(dimension, players);
+
+		return nullptr;
+	}
+
+	void printPhase(const char* name, double seconds, double total)
+	{
+		std::cout << "  " << std::left << std::setw(16) << name << std::right << std::setw(10) << std::fixed << std::setprecision(3)
+			<< seconds << " s " << std::setw(6) << std::setprecision(1) << 100.0 * seconds / total << "%" << std::endl;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::string envName = "cartpole", tracePath, coreName;
+	size_t dimension = 2, players = 1, batch = 4800;
+	int iterations = 10, warmup = 1, epochs = 5, threads = 0;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		std::string option = argv[i];
+
+		if (option == "--env")
+			envName = argv[i + 1];
+		else if (option == "--dimension")
+			dimension = std::stoul(argv[i + 1]);
+		else if (option == "--players")
+			players = std::stoul(argv[i + 1]);
+		else if (option == "--batch")
+			batch = std::stoul(argv[i + 1]);
+		else if (option == "--iterations")
+			iterations = std::stoi(argv[i + 1]);
+		else if (option == "--warmup")
+			warmup = std::stoi(argv[i + 1]);
+		else if (option == "--epochs")
+			epochs = std::stoi(argv[i + 1]);
+		else if (option == "--threads")
+			threads = std::stoi(argv[i + 1]);
+		else if (option == "--trace")
+			tracePath = argv[i + 1];
+		else if (option == "--core")
+			coreName = argv[i + 1];
+		else
+		{
+			std::cout << "Unknown option " << option << std::endl;
+			return 1;
+		}
+	}
+
+	if (threads > 0)
+		omp_set_num_threads(threads);
+
+	std::unique_ptr<BaseML::RL::Environment> environment = createEnvironment(envName, dimension, players);
+
+	if (!environment)
+	{
+		std::cout << "Unknown environment " << envName << std::endl;
+		return 1;
+	}
+
+	BaseML::RL::PPO ppo(std::move(environment), CRITIC_FILE, ACTOR_FILE, 0.005f, 0.95f, 0.2f, (int)batch);
+
+	ppo.setEpochsPerIteration(epochs);
+	ppo.setTrainAllPlayers(players > 1);
+
+	if (coreName == "lstm")
+		ppo.setRecurrentCore(BaseML::RecurrentLayer::Cell::LSTM, 64);
+	else if (coreName == "gru")
+		ppo.setRecurrentCore(BaseML::RecurrentLayer::Cell::GRU, 64);
+	else if (!coreName.empty())
+	{
+		std::cout << "Unknown recurrent core " << coreName << std::endl;
+		return 1;
+	}
+
+	BaseML::RL::IterationTimings total;
+	double wallSeconds = 0.0;
+
+	for (int i = 0; i < warmup + iterations; i++)
+	{
+		// Profile only the measured iterations
+		if (i == warmup)
+		{
+			BaseML::Utils::Profiler::reset();
+			BaseML::Utils::Profiler::setTracing(!tracePath.empty());
+		}
+
+		auto start = Clock::now();
+
+		// Every call of learn() performs a single iteration, since an iteration collects at least 'batch' timesteps
+		ppo.learn(batch);
+
+		double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+		if (i < warmup)
+			continue;
+
+		const BaseML::RL::IterationTimings& timings = ppo.getLastIterationTimings();
+
+		total.collection += timings.collection;
+		total.advantage += timings.advantage;
+		total.policyUpdate += timings.policyUpdate;
+		total.valueFit += timings.valueFit;
+		total.checkpoint += timings.checkpoint;
+		total.environmentSteps += timings.environmentSteps;
+		total.updateSamples += timings.updateSamples;
+
+		wallSeconds += elapsed;
+	}
+
+	double updateSeconds = total.policyUpdate + total.valueFit;
+
+	std::cout << std::endl << "Environment: " << envName << ", players: " << players << ", batch: " << batch << ", epochs: " << epochs
+		<< ", threads: " << omp_get_max_threads() << ", iterations: " << iterations;
+
+	if (!coreName.empty())
+		std::cout << ", recurrent core: " << coreName;
+
+	std::cout << std::endl;
+
+	std::cout << "Environment steps/sec: " << std::fixed << std::setprecision(0) << total.environmentSteps / total.collection
+		<< " (collection), " << total.environmentSteps / wallSeconds << " (end-to-end)" << std::endl;
+	std::cout << "Update samples/sec: " << total.updateSamples / updateSeconds << std::endl;
+
+	const BaseML::MatrixArena& arena = ppo.getIterationArena();
+
+	std::cout << "Iteration arena: " << std::setprecision(1) << arena.getCapacity() / 1048576.0 << " MiB, "
+		<< arena.getEscapedBlockCount() << " blocks escaped" << std::endl;
+
+	std::cout << "Time breakdown:" << std::endl;
+	printPhase("collection", total.collection, wallSeconds);
+	printPhase("advantage", total.advantage, wallSeconds);
+	printPhase("policy update", total.policyUpdate, wallSeconds);
+	printPhase("value fit", total.valueFit, wallSeconds);
+	printPhase("checkpoint I/O", total.checkpoint, wallSeconds);
+	printPhase("total", wallSeconds, wallSeconds);
+
+	if (BaseML::Utils::Profiler::isEnabled())
+	{
+		std::cout << std::endl;
+		BaseML::Utils::Profiler::printSummary(std::cout);
+
+		if (!tracePath.empty())
+		{
+			if (BaseML::Utils::Profiler::writeChromeTrace(tracePath.c_str()))
+				std::cout << "Trace written to " << tracePath << std::endl;
+			else
+				std::cout << "Failed to write the trace to " << tracePath << std::endl;
+		}
+	}
+
+	std::remove(CRITIC_FILE);
+	std::remove(ACTOR_FILE);
+
+	return 0;
+}
@@ -0,0 +1,315 @@
+#include "BenchmarkEnvironments.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+#include "UtilsRandom.h"
+
+namespace BaseML::RL
+{
+	// Players are simulated in parallel only when there are enough of them to pay for the parallel region
+	static constexpr size_t PARALLEL_PLAYERS_THRESHOLD = 256;
+
+	BenchmarkEnvironment::BenchmarkEnvironment(size_t observationDim, size_t actionDim, size_t numPlayers, size_t maxEpisodeSteps,
+		uint64_t seed, float deltaTime)
+		:Environment(observationDim, actionDim), rewards(numPlayers, 0.0f), dones(numPlayers, 0), maxEpisodeSteps(maxEpisodeSteps),
+		episodeStep(0), seed(seed), episode(0), initialized(false), renderMode(false)
+	{
+		this->deltaTime = deltaTime;
+
+		for (size_t p = 0; p < numPlayers; p++)
+		{
+			players.push_back("player" + std::to_string(p));
+
+			states.emplace_back(observationDim, 1);
+			states.back().clear();
+
+			actions.emplace_back(actionDim, 1);
+			actions.back().clear();
+		}
+	}
+
+	void BenchmarkEnvironment::sampleInitialValues(size_t playerIndex, float* dest, size_t count, float min, float max) const
+	{
+		// Every episode of every player owns a block of counters of the random stream, large enough for
+		// the whole observation
+		uint64_t blocksPerEpisode = (obsDim + 3) / 4;
+
+		for (size_t i = 0; i < count; i += 4)
+		{
+			std::array<uint32_t, 4> bits = Utils::Philox4x32::generate(seed, playerIndex, episode * blocksPerEpisode + i / 4);
+
+			for (size_t j = 0; j < 4 && i + j < count; j++)
+			{
+				// The top 24 bits give a float in [0, 1) exactly
+				float uniform = (float)(bits[j] >> 8) * (1.0f / 16777216.0f);
+
+				dest[i + j] = min + (max - min) * uniform;
+			}
+		}
+	}
+
+	const std::vector<std::string>& BenchmarkEnvironment::getPlayers() const
+	{
+		return players;
+	}
+
+	void BenchmarkEnvironment::update()
+	{
+		const long long numPlayers = (long long)players.size();
+
+		#pragma omp parallel for if (numPlayers >= (long long)PARALLEL_PLAYERS_THRESHOLD)
+		for (long long p = 0; p < numPlayers; p++)
+		{
+			if (!dones[p])
+				stepPlayer((size_t)p);
+		}
+
+		episodeStep++;
+
+		if (maxEpisodeSteps > 0 && episodeStep >= maxEpisodeSteps)
+			std::fill(dones.begin(), dones.end(), 1);
+
+		if (renderMode)
+			render();
+	}
+
+	const Matrix& BenchmarkEnvironment::getState(const char* playerId) const
+	{
+		return states[getPlayerIndex(playerId)];
+	}
+
+	void BenchmarkEnvironment::setAction(const char* playerId, const Matrix& action)
+	{
+		setPlayerAction(getPlayerIndex(playerId), action);
+	}
+
+	float BenchmarkEnvironment::getReward(const char* playerId) const
+	{
+		return rewards[getPlayerIndex(playerId)];
+	}
+
+	void BenchmarkEnvironment::initialize(bool renderMode)
+	{
+		this->renderMode = renderMode;
+		initialized = true;
+
+		reset();
+	}
+
+	bool BenchmarkEnvironment::isInitialized()
+	{
+		return initialized;
+	}
+
+	bool BenchmarkEnvironment::isFinished()
+	{
+		return std::all_of(dones.begin(), dones.end(), [](unsigned char done) { return done != 0; });
+	}
+
+	void BenchmarkEnvironment::close()
+	{
+		initialized = false;
+	}
+
+	void BenchmarkEnvironment::reset()
+	{
+		for (size_t p = 0; p < players.size(); p++)
+		{
+			resetPlayer(p);
+
+			actions[p].clear();
+			rewards[p] = 0.0f;
+			dones[p] = 0;
+		}
+
+		episodeStep = 0;
+		episode++;
+	}
+
+	void BenchmarkEnvironment::render()
+	{
+		for (size_t p = 0; p < players.size(); p++)
+		{
+			std::cout << players[p] << ": ";
+
+			for (size_t i = 0; i < obsDim; i++)
+				std::cout << states[p](i) << " ";
+
+			std::cout << "(reward " << rewards[p] << (dones[p] ? ", done)" : ")") << std::endl;
+		}
+	}
+
+	const Matrix& BenchmarkEnvironment::getPlayerState(size_t playerIndex) const
+	{
+		return states[playerIndex];
+	}
+
+	void BenchmarkEnvironment::setPlayerAction(size_t playerIndex, const Matrix& action)
+	{
+		for (size_t i = 0; i < actDim; i++)
+			actions[playerIndex](i) = action(i);
+	}
+
+	float BenchmarkEnvironment::getPlayerReward(size_t playerIndex) const
+	{
+		return rewards[playerIndex];
+	}
+
+	bool BenchmarkEnvironment::isPlayerFinished(size_t playerIndex)
+	{
+		return dones[playerIndex] != 0;
+	}
+
+	void BenchmarkEnvironment::observeBatch(EnvironmentBatch& batch)
+	{
+		prepareBatch(batch);
+
+		for (size_t p = 0; p < players.size(); p++)
+		{
+			for (size_t i = 0; i < obsDim; i++)
+				batch.observations(i, p) = states[p](i);
+		}
+	}
+
+	void BenchmarkEnvironment::stepBatch(const Matrix& actions, EnvironmentBatch& batch)
+	{
+		for (size_t p = 0; p < players.size(); p++)
+		{
+			for (size_t i = 0; i < actDim; i++)
+				this->actions[p](i) = actions(i, p);
+		}
+
+		update();
+
+		observeBatch(batch);
+
+		for (size_t p = 0; p < players.size(); p++)
+		{
+			batch.rewards(p) = rewards[p];
+			batch.dones[p] = dones[p];
+		}
+	}
+
+	CartPoleEnvironment::CartPoleEnvironment(size_t numPlayers, size_t maxEpisodeSteps, uint64_t seed)
+		:BenchmarkEnvironment(4, 1, numPlayers, maxEpisodeSteps, seed, 0.02f)
+	{
+	}
+
+	void CartPoleEnvironment::resetPlayer(size_t playerIndex)
+	{
+		sampleInitialValues(playerIndex, &states[playerIndex](0), 4, -0.05f, 0.05f);
+	}
+
+	void CartPoleEnvironment::stepPlayer(size_t playerIndex)
+	{
+		Matrix& state = states[playerIndex];
+
+		float x = state(0), xDot = state(1), theta = state(2), thetaDot = state(3);
+		float force = FORCE_MAGNITUDE * std::clamp(actions[playerIndex](0), -1.0f, 1.0f);
+
+		float cosTheta = std::cos(theta), sinTheta = std::sin(theta);
+		float totalMass = CART_MASS + POLE_MASS, poleMassLength = POLE_MASS * POLE_HALF_LENGTH;
+
+		float temp = (force + poleMassLength * thetaDot * thetaDot * sinTheta) / totalMass;
+		float thetaAcc = (GRAVITY * sinTheta - cosTheta * temp) /
+			(POLE_HALF_LENGTH * (4.0f / 3.0f - POLE_MASS * cosTheta * cosTheta / totalMass));
+		float xAcc = temp - poleMassLength * thetaAcc * cosTheta / totalMass;
+
+		// Semi-implicit Euler integration
+		xDot += deltaTime * xAcc;
+		x += deltaTime * xDot;
+		thetaDot += deltaTime * thetaAcc;
+		theta += deltaTime * thetaDot;
+
+		state(0) = x;
+		state(1) = xDot;
+		state(2) = theta;
+		state(3) = thetaDot;
+
+		rewards[playerIndex] = 1.0f;
+		dones[playerIndex] = (std::abs(x) > MAX_POSITION || std::abs(theta) > MAX_ANGLE) ? 1 : 0;
+	}
+
+	PendulumEnvironment::PendulumEnvironment(size_t numPlayers, size_t maxEpisodeSteps, uint64_t seed)
+		:BenchmarkEnvironment(3, 1, numPlayers, maxEpisodeSteps, seed, 0.05f)
+	{
+	}
+
+	void PendulumEnvironment::resetPlayer(size_t playerIndex)
+	{
+		float initial[2];
+
+		sampleInitialValues(playerIndex, initial, 2, -1.0f, 1.0f);
+
+		float theta = PI * initial[0];
+		Matrix& state = states[playerIndex];
+
+		state(0) = std::cos(theta);
+		state(1) = std::sin(theta);
+		state(2) = initial[1];
+	}
+
+	void PendulumEnvironment::stepPlayer(size_t playerIndex)
+	{
+		Matrix& state = states[playerIndex];
+
+		float theta = std::atan2(state(1), state(0)), thetaDot = state(2);
+		float torque = std::clamp(actions[playerIndex](0), -MAX_TORQUE, MAX_TORQUE);
+
+		// The cost is computed from the state before the update (the angle is in [-pi, pi], 0 is upright)
+		rewards[playerIndex] = -(theta * theta + 0.1f * thetaDot * thetaDot + 0.001f * torque * torque);
+
+		thetaDot += deltaTime * (3.0f * GRAVITY / (2.0f * LENGTH) * std::sin(theta) + 3.0f / (MASS * LENGTH * LENGTH) * torque);
+		thetaDot = std::clamp(thetaDot, -MAX_SPEED, MAX_SPEED);
+		theta += deltaTime * thetaDot;
+
+		state(0) = std::cos(theta);
+		state(1) = std::sin(theta);
+		state(2) = thetaDot;
+
+		dones[playerIndex] = 0;
+	}
+
+	PointMassEnvironment::PointMassEnvironment(size_t dimension, size_t numPlayers, size_t maxEpisodeSteps, uint64_t seed)
+		:BenchmarkEnvironment(2 * dimension, dimension, numPlayers, maxEpisodeSteps, seed, 0.05f), dimension(dimension)
+	{
+	}
+
+	void PointMassEnvironment::resetPlayer(size_t playerIndex)
+	{
+		Matrix& state = states[playerIndex];
+
+		// Random position with the mass at rest
+		sampleInitialValues(playerIndex, &state(0), dimension, -1.0f, 1.0f);
+
+		for (size_t i = dimension; i < 2 * dimension; i++)
+			state(i) = 0.0f;
+	}
+
+	void PointMassEnvironment::stepPlayer(size_t playerIndex)
+	{
+		Matrix& state = states[playerIndex];
+		const Matrix& action = actions[playerIndex];
+
+		float distanceSquared = 0.0f, actionSquared = 0.0f;
+
+		for (size_t i = 0; i < dimension; i++)
+		{
+			float acceleration = std::clamp(action(i), -1.0f, 1.0f);
+
+			float& position = state(i);
+			float& velocity = state(dimension + i);
+
+			velocity += deltaTime * (acceleration - DAMPING * velocity);
+			position += deltaTime * velocity;
+
+			distanceSquared += position * position;
+			actionSquared += acceleration * acceleration;
+		}
+
+		rewards[playerIndex] = -distanceSquared - ACTION_COST * actionSquared;
+		dones[playerIndex] = 0;
+	}
+}
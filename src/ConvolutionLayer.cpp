@@ -0,0 +1,602 @@
+#include "ConvolutionLayer.h"
+
+#include <vector>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+#include "MatrixArena.h"
+#include "UtilsFunctions.h"
+#include "UtilsRandom.h"
+#include "Profiler.h"
+
+namespace BaseML
+{
+	namespace
+	{
+		// Returns the number of positions of a kernel of 'kernelSize' values that moves by 'stride' values over
+		// 'inputSize' values with 'padding' zeros at both ends. Throws if the kernel doesn't fit, before the
+		// unsigned sizes can wrap around.
+		size_t convolutionOutputSize(size_t inputSize, size_t kernelSize, size_t stride, size_t padding)
+		{
+			if (stride == 0)
+				throw std::invalid_argument("The stride of a convolution should be positive");
+
+			if (kernelSize == 0 || kernelSize > inputSize + 2 * padding)
+				throw std::invalid_argument("The kernel of a convolution should fit in its padded inputs");
+
+			return (inputSize + 2 * padding - kernelSize) / stride + 1;
+		}
+	}
+
+	ConvolutionLayer::ConvolutionLayer()
+		:inputChannels(0), inputHeight(0), inputWidth(0), filterCount(0), kernelHeight(0), kernelWidth(0), strideHeight(1), strideWidth(1),
+		paddingHeight(0), paddingWidth(0), outputHeight(0), outputWidth(0), inputCount(0), outputCount(0), batchSize(1), inputRef(nullptr),
+		activationFunc(nullptr), activationFuncDerivative(nullptr)
+	{
+	}
+
+	ConvolutionLayer::ConvolutionLayer(size_t channels, size_t rows, size_t columns, size_t numFilters, size_t kernelRows, size_t kernelColumns,
+		size_t strideRows, size_t strideColumns, size_t paddingRows, size_t paddingColumns,
+		float(*activationFunction)(float), float(*activationFunctionDerivative)(float))
+		:inputChannels(channels), inputHeight(rows), inputWidth(columns), filterCount(numFilters), kernelHeight(kernelRows), kernelWidth(kernelColumns),
+		strideHeight(strideRows), strideWidth(strideColumns), paddingHeight(paddingRows), paddingWidth(paddingColumns),
+		outputHeight(convolutionOutputSize(rows, kernelRows, strideRows, paddingRows)),
+		outputWidth(convolutionOutputSize(columns, kernelColumns, strideColumns, paddingColumns)),
+		inputCount(channels * rows * columns), outputCount(0), batchSize(1), inputRef(nullptr),
+		activationFunc(activationFunction), activationFuncDerivative(activationFunctionDerivative)
+	{
+		outputCount = filterCount * outputHeight * outputWidth;
+
+		const size_t filterSize = inputChannels * kernelHeight * kernelWidth;
+
+		weights = Matrix(filterSize, filterCount);
+		biases = Matrix(filterCount, 1);
+
+		// Initialize the biases and weights with random values. Every output sees 'filterSize' inputs.
+		for (size_t i = 0; i < weights.size(); i++)
+			weights(i) = Utils::initFromNumInputs(filterSize);
+
+		for (size_t i = 0; i < biases.size(); i++)
+			biases(i) = Utils::initFromNumInputs(filterSize);
+
+		// Initialize Adam Optimizer matrices
+		mWeights = Matrix(filterSize, filterCount);
+		vWeights = Matrix(filterSize, filterCount);
+		mBiases = Matrix(filterCount, 1);
+		vBiases = Matrix(filterCount, 1);
+
+		mWeights.clear();
+		vWeights.clear();
+		mBiases.clear();
+		vBiases.clear();
+	}
+
+	Conv1DLayer::Conv1DLayer()
+		:ConvolutionLayer()
+	{
+	}
+
+	Conv1DLayer::Conv1DLayer(size_t channels, size_t length, size_t numFilters, size_t kernelSize, size_t stride, size_t padding,
+		float(*activationFunction)(float), float(*activationFunctionDerivative)(float))
+		:ConvolutionLayer(channels, 1, length, numFilters, 1, kernelSize, 1, stride, 0, padding, activationFunction, activationFunctionDerivative)
+	{
+	}
+
+	Conv2DLayer::Conv2DLayer()
+		:ConvolutionLayer()
+	{
+	}
+
+	Conv2DLayer::Conv2DLayer(size_t channels, size_t height, size_t width, size_t numFilters, size_t kernelSize, size_t stride, size_t padding,
+		float(*activationFunction)(float), float(*activationFunctionDerivative)(float))
+		:ConvolutionLayer(channels, height, width, numFilters, kernelSize, kernelSize, stride, stride, padding, padding,
+			activationFunction, activationFunctionDerivative)
+	{
+	}
+
+	void ConvolutionLayer::setActivationFunction(float(*activationFunction)(float), float(*activationFunctionDerivative)(float))
+	{
+		activationFunc = activationFunction;
+		activationFuncDerivative = activationFunctionDerivative;
+	}
+
+	size_t ConvolutionLayer::getInputCount() const
+	{
+		return inputCount;
+	}
+
+	size_t ConvolutionLayer::getOutputCount() const
+	{
+		return outputCount;
+	}
+
+	size_t ConvolutionLayer::getInputChannels() const
+	{
+		return inputChannels;
+	}
+
+	size_t ConvolutionLayer::getFilterCount() const
+	{
+		return filterCount;
+	}
+
+	size_t ConvolutionLayer::getOutputHeight() const
+	{
+		return outputHeight;
+	}
+
+	size_t ConvolutionLayer::getOutputWidth() const
+	{
+		return outputWidth;
+	}
+
+	size_t ConvolutionLayer::getCurrentBatchSize() const
+	{
+		return batchSize;
+	}
+
+	const Matrix& ConvolutionLayer::getOutputs() const
+	{
+		return outputs;
+	}
+
+	const Matrix& ConvolutionLayer::getWeights() const
+	{
+		return weights;
+	}
+
+	const Matrix& ConvolutionLayer::getBiases() const
+	{
+		return biases;
+	}
+
+	const Matrix& ConvolutionLayer::getGradients() const
+	{
+		return gradients;
+	}
+
+	void ConvolutionLayer::convolve(const float* input, Matrix& outputs, size_t column, float* sums) const
+	{
+		const size_t positions = outputHeight * outputWidth;
+
+		for (size_t oy = 0; oy < outputHeight; oy++)
+		{
+			for (size_t ox = 0; ox < outputWidth; ox++)
+			{
+				std::copy(&biases(0), &biases(0) + filterCount, sums);
+
+				// Every input value under the kernel adds its weights to all of the filters at once. The parts of
+				// the kernel that fall on the padding add nothing.
+				for (size_t c = 0; c < inputChannels; c++)
+				{
+					for (size_t ky = 0; ky < kernelHeight; ky++)
+					{
+						const long long iy = (long long)(oy * strideHeight + ky) - (long long)paddingHeight;
+
+						if (iy < 0 || iy >= (long long)inputHeight)
+							continue;
+
+						const float* inputRow = input + (c * inputHeight + iy) * inputWidth;
+
+						for (size_t kx = 0; kx < kernelWidth; kx++)
+						{
+							const long long ix = (long long)(ox * strideWidth + kx) - (long long)paddingWidth;
+
+							if (ix < 0 || ix >= (long long)inputWidth)
+								continue;
+
+							const float value = inputRow[ix];
+							const float* weightsRow = &weights((c * kernelHeight + ky) * kernelWidth + kx, 0);
+
+							#pragma omp simd
+							for (size_t f = 0; f < filterCount; f++)
+							{
+								sums[f] += value * weightsRow[f];
+							}
+						}
+					}
+				}
+
+				const size_t position = oy * outputWidth + ox;
+
+				for (size_t f = 0; f < filterCount; f++)
+				{
+					outputs(f * positions + position, column) = (*activationFunc)(sums[f]);
+				}
+			}
+		}
+	}
+
+	void ConvolutionLayer::calculateOutputs(const Matrix* inputs)
+	{
+#ifdef DEBUG
+		if (inputs == nullptr)
+		{
+			std::cout << "Cannot calculate output from null input" << std::endl;
+			throw std::runtime_error("Cannot calculate output from null input");
+		}
+
+		if (inputCount != inputs->rowsCount())
+		{
+			std::cout << "Invalid input size for layer" << std::endl;
+			throw std::runtime_error("Invalid input size for layer");
+		}
+#endif // DEBUG
+
+		// Update batch size according to the input
+		batchSize = inputs->columnsCount();
+
+		// The kernels read every data point as contiguous memory. The copy of row-major inputs is kept for the
+		// backward pass, in a buffer that is reused between batches.
+		if (inputs->getLayout() == Matrix::Layout::ColumnMajor)
+		{
+			inputRef = inputs;
+		}
+		else
+		{
+			if (inputColumns.rowsCount() != inputCount || inputColumns.columnsCount() != batchSize)
+			{
+				MatrixArena::HeapScope heap;
+				inputColumns = Matrix(inputCount, batchSize, Matrix::Layout::ColumnMajor);
+			}
+
+			inputColumns.copyFrom(*inputs);
+			inputRef = &inputColumns;
+		}
+
+		if (outputs.rowsCount() != outputCount || outputs.columnsCount() != batchSize || outputs.getLayout() != Matrix::Layout::ColumnMajor)
+		{
+			MatrixArena::HeapScope heap;
+			outputs = Matrix(outputCount, batchSize, Matrix::Layout::ColumnMajor);
+		}
+
+		calculateOutputs(*inputRef, outputs);
+	}
+
+	void ConvolutionLayer::calculateOutputs(const Matrix& inputs, Matrix& outputs) const
+	{
+		const size_t batch = inputs.columnsCount();
+		const size_t work = outputCount * inputChannels * kernelHeight * kernelWidth * batch;
+
+		BASEML_PROFILE_OPERATION("ConvolutionLayer::calculateOutputs", 2.0 * work,
+			(weights.size() + inputs.size() + outputCount * batch) * sizeof(float));
+
+		// The outputs are kept between batches, so they don't come from an arena
+		if (outputs.rowsCount() != outputCount || outputs.columnsCount() != batch)
+		{
+			MatrixArena::HeapScope heap;
+			outputs = Matrix(outputCount, batch, Matrix::Layout::ColumnMajor);
+		}
+
+		Matrix columnInputs;
+		const Matrix* columns = &inputs;
+
+		if (inputs.getLayout() != Matrix::Layout::ColumnMajor)
+		{
+			columnInputs = inputs.toLayout(Matrix::Layout::ColumnMajor);
+			columns = &columnInputs;
+		}
+
+		// Parallel over the data points. Small batches (like single inference requests) are computed on the calling thread.
+		#pragma omp parallel if (work >= 32768)
+		{
+			std::vector<float> sums(filterCount);
+
+			#pragma omp for
+			for (int j = 0; j < (int)batch; j++)
+			{
+				convolve(&(*columns)(0, j), outputs, j, sums.data());
+			}
+		}
+	}
+
+	void ConvolutionLayer::resizeGradients()
+	{
+		const size_t columns = outputHeight * outputWidth * batchSize;
+
+		if (gradients.rowsCount() != filterCount || gradients.columnsCount() != columns)
+		{
+			MatrixArena::HeapScope heap;
+			gradients = Matrix(filterCount, columns, Matrix::Layout::ColumnMajor);
+		}
+	}
+
+	void ConvolutionLayer::calculateLastLayerGradientsToTarget(const Matrix& expectedOutputs, float(*lossFunctionDerivative)(float, float))
+	{
+#ifdef DEBUG
+		if (outputCount != expectedOutputs.rowsCount() || outputs.columnsCount() != expectedOutputs.columnsCount())
+		{
+			std::cout << "Invalid expected output size for layer" << std::endl;
+			throw std::runtime_error("Invalid expected output size for layer");
+		}
+#endif // DEBUG
+
+		resizeGradients();
+
+		const size_t positions = outputHeight * outputWidth;
+
+		// The gradients of every position are stored together, for the kernels of the backward pass
+		#pragma omp parallel for if (outputCount * batchSize >= 32768)
+		for (int j = 0; j < (int)batchSize; j++)
+		{
+			const float* outputsColumn = &outputs(0, j);
+			float* gradientsColumns = &gradients(0, j * positions);
+
+			for (size_t f = 0; f < filterCount; f++)
+			{
+				for (size_t p = 0; p < positions; p++)
+				{
+					const size_t row = f * positions + p;
+
+					gradientsColumns[p * filterCount + f] = (*lossFunctionDerivative)(outputsColumn[row], expectedOutputs(row, j)) *
+						(*activationFuncDerivative)(outputsColumn[row]);
+				}
+			}
+		}
+	}
+
+	void ConvolutionLayer::calculateLastLayerGradients(const Matrix& externalGradients)
+	{
+#ifdef DEBUG
+		if (outputCount != externalGradients.rowsCount() || outputs.columnsCount() != externalGradients.columnsCount())
+		{
+			std::cout << "Invalid external gradients size for layer" << std::endl;
+			throw std::runtime_error("Invalid external gradients size for layer");
+		}
+#endif // DEBUG
+
+		resizeGradients();
+
+		const size_t positions = outputHeight * outputWidth;
+
+		#pragma omp parallel for if (outputCount * batchSize >= 32768)
+		for (int j = 0; j < (int)batchSize; j++)
+		{
+			const float* outputsColumn = &outputs(0, j);
+			float* gradientsColumns = &gradients(0, j * positions);
+
+			for (size_t f = 0; f < filterCount; f++)
+			{
+				for (size_t p = 0; p < positions; p++)
+				{
+					const size_t row = f * positions + p;
+
+					gradientsColumns[p * filterCount + f] = externalGradients(row, j) * (*activationFuncDerivative)(outputsColumn[row]);
+				}
+			}
+		}
+	}
+
+	Matrix ConvolutionLayer::calculateInputGradients() const
+	{
+		const size_t positions = outputHeight * outputWidth;
+
+		Matrix inputGradients(inputCount, batchSize, Matrix::Layout::ColumnMajor);
+		inputGradients.clear();
+
+		// Every input value under the kernel at a position receives the dot product of its weights and the
+		// gradients of all of the filters at that position (the transposed convolution). Parallel over the data points.
+		#pragma omp parallel for if (outputCount * inputChannels * kernelHeight * kernelWidth * batchSize >= 32768)
+		for (int j = 0; j < (int)batchSize; j++)
+		{
+			float* inputColumn = &inputGradients(0, j);
+
+			for (size_t oy = 0; oy < outputHeight; oy++)
+			{
+				for (size_t ox = 0; ox < outputWidth; ox++)
+				{
+					const float* positionGradients = &gradients(0, j * positions + oy * outputWidth + ox);
+
+					for (size_t c = 0; c < inputChannels; c++)
+					{
+						for (size_t ky = 0; ky < kernelHeight; ky++)
+						{
+							const long long iy = (long long)(oy * strideHeight + ky) - (long long)paddingHeight;
+
+							if (iy < 0 || iy >= (long long)inputHeight)
+								continue;
+
+							float* inputRow = inputColumn + (c * inputHeight + iy) * inputWidth;
+
+							for (size_t kx = 0; kx < kernelWidth; kx++)
+							{
+								const long long ix = (long long)(ox * strideWidth + kx) - (long long)paddingWidth;
+
+								if (ix < 0 || ix >= (long long)inputWidth)
+									continue;
+
+								const float* weightsRow = &weights((c * kernelHeight + ky) * kernelWidth + kx, 0);
+								float sum = 0.0f;
+
+								#pragma omp simd reduction(+:sum)
+								for (size_t f = 0; f < filterCount; f++)
+								{
+									sum += weightsRow[f] * positionGradients[f];
+								}
+
+								inputRow[ix] += sum;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		return inputGradients;
+	}
+
+	void ConvolutionLayer::accumulateParameterGradients(float* dest, float scale) const
+	{
+		const size_t positions = outputHeight * outputWidth;
+		const size_t weightCount = weights.size();
+
+		// Every thread sums the gradients of its data points, so the threads don't write to the same memory until
+		// the partial sums are added together
+		#pragma omp parallel if (outputCount * inputChannels * kernelHeight * kernelWidth * batchSize >= 32768)
+		{
+			std::vector<float> sums(weightCount + filterCount, 0.0f);
+
+			#pragma omp for
+			for (int j = 0; j < (int)batchSize; j++)
+			{
+				const float* inputColumn = &(*inputRef)(0, j);
+
+				for (size_t oy = 0; oy < outputHeight; oy++)
+				{
+					for (size_t ox = 0; ox < outputWidth; ox++)
+					{
+						const float* positionGradients = &gradients(0, j * positions + oy * outputWidth + ox);
+						float* biasesSums = sums.data() + weightCount;
+
+						#pragma omp simd
+						for (size_t f = 0; f < filterCount; f++)
+						{
+							biasesSums[f] += positionGradients[f];
+						}
+
+						// The gradient of a weight is the gradient of its filter times the input value it multiplied
+						for (size_t c = 0; c < inputChannels; c++)
+						{
+							for (size_t ky = 0; ky < kernelHeight; ky++)
+							{
+								const long long iy = (long long)(oy * strideHeight + ky) - (long long)paddingHeight;
+
+								if (iy < 0 || iy >= (long long)inputHeight)
+									continue;
+
+								const float* inputRow = inputColumn + (c * inputHeight + iy) * inputWidth;
+
+								for (size_t kx = 0; kx < kernelWidth; kx++)
+								{
+									const long long ix = (long long)(ox * strideWidth + kx) - (long long)paddingWidth;
+
+									if (ix < 0 || ix >= (long long)inputWidth)
+										continue;
+
+									const float value = inputRow[ix];
+									float* weightsSums = sums.data() + ((c * kernelHeight + ky) * kernelWidth + kx) * filterCount;
+
+									#pragma omp simd
+									for (size_t f = 0; f < filterCount; f++)
+									{
+										weightsSums[f] += value * positionGradients[f];
+									}
+								}
+							}
+						}
+					}
+				}
+			}
+
+			#pragma omp critical
+			{
+				for (size_t i = 0; i < sums.size(); i++)
+				{
+					dest[i] += sums[i] * scale;
+				}
+			}
+		}
+	}
+
+	void ConvolutionLayer::adamGradientDescent(float learningRate, size_t timestep, float beta1, float beta2, float epsilon)
+	{
+		std::vector<float> gradients(getParameterCount(), 0.0f);
+
+		accumulateParameterGradients(gradients.data(), 1.0f / batchSize);
+		adamUpdate(gradients.data(), learningRate, timestep, beta1, beta2, epsilon);
+	}
+
+	void ConvolutionLayer::adamUpdate(const float* gradients, float learningRate, size_t timestep, float beta1, float beta2, float epsilon)
+	{
+		// Reads the gradients and reads and writes the parameters and both moments
+		BASEML_PROFILE_OPERATION("ConvolutionLayer::adamUpdate", 10 * getParameterCount(), 7 * getParameterCount() * sizeof(float));
+
+		// Zero bias correction factors
+		const float mCorrection = 1.0f / (1.0f - std::pow(beta1, (float)timestep));
+		const float vCorrection = 1.0f / (1.0f - std::pow(beta2, (float)timestep));
+
+		// The parameters are updated matrix by matrix, in the order of getParameters()
+		Matrix* parameters[] = { &weights, &biases };
+		Matrix* firstMoments[] = { &mWeights, &mBiases };
+		Matrix* secondMoments[] = { &vWeights, &vBiases };
+
+		for (int p = 0; p < 2; p++)
+		{
+			Matrix& values = *parameters[p];
+			Matrix& m = *firstMoments[p];
+			Matrix& v = *secondMoments[p];
+
+			#pragma omp parallel for if (values.size() >= 32768)
+			for (int i = 0; i < (int)values.size(); i++)
+			{
+				float grad = gradients[i];
+
+				m(i) = m(i) * beta1 + grad * (1.0f - beta1);
+				v(i) = v(i) * beta2 + grad * grad * (1.0f - beta2);
+
+				values(i) = values(i) - m(i) * mCorrection * (learningRate / (std::sqrt(v(i) * vCorrection) + epsilon));
+			}
+
+			gradients += values.size();
+		}
+	}
+
+	size_t ConvolutionLayer::getParameterCount() const
+	{
+		return weights.size() + biases.size();
+	}
+
+	void ConvolutionLayer::getParameters(float* dest) const
+	{
+		std::copy(&weights(0), &weights(0) + weights.size(), dest);
+		std::copy(&biases(0), &biases(0) + biases.size(), dest + weights.size());
+	}
+
+	void ConvolutionLayer::setParameters(const float* src)
+	{
+		std::copy(src, src + weights.size(), &weights(0));
+		std::copy(src + weights.size(), src + weights.size() + biases.size(), &biases(0));
+	}
+
+	void ConvolutionLayer::getParameterSpans(std::vector<std::span<float>>& spans)
+	{
+		spans.emplace_back(&weights(0), weights.size());
+		spans.emplace_back(&biases(0), biases.size());
+	}
+
+	void ConvolutionLayer::addParameterGradients(float* dest) const
+	{
+		accumulateParameterGradients(dest, 1.0f);
+	}
+
+	void ConvolutionLayer::applyParameterGradients(const float* gradients, float learningRate, size_t timestep, float beta1, float beta2, float epsilon)
+	{
+		adamUpdate(gradients, learningRate, timestep, beta1, beta2, epsilon);
+	}
+
+	void ConvolutionLayer::save(std::ofstream& outFile)
+	{
+		const size_t shape[] = { inputChannels, inputHeight, inputWidth, filterCount, kernelHeight, kernelWidth,
+			strideHeight, strideWidth, paddingHeight, paddingWidth };
+
+		outFile.write(reinterpret_cast<const char*>(shape), sizeof(shape));
+
+		weights.save(outFile);
+		biases.save(outFile);
+	}
+
+	void ConvolutionLayer::load(std::ifstream& inFile, float(*activationFunction)(float), float(*activationFunctionDerivative)(float))
+	{
+		size_t shape[10];
+
+		inFile.read(reinterpret_cast<char*>(shape), sizeof(shape));
+
+		// Start from a new layer of the saved shape (with fresh optimizer moments) and read its parameters
+		*this = ConvolutionLayer(shape[0], shape[1], shape[2], shape[3], shape[4], shape[5], shape[6], shape[7], shape[8], shape[9],
+			activationFunction, activationFunctionDerivative);
+
+		weights.load(inFile);
+		biases.load(inFile);
+	}
+}
@@ -0,0 +1,146 @@
+#include "DataParallelTrainer.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+#include <omp.h>
+
+#include "Profiler.h"
+
+namespace BaseML
+{
+	DataParallelTrainer::DataParallelTrainer(NeuralNetwork& network, size_t numThreads)
+		: network(network), parameterCount(network.getParameterCount()), accumulatedDataPoints(0)
+	{
+		if (numThreads == 0)
+			numThreads = omp_get_max_threads();
+
+		replicas.assign(numThreads, network);
+		gradientBuffers.assign(numThreads, std::vector<float>(parameterCount, 0.0f));
+		parameters.resize(parameterCount);
+	}
+
+	size_t DataParallelTrainer::getThreadCount() const
+	{
+		return replicas.size();
+	}
+
+	void DataParallelTrainer::synchronize()
+	{
+		network.getParameters(parameters.data());
+
+		#pragma omp parallel for
+		for (long long i = 0; i < (long long)replicas.size(); i++)
+		{
+			replicas[i].setParameters(parameters.data());
+		}
+	}
+
+	Matrix DataParallelTrainer::getColumns(const Matrix& mat, size_t begin, size_t end)
+	{
+		std::vector<size_t> indices(end - begin);
+		std::iota(indices.begin(), indices.end(), begin);
+
+		return mat.gatherColumns(indices.data(), indices.size());
+	}
+
+	float DataParallelTrainer::accumulate(const Matrix& inputs, const Matrix& expectedOutputs)
+	{
+		if (inputs.columnsCount() != expectedOutputs.columnsCount())
+			throw std::invalid_argument("The inputs and the expected outputs have a different number of data points");
+
+		size_t dataPoints = inputs.columnsCount();
+		size_t numShards = std::min(replicas.size(), dataPoints);
+
+		if (numShards == 0)
+			return 0.0f;
+
+		std::vector<float> shardLosses(numShards, 0.0f);
+
+		// Every thread trains on a contiguous range of columns. The OpenMP parallel regions inside the 
+		// Matrix operations are nested in this one, so each replica runs on a single thread.
+		#pragma omp parallel for num_threads((int)numShards) schedule(static, 1)
+		for (long long shard = 0; shard < (long long)numShards; shard++)
+		{
+			BASEML_PROFILE_SCOPE_ID("DataParallelTrainer shard", shard);
+
+			size_t begin = dataPoints * shard / numShards;
+			size_t end = dataPoints * (shard + 1) / numShards;
+
+			Matrix shardExpected = getColumns(expectedOutputs, begin, end);
+
+			replicas[shard].forwardPropagate(getColumns(inputs, begin, end));
+			replicas[shard].calculateGradientsToTarget(shardExpected);
+			replicas[shard].addParameterGradients(gradientBuffers[shard].data());
+
+			shardLosses[shard] = replicas[shard].calculateSumLoss(shardExpected) * (end - begin);
+		}
+
+		accumulatedDataPoints += dataPoints;
+
+		return std::accumulate(shardLosses.begin(), shardLosses.end(), 0.0f) / dataPoints;
+	}
+
+	void DataParallelTrainer::step(float learningRate)
+	{
+		if (accumulatedDataPoints == 0)
+			return;
+
+		BASEML_PROFILE_SCOPE("DataParallelTrainer::step");
+
+		const float scale = 1.0f / accumulatedDataPoints;
+		std::vector<float>& result = gradientBuffers[0];
+
+		// All-reduce: every thread sums a contiguous slice of the parameters across all of the buffers (the 
+		// shared memory equivalent of the reduce-scatter phase of a ring all-reduce), so every buffer is read 
+		// once and the work is evenly balanced. The buffers are cleared for the next accumulation.
+		#pragma omp parallel for
+		for (long long i = 0; i < (long long)parameterCount; i++)
+		{
+			float sum = result[i];
+
+			for (size_t b = 1; b < gradientBuffers.size(); b++)
+			{
+				sum += gradientBuffers[b][i];
+				gradientBuffers[b][i] = 0.0f;
+			}
+
+			result[i] = sum * scale;
+		}
+
+		network.applyParameterGradients(result.data(), learningRate);
+
+		std::fill(result.begin(), result.end(), 0.0f);
+		accumulatedDataPoints = 0;
+
+		// Broadcast the updated parameters
+		synchronize();
+	}
+
+	float DataParallelTrainer::learn(const Matrix& inputs, const Matrix& expectedOutputs, float learningRate, size_t microBatchSize)
+	{
+		size_t dataPoints = inputs.columnsCount();
+
+		if (microBatchSize == 0 || microBatchSize >= dataPoints)
+		{
+			float loss = accumulate(inputs, expectedOutputs);
+			step(learningRate);
+
+			return loss;
+		}
+
+		float sumLoss = 0.0f;
+
+		for (size_t begin = 0; begin < dataPoints; begin += microBatchSize)
+		{
+			size_t end = std::min(begin + microBatchSize, dataPoints);
+
+			sumLoss += accumulate(getColumns(inputs, begin, end), getColumns(expectedOutputs, begin, end)) * (end - begin);
+		}
+
+		step(learningRate);
+
+		return sumLoss / dataPoints;
+	}
+}
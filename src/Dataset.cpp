@@ -0,0 +1,248 @@
+#include "Dataset.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+namespace BaseML
+{
+	namespace
+	{
+		// Copy the record of a data point to column 'column' of 'inputs' and 'expectedOutputs'
+		void copyRecord(const float* record, size_t inputDimension, size_t outputDimension, Matrix& inputs, Matrix& expectedOutputs, size_t column)
+		{
+			for (size_t i = 0; i < inputDimension; i++)
+				inputs(i, column) = record[i];
+
+			for (size_t i = 0; i < outputDimension; i++)
+				expectedOutputs(i, column) = record[inputDimension + i];
+		}
+
+		void validateHeader(const DatasetFileHeader& header, const char* path)
+		{
+			if (header.magic != DatasetFileHeader::MAGIC || header.version != DatasetFileHeader::VERSION)
+				throw std::runtime_error(std::string("Not a valid dataset file: ") + path);
+		}
+	}
+
+	// InMemoryDataset
+
+	InMemoryDataset::InMemoryDataset(Matrix inputs, Matrix expectedOutputs)
+		:inputs(std::move(inputs)), expectedOutputs(std::move(expectedOutputs))
+	{
+		if (this->inputs.columnsCount() != this->expectedOutputs.columnsCount())
+			throw std::invalid_argument("The inputs and the expected outputs have a different number of data points");
+	}
+
+	InMemoryDataset::InMemoryDataset(const std::vector<std::pair<Matrix, Matrix>>& data)
+	{
+		if (data.empty())
+			return;
+
+		inputs = Matrix(data[0].first.size(), data.size());
+		expectedOutputs = Matrix(data[0].second.size(), data.size());
+
+		for (size_t j = 0; j < data.size(); j++)
+		{
+			for (size_t i = 0; i < inputs.rowsCount(); i++)
+				inputs(i, j) = data[j].first(i);
+
+			for (size_t i = 0; i < expectedOutputs.rowsCount(); i++)
+				expectedOutputs(i, j) = data[j].second(i);
+		}
+	}
+
+	size_t InMemoryDataset::size() const
+	{
+		return inputs.columnsCount();
+	}
+
+	size_t InMemoryDataset::getInputDimension() const
+	{
+		return inputs.rowsCount();
+	}
+
+	size_t InMemoryDataset::getOutputDimension() const
+	{
+		return expectedOutputs.rowsCount();
+	}
+
+	void InMemoryDataset::readBatch(const size_t* indices, size_t count, Matrix& inputs, Matrix& expectedOutputs)
+	{
+		for (size_t i = 0; i < this->inputs.rowsCount(); i++)
+		{
+			for (size_t j = 0; j < count; j++)
+				inputs(i, j) = this->inputs(i, indices[j]);
+		}
+
+		for (size_t i = 0; i < this->expectedOutputs.rowsCount(); i++)
+		{
+			for (size_t j = 0; j < count; j++)
+				expectedOutputs(i, j) = this->expectedOutputs(i, indices[j]);
+		}
+	}
+
+	// DatasetFileWriter
+
+	DatasetFileWriter::DatasetFileWriter(const char* path, size_t inputDimension, size_t outputDimension)
+		:file(path, std::ios::binary | std::ios::out | std::ios::trunc), header{ DatasetFileHeader::MAGIC, DatasetFileHeader::VERSION,
+		inputDimension, outputDimension, 0, DatasetFileHeader::DATA_OFFSET }, record(inputDimension + outputDimension)
+	{
+		if (!file)
+			throw std::runtime_error(std::string("Failed to create dataset file ") + path);
+
+		// The header is rewritten with the final count when the file is closed
+		writeHeader();
+	}
+
+	DatasetFileWriter::~DatasetFileWriter()
+	{
+		if (file.is_open())
+			close();
+	}
+
+	void DatasetFileWriter::writeHeader()
+	{
+		char padding[DatasetFileHeader::DATA_OFFSET] = {};
+
+		file.seekp(0);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(padding, DatasetFileHeader::DATA_OFFSET - sizeof(header));
+	}
+
+	void DatasetFileWriter::append(const Matrix& inputs, const Matrix& expectedOutputs)
+	{
+		if (inputs.rowsCount() != header.inputDimension || expectedOutputs.rowsCount() != header.outputDimension ||
+			inputs.columnsCount() != expectedOutputs.columnsCount())
+			throw std::invalid_argument("The data points don't match the dimensions of the dataset");
+
+		for (size_t j = 0; j < inputs.columnsCount(); j++)
+		{
+			for (size_t i = 0; i < header.inputDimension; i++)
+				record[i] = inputs(i, j);
+
+			for (size_t i = 0; i < header.outputDimension; i++)
+				record[header.inputDimension + i] = expectedOutputs(i, j);
+
+			file.write(reinterpret_cast<const char*>(record.data()), record.size() * sizeof(float));
+		}
+
+		header.count += inputs.columnsCount();
+	}
+
+	size_t DatasetFileWriter::size() const
+	{
+		return header.count;
+	}
+
+	void DatasetFileWriter::close()
+	{
+		writeHeader();
+		file.close();
+	}
+
+	// MemoryMappedDataset
+
+	MemoryMappedDataset::MemoryMappedDataset(const char* path)
+		:file(path)
+	{
+		if (file.size() < sizeof(header))
+			throw std::runtime_error(std::string("Not a valid dataset file: ") + path);
+
+		std::copy(file.getData(), file.getData() + sizeof(header), reinterpret_cast<char*>(&header));
+		validateHeader(header, path);
+
+		if (file.size() < header.dataOffset + header.count * (header.inputDimension + header.outputDimension) * sizeof(float))
+			throw std::runtime_error(std::string("Dataset file is truncated: ") + path);
+
+		records = reinterpret_cast<const float*>(file.getData() + header.dataOffset);
+	}
+
+	size_t MemoryMappedDataset::size() const
+	{
+		return header.count;
+	}
+
+	size_t MemoryMappedDataset::getInputDimension() const
+	{
+		return header.inputDimension;
+	}
+
+	size_t MemoryMappedDataset::getOutputDimension() const
+	{
+		return header.outputDimension;
+	}
+
+	void MemoryMappedDataset::readBatch(const size_t* indices, size_t count, Matrix& inputs, Matrix& expectedOutputs)
+	{
+		const size_t recordSize = header.inputDimension + header.outputDimension;
+
+		for (size_t j = 0; j < count; j++)
+			copyRecord(records + indices[j] * recordSize, header.inputDimension, header.outputDimension, inputs, expectedOutputs, j);
+	}
+
+	// ChunkedFileDataset
+
+	ChunkedFileDataset::ChunkedFileDataset(const char* path, size_t chunkSize)
+		:file(path, std::ios::binary | std::ios::in), chunkSize(std::max<size_t>(chunkSize, 1)), loadedChunk(SIZE_MAX)
+	{
+		if (!file || !file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+			throw std::runtime_error(std::string("Failed to read dataset file ") + path);
+
+		validateHeader(header, path);
+	}
+
+	size_t ChunkedFileDataset::size() const
+	{
+		return header.count;
+	}
+
+	size_t ChunkedFileDataset::getInputDimension() const
+	{
+		return header.inputDimension;
+	}
+
+	size_t ChunkedFileDataset::getOutputDimension() const
+	{
+		return header.outputDimension;
+	}
+
+	size_t ChunkedFileDataset::getChunkSize() const
+	{
+		return chunkSize;
+	}
+
+	const float* ChunkedFileDataset::getRecord(size_t index)
+	{
+		const size_t recordSize = header.inputDimension + header.outputDimension;
+		const size_t chunkIndex = index / chunkSize;
+
+		if (chunkIndex != loadedChunk)
+		{
+			size_t first = chunkIndex * chunkSize;
+			size_t count = std::min(chunkSize, header.count - first);
+
+			chunk.resize(count * recordSize);
+
+			file.seekg(header.dataOffset + first * recordSize * sizeof(float));
+
+			if (!file.read(reinterpret_cast<char*>(chunk.data()), chunk.size() * sizeof(float)))
+			{
+				file.clear();
+				loadedChunk = SIZE_MAX;
+
+				throw std::runtime_error("Failed to read a chunk of the dataset file");
+			}
+
+			loadedChunk = chunkIndex;
+		}
+
+		return chunk.data() + (index - loadedChunk * chunkSize) * recordSize;
+	}
+
+	void ChunkedFileDataset::readBatch(const size_t* indices, size_t count, Matrix& inputs, Matrix& expectedOutputs)
+	{
+		for (size_t j = 0; j < count; j++)
+			copyRecord(getRecord(indices[j]), header.inputDimension, header.outputDimension, inputs, expectedOutputs, j);
+	}
+}
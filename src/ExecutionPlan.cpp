@@ -0,0 +1,460 @@
+#include "ExecutionPlan.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "Profiler.h"
+
+namespace BaseML
+{
+	// Slices start on cache line boundaries
+	static constexpr size_t SLICE_ALIGNMENT = 64 / sizeof(float);
+
+	// Kernels with less work than this run on the calling thread (the same threshold as Layer::calculateOutputs())
+	static constexpr size_t PARALLEL_WORK_THRESHOLD = 32768;
+
+	ExecutionPlan::ExecutionPlan(NeuralNetwork& network, size_t maxBatchSize, Mode mode)
+		:network(network), mode(mode), maxBatchSize(maxBatchSize), outputValue(0), currentBatch(0)
+	{
+		const std::vector<NetworkLayer>& networkLayers = network.getLayers();
+		const size_t layerCount = networkLayers.size();
+
+		if (layerCount == 0)
+			throw std::invalid_argument("Cannot compile a network without layers");
+
+		// The fused kernels are written for dense layers
+		std::vector<const Layer*> layers(layerCount);
+
+		for (size_t i = 0; i < layerCount; i++)
+		{
+			layers[i] = std::get_if<Layer>(&networkLayers[i]);
+
+			if (layers[i] == nullptr)
+				throw std::invalid_argument("Execution plans can only be compiled from networks of dense layers");
+		}
+
+		if (maxBatchSize == 0)
+			throw std::invalid_argument("The maximum batch size should be positive");
+
+		// Forward pass: one fused kernel per layer
+		std::vector<size_t> activations(layerCount);
+		size_t input = INPUT_VALUE;
+
+		for (size_t i = 0; i < layerCount; i++)
+		{
+			size_t step = steps.size();
+
+			activations[i] = addValue(layers[i]->getOutputCount(), step);
+			useValue(input, step);
+
+			steps.push_back({ StepType::Dense, i, input, activations[i], activations[i], 0 });
+
+			input = activations[i];
+		}
+
+		outputValue = activations[layerCount - 1];
+
+		if (mode == Mode::Training)
+		{
+			std::vector<size_t> parameterOffsets(layerCount);
+			size_t parameterCount = 0;
+
+			for (size_t i = 0; i < layerCount; i++)
+			{
+				parameterOffsets[i] = parameterCount;
+				parameterCount += layers[i]->getParameterCount();
+			}
+
+			parameterGradients.resize(parameterCount);
+
+			// Backward pass: the gradients of a layer are used for the gradients of its parameters and for the
+			// gradients of the layer before it, and then die
+			size_t gradients = addValue(layers[layerCount - 1]->getOutputCount(), steps.size());
+			useValue(outputValue, steps.size());
+
+			steps.push_back({ StepType::OutputGradients, layerCount - 1, TARGET_VALUE, gradients, outputValue, 0 });
+
+			for (size_t i = layerCount; i-- > 0;)
+			{
+				size_t layerInput = i > 0 ? activations[i - 1] : INPUT_VALUE;
+
+				useValue(gradients, steps.size());
+				useValue(layerInput, steps.size());
+
+				steps.push_back({ StepType::ParameterGradients, i, layerInput, gradients, activations[i], parameterOffsets[i] });
+
+				if (i > 0)
+				{
+					size_t previousGradients = addValue(layers[i - 1]->getOutputCount(), steps.size());
+
+					useValue(gradients, steps.size());
+					useValue(activations[i - 1], steps.size());
+
+					steps.push_back({ StepType::HiddenGradients, i, gradients, previousGradients, activations[i - 1], 0 });
+
+					gradients = previousGradients;
+				}
+			}
+		}
+
+		// The output stays valid after the plan runs
+		values[outputValue].lastStep = std::max(values[outputValue].lastStep, steps.size());
+
+		allocateSlices();
+	}
+
+	size_t ExecutionPlan::addValue(size_t rows, size_t firstStep)
+	{
+		values.push_back({ rows, 0, firstStep, firstStep });
+
+		return values.size() - 1;
+	}
+
+	void ExecutionPlan::useValue(size_t value, size_t step)
+	{
+		if (value == INPUT_VALUE || value == TARGET_VALUE)
+			return;
+
+		values[value].lastStep = std::max(values[value].lastStep, step);
+	}
+
+	void ExecutionPlan::allocateSlices()
+	{
+		std::vector<size_t> capacities; // In floats
+		std::vector<size_t> busyUntil; // Last step in which the value in the slice is read
+
+		// The values were added in the order in which they are written
+		for (Value& value : values)
+		{
+			size_t needed = value.rows * maxBatchSize;
+			size_t best = capacities.size();
+
+			for (size_t s = 0; s < capacities.size(); s++)
+			{
+				// A slice read in the step that writes the value can't hold it
+				if (busyUntil[s] >= value.firstStep)
+					continue;
+
+				if (best == capacities.size())
+				{
+					best = s;
+					continue;
+				}
+
+				bool fits = capacities[s] >= needed, bestFits = capacities[best] >= needed;
+
+				// The smallest slice that fits, or the largest one if none fits
+				if ((fits && (!bestFits || capacities[s] < capacities[best])) || (!fits && !bestFits && capacities[s] > capacities[best]))
+					best = s;
+			}
+
+			if (best == capacities.size())
+			{
+				capacities.push_back(0);
+				busyUntil.push_back(0);
+			}
+
+			capacities[best] = std::max(capacities[best], needed);
+			busyUntil[best] = value.lastStep;
+			value.slice = best;
+		}
+
+		size_t arenaSize = 0;
+
+		for (size_t capacity : capacities)
+		{
+			sliceOffsets.push_back(arenaSize);
+			arenaSize += (capacity + SLICE_ALIGNMENT - 1) / SLICE_ALIGNMENT * SLICE_ALIGNMENT;
+		}
+
+		arena.resize(arenaSize);
+	}
+
+	const float* ExecutionPlan::getData(size_t value, const Matrix& inputs, const Matrix& expectedOutputs) const
+	{
+		if (value == INPUT_VALUE)
+			return &inputs(0);
+
+		if (value == TARGET_VALUE)
+			return &expectedOutputs(0);
+
+		return arena.data() + sliceOffsets[values[value].slice];
+	}
+
+	float* ExecutionPlan::getData(size_t value)
+	{
+		return arena.data() + sliceOffsets[values[value].slice];
+	}
+
+	void ExecutionPlan::runSteps(size_t first, size_t end, const Matrix& inputs, const Matrix& expectedOutputs, float& loss)
+	{
+		for (size_t s = first; s < end; s++)
+		{
+			const Step& step = steps[s];
+
+			switch (step.type)
+			{
+			case StepType::Dense:
+				runDense(step, inputs);
+				break;
+			case StepType::OutputGradients:
+				loss = runOutputGradients(step, expectedOutputs);
+				break;
+			case StepType::HiddenGradients:
+				runHiddenGradients(step);
+				break;
+			case StepType::ParameterGradients:
+				runParameterGradients(step, inputs);
+				break;
+			}
+		}
+	}
+
+	const Layer& ExecutionPlan::getLayer(size_t index) const
+	{
+		return std::get<Layer>(network.getLayers()[index]);
+	}
+
+	void ExecutionPlan::runDense(const Step& step, const Matrix& inputs)
+	{
+		const Layer& layer = getLayer(step.layer);
+
+		// The layer's kernel writes to a view of the output's slice, which has the right size so it isn't reallocated.
+		// The intermediate values are row-major, the caller's input may have either layout.
+		Matrix::Layout inputLayout = step.input == INPUT_VALUE ? inputs.getLayout() : Matrix::Layout::RowMajor;
+		Matrix inputView = Matrix::view(const_cast<float*>(getData(step.input, inputs, inputs)), layer.getInputCount(), currentBatch, inputLayout);
+		Matrix outputView = Matrix::view(getData(step.output), layer.getOutputCount(), currentBatch);
+
+		layer.calculateOutputs(inputView, outputView);
+	}
+
+	float ExecutionPlan::runOutputGradients(const Step& step, const Matrix& expectedOutputs)
+	{
+		const Layer& layer = getLayer(step.layer);
+		const long long count = (long long)(layer.getOutputCount() * currentBatch);
+
+		const float* outputs = getData(step.activations);
+		const float* expected = &expectedOutputs(0);
+		float* gradients = getData(step.output);
+
+		const bool rowMajorExpected = expectedOutputs.getLayout() == Matrix::Layout::RowMajor;
+		const size_t batch = currentBatch;
+
+		float sumLoss = 0.0f;
+
+		// The loss and its derivative through the activation function in one pass
+		#pragma omp parallel for reduction(+:sumLoss) if (count >= (long long)PARALLEL_WORK_THRESHOLD)
+		for (long long i = 0; i < count; i++)
+		{
+			const float target = rowMajorExpected ? expected[i] : expectedOutputs(i / batch, i % batch);
+
+			sumLoss += (*network.lossFunc)(outputs[i], target);
+			gradients[i] = (*network.lossFuncDerivative)(outputs[i], target) * (*layer.activationFuncDerivative)(outputs[i]);
+		}
+
+		return sumLoss / currentBatch;
+	}
+
+	void ExecutionPlan::runHiddenGradients(const Step& step)
+	{
+		const Layer& nextLayer = getLayer(step.layer);
+		const Layer& layer = getLayer(step.layer - 1);
+
+		const Matrix& weights = nextLayer.getWeights();
+		const size_t nextCount = nextLayer.getOutputCount(), count = layer.getOutputCount(), batch = currentBatch;
+
+		const float* nextGradients = getData(step.input);
+		const float* outputs = getData(step.activations);
+		float* gradients = getData(step.output);
+
+		// The transposed weights of the next layer times its gradients, accumulated row by row so the inner loop
+		// is contiguous, and then the derivative of the activation function, while the row is in the cache
+		#pragma omp parallel for if (nextCount * count * batch >= PARALLEL_WORK_THRESHOLD)
+		for (long long k = 0; k < (long long)count; k++)
+		{
+			float* row = gradients + k * batch;
+			const float* outputsRow = outputs + k * batch;
+
+			std::fill(row, row + batch, 0.0f);
+
+			for (size_t i = 0; i < nextCount; i++)
+			{
+				const float weight = weights(i, k);
+				const float* nextRow = nextGradients + i * batch;
+
+				#pragma omp simd
+				for (size_t j = 0; j < batch; j++)
+				{
+					row[j] += weight * nextRow[j];
+				}
+			}
+
+			for (size_t j = 0; j < batch; j++)
+			{
+				row[j] *= (*layer.activationFuncDerivative)(outputsRow[j]);
+			}
+		}
+	}
+
+	void ExecutionPlan::runParameterGradients(const Step& step, const Matrix& inputs)
+	{
+		const Layer& layer = getLayer(step.layer);
+		const size_t inputCount = layer.getInputCount(), outputCount = layer.getOutputCount(), batch = currentBatch;
+		const float scale = 1.0f / batch;
+
+		const float* gradients = getData(step.output);
+		const float* layerInputs = getData(step.input, inputs, inputs);
+
+		float* weightsGradients = parameterGradients.data() + step.parameterOffset;
+		float* biasesGradients = weightsGradients + outputCount * inputCount;
+
+		// Column-major inputs of the network: every data point adds its gradients times its (contiguous) inputs 
+		// to the rows of the weights' gradients
+		if (step.input == INPUT_VALUE && inputs.getLayout() == Matrix::Layout::ColumnMajor)
+		{
+			#pragma omp parallel for if (outputCount * inputCount * batch >= PARALLEL_WORK_THRESHOLD)
+			for (long long i = 0; i < (long long)outputCount; i++)
+			{
+				const float* gradientsRow = gradients + i * batch;
+				float* weightsRow = weightsGradients + i * inputCount;
+				float biasSum = 0.0f;
+
+				std::fill(weightsRow, weightsRow + inputCount, 0.0f);
+
+				for (size_t j = 0; j < batch; j++)
+				{
+					const float gradient = gradientsRow[j] * scale;
+					const float* inputsColumn = layerInputs + j * inputCount;
+
+					#pragma omp simd
+					for (size_t k = 0; k < inputCount; k++)
+					{
+						weightsRow[k] += gradient * inputsColumn[k];
+					}
+
+					biasSum += gradientsRow[j];
+				}
+
+				biasesGradients[i] = biasSum * scale;
+			}
+
+			return;
+		}
+
+		// Every gradient of a weight is the dot product of a row of the gradients and a row of the inputs, and the
+		// gradient of the bias is the sum of the row of the gradients. Written averaged over the batch.
+		#pragma omp parallel for if (outputCount * inputCount * batch >= PARALLEL_WORK_THRESHOLD)
+		for (long long i = 0; i < (long long)outputCount; i++)
+		{
+			const float* gradientsRow = gradients + i * batch;
+
+			for (size_t k = 0; k < inputCount; k++)
+			{
+				const float* inputsRow = layerInputs + k * batch;
+				float sum = 0.0f;
+
+				#pragma omp simd reduction(+:sum)
+				for (size_t j = 0; j < batch; j++)
+				{
+					sum += gradientsRow[j] * inputsRow[j];
+				}
+
+				weightsGradients[i * inputCount + k] = sum * scale;
+			}
+
+			float biasSum = 0.0f;
+
+			#pragma omp simd reduction(+:biasSum)
+			for (size_t j = 0; j < batch; j++)
+			{
+				biasSum += gradientsRow[j];
+			}
+
+			biasesGradients[i] = biasSum * scale;
+		}
+	}
+
+	Matrix ExecutionPlan::infer(const Matrix& inputs)
+	{
+		BASEML_PROFILE_SCOPE("ExecutionPlan::infer");
+
+		if (inputs.rowsCount() != network.getInputCount() || inputs.columnsCount() > maxBatchSize || inputs.columnsCount() == 0)
+			throw std::invalid_argument("The inputs don't fit the execution plan");
+
+		currentBatch = inputs.columnsCount();
+
+		// The forward pass is the first step of every layer
+		float loss = 0.0f;
+		runSteps(0, network.getLayers().size(), inputs, inputs, loss);
+
+		return Matrix::view(getData(outputValue), network.getOutputCount(), currentBatch);
+	}
+
+	float ExecutionPlan::learn(const Matrix& inputs, const Matrix& expectedOutputs, float learningRate)
+	{
+		BASEML_PROFILE_SCOPE("ExecutionPlan::learn");
+
+		if (mode != Mode::Training)
+			throw std::logic_error("The execution plan wasn't compiled for training");
+
+		if (inputs.rowsCount() != network.getInputCount() || inputs.columnsCount() > maxBatchSize || inputs.columnsCount() == 0 ||
+			expectedOutputs.rowsCount() != network.getOutputCount() || expectedOutputs.columnsCount() != inputs.columnsCount())
+			throw std::invalid_argument("The data doesn't fit the execution plan");
+
+		currentBatch = inputs.columnsCount();
+
+		float loss = 0.0f;
+		runSteps(0, steps.size(), inputs, expectedOutputs, loss);
+
+		network.applyParameterGradients(parameterGradients.data(), learningRate);
+
+		return loss;
+	}
+
+	size_t ExecutionPlan::getArenaSize() const
+	{
+		return arena.size() * sizeof(float);
+	}
+
+	size_t ExecutionPlan::getStepCount() const
+	{
+		return steps.size();
+	}
+
+	std::string ExecutionPlan::describe() const
+	{
+		static const char* STEP_NAMES[] = { "Dense", "OutputGradients", "HiddenGradients", "ParameterGradients" };
+
+		auto valueName = [this](size_t value)
+			{
+				if (value == INPUT_VALUE)
+					return std::string("input");
+
+				if (value == TARGET_VALUE)
+					return std::string("target");
+
+				return "v" + std::to_string(value) + "[slice " + std::to_string(values[value].slice) + "]";
+			};
+
+		std::ostringstream out;
+
+		for (size_t s = 0; s < steps.size(); s++)
+		{
+			const Step& step = steps[s];
+
+			out << s << ": " << STEP_NAMES[(int)step.type] << " layer " << step.layer << " " << valueName(step.input);
+
+			if (step.type == StepType::ParameterGradients)
+				out << ", " << valueName(step.output) << " -> parameters +" << step.parameterOffset;
+			else
+				out << " -> " << valueName(step.output);
+
+			out << "\n";
+		}
+
+		out << "Arena: " << sliceOffsets.size() << " slices, " << getArenaSize() << " bytes for batches of " << maxBatchSize << "\n";
+
+		return out.str();
+	}
+}
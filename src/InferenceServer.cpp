@@ -0,0 +1,195 @@
+#include "InferenceServer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <omp.h>
+
+#include "Profiler.h"
+
+namespace BaseML
+{
+	InferenceServer::InferenceServer(const RL::Policy& policy, size_t maxBatchSize, std::chrono::microseconds maxLatency, size_t numWorkers)
+		:policy(policy), maxBatchSize(std::max<size_t>(maxBatchSize, 1)), maxLatency(maxLatency), nextWorker(0), stopping(false), 
+		processedRequests(0), processedBatches(0), submittedRequests(0), completedRequests(0)
+	{
+		size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+
+		if (numWorkers == 0)
+			numWorkers = hardwareThreads;
+
+		threadsPerWorker = (int)std::max<size_t>(hardwareThreads / numWorkers, 1);
+
+		for (size_t i = 0; i < numWorkers; i++)
+		{
+			workers.push_back(std::make_unique<Worker>());
+			workers.back()->batch.reserve(this->maxBatchSize);
+		}
+
+		for (std::unique_ptr<Worker>& worker : workers)
+			worker->thread = std::thread(&InferenceServer::workerMain, this, std::ref(*worker));
+	}
+
+	InferenceServer::~InferenceServer()
+	{
+		stopping.store(true);
+
+		for (std::unique_ptr<Worker>& worker : workers)
+		{
+			worker->signal.fetch_add(1, std::memory_order_release);
+			worker->signal.notify_one();
+		}
+
+		for (std::unique_ptr<Worker>& worker : workers)
+			worker->thread.join();
+
+		// Fail requests that were submitted while the server was stopping. A request whose push is still in
+		// progress can't be popped yet, so the queues are drained until every submitted request is completed.
+		while (completedRequests.load() < submittedRequests.load())
+		{
+			for (std::unique_ptr<Worker>& worker : workers)
+			{
+				while (Utils::MPSCNode* node = worker->queue.pop())
+				{
+					Request* request = static_cast<Request*>(node);
+
+					request->result.set_exception(std::make_exception_ptr(std::runtime_error("The inference server was stopped")));
+					delete request;
+
+					completedRequests.fetch_add(1);
+				}
+			}
+
+			std::this_thread::yield();
+		}
+	}
+
+	std::future<Matrix> InferenceServer::submit(const Matrix& input)
+	{
+		if (input.rowsCount() != policy.getInputCount() || input.columnsCount() != 1)
+			throw std::invalid_argument("The input doesn't match the policy's input size");
+
+		std::unique_ptr<Request> request = std::make_unique<Request>();
+
+		request->input = input;
+		request->submitTime = Clock::now();
+
+		std::future<Matrix> result = request->result.get_future();
+
+		// Counted before checking that the server runs, so the destructor either waits for the request or this
+		// function sees that the server stops
+		submittedRequests.fetch_add(1);
+
+		if (stopping.load())
+		{
+			submittedRequests.fetch_sub(1);
+			throw std::runtime_error("The inference server was stopped");
+		}
+
+		Worker& worker = *workers[nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size()];
+
+		worker.queue.push(request.release());
+
+		worker.signal.fetch_add(1, std::memory_order_release);
+		worker.signal.notify_one();
+
+		return result;
+	}
+
+	Matrix InferenceServer::infer(const Matrix& input)
+	{
+		return submit(input).get();
+	}
+
+	float InferenceServer::getAverageBatchSize() const
+	{
+		size_t batches = processedBatches.load();
+
+		return batches == 0 ? 0.0f : (float)processedRequests.load() / batches;
+	}
+
+	void InferenceServer::workerMain(Worker& worker)
+	{
+		BASEML_PROFILE_THREAD_NAME("inference worker");
+
+		// Applies to the parallel regions started by this thread
+		omp_set_num_threads(threadsPerWorker);
+
+		while (true)
+		{
+			uint32_t signal = worker.signal.load(std::memory_order_acquire);
+			Utils::MPSCNode* first = worker.queue.pop();
+
+			if (!first)
+			{
+				// The queue is drained before the worker stops
+				if (stopping.load(std::memory_order_acquire) && signal == worker.signal.load(std::memory_order_acquire))
+					return;
+
+				// Sleep until a request is submitted (returns immediately if one was submitted since 'signal' was read)
+				worker.signal.wait(signal, std::memory_order_acquire);
+				continue;
+			}
+
+			worker.batch.push_back(static_cast<Request*>(first));
+
+			// Collect requests until the batch is full or the first request's deadline passes
+			Clock::time_point deadline = worker.batch.front()->submitTime + maxLatency;
+
+			while (worker.batch.size() < maxBatchSize)
+			{
+				if (Utils::MPSCNode* node = worker.queue.pop())
+				{
+					worker.batch.push_back(static_cast<Request*>(node));
+					continue;
+				}
+
+				if (Clock::now() >= deadline || stopping.load(std::memory_order_relaxed))
+					break;
+
+				std::this_thread::yield();
+			}
+
+			processBatch(worker);
+		}
+	}
+
+	void InferenceServer::processBatch(Worker& worker)
+	{
+		BASEML_PROFILE_SCOPE("InferenceServer::processBatch");
+
+		const size_t batchSize = worker.batch.size();
+
+		// Gather the inputs to the columns of one matrix
+		if (worker.batchInputs.rowsCount() != policy.getInputCount() || worker.batchInputs.columnsCount() != batchSize)
+			worker.batchInputs = Matrix(policy.getInputCount(), batchSize);
+
+		for (size_t j = 0; j < batchSize; j++)
+		{
+			const Matrix& input = worker.batch[j]->input;
+
+			for (size_t i = 0; i < input.size(); i++)
+				worker.batchInputs(i, j) = input(i);
+		}
+
+		// Normalizes the observations of the whole batch before the networks see them
+		const Matrix& outputs = policy.infer(worker.batchInputs, worker.workspace);
+
+		for (size_t j = 0; j < batchSize; j++)
+		{
+			Matrix output(outputs.rowsCount(), 1);
+
+			for (size_t i = 0; i < outputs.rowsCount(); i++)
+				output(i) = outputs(i, j);
+
+			worker.batch[j]->result.set_value(std::move(output));
+			delete worker.batch[j];
+		}
+
+		processedRequests.fetch_add(batchSize, std::memory_order_relaxed);
+		processedBatches.fetch_add(1, std::memory_order_relaxed);
+		completedRequests.fetch_add(batchSize);
+
+		worker.batch.clear();
+	}
+}
@@ -0,0 +1,59 @@
+#include "MPSCQueue.h"
+
+namespace BaseML::Utils
+{
+	MPSCQueue::MPSCQueue()
+		:head(&stub), tail(&stub)
+	{
+	}
+
+	void MPSCQueue::push(MPSCNode* node)
+	{
+		node->next.store(nullptr, std::memory_order_relaxed);
+
+		// The node becomes the head first and is linked to the previous head after. Between the two steps 
+		// the consumer can't pass the previous node.
+		MPSCNode* previous = head.exchange(node, std::memory_order_acq_rel);
+		previous->next.store(node, std::memory_order_release);
+	}
+
+	MPSCNode* MPSCQueue::pop()
+	{
+		MPSCNode* node = tail;
+		MPSCNode* next = node->next.load(std::memory_order_acquire);
+
+		// Skip the stub
+		if (node == &stub)
+		{
+			if (!next)
+				return nullptr;
+
+			tail = next;
+			node = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+
+		if (next)
+		{
+			tail = next;
+			return node;
+		}
+
+		// 'node' is the last linked node. If it isn't the head, a push is in progress.
+		if (node != head.load(std::memory_order_acquire))
+			return nullptr;
+
+		// Push the stub behind the last node so the last node can be removed
+		push(&stub);
+
+		next = node->next.load(std::memory_order_acquire);
+
+		if (next)
+		{
+			tail = next;
+			return node;
+		}
+
+		return nullptr;
+	}
+}
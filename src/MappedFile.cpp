@@ -0,0 +1,168 @@
+#include "MappedFile.h"
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif // _WIN32
+
+namespace BaseML::Utils
+{
+	MappedFile::MappedFile()
+		:data(nullptr), fileSize(0)
+	{
+#ifdef _WIN32
+		fileHandle = nullptr;
+		mappingHandle = nullptr;
+#endif // _WIN32
+	}
+
+	MappedFile::MappedFile(const char* path, bool copyOnWrite)
+		:MappedFile()
+	{
+#ifdef _WIN32
+		fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+		if (fileHandle == INVALID_HANDLE_VALUE)
+		{
+			fileHandle = nullptr;
+			throw std::runtime_error(std::string("Failed to open file ") + path);
+		}
+
+		LARGE_INTEGER size;
+		GetFileSizeEx(fileHandle, &size);
+		fileSize = (size_t)size.QuadPart;
+
+		// Empty files can't be mapped
+		if (fileSize == 0)
+			return;
+
+		mappingHandle = CreateFileMappingA(fileHandle, nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+
+		if (mappingHandle)
+			data = static_cast<const char*>(MapViewOfFile(mappingHandle, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+
+		if (!data)
+		{
+			unmap();
+			throw std::runtime_error(std::string("Failed to map file ") + path);
+		}
+#else
+		int fd = open(path, O_RDONLY);
+
+		if (fd < 0)
+			throw std::runtime_error(std::string("Failed to open file ") + path);
+
+		struct stat info;
+
+		if (fstat(fd, &info) != 0)
+		{
+			::close(fd);
+			throw std::runtime_error(std::string("Failed to read the size of file ") + path);
+		}
+
+		fileSize = (size_t)info.st_size;
+
+		// Empty files can't be mapped
+		if (fileSize > 0)
+		{
+			void* mapping = copyOnWrite ? mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) :
+				mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+
+			if (mapping == MAP_FAILED)
+			{
+				::close(fd);
+				throw std::runtime_error(std::string("Failed to map file ") + path);
+			}
+
+			data = static_cast<const char*>(mapping);
+		}
+
+		// The mapping stays valid after the file is closed
+		::close(fd);
+#endif // _WIN32
+	}
+
+	MappedFile::~MappedFile()
+	{
+		unmap();
+	}
+
+	MappedFile::MappedFile(MappedFile&& other) noexcept
+		:MappedFile()
+	{
+		*this = std::move(other);
+	}
+
+	MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+	{
+		if (this != &other)
+		{
+			unmap();
+
+			std::swap(data, other.data);
+			std::swap(fileSize, other.fileSize);
+
+#ifdef _WIN32
+			std::swap(fileHandle, other.fileHandle);
+			std::swap(mappingHandle, other.mappingHandle);
+#endif // _WIN32
+		}
+
+		return *this;
+	}
+
+	void MappedFile::unmap()
+	{
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+
+		if (mappingHandle)
+			CloseHandle(mappingHandle);
+
+		if (fileHandle)
+			CloseHandle(fileHandle);
+
+		fileHandle = nullptr;
+		mappingHandle = nullptr;
+#else
+		if (data)
+			munmap(const_cast<char*>(data), fileSize);
+#endif // _WIN32
+
+		data = nullptr;
+		fileSize = 0;
+	}
+
+	const char* MappedFile::getData() const
+	{
+		return data;
+	}
+
+	char* MappedFile::getWritableData() const
+	{
+		return const_cast<char*>(data);
+	}
+
+	size_t MappedFile::size() const
+	{
+		return fileSize;
+	}
+
+	void MappedFile::adviseSequential() const
+	{
+#ifndef _WIN32
+		if (data)
+			madvise(const_cast<char*>(data), fileSize, MADV_SEQUENTIAL);
+#endif // _WIN32
+	}
+}
@@ -0,0 +1,158 @@
+#include "MatrixArena.h"
+
+#include <algorithm>
+#include <new>
+
+#include "Profiler.h"
+
+namespace BaseML
+{
+	// Blocks and allocations start on cache line boundaries
+	static constexpr size_t CACHE_LINE = 64;
+	static constexpr size_t ALIGNMENT = CACHE_LINE / sizeof(float);
+
+	thread_local MatrixArena* MatrixArena::active = nullptr;
+
+	MatrixArena::Scope::Scope(MatrixArena& arena)
+		:arena(arena), previous(MatrixArena::active)
+	{
+		MatrixArena::active = &arena;
+	}
+
+	MatrixArena::Scope::~Scope()
+	{
+		MatrixArena::active = previous;
+		arena.reset();
+	}
+
+	MatrixArena::HeapScope::HeapScope()
+		:previous(MatrixArena::active)
+	{
+		MatrixArena::active = nullptr;
+	}
+
+	MatrixArena::HeapScope::~HeapScope()
+	{
+		MatrixArena::active = previous;
+	}
+
+	MatrixArena::MatrixArena(size_t initialSize)
+		:nextCapacity(std::max(initialSize / sizeof(float), ALIGNMENT)), escapedBlocks(0)
+	{
+	}
+
+	MatrixArena::~MatrixArena()
+	{
+		for (ArenaBlock* block : blocks)
+			release(block);
+	}
+
+	MatrixArena* MatrixArena::getActive()
+	{
+		return active;
+	}
+
+	void MatrixArena::addBlock(size_t count)
+	{
+		size_t capacity = std::max(count, nextCapacity);
+
+		BASEML_PROFILE_ALLOCATION(capacity * sizeof(float));
+
+		ArenaBlock* block = new ArenaBlock;
+
+		block->references.store(1, std::memory_order_relaxed); // The arena's reference
+		block->capacity = capacity;
+		block->used = 0;
+		block->data = static_cast<float*>(::operator new(capacity * sizeof(float), std::align_val_t(CACHE_LINE)));
+
+		blocks.push_back(block);
+
+		// Every new block doubles the capacity of the arena
+		nextCapacity = 0;
+
+		for (ArenaBlock* b : blocks)
+			nextCapacity += b->capacity;
+	}
+
+	float* MatrixArena::allocate(size_t count, ArenaBlock*& block)
+	{
+		const size_t alignedCount = (count + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+		if (blocks.empty() || blocks.back()->capacity - blocks.back()->used < alignedCount)
+			addBlock(alignedCount);
+
+		block = blocks.back();
+
+		float* memory = block->data + block->used;
+		block->used += alignedCount;
+
+		block->references.fetch_add(1, std::memory_order_relaxed);
+
+		return memory;
+	}
+
+	void MatrixArena::release(ArenaBlock* block)
+	{
+		// The last reference frees the block (acquire-release so the frees see the writes of every thread that used it)
+		if (block->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			::operator delete(block->data, std::align_val_t(CACHE_LINE));
+			delete block;
+		}
+	}
+
+	void MatrixArena::reset()
+	{
+		// The steady state: one block and no matrix left in it
+		if (blocks.size() == 1 && blocks[0]->references.load(std::memory_order_acquire) == 1)
+		{
+			blocks[0]->used = 0;
+			return;
+		}
+
+		if (blocks.empty())
+			return;
+
+		// Replace the blocks with one block large enough for all of the allocations since the last reset (allocated
+		// on the next allocation). Blocks with live matrices are left to them.
+		size_t totalCapacity = 0;
+
+		for (ArenaBlock* block : blocks)
+		{
+			totalCapacity += block->capacity;
+
+			if (block->references.load(std::memory_order_acquire) > 1)
+				escapedBlocks++;
+
+			release(block);
+		}
+
+		blocks.clear();
+		nextCapacity = totalCapacity;
+	}
+
+	size_t MatrixArena::getCapacity() const
+	{
+		size_t capacity = 0;
+
+		for (const ArenaBlock* block : blocks)
+			capacity += block->capacity;
+
+		return capacity * sizeof(float);
+	}
+
+	size_t MatrixArena::getUsed() const
+	{
+		size_t used = 0;
+
+		for (const ArenaBlock* block : blocks)
+			used += block->used;
+
+		return used * sizeof(float);
+	}
+
+	size_t MatrixArena::getEscapedBlockCount() const
+	{
+		return escapedBlocks;
+	}
+}
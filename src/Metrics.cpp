@@ -0,0 +1,300 @@
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+namespace BaseML::Utils
+{
+	namespace
+	{
+		// Significant digits of the values written to files. Enough for float metrics and for times with a 
+		// microsecond resolution over days of training.
+		constexpr int VALUE_PRECISION = 12;
+
+		void writeJsonString(std::ostream& out, const std::string& text)
+		{
+			out << '"';
+
+			for (char c : text)
+			{
+				if (c == '"' || c == '\\')
+					out << '\\' << c;
+				else if (c == '\n')
+					out << "\\n";
+				else
+					out << c;
+			}
+
+			out << '"';
+		}
+	}
+
+	CsvMetricsSink::CsvMetricsSink(const char* path, bool append)
+		:headerWritten(false)
+	{
+		file.open(path, append ? std::ios::out | std::ios::app : std::ios::out | std::ios::trunc);
+
+		if (!file)
+			throw std::runtime_error("Failed to open the metrics file");
+
+		// Continue the columns of an existing file
+		if (append)
+		{
+			std::ifstream existing(path);
+			std::string header;
+
+			if (std::getline(existing, header) && !header.empty())
+			{
+				std::stringstream stream(header);
+				std::string column;
+
+				// Skip the time, category and step columns
+				for (int i = 0; i < 3; i++)
+					std::getline(stream, column, ',');
+
+				while (std::getline(stream, column, ','))
+					columns.push_back(column);
+
+				headerWritten = true;
+			}
+		}
+
+		file << std::setprecision(VALUE_PRECISION);
+	}
+
+	void CsvMetricsSink::write(const MetricsRecord& record)
+	{
+		if (!headerWritten)
+		{
+			file << "time,category,step";
+
+			for (const auto& [name, value] : record.values)
+			{
+				columns.push_back(name);
+				file << "," << name;
+			}
+
+			file << "\n";
+			headerWritten = true;
+		}
+
+		file << record.time << "," << record.category << "," << record.step;
+
+		for (const std::string& column : columns)
+		{
+			file << ",";
+
+			auto position = std::find_if(record.values.begin(), record.values.end(),
+				[&column](const std::pair<std::string, double>& value) { return value.first == column; });
+
+			if (position != record.values.end())
+				file << position->second;
+		}
+
+		file << "\n";
+	}
+
+	void CsvMetricsSink::flush()
+	{
+		file.flush();
+	}
+
+	JsonLinesMetricsSink::JsonLinesMetricsSink(const char* path, bool append)
+	{
+		file.open(path, append ? std::ios::out | std::ios::app : std::ios::out | std::ios::trunc);
+
+		if (!file)
+			throw std::runtime_error("Failed to open the metrics file");
+
+		file << std::setprecision(VALUE_PRECISION);
+	}
+
+	void JsonLinesMetricsSink::write(const MetricsRecord& record)
+	{
+		file << "{\"time\":" << record.time << ",\"category\":";
+		writeJsonString(file, record.category);
+		file << ",\"step\":" << record.step;
+
+		for (const auto& [name, value] : record.values)
+		{
+			file << ",";
+			writeJsonString(file, name);
+
+			// JSON has no representation of infinities and NaN
+			if (std::isfinite(value))
+				file << ":" << value;
+			else
+				file << ":null";
+		}
+
+		file << "}\n";
+	}
+
+	void JsonLinesMetricsSink::flush()
+	{
+		file.flush();
+	}
+
+	RingBufferMetricsSink::RingBufferMetricsSink(size_t capacity)
+		:capacity(capacity)
+	{
+		if (capacity == 0)
+			throw std::invalid_argument("The capacity of the ring buffer should be positive");
+	}
+
+	void RingBufferMetricsSink::write(const MetricsRecord& record)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (records.size() == capacity)
+			records.pop_front();
+
+		records.push_back(record);
+	}
+
+	std::vector<MetricsRecord> RingBufferMetricsSink::getRecords() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		return std::vector<MetricsRecord>(records.begin(), records.end());
+	}
+
+	double RingBufferMetricsSink::getLatest(const std::string& category, const std::string& name, double defaultValue) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (auto record = records.rbegin(); record != records.rend(); record++)
+		{
+			if (record->category != category)
+				continue;
+
+			for (const auto& [valueName, value] : record->values)
+			{
+				if (valueName == name)
+					return value;
+			}
+		}
+
+		return defaultValue;
+	}
+
+	ConsoleMetricsSink::ConsoleMetricsSink(std::ostream& out)
+		:out(out)
+	{
+	}
+
+	void ConsoleMetricsSink::write(const MetricsRecord& record)
+	{
+		out << record.category << " " << record.step << ":";
+
+		for (const auto& [name, value] : record.values)
+			out << " " << name << "=" << value;
+
+		out << "\n";
+	}
+
+	void ConsoleMetricsSink::flush()
+	{
+		out.flush();
+	}
+
+	MetricsLogger::MetricsLogger()
+		:signal(0), stopping(false), loggedCount(0), writtenCount(0), startTime(Clock::now())
+	{
+		writer = std::thread(&MetricsLogger::writerMain, this);
+	}
+
+	MetricsLogger::~MetricsLogger()
+	{
+		stopping.store(true, std::memory_order_release);
+
+		signal.fetch_add(1, std::memory_order_release);
+		signal.notify_one();
+
+		writer.join();
+	}
+
+	void MetricsLogger::addSink(std::unique_ptr<MetricsSink> sink)
+	{
+		std::lock_guard<std::mutex> lock(sinksMutex);
+
+		sinks.push_back(std::move(sink));
+	}
+
+	void MetricsLogger::log(MetricsRecord record)
+	{
+		record.time = std::chrono::duration<double>(Clock::now() - startTime).count();
+
+		queue.push(new Entry(std::move(record)));
+		loggedCount.fetch_add(1, std::memory_order_relaxed);
+
+		signal.fetch_add(1, std::memory_order_release);
+		signal.notify_one();
+	}
+
+	void MetricsLogger::flush()
+	{
+		uint64_t target = loggedCount.load(std::memory_order_relaxed);
+		uint64_t written = writtenCount.load(std::memory_order_acquire);
+
+		while (written < target)
+		{
+			writtenCount.wait(written, std::memory_order_acquire);
+			written = writtenCount.load(std::memory_order_acquire);
+		}
+	}
+
+	void MetricsLogger::writerMain()
+	{
+		uint64_t written = 0;
+		bool unflushed = false;
+
+		while (true)
+		{
+			uint32_t currentSignal = signal.load(std::memory_order_acquire);
+			MPSCNode* node = queue.pop();
+
+			if (node)
+			{
+				std::unique_ptr<Entry> entry(static_cast<Entry*>(node));
+
+				{
+					std::lock_guard<std::mutex> lock(sinksMutex);
+
+					for (std::unique_ptr<MetricsSink>& sink : sinks)
+						sink->write(entry->record);
+				}
+
+				written++;
+				unflushed = true;
+				continue;
+			}
+
+			// The queue is empty: flush the sinks before reporting the records as written
+			if (unflushed)
+			{
+				{
+					std::lock_guard<std::mutex> lock(sinksMutex);
+
+					for (std::unique_ptr<MetricsSink>& sink : sinks)
+						sink->flush();
+				}
+
+				unflushed = false;
+
+				writtenCount.store(written, std::memory_order_release);
+				writtenCount.notify_all();
+			}
+
+			// The queue is drained before the writer stops
+			if (stopping.load(std::memory_order_acquire) && currentSignal == signal.load(std::memory_order_acquire))
+				return;
+
+			// Sleep until a record is logged (returns immediately if one was logged since 'currentSignal' was read)
+			signal.wait(currentSignal, std::memory_order_acquire);
+		}
+	}
+}
@@ -0,0 +1,347 @@
+#include "NormalizationLayer.h"
+
+#include <vector>
+#include <cmath>
+#include <fstream>
+
+#include "MatrixArena.h"
+#include "Profiler.h"
+
+namespace BaseML
+{
+	namespace
+	{
+		// Distance between consecutive values of a data point (a column) of 'matrix'
+		inline size_t columnStride(const Matrix& matrix)
+		{
+			return matrix.getLayout() == Matrix::Layout::RowMajor ? matrix.columnsCount() : 1;
+		}
+	}
+
+	NormalizationLayer::NormalizationLayer()
+		:count(0), batchSize(1), epsilon(1.0e-5f)
+	{
+	}
+
+	NormalizationLayer::NormalizationLayer(size_t size, float varianceEpsilon)
+		:count(size), batchSize(1), epsilon(varianceEpsilon), gains(size, 1), biases(size, 1),
+		mGains(size, 1), vGains(size, 1), mBiases(size, 1), vBiases(size, 1)
+	{
+		// Start as a plain normalization
+		for (size_t i = 0; i < count; i++)
+			gains(i) = 1.0f;
+
+		biases.clear();
+
+		// Initialize Adam Optimizer matrices
+		mGains.clear();
+		vGains.clear();
+		mBiases.clear();
+		vBiases.clear();
+	}
+
+	size_t NormalizationLayer::getInputCount() const
+	{
+		return count;
+	}
+
+	size_t NormalizationLayer::getOutputCount() const
+	{
+		return count;
+	}
+
+	size_t NormalizationLayer::getCurrentBatchSize() const
+	{
+		return batchSize;
+	}
+
+	const Matrix& NormalizationLayer::getOutputs() const
+	{
+		return outputs;
+	}
+
+	void NormalizationLayer::normalize(const Matrix& inputs, Matrix& outputs, Matrix* normalized, float* deviations) const
+	{
+		const size_t batch = inputs.columnsCount();
+
+		BASEML_PROFILE_OPERATION("NormalizationLayer::normalize", 8.0 * count * batch, 3 * count * batch * sizeof(float));
+
+		const size_t inputStride = columnStride(inputs), outputStride = columnStride(outputs);
+		const size_t normalizedStride = normalized != nullptr ? columnStride(*normalized) : 0;
+
+		// Every data point is normalized on its own. Parallel over the data points.
+		#pragma omp parallel for if (count * batch >= 32768)
+		for (int j = 0; j < (int)batch; j++)
+		{
+			const float* input = &inputs(0, j);
+			float* output = &outputs(0, j);
+
+			float mean = 0.0f;
+
+			for (size_t i = 0; i < count; i++)
+				mean += input[i * inputStride];
+
+			mean /= count;
+
+			float variance = 0.0f;
+
+			for (size_t i = 0; i < count; i++)
+				variance += (input[i * inputStride] - mean) * (input[i * inputStride] - mean);
+
+			const float inverseDeviation = 1.0f / std::sqrt(variance / count + epsilon);
+
+			for (size_t i = 0; i < count; i++)
+			{
+				const float value = (input[i * inputStride] - mean) * inverseDeviation;
+
+				output[i * outputStride] = value * gains(i) + biases(i);
+
+				if (normalized != nullptr)
+					(&(*normalized)(0, j))[i * normalizedStride] = value;
+			}
+
+			if (normalized != nullptr)
+				deviations[j] = inverseDeviation;
+		}
+	}
+
+	void NormalizationLayer::calculateOutputs(const Matrix* inputs)
+	{
+#ifdef DEBUG
+		if (inputs == nullptr)
+		{
+			std::cout << "Cannot calculate output from null input" << std::endl;
+			throw std::runtime_error("Cannot calculate output from null input");
+		}
+
+		if (count != inputs->rowsCount())
+		{
+			std::cout << "Invalid input size for layer" << std::endl;
+			throw std::runtime_error("Invalid input size for layer");
+		}
+#endif // DEBUG
+
+		batchSize = inputs->columnsCount();
+
+		// The outputs and the values kept for the backward pass follow the layout of the inputs and are reused
+		// between batches, so they don't come from an arena
+		if (outputs.rowsCount() != count || outputs.columnsCount() != batchSize || outputs.getLayout() != inputs->getLayout())
+		{
+			MatrixArena::HeapScope heap;
+			outputs = Matrix(count, batchSize, inputs->getLayout());
+			normalized = Matrix(count, batchSize, inputs->getLayout());
+		}
+
+		inverseDeviations.resize(batchSize);
+
+		normalize(*inputs, outputs, &normalized, inverseDeviations.data());
+	}
+
+	void NormalizationLayer::calculateOutputs(const Matrix& inputs, Matrix& outputs) const
+	{
+		if (outputs.rowsCount() != count || outputs.columnsCount() != inputs.columnsCount())
+		{
+			MatrixArena::HeapScope heap;
+			outputs = Matrix(count, inputs.columnsCount(), inputs.getLayout());
+		}
+
+		normalize(inputs, outputs, nullptr, nullptr);
+	}
+
+	void NormalizationLayer::calculateLastLayerGradientsToTarget(const Matrix& expectedOutputs, float(*lossFunctionDerivative)(float, float))
+	{
+#ifdef DEBUG
+		if (count != expectedOutputs.rowsCount() || outputs.columnsCount() != expectedOutputs.columnsCount())
+		{
+			std::cout << "Invalid expected output size for layer" << std::endl;
+			throw std::runtime_error("Invalid expected output size for layer");
+		}
+#endif // DEBUG
+
+		if (gradients.rowsCount() != count || gradients.columnsCount() != batchSize || gradients.getLayout() != outputs.getLayout())
+		{
+			MatrixArena::HeapScope heap;
+			gradients = Matrix(count, batchSize, outputs.getLayout());
+		}
+
+		#pragma omp parallel for if (count * batchSize >= 32768)
+		for (int i = 0; i < (int)count; i++)
+		{
+			for (size_t j = 0; j < batchSize; j++)
+			{
+				gradients(i, j) = (*lossFunctionDerivative)(outputs(i, j), expectedOutputs(i, j));
+			}
+		}
+	}
+
+	void NormalizationLayer::calculateLastLayerGradients(const Matrix& externalGradients)
+	{
+#ifdef DEBUG
+		if (count != externalGradients.rowsCount() || outputs.columnsCount() != externalGradients.columnsCount())
+		{
+			std::cout << "Invalid external gradients size for layer" << std::endl;
+			throw std::runtime_error("Invalid external gradients size for layer");
+		}
+#endif // DEBUG
+
+		// The layer has no activation function, so its gradients are the gradients of its outputs
+		if (gradients.rowsCount() != count || gradients.columnsCount() != batchSize || gradients.getLayout() != outputs.getLayout())
+		{
+			MatrixArena::HeapScope heap;
+			gradients = Matrix(count, batchSize, outputs.getLayout());
+		}
+
+		gradients.copyFrom(externalGradients);
+	}
+
+	Matrix NormalizationLayer::calculateInputGradients() const
+	{
+		Matrix inputGradients(count, batchSize, normalized.getLayout());
+
+		const size_t stride = columnStride(normalized);
+
+		// Every input moves the mean and the variance of its data point, so the gradient of an input depends on
+		// the gradients of all of the values of the data point: the gradient of its normalized value minus the
+		// mean of those gradients and minus its normalized value times their covariance with the normalized values
+		#pragma omp parallel for if (count * batchSize >= 32768)
+		for (int j = 0; j < (int)batchSize; j++)
+		{
+			const float* values = &normalized(0, j);
+			const float* outputGradients = &gradients(0, j);
+			float* column = &inputGradients(0, j);
+
+			float sum = 0.0f, valuesSum = 0.0f;
+
+			for (size_t i = 0; i < count; i++)
+			{
+				const float gradient = outputGradients[i * stride] * gains(i);
+
+				sum += gradient;
+				valuesSum += gradient * values[i * stride];
+			}
+
+			const float mean = sum / count, covariance = valuesSum / count;
+
+			for (size_t i = 0; i < count; i++)
+			{
+				column[i * stride] = (outputGradients[i * stride] * gains(i) - mean - values[i * stride] * covariance) * inverseDeviations[j];
+			}
+		}
+
+		return inputGradients;
+	}
+
+	void NormalizationLayer::accumulateParameterGradients(float* dest, float scale) const
+	{
+		#pragma omp parallel for if (count * batchSize >= 32768)
+		for (int i = 0; i < (int)count; i++)
+		{
+			float gainSum = 0.0f, biasSum = 0.0f;
+
+			for (size_t j = 0; j < batchSize; j++)
+			{
+				gainSum += gradients(i, j) * normalized(i, j);
+				biasSum += gradients(i, j);
+			}
+
+			dest[i] += gainSum * scale;
+			dest[count + i] += biasSum * scale;
+		}
+	}
+
+	void NormalizationLayer::adamGradientDescent(float learningRate, size_t timestep, float beta1, float beta2, float epsilon)
+	{
+		std::vector<float> gradients(getParameterCount(), 0.0f);
+
+		accumulateParameterGradients(gradients.data(), 1.0f / batchSize);
+		adamUpdate(gradients.data(), learningRate, timestep, beta1, beta2, epsilon);
+	}
+
+	void NormalizationLayer::adamUpdate(const float* gradients, float learningRate, size_t timestep, float beta1, float beta2, float epsilon)
+	{
+		// Zero bias correction factors
+		const float mCorrection = 1.0f / (1.0f - std::pow(beta1, (float)timestep));
+		const float vCorrection = 1.0f / (1.0f - std::pow(beta2, (float)timestep));
+
+		// The parameters are updated matrix by matrix, in the order of getParameters()
+		Matrix* parameters[] = { &gains, &biases };
+		Matrix* firstMoments[] = { &mGains, &mBiases };
+		Matrix* secondMoments[] = { &vGains, &vBiases };
+
+		for (int p = 0; p < 2; p++)
+		{
+			Matrix& values = *parameters[p];
+			Matrix& m = *firstMoments[p];
+			Matrix& v = *secondMoments[p];
+
+			for (size_t i = 0; i < values.size(); i++)
+			{
+				float grad = gradients[i];
+
+				m(i) = m(i) * beta1 + grad * (1.0f - beta1);
+				v(i) = v(i) * beta2 + grad * grad * (1.0f - beta2);
+
+				values(i) = values(i) - m(i) * mCorrection * (learningRate / (std::sqrt(v(i) * vCorrection) + epsilon));
+			}
+
+			gradients += values.size();
+		}
+	}
+
+	size_t NormalizationLayer::getParameterCount() const
+	{
+		return gains.size() + biases.size();
+	}
+
+	void NormalizationLayer::getParameters(float* dest) const
+	{
+		std::copy(&gains(0), &gains(0) + gains.size(), dest);
+		std::copy(&biases(0), &biases(0) + biases.size(), dest + gains.size());
+	}
+
+	void NormalizationLayer::setParameters(const float* src)
+	{
+		std::copy(src, src + gains.size(), &gains(0));
+		std::copy(src + gains.size(), src + gains.size() + biases.size(), &biases(0));
+	}
+
+	void NormalizationLayer::getParameterSpans(std::vector<std::span<float>>& spans)
+	{
+		spans.emplace_back(&gains(0), gains.size());
+		spans.emplace_back(&biases(0), biases.size());
+	}
+
+	void NormalizationLayer::addParameterGradients(float* dest) const
+	{
+		accumulateParameterGradients(dest, 1.0f);
+	}
+
+	void NormalizationLayer::applyParameterGradients(const float* gradients, float learningRate, size_t timestep, float beta1, float beta2, float epsilon)
+	{
+		adamUpdate(gradients, learningRate, timestep, beta1, beta2, epsilon);
+	}
+
+	void NormalizationLayer::save(std::ofstream& outFile)
+	{
+		outFile.write(reinterpret_cast<const char*>(&count), sizeof(count));
+		outFile.write(reinterpret_cast<const char*>(&epsilon), sizeof(epsilon));
+
+		gains.save(outFile);
+		biases.save(outFile);
+	}
+
+	void NormalizationLayer::load(std::ifstream& inFile)
+	{
+		size_t size;
+		float varianceEpsilon;
+
+		inFile.read(reinterpret_cast<char*>(&size), sizeof(size));
+		inFile.read(reinterpret_cast<char*>(&varianceEpsilon), sizeof(varianceEpsilon));
+
+		// Start from a new layer of the saved size (with fresh optimizer moments) and read its parameters
+		*this = NormalizationLayer(size, varianceEpsilon);
+
+		gains.load(inFile);
+		biases.load(inFile);
+	}
+}
@@ -2,37 +2,138 @@
 
 #include <deque>
 #include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <numeric>
 
 #include "RLAlgorithm.h"
 #include "UtilsGeneral.h"
+#include "UtilsFunctions.h"
+#include "Profiler.h"
 
 namespace BaseML::RL
 {
 	PPO::PPO(std::unique_ptr<Environment> environment, const char* criticFileName, const char* actorFileName, float learningRate, float discountFactor,
-		float clipThreshold, int timestepsPerBatch, int maxTimestepsPerEpisode, int updatesPerIteration, float actionSigma)
+		float clipThreshold, int timestepsPerBatch, int maxTimestepsPerEpisode, int updatesPerIteration, float actionSigma, size_t minibatchSize)
 		:RLAlgorithm(std::move(environment)), criticNetFile(criticFileName), actorNetFile(actorFileName), learningRate(learningRate), rewardDiscountFactor(discountFactor),
 		clipThreshold(clipThreshold), timestepsPerBatch(timestepsPerBatch), maxTimestepsPerEpisode(maxTimestepsPerEpisode), updatesPerIter(updatesPerIteration), 
 		criticNetwork({ this->environment->getObservationDimension(), DEFAULT_HIDDEN_LAYER_SIZE, 1 }), 
 		actorNetwork({ this->environment->getObservationDimension(), DEFAULT_HIDDEN_LAYER_SIZE, this->environment->getActionDimension() }),
-		sampler(actionSigma), timestepsLearned(0)
+		sharedTrunk(false), trunkNetwork(), valueLossCoefficient(0.5f), recurrent(false), recurrentCore(), segmentLength(16), 
+		recurrentCoreTimestep(1), sampler(actionSigma), actionLogStd(this->environment->getActionDimension(), 1), mActionLogStd(this->environment->getActionDimension(), 1), 
+		vActionLogStd(this->environment->getActionDimension(), 1), actionLogStdTimestep(1), learnActionSigma(true), 
+		minibatchSize(minibatchSize), timestepsLearned(0), observationNormalization(false), rewardNormalization(false), 
+		observationStats(this->environment->getObservationDimension()), rewardStats(1), criticTrainingThreads(1)
 	{
-		criticNetwork.setOutputActivationFunction([](float x) { return x; }, [](float x) { return 1.0f; });
-		actorNetwork.setOutputActivationFunction([](float x) { return x; }, [](float x) { return 1.0f; });
+		setActionSigma(actionSigma);
+
+		criticNetwork.setOutputActivationFunction(&Utils::linear, &Utils::linearDerivative);
+		actorNetwork.setOutputActivationFunction(&Utils::linear, &Utils::linearDerivative);
+	}
+
+	void PPO::setEpochsPerIteration(int epochs)
+	{
+		updatesPerIter = epochs;
+	}
+
+	void PPO::setMinibatchSize(size_t size)
+	{
+		minibatchSize = size;
 	}
 
 	void PPO::setActionSigma(float actionSigma)
 	{
-		sampler = Utils::GaussianSampler(actionSigma);
+		for (size_t i = 0; i < actionLogStd.size(); i++)
+		{
+			actionLogStd(i) = std::log(actionSigma);
+		}
+
+		// Restart the optimization of the standard deviations
+		mActionLogStd.clear();
+		vActionLogStd.clear();
+		actionLogStdTimestep = 1;
+	}
+
+	void PPO::setLearnActionSigma(bool learn)
+	{
+		learnActionSigma = learn;
+	}
+
+	const Matrix& PPO::getActionLogStd() const
+	{
+		return actionLogStd;
+	}
+
+	void PPO::setObservationNormalization(bool normalize)
+	{
+		observationNormalization = normalize;
+	}
+
+	void PPO::setRewardNormalization(bool normalize)
+	{
+		rewardNormalization = normalize;
+	}
+
+	void PPO::setCriticTrainingThreads(size_t threads)
+	{
+		criticTrainingThreads = threads;
+		criticTrainer.reset();
+	}
+
+	void PPO::recordRollouts(const char* path, bool bfloat16)
+	{
+		rolloutWriter.reset();
+
+		if (path)
+			rolloutWriter = std::make_unique<RolloutWriter>(path, environment->getObservationDimension(), environment->getActionDimension(), bfloat16, true);
 	}
 
 	void PPO::setCriticNetworkLayers(std::initializer_list<size_t> layerSizes)
 	{
 		criticNetwork = NeuralNetwork(layerSizes);
+		criticTrainer.reset();
+		sharedTrunk = false;
+		recurrent = false;
 	}
 
 	void PPO::setActorNetworkLayers(std::initializer_list<size_t> layerSizes)
 	{
 		actorNetwork = NeuralNetwork(layerSizes);
+		sharedTrunk = false;
+		recurrent = false;
+	}
+
+	void PPO::setSharedTrunkLayers(std::initializer_list<size_t> layerSizes, float valueLossCoef)
+	{
+		trunkNetwork = NeuralNetwork(layerSizes, &Utils::leakyReLU, &Utils::leakyReLUDerivative);
+
+		size_t trunkOutputs = trunkNetwork.getOutputCount();
+
+		actorNetwork = NeuralNetwork({ trunkOutputs, environment->getActionDimension() }, &Utils::linear, &Utils::linearDerivative);
+		criticNetwork = NeuralNetwork({ trunkOutputs, 1 }, &Utils::linear, &Utils::linearDerivative);
+		criticTrainer.reset();
+
+		valueLossCoefficient = valueLossCoef;
+		sharedTrunk = true;
+		recurrent = false;
+	}
+
+	void PPO::setRecurrentCore(RecurrentLayer::Cell cell, size_t hiddenSize, size_t segmentLength, float valueLossCoef)
+	{
+		recurrentCore = RecurrentLayer(cell, environment->getObservationDimension(), hiddenSize);
+		recurrentCoreTimestep = 1;
+
+		actorNetwork = NeuralNetwork({ hiddenSize, DEFAULT_HIDDEN_LAYER_SIZE, environment->getActionDimension() });
+		criticNetwork = NeuralNetwork({ hiddenSize, DEFAULT_HIDDEN_LAYER_SIZE, 1 });
+		criticTrainer.reset();
+
+		actorNetwork.setOutputActivationFunction(&Utils::linear, &Utils::linearDerivative);
+		criticNetwork.setOutputActivationFunction(&Utils::linear, &Utils::linearDerivative);
+
+		this->segmentLength = std::max(segmentLength, (size_t)1);
+		valueLossCoefficient = valueLossCoef;
+		sharedTrunk = false;
+		recurrent = true;
 	}
 
 	void PPO::setActorOutputActivationFunction(float(*activationFunction)(float), float(*activationFunctionDerivative)(float))
@@ -42,8 +143,38 @@ namespace BaseML::RL
 
 	bool PPO::loadFromFiles()
 	{
-		if (!actorNetwork.loadFromFile(actorNetFile.c_str()))
+		criticTrainer.reset();
+
+		try {
+			std::ifstream afile(actorNetFile, std::ios::binary | std::ios::in);
+
+			if (!afile)
+				return false;
+
+			if (sharedTrunk)
+			{
+				// The actor file holds the trunk followed by the policy head
+				trunkNetwork.load(afile, &Utils::leakyReLU, &Utils::leakyReLUDerivative, &Utils::leakyReLU, &Utils::leakyReLUDerivative);
+				actorNetwork.load(afile, &Utils::linear, &Utils::linearDerivative, &Utils::linear, &Utils::linearDerivative);
+			}
+			else if (recurrent)
+			{
+				// The actor file holds the recurrent core followed by the policy head
+				recurrentCore.load(afile);
+				actorNetwork.load(afile, &Utils::leakyReLU, &Utils::leakyReLUDerivative, &Utils::linear, &Utils::linearDerivative);
+			}
+			else
+			{
+				actorNetwork.load(afile);
+			}
+
+			// Files saved before the observation statistics were saved with the actor end after the networks
+			if (afile.peek() != std::ifstream::traits_type::eof())
+				loadObservationNormalization(afile);
+		}
+		catch (...) {
 			return false;
+		}
 
 		try {
 			std::ifstream ifile;
@@ -51,7 +182,24 @@ namespace BaseML::RL
 			ifile.open(criticNetFile, std::ios::binary | std::ios::in);
 
 			ifile.read(reinterpret_cast<char*>(&timestepsLearned), sizeof(timestepsLearned));
-			criticNetwork.load(ifile);
+
+			if (sharedTrunk)
+				criticNetwork.load(ifile, &Utils::linear, &Utils::linearDerivative, &Utils::linear, &Utils::linearDerivative);
+			else if (recurrent)
+				criticNetwork.load(ifile, &Utils::leakyReLU, &Utils::leakyReLUDerivative, &Utils::linear, &Utils::linearDerivative);
+			else
+				criticNetwork.load(ifile);
+
+			// Files saved before the standard deviation was learned end after the critic network
+			if (ifile.peek() != std::ifstream::traits_type::eof())
+				actionLogStd.load(ifile);
+
+			// Files saved before the normalization statistics were added end here
+			if (ifile.peek() != std::ifstream::traits_type::eof())
+			{
+				observationStats.load(ifile);
+				rewardStats.load(ifile);
+			}
 
 			ifile.close();
 		}
@@ -62,63 +210,429 @@ namespace BaseML::RL
 		return true;
 	}
 
+	Policy PPO::getPolicy() const
+	{
+		const Utils::RunningStatistics* statistics = observationNormalization ? &observationStats : nullptr;
+
+		if (sharedTrunk)
+			return Policy(trunkNetwork, actorNetwork, statistics);
+
+		if (recurrent)
+			return Policy(recurrentCore, actorNetwork, statistics);
+
+		return Policy(actorNetwork, statistics);
+	}
+
 	void PPO::learn(size_t maxTimesteps)
 	{
+		using Clock = std::chrono::steady_clock;
+
 		size_t timestepsPassed = 0; // Total time steps so far
+
+		// Returns the seconds passed since 'phaseStart' and starts the next phase
+		Clock::time_point phaseStart;
+
+		auto endPhase = [&phaseStart]()
+			{
+				Clock::time_point now = Clock::now();
+				double seconds = std::chrono::duration<double>(now - phaseStart).count();
+
+				phaseStart = now;
+
+				return seconds;
+			};
+
+		synchronizeParameters();
 		
 		while (timestepsPassed < maxTimesteps)
 		{
+			BASEML_PROFILE_SCOPE("PPO iteration");
+
+			// The matrices created in the iteration take their memory from the arena, which is reset when the iteration ends
+			MatrixArena::Scope arenaScope(iterationArena);
+
+			IterationTimings timings;
+
+			phaseStart = Clock::now();
+
 			auto [data, collectedTimesteps] = collectTrajectories();
 
+			timings.environmentSteps = data.observations.columnsCount();
+
+			if (transport)
+			{
+				// Count the timesteps of all of the processes
+				double totalTimesteps = (double)collectedTimesteps;
+				transport->allReduceSum(&totalTimesteps, 1);
+
+				collectedTimesteps = (size_t)totalTimesteps;
+			}
+
+			timings.collection = endPhase();
+
+			if (rolloutWriter)
+				rolloutWriter->append(data);
+
+			timings.checkpoint = endPhase();
+
+			// The networks see the observations normalized with the same statistics as during collection
+			Matrix rawObservations;
+
+			if (observationNormalization)
+			{
+				rawObservations = data.observations;
+				normalizeObservations(data.observations);
+			}
+
 			Matrix advantage = computeAdvantageEstimates(data);
 
+			timings.advantage = endPhase();
+
+			size_t batchSize = data.observations.columnsCount();
+			size_t numMinibatches = getMinibatchCount(batchSize);
+
+			// In recurrent mode the mini-batches are made of whole segments
+			size_t sampleCount = recurrent ? data.segmentStarts.size() : batchSize;
+
+			if (!transport)
+				numMinibatches = std::min(numMinibatches, sampleCount);
+
+			PolicyUpdateStats statsSum;
+			int numUpdates = 0;
+
 			for (int i = 0; i < updatesPerIter; i++)
 			{
-				updatePolicy(data, advantage);
+				// Visit the data points in a different order every epoch
+				Utils::randomPermutation(sampleOrder, sampleCount);
 
-				fitValueFunction(data);
+				for (size_t m = 0; m < numMinibatches; m++)
+				{
+					size_t begin = sampleCount * m / numMinibatches;
+					size_t end = sampleCount * (m + 1) / numMinibatches;
+
+					if (begin == end)
+					{
+						// This process has no data for the update but still takes part in the all-reduce
+						Matrix noLogStdGradients(actionLogStd.rowsCount(), 1);
+						noLogStdGradients.clear();
+
+						if (sharedTrunk)
+						{
+							applyUpdate({ &trunkNetwork, &actorNetwork, &criticNetwork }, &noLogStdGradients, 0);
+							timings.policyUpdate += endPhase();
+						}
+						else if (recurrent)
+						{
+							applyUpdate({ &actorNetwork, &criticNetwork }, &noLogStdGradients, 0, &recurrentCore);
+							timings.policyUpdate += endPhase();
+						}
+						else
+						{
+							applyUpdate({ &actorNetwork }, &noLogStdGradients, 0);
+							timings.policyUpdate += endPhase();
+
+							applyUpdate({ &criticNetwork }, nullptr, 0);
+							timings.valueFit += endPhase();
+						}
+
+						continue;
+					}
+
+					Matrix minibatchAdvantages;
+					RLTrainingData minibatch;
+					std::vector<size_t> segmentBatchSizes;
+
+					if (recurrent)
+						minibatch = gatherSegments(data, advantage, begin, end, minibatchAdvantages, segmentBatchSizes);
+					else
+						minibatch = gatherMinibatch(data, advantage, begin, end, minibatchAdvantages);
+
+					PolicyUpdateStats stats;
+
+					if (sharedTrunk)
+					{
+						stats = updateSharedNetwork(minibatch, minibatchAdvantages);
+						timings.policyUpdate += endPhase();
+					}
+					else if (recurrent)
+					{
+						stats = updateRecurrentNetwork(minibatch, minibatchAdvantages, segmentBatchSizes);
+						timings.policyUpdate += endPhase();
+					}
+					else
+					{
+						stats = updatePolicy(minibatch, minibatchAdvantages);
+						timings.policyUpdate += endPhase();
+
+						stats.valueLoss = fitValueFunction(minibatch);
+						timings.valueFit += endPhase();
+					}
+
+					timings.updateSamples += minibatch.observations.columnsCount();
+
+					statsSum.clipFraction += stats.clipFraction;
+					statsSum.approxKL += stats.approxKL;
+					statsSum.policyLoss += stats.policyLoss;
+					statsSum.valueLoss += stats.valueLoss;
+					numUpdates++;
+				}
 			}
 
+			if (numUpdates > 0)
+			{
+				lastPolicyStats.clipFraction = statsSum.clipFraction / numUpdates;
+				lastPolicyStats.approxKL = statsSum.approxKL / numUpdates;
+				lastPolicyStats.policyLoss = statsSum.policyLoss / numUpdates;
+				lastPolicyStats.valueLoss = statsSum.valueLoss / numUpdates;
+			}
+
+			// Entropy of the Gaussian policy, which only depends on the standard deviations
+			lastPolicyStats.entropy = 0.0f;
+
+			for (size_t i = 0; i < actionLogStd.size(); i++)
+				lastPolicyStats.entropy += actionLogStd(i) + 0.5f * (1.0f + std::log(2.0f * 3.14159265359f));
+
+			// Shuffling and gathering the mini-batches and averaging the statistics count as part of the policy update
+			timings.policyUpdate += endPhase();
+
+			updateNormalizationStatistics(observationNormalization ? rawObservations : data.observations, data.rewards);
+
+			timings.advantage += endPhase();
+
 			timestepsPassed += collectedTimesteps;
+			timestepsLearned += collectedTimesteps;
+
+			if (!transport || transport->isRoot())
+				save();
+
+			timings.checkpoint += endPhase();
+
+			lastTimings = timings;
+
+			logIterationMetrics();
 		}
 	}
 
+	const PolicyUpdateStats& PPO::getLastPolicyUpdateStats() const
+	{
+		return lastPolicyStats;
+	}
+
+	const IterationTimings& PPO::getLastIterationTimings() const
+	{
+		return lastTimings;
+	}
+
+	const EpisodeStats& PPO::getLastEpisodeStats() const
+	{
+		return lastEpisodeStats;
+	}
+
+	const MatrixArena& PPO::getIterationArena() const
+	{
+		return iterationArena;
+	}
+
 	void PPO::showRealTime()
 	{
 		float episodeReward = 0.0f;
 		int totalTimesteps = 0;
 
 		environment->reset();
+		resetCoreStates(1);
 
 		while (!environment->isFinished() && totalTimesteps < maxTimestepsPerEpisode)
 		{
 			totalTimesteps++;
 
 			// Get environment state
-			const Matrix& observation = environment->getState(playerId.c_str());
+			const Matrix& observation = environment->getPlayerState(playerIndex);
 
 			// Get action from actor network
 			auto [action, logProbability] = getAction(observation);
 
 			// Update environment
-			environment->setAction(playerId.c_str(), action);
+			environment->setPlayerAction(playerIndex, action);
 			environment->update();
 
 			// Get reward of action
-			float reward = environment->getReward(playerId.c_str());
+			float reward = environment->getPlayerReward(playerIndex);
 
 			episodeReward += reward;
 		}
 
-		std::cout << "Total episode reward: " << episodeReward << std::endl;
+		if (Utils::MetricsLogger* logger = getMetricsLogger())
+		{
+			logger->log(Utils::MetricsRecord("ppo_evaluation", timestepsLearned)
+				.add("episode_reward", episodeReward)
+				.add("episode_length", totalTimesteps));
+
+			logger->flush();
+		}
+	}
+
+	const Matrix& PPO::actorForward(const Matrix& observations)
+	{
+		if (recurrent)
+		{
+			recurrentCore.step(observations, coreStates, coreOutputs);
+			return actorNetwork.forwardPropagate(coreOutputs);
+		}
+
+		if (sharedTrunk)
+			return actorNetwork.forwardPropagate(trunkNetwork.forwardPropagate(observations));
+
+		return actorNetwork.forwardPropagate(observations);
+	}
+
+	const Matrix& PPO::criticForward(const Matrix& observations)
+	{
+		if (sharedTrunk)
+			return criticNetwork.forwardPropagate(trunkNetwork.forwardPropagate(observations));
+
+		return criticNetwork.forwardPropagate(observations);
+	}
+
+	void PPO::resetCoreStates(size_t players)
+	{
+		if (!recurrent)
+			return;
+
+		// The states live through the episodes, so they don't come from an arena
+		if (coreStates.rowsCount() != recurrentCore.getStateSize() || coreStates.columnsCount() != players)
+		{
+			MatrixArena::HeapScope heap;
+
+			coreStates = Matrix(recurrentCore.getStateSize(), players, Matrix::Layout::ColumnMajor);
+			coreOutputs = Matrix(recurrentCore.getOutputCount(), players);
+		}
+
+		coreStates.clear();
+	}
+
+	void PPO::recordSegmentState(std::vector<float>& states, size_t player) const
+	{
+		states.insert(states.end(), &coreStates(0, player), &coreStates(0, player) + coreStates.rowsCount());
+	}
+
+	Matrix PPO::packSegments(const RLTrainingData& data, const size_t* segments, size_t count, std::vector<size_t>& indices, 
+		std::vector<size_t>& batchSizes) const
+	{
+		const size_t dataPoints = data.observations.columnsCount();
+
+		// Length of a segment (it ends where the next one starts)
+		auto length = [&](size_t segment)
+			{
+				size_t end = segment + 1 < data.segmentStarts.size() ? data.segmentStarts[segment + 1] : dataPoints;
+				return end - data.segmentStarts[segment];
+			};
+
+		std::vector<size_t> sorted(segments, segments + count);
+		std::stable_sort(sorted.begin(), sorted.end(), [&](size_t a, size_t b) { return length(a) > length(b); });
+
+		batchSizes.assign(count == 0 ? 0 : length(sorted[0]), 0);
+		indices.clear();
+
+		for (size_t t = 0; t < batchSizes.size(); t++)
+		{
+			for (size_t segment : sorted)
+			{
+				if (length(segment) <= t)
+					break;
+
+				indices.push_back(data.segmentStarts[segment] + t);
+				batchSizes[t]++;
+			}
+		}
+
+		return data.segmentStates.gatherColumns(sorted.data(), sorted.size());
+	}
+
+	void PPO::saveObservationNormalization(std::ofstream& outFile) const
+	{
+		uint8_t normalize = observationNormalization;
+
+		outFile.write(reinterpret_cast<const char*>(&normalize), sizeof(normalize));
+		observationStats.save(outFile);
+	}
+
+	void PPO::loadObservationNormalization(std::ifstream& inFile)
+	{
+		uint8_t normalize;
+
+		inFile.read(reinterpret_cast<char*>(&normalize), sizeof(normalize));
+		observationStats.load(inFile);
+
+		observationNormalization = normalize != 0;
+	}
+
+	void PPO::normalizeObservations(Matrix& observations) const
+	{
+		if (observationNormalization)
+			observationStats.normalize(observations);
+	}
+
+	float PPO::normalizeReward(float reward) const
+	{
+		if (!rewardNormalization)
+			return reward;
+
+		return reward / std::sqrt(rewardStats.getVariance(0) + 1.0e-8f);
+	}
+
+	void PPO::updateNormalizationStatistics(const Matrix& rawObservations, const Matrix& rewards)
+	{
+		if (!transport)
+		{
+			if (observationNormalization)
+				observationStats.update(rawObservations);
+
+			if (rewardNormalization)
+				rewardStats.update(rewards);
+
+			return;
+		}
+
+		// Every process computes the statistics of its own data and the statistics of all of the processes 
+		// are gathered (each process fills its part of a zeroed buffer and the buffers are summed) and merged 
+		// in rank order, so all of the processes end up with the same statistics
+		Utils::RunningStatistics batchObservationStats(observationStats.getDimension()), batchRewardStats(1);
+
+		if (observationNormalization)
+			batchObservationStats.update(rawObservations);
+
+		if (rewardNormalization)
+			batchRewardStats.update(rewards);
+
+		size_t stateSize = batchObservationStats.getStateSize() + batchRewardStats.getStateSize();
+		size_t worldSize = transport->getWorldSize();
+
+		std::vector<double> states(stateSize * worldSize, 0.0);
+		double* ownState = states.data() + stateSize * transport->getRank();
+
+		batchObservationStats.getState(ownState);
+		batchRewardStats.getState(ownState + batchObservationStats.getStateSize());
+
+		transport->allReduceSum(states.data(), states.size());
+
+		for (size_t r = 0; r < worldSize; r++)
+		{
+			const double* state = states.data() + stateSize * r;
+
+			observationStats.mergeState(state);
+			rewardStats.mergeState(state + batchObservationStats.getStateSize());
+		}
 	}
 
 	std::pair<Matrix, float> PPO::getAction(const Matrix& observation)
 	{
-		Matrix actionMean = actorNetwork.forwardPropagate(observation);
+		Matrix normalizedObservation = observation;
+		normalizeObservations(normalizedObservation);
+
+		Matrix actionMean = actorForward(normalizedObservation);
 
-		Matrix action = sampler.sample(actionMean);
-		float logProbability = sampler.logProbabiltiy(actionMean, action);
+		Matrix action = sampler.sample(actionMean, actionLogStd);
+		float logProbability = sampler.logProbabiltiy(actionMean, action, actionLogStd);
 
 		return { action, logProbability };
 	}
@@ -162,21 +676,186 @@ namespace BaseML::RL
 			throw std::runtime_error("Cannot convert an empty collection");
 		}
 
-		Matrix converted(data[0].size(), data.size());
+		// Column-major, so every timestep is copied to contiguous memory
+		Matrix converted(data[0].size(), data.size(), Matrix::Layout::ColumnMajor);
 
 		for (int i = 0; i < converted.columnsCount(); i++)
 		{
-			for (int j = 0; j < converted.rowsCount(); j++)
+			std::copy(&data[i](0), &data[i](0) + converted.rowsCount(), &converted(0, i));
+		}
+
+		return converted;
+	}
+
+	Matrix PPO::columnDataToMatrix(const std::vector<float>& data, size_t rows)
+	{
+		if (data.size() == 0)
+		{
+			std::cout << "Cannot convert an empty collection" << std::endl;
+			throw std::runtime_error("Cannot convert an empty collection");
+		}
+
+		// The data points are stored one after the other, which is the column-major layout
+		Matrix converted(rows, data.size() / rows, Matrix::Layout::ColumnMajor);
+
+		std::copy(data.begin(), data.begin() + converted.size(), &converted(0));
+
+		return converted;
+	}
+
+	std::pair<RLTrainingData, size_t> PPO::collectAllPlayersTrajectories()
+	{
+		const size_t numPlayers = environment->getPlayerCount();
+		const size_t obsDim = environment->getObservationDimension();
+		const size_t actDim = environment->getActionDimension();
+
+		// The data of the current episode of every player. An episode is added to the batch only after 
+		// it ends, so that the data of each player's episode is contiguous for the rewards-to-go.
+		struct PlayerEpisode
+		{
+			std::vector<float> observations, actions, logProbabilities, rawRewards;
+			std::deque<float> rewards;
+
+			// Recurrent mode: the timesteps at which the segments of the episode start and the states of the core there
+			std::vector<size_t> segmentStarts;
+			std::vector<float> segmentStates;
+		};
+
+		std::vector<PlayerEpisode> episodes(numPlayers);
+
+		std::vector<float> observations, actions, logProbabilities, rewards, dones;
+		std::deque<float> rtgs; // Rewards-to-go
+
+		std::vector<size_t> segmentStarts;
+		std::vector<float> segmentStates;
+
+		EnvironmentBatch batch;
+
+		size_t tBatch = 0;
+
+		// for monitoring reward
+		float totalBatchReward = 0.0f;
+		int numEpisodes = 0;
+
+		while (tBatch < (size_t)timestepsPerBatch)
+		{
+			environment->reset();
+			environment->observeBatch(batch);
+			resetCoreStates(numPlayers);
+
+			std::fill(batch.dones.begin(), batch.dones.end(), 0);
+			numEpisodes++;
+
+			for (int tEpisode = 0; tEpisode < maxTimestepsPerEpisode && !environment->isFinished(); tEpisode++)
+			{
+				// A new segment starts every 'segmentLength' timesteps of a player's episode
+				if (recurrent && tEpisode % segmentLength == 0)
+				{
+					for (size_t p = 0; p < numPlayers; p++)
+					{
+						if (batch.dones[p])
+							continue;
+
+						episodes[p].segmentStarts.push_back(episodes[p].logProbabilities.size());
+						recordSegmentState(episodes[p].segmentStates, p);
+					}
+				}
+
+				// One forward pass computes the actions of all of the players
+				Matrix currObservations = batch.observations;
+				Matrix normalizedObservations = currObservations;
+				normalizeObservations(normalizedObservations);
+
+				const Matrix& actionMeans = actorForward(normalizedObservations);
+
+				Matrix currActions = sampler.sample(actionMeans, actionLogStd);
+				Matrix currLogProbabilities = sampler.batchLogProbabilities(actionMeans, currActions, actionLogStd);
+
+				std::vector<unsigned char> wasDone = batch.dones;
+
+				environment->stepBatch(currActions, batch);
+
+				for (size_t p = 0; p < numPlayers; p++)
+				{
+					// Players that already finished don't collect more data in this episode
+					if (wasDone[p])
+						continue;
+
+					PlayerEpisode& episode = episodes[p];
+
+					for (size_t i = 0; i < obsDim; i++)
+						episode.observations.push_back(currObservations(i, p));
+
+					for (size_t i = 0; i < actDim; i++)
+						episode.actions.push_back(currActions(i, p));
+
+					episode.logProbabilities.push_back(currLogProbabilities(p));
+					episode.rewards.push_back(normalizeReward(batch.rewards(p)));
+					episode.rawRewards.push_back(batch.rewards(p));
+
+					totalBatchReward += batch.rewards(p);
+					tBatch++;
+				}
+
+				if (std::all_of(batch.dones.begin(), batch.dones.end(), [](unsigned char done) { return done != 0; }))
+					break;
+			}
+
+			// Move the episodes of all of the players to the batch
+			for (PlayerEpisode& episode : episodes)
 			{
-				converted(j, i) = data[i](j);
+				for (size_t start : episode.segmentStarts)
+					segmentStarts.push_back(logProbabilities.size() + start);
+
+				segmentStates.insert(segmentStates.end(), episode.segmentStates.begin(), episode.segmentStates.end());
+
+				observations.insert(observations.end(), episode.observations.begin(), episode.observations.end());
+				actions.insert(actions.end(), episode.actions.begin(), episode.actions.end());
+				logProbabilities.insert(logProbabilities.end(), episode.logProbabilities.begin(), episode.logProbabilities.end());
+				rewards.insert(rewards.end(), episode.rawRewards.begin(), episode.rawRewards.end());
+
+				if (!episode.rawRewards.empty())
+				{
+					dones.insert(dones.end(), episode.rawRewards.size() - 1, 0.0f);
+					dones.push_back(1.0f);
+				}
+
+				calculateRewardsToGo(rtgs, episode.rewards);
+
+				episode = PlayerEpisode();
 			}
 		}
 
-		return converted;
+		lastEpisodeStats.episodes = numEpisodes * numPlayers;
+		lastEpisodeStats.averageReward = totalBatchReward / (float)lastEpisodeStats.episodes;
+		lastEpisodeStats.averageLength = (float)tBatch / (float)lastEpisodeStats.episodes;
+
+		// Convert to matrices
+		RLTrainingData data;
+
+		data.observations = columnDataToMatrix(observations, obsDim);
+		data.actions = columnDataToMatrix(actions, actDim);
+		data.logProbabilities = columnDataToMatrix(logProbabilities, 1);
+		data.rtgs = scalarDataToMatrix(rtgs);
+		data.rewards = columnDataToMatrix(rewards, 1);
+		data.dones = columnDataToMatrix(dones, 1);
+
+		if (recurrent)
+		{
+			data.segmentStarts = std::move(segmentStarts);
+			data.segmentStates = columnDataToMatrix(segmentStates, recurrentCore.getStateSize());
+		}
+
+		return { data, tBatch };
 	}
 
 	std::pair<RLTrainingData, size_t> PPO::collectTrajectories()
 	{
+		BASEML_PROFILE_SCOPE("PPO::collectTrajectories");
+
+		if (trainAllPlayers)
+			return collectAllPlayersTrajectories();
+
 		RLTrainingData data;
 
 		int tBatch = 0, tEpisode;
@@ -186,6 +865,11 @@ namespace BaseML::RL
 		std::deque<Matrix> actions;
 		std::deque<float> logProbabilities;
 		std::deque<float> rtgs; // Rewards-to-go
+		std::deque<float> rewards;
+		std::deque<float> dones;
+
+		std::vector<size_t> segmentStarts;
+		std::vector<float> segmentStates;
 
 		// for monitoring reward
 		float totalBatchReward = 0.0f; 
@@ -194,26 +878,34 @@ namespace BaseML::RL
 		while (tBatch < timestepsPerBatch)
 		{
 			environment->reset();
+			resetCoreStates(1);
 
 			std::deque<float> episodeRewards;
 			numEpisodes++;
 
 			for (tEpisode = 0; tEpisode < maxTimestepsPerEpisode && !environment->isFinished(); tEpisode++)
 			{
+				// A new segment starts every 'segmentLength' timesteps of the episode
+				if (recurrent && tEpisode % segmentLength == 0)
+				{
+					segmentStarts.push_back(tBatch);
+					recordSegmentState(segmentStates, 0);
+				}
+
 				tBatch++;
 
-				// Get environment state
-				const Matrix& observation = environment->getState(playerId.c_str());
+				// Get environment state. The state is copied because the environment overwrites it on update.
+				Matrix observation = environment->getPlayerState(playerIndex);
 
 				// Get action from actor network
 				auto [action, logProbability] = getAction(observation);
 
 				// Update environment
-				environment->setAction(playerId.c_str(), action);
+				environment->setPlayerAction(playerIndex, action);
 				environment->update();
 
 				// Get reward of action
-				float reward = environment->getReward(playerId.c_str());
+				float reward = environment->getPlayerReward(playerIndex);
 
 				totalBatchReward += reward;
 
@@ -221,27 +913,279 @@ namespace BaseML::RL
 				observations.push_back(observation);
 				actions.push_back(action);
 				logProbabilities.push_back(logProbability);
-				episodeRewards.push_back(reward);
+				episodeRewards.push_back(normalizeReward(reward));
+				rewards.push_back(reward);
+				dones.push_back(0.0f);
 			}
 
+			// Mark the end of the episode
+			if (!episodeRewards.empty())
+				dones.back() = 1.0f;
+
 			// Compute rewards-to-go
 			calculateRewardsToGo(rtgs, episodeRewards);
 		}
 
-		std::cout << "Average episode reward: " << totalBatchReward / (float)numEpisodes << std::endl;
+		lastEpisodeStats.episodes = numEpisodes;
+		lastEpisodeStats.averageReward = totalBatchReward / (float)numEpisodes;
+		lastEpisodeStats.averageLength = (float)tBatch / (float)numEpisodes;
 
 		// Convert to matrices
 		data.observations = vectorDataToMatrix(observations);
 		data.actions = vectorDataToMatrix(actions);
 		data.logProbabilities = scalarDataToMatrix(logProbabilities);
 		data.rtgs = scalarDataToMatrix(rtgs);
+		data.rewards = scalarDataToMatrix(rewards);
+		data.dones = scalarDataToMatrix(dones);
+
+		if (recurrent)
+		{
+			data.segmentStarts = std::move(segmentStarts);
+			data.segmentStates = columnDataToMatrix(segmentStates, recurrentCore.getStateSize());
+		}
 
 		return { data, tBatch };
 	}
 
+	size_t PPO::getMinibatchSize(size_t batchSize) const
+	{
+		if (minibatchSize != 0)
+			return std::min(minibatchSize, batchSize);
+
+		// Count the floats stored for each data point during an update: the data point itself and 
+		// the outputs and gradients of every layer in both networks
+		size_t floatsPerDataPoint = environment->getObservationDimension() + environment->getActionDimension() + 2;
+
+		auto layerOutputs = [](const NeuralNetwork& network)
+		{
+			size_t count = 0;
+
+			for (const NetworkLayer& layer : network.getLayers())
+				count += std::visit([](const auto& l) { return l.getOutputCount(); }, layer);
+
+			return count;
+		};
+
+		floatsPerDataPoint += 2 * (layerOutputs(actorNetwork) + layerOutputs(criticNetwork));
+
+		if (sharedTrunk)
+			floatsPerDataPoint += 2 * layerOutputs(trunkNetwork);
+
+		// The gates, the states and the gradients of the recurrent core take about ten values per cell
+		if (recurrent)
+			floatsPerDataPoint += 10 * recurrentCore.getOutputCount();
+
+		size_t autoSize = L2_CACHE_BYTES / (floatsPerDataPoint * sizeof(float));
+
+		return std::min(std::max(autoSize, MIN_AUTO_MINIBATCH_SIZE), batchSize);
+	}
+
+	size_t PPO::getMinibatchCount(size_t batchSize)
+	{
+		size_t currMinibatchSize = getMinibatchSize(batchSize);
+		size_t numMinibatches = currMinibatchSize == 0 ? 0 : (batchSize + currMinibatchSize - 1) / currMinibatchSize;
+
+		if (transport)
+		{
+			double rootMinibatches = (double)numMinibatches;
+			transport->broadcast(&rootMinibatches, 1);
+
+			numMinibatches = (size_t)rootMinibatches;
+		}
+
+		return numMinibatches;
+	}
+
+	void PPO::synchronizeParameters()
+	{
+		if (!transport)
+			return;
+
+		std::vector<float> parameters;
+
+		for (NeuralNetwork* network : { &trunkNetwork, &actorNetwork, &criticNetwork })
+		{
+			if (network == &trunkNetwork && !sharedTrunk)
+				continue;
+
+			parameters.resize(network->getParameterCount());
+
+			network->getParameters(parameters.data());
+			transport->broadcast(parameters.data(), parameters.size());
+			network->setParameters(parameters.data());
+		}
+
+		if (recurrent)
+		{
+			parameters.resize(recurrentCore.getParameterCount());
+
+			recurrentCore.getParameters(parameters.data());
+			transport->broadcast(parameters.data(), parameters.size());
+			recurrentCore.setParameters(parameters.data());
+		}
+
+		transport->broadcast(&actionLogStd(0), actionLogStd.size());
+	}
+
+	void PPO::applyUpdate(std::initializer_list<NeuralNetwork*> networks, const Matrix* logStdGradients, size_t dataPoints, 
+		RecurrentLayer* core)
+	{
+		BASEML_PROFILE_SCOPE("PPO::applyUpdate");
+
+		bool updateLogStd = logStdGradients && learnActionSigma;
+
+		if (!transport)
+		{
+			for (NeuralNetwork* network : networks)
+				network->applyGradients(learningRate);
+
+			if (core)
+				core->adamGradientDescent(learningRate, recurrentCoreTimestep++);
+
+			if (updateLogStd)
+				updateActionLogStd(*logStdGradients);
+
+			return;
+		}
+
+		// Flat buffer of the gradients summed over the data points: the parameters of every network, then the log 
+		// standard deviations and finally the number of data points, so the sums can be averaged after the all-reduce
+		size_t bufferSize = 1;
+
+		for (NeuralNetwork* network : networks)
+			bufferSize += network->getParameterCount();
+
+		if (core)
+			bufferSize += core->getParameterCount();
+
+		if (updateLogStd)
+			bufferSize += actionLogStd.size();
+
+		std::vector<float> gradients(bufferSize, 0.0f);
+		float* position = gradients.data();
+
+		for (NeuralNetwork* network : networks)
+		{
+			if (dataPoints > 0)
+				network->addParameterGradients(position);
+
+			position += network->getParameterCount();
+		}
+
+		if (core)
+		{
+			if (dataPoints > 0)
+				core->addParameterGradients(position);
+
+			position += core->getParameterCount();
+		}
+
+		if (updateLogStd)
+		{
+			for (size_t i = 0; i < actionLogStd.size(); i++)
+				position[i] = (*logStdGradients)(i) * dataPoints;
+
+			position += actionLogStd.size();
+		}
+
+		*position = (float)dataPoints;
+
+		transport->allReduceSum(gradients.data(), gradients.size());
+
+		float totalDataPoints = gradients.back();
+
+		if (totalDataPoints == 0.0f)
+			return;
+
+		for (float& gradient : gradients)
+			gradient /= totalDataPoints;
+
+		position = gradients.data();
+
+		for (NeuralNetwork* network : networks)
+		{
+			network->applyParameterGradients(position, learningRate);
+			position += network->getParameterCount();
+		}
+
+		if (core)
+		{
+			core->applyParameterGradients(position, learningRate, recurrentCoreTimestep++);
+			position += core->getParameterCount();
+		}
+
+		if (updateLogStd)
+		{
+			Matrix averageLogStdGradients(actionLogStd.rowsCount(), 1);
+			std::copy(position, position + actionLogStd.size(), &averageLogStdGradients(0));
+
+			updateActionLogStd(averageLogStdGradients);
+		}
+	}
+
+	RLTrainingData PPO::gatherMinibatch(const RLTrainingData& data, const Matrix& advantages, size_t begin, size_t end,
+		Matrix& minibatchAdvantages) const
+	{
+		BASEML_PROFILE_SCOPE("PPO::gatherMinibatch");
+
+		return gatherDataPoints(data, advantages, sampleOrder.data() + begin, end - begin, minibatchAdvantages);
+	}
+
+	RLTrainingData PPO::gatherDataPoints(const RLTrainingData& data, const Matrix& advantages, const size_t* indices, size_t count,
+		Matrix& minibatchAdvantages) const
+	{
+		RLTrainingData minibatch;
+
+		minibatch.observations = data.observations.gatherColumns(indices, count);
+
+		// The policy gradient kernel reads the actions of a block of data points dimension by dimension
+		minibatch.actions = data.actions.gatherColumns(indices, count).toLayout(Matrix::Layout::RowMajor);
+		minibatch.logProbabilities = data.logProbabilities.gatherColumns(indices, count);
+		minibatch.rtgs = data.rtgs.gatherColumns(indices, count);
+
+		minibatchAdvantages = advantages.gatherColumns(indices, count);
+
+		return minibatch;
+	}
+
+	RLTrainingData PPO::gatherSegments(const RLTrainingData& data, const Matrix& advantages, size_t begin, size_t end,
+		Matrix& minibatchAdvantages, std::vector<size_t>& batchSizes) const
+	{
+		BASEML_PROFILE_SCOPE("PPO::gatherSegments");
+
+		std::vector<size_t> indices;
+		Matrix states = packSegments(data, sampleOrder.data() + begin, end - begin, indices, batchSizes);
+
+		RLTrainingData minibatch = gatherDataPoints(data, advantages, indices.data(), indices.size(), minibatchAdvantages);
+		minibatch.segmentStates = std::move(states);
+
+		return minibatch;
+	}
+
 	Matrix PPO::computeAdvantageEstimates(const RLTrainingData& data)
 	{
-		Matrix criticStateValues = criticNetwork.forwardPropagate(data.observations);
+		BASEML_PROFILE_SCOPE("PPO::computeAdvantageEstimates");
+
+		Matrix criticStateValues;
+
+		if (recurrent)
+		{
+			// Run all of the segments through the core at once and put the values back in the order of the data
+			std::vector<size_t> segments(data.segmentStarts.size()), indices, batchSizes;
+			std::iota(segments.begin(), segments.end(), 0);
+
+			Matrix states = packSegments(data, segments.data(), segments.size(), indices, batchSizes);
+			Matrix observations = data.observations.gatherColumns(indices.data(), indices.size());
+
+			const Matrix& packedValues = criticNetwork.forwardPropagate(recurrentCore.forwardPropagate(observations, batchSizes, &states));
+
+			criticStateValues = Matrix(1, data.observations.columnsCount());
+
+			for (size_t i = 0; i < indices.size(); i++)
+				criticStateValues(indices[i]) = packedValues(i);
+		}
+		else
+			criticStateValues = criticForward(data.observations);
 
 		// Calculate advantages
 		Matrix advantages = data.rtgs - criticStateValues;
@@ -252,81 +1196,309 @@ namespace BaseML::RL
 		return advantages;
 	}
 
-	std::pair<Matrix, Matrix> PPO::checkActorUnderCurrentPolicy(const Matrix& observations, const Matrix& actions)
+	PolicyUpdateStats PPO::computePolicyGradients(const Matrix& actionMeans, const RLTrainingData& data,
+		const Matrix& advantages, Matrix& gradients, Matrix& logStdGradients) const
 	{
-		Matrix actionMeans = actorNetwork.forwardPropagate(observations);
+		const size_t actionDim = data.actions.rowsCount();
+		const size_t batchSize = data.actions.columnsCount();
 
-		return { actionMeans, sampler.batchLogProbabilities(actionMeans, actions) };
-	}
+		// Values shared by all of the data points are computed once
+		std::vector<float> invVariances(actionDim);
+		float logNormalizer = actionDim * 0.5f * std::log(2.0f * 3.14159265359f);
 
-	void PPO::updatePolicy(const RLTrainingData& data, const Matrix& advantages)
-	{
-		auto [currentActionMeans, currentLogProbabilities] = checkActorUnderCurrentPolicy(data.observations, data.actions);
+		for (size_t j = 0; j < actionDim; j++)
+		{
+			invVariances[j] = std::exp(-2.0f * actionLogStd(j));
+			logNormalizer += actionLogStd(j);
+		}
 
-		// Calculate the action-probability ratio of the current policy to the old policy
-		Matrix ratios = currentLogProbabilities - data.logProbabilities;
-		ratios.applyToElements([](float x) { return std::exp(x); });
+		const int numBlocks = (int)((batchSize + POLICY_KERNEL_BLOCK - 1) / POLICY_KERNEL_BLOCK);
 
-		// Calculate gradients
-		Matrix gradients(data.actions.rowsCount(), data.actions.columnsCount());
+		float clippedCount = 0.0f, klSum = 0.0f, objectiveSum = 0.0f;
+
+		logStdGradients = Matrix(actionDim, 1);
+		logStdGradients.clear();
 
-		// Iterate over all timesteps
-		#pragma omp parallel for
-		for (int i = 0; i < gradients.columnsCount(); i++)
+		#pragma omp parallel reduction(+:clippedCount, klSum, objectiveSum)
 		{
-			// This 'if' statement calculates the gradients of the clip function and min function
-			if (
-				(advantages(i) > 0 && ratios(i) < 1 + clipThreshold) 
-				|| 
-				(advantages(i) < 0 && ratios(i) > 1 - clipThreshold)
-				)
+			std::vector<float> threadLogStdGradients(actionDim, 0.0f);
+
+			// Each thread handles blocks of data points. A block is small enough to stay in L1, so the second 
+			// read of the actions and means of a block doesn't go to memory.
+			#pragma omp for
+			for (int block = 0; block < numBlocks; block++)
 			{
-				// Gradient of the advantage and probability ratio. The stddev is from the 
-				// distribution's gradient calculation, but since it stays the same for all 
-				// states we can divide by it here to save calculations. The minus (-) is 
-				// here because we need to flip the sign of the gradient since we later use 
-				// a gradient descent algorithm (instead of gradient ascent).
-				float actionGradient = -advantages(i) * ratios(i) / (sampler.getSigma() * sampler.getSigma());
-
-				for (int j = 0; j < gradients.rowsCount(); j++)
+				const size_t first = block * POLICY_KERNEL_BLOCK;
+				const size_t count = std::min(POLICY_KERNEL_BLOCK, batchSize - first);
+
+				float squaredDistance[POLICY_KERNEL_BLOCK] = {};
+				float coefficients[POLICY_KERNEL_BLOCK];
+
+				// Squared distance of every action from its mean, scaled by the variance of each dimension
+				for (size_t j = 0; j < actionDim; j++)
+				{
+					const float* actionsRow = &data.actions(j, first);
+					const float* meansRow = &actionMeans(j, first);
+					const float invVariance = invVariances[j];
+
+					#pragma omp simd
+					for (size_t i = 0; i < count; i++)
+					{
+						float diff = actionsRow[i] - meansRow[i];
+						squaredDistance[i] += diff * diff * invVariance;
+					}
+				}
+
+				const float* oldLogProbabilities = &data.logProbabilities(first);
+				const float* blockAdvantages = &advantages(first);
+
+				// Probability ratio and the derivative of the clipped objective with respect to the log probability
+				#pragma omp simd reduction(+:clippedCount, klSum, objectiveSum)
+				for (size_t i = 0; i < count; i++)
 				{
-					gradients(j, i) = actionGradient * (data.actions(j, i) - currentActionMeans(j, i));
+					float logRatio = -logNormalizer - 0.5f * squaredDistance[i] - oldLogProbabilities[i];
+					float ratio = std::exp(logRatio);
+					float advantage = blockAdvantages[i];
+
+					// The gradient is zero where the clipped term is the smaller one and is outside of the clip range
+					bool active = (advantage > 0 && ratio < 1 + clipThreshold) || (advantage < 0 && ratio > 1 - clipThreshold);
+
+					// The minus (-) is here because we need to flip the sign of the gradient since we later use 
+					// a gradient descent algorithm (instead of gradient ascent).
+					coefficients[i] = active ? -advantage * ratio : 0.0f;
+
+					clippedCount += (ratio > 1 + clipThreshold || ratio < 1 - clipThreshold) ? 1.0f : 0.0f;
+					klSum += (ratio - 1.0f) - logRatio; // Low variance estimator of KL(old || current)
+					objectiveSum += std::min(ratio * advantage, std::clamp(ratio, 1 - clipThreshold, 1 + clipThreshold) * advantage);
+				}
+
+				// Gradients of the objective with respect to the action means and the log standard deviations. 
+				// The derivative of the log probability is (a - mean) / var for the mean and 
+				// (a - mean)^2 / var - 1 for the log standard deviation.
+				for (size_t j = 0; j < actionDim; j++)
+				{
+					const float* actionsRow = &data.actions(j, first);
+					const float* meansRow = &actionMeans(j, first);
+					float* gradientsRow = &gradients(j, first);
+					const float invVariance = invVariances[j];
+
+					float logStdGradient = 0.0f;
+
+					#pragma omp simd reduction(+:logStdGradient)
+					for (size_t i = 0; i < count; i++)
+					{
+						float scaledDiff = (actionsRow[i] - meansRow[i]) * invVariance;
+
+						gradientsRow[i] = coefficients[i] * scaledDiff;
+						logStdGradient += coefficients[i] * (scaledDiff * (actionsRow[i] - meansRow[i]) - 1.0f);
+					}
+
+					threadLogStdGradients[j] += logStdGradient;
 				}
 			}
-			else // The clip is the smaller value and is outside of the clip range
+
+			#pragma omp critical
 			{
-				// The gradient for this timestep should be 0
-				for (int j = 0; j < gradients.rowsCount(); j++)
+				for (size_t j = 0; j < actionDim; j++)
 				{
-					gradients(j, i) = 0.0f;
+					logStdGradients(j) += threadLogStdGradients[j] / batchSize;
 				}
 			}
 		}
 
+		PolicyUpdateStats stats;
+
+		stats.clipFraction = clippedCount / batchSize;
+		stats.approxKL = klSum / batchSize;
+		stats.policyLoss = -objectiveSum / batchSize;
+
+		return stats;
+	}
+
+	void PPO::updateActionLogStd(const Matrix& logStdGradients, float beta1, float beta2, float epsilon)
+	{
+		float mCorrection = 1.0f / (1.0f - std::pow(beta1, (float)actionLogStdTimestep));
+		float vCorrection = 1.0f / (1.0f - std::pow(beta2, (float)actionLogStdTimestep));
+
+		for (size_t i = 0; i < actionLogStd.size(); i++)
+		{
+			float gradient = logStdGradients(i);
+
+			mActionLogStd(i) = mActionLogStd(i) * beta1 + gradient * (1.0f - beta1);
+			vActionLogStd(i) = vActionLogStd(i) * beta2 + gradient * gradient * (1.0f - beta2);
+
+			actionLogStd(i) -= mActionLogStd(i) * mCorrection * (learningRate / (std::sqrt(vActionLogStd(i) * vCorrection) + epsilon));
+			actionLogStd(i) = std::clamp(actionLogStd(i), MIN_ACTION_LOG_STD, MAX_ACTION_LOG_STD);
+		}
+
+		actionLogStdTimestep++;
+	}
+
+	PolicyUpdateStats PPO::updatePolicy(const RLTrainingData& data, const Matrix& advantages)
+	{
+		BASEML_PROFILE_SCOPE("PPO::updatePolicy");
+
+		const Matrix& currentActionMeans = actorNetwork.forwardPropagate(data.observations);
+
+		Matrix gradients(data.actions.rowsCount(), data.actions.columnsCount());
+		Matrix logStdGradients;
+
+		PolicyUpdateStats stats = computePolicyGradients(currentActionMeans, data, advantages, gradients, logStdGradients);
+
 		// Update actor network
-		actorNetwork.backPropagation(gradients, learningRate);
+		actorNetwork.calculateGradients(gradients);
 
-		actorNetwork.saveToFile(actorNetFile.c_str());
+		applyUpdate({ &actorNetwork }, &logStdGradients, data.observations.columnsCount());
+
+		return stats;
 	}
 
-	void PPO::fitValueFunction(const RLTrainingData& data)
+	float PPO::fitValueFunction(const RLTrainingData& data)
 	{
-		criticNetwork.learn(data.observations, data.rtgs, learningRate);
+		BASEML_PROFILE_SCOPE("PPO::fitValueFunction");
 
-		// Save network
-		std::ofstream ofile;
+		if (transport)
+		{
+			criticNetwork.forwardPropagate(data.observations);
+			criticNetwork.calculateGradientsToTarget(data.rtgs);
 
-		ofile.open(criticNetFile.c_str(), std::ios::binary | std::ios::out);
+			float loss = criticNetwork.calculateSumLoss(data.rtgs);
 
-		ofile.write(reinterpret_cast<const char*>(&timestepsLearned), sizeof(timestepsLearned));
-		criticNetwork.save(ofile);
+			applyUpdate({ &criticNetwork }, nullptr, data.observations.columnsCount());
+			return loss;
+		}
 
-		ofile.close();
+		if (criticTrainingThreads == 1)
+			return criticNetwork.learn(data.observations, data.rtgs, learningRate);
+
+		if (!criticTrainer)
+			criticTrainer = std::make_unique<DataParallelTrainer>(criticNetwork, criticTrainingThreads);
+
+		return criticTrainer->learn(data.observations, data.rtgs, learningRate);
+	}
+
+	PolicyUpdateStats PPO::updateSharedNetwork(const RLTrainingData& data, const Matrix& advantages)
+	{
+		BASEML_PROFILE_SCOPE("PPO::updateSharedNetwork");
+
+		// One forward pass of the trunk feeds both heads
+		const Matrix& features = trunkNetwork.forwardPropagate(data.observations);
+
+		const Matrix& currentActionMeans = actorNetwork.forwardPropagate(features);
+		criticNetwork.forwardPropagate(features);
+
+		// Gradients of the policy head
+		Matrix gradients(data.actions.rowsCount(), data.actions.columnsCount());
+		Matrix logStdGradients;
+
+		PolicyUpdateStats stats = computePolicyGradients(currentActionMeans, data, advantages, gradients, logStdGradients);
+
+		actorNetwork.calculateGradients(gradients);
+
+		// Gradients of the value head
+		criticNetwork.calculateGradientsToTarget(data.rtgs);
+
+		stats.valueLoss = criticNetwork.calculateSumLoss(data.rtgs);
+
+		// Gradients of the combined loss with respect to the trunk's output. These have to be calculated 
+		// before the heads are updated.
+		Matrix trunkGradients = actorNetwork.calculateInputGradients() + criticNetwork.calculateInputGradients() * valueLossCoefficient;
+
+		trunkNetwork.calculateGradients(trunkGradients);
+
+		// Update parameters
+		applyUpdate({ &trunkNetwork, &actorNetwork, &criticNetwork }, &logStdGradients, data.observations.columnsCount());
+
+		return stats;
+	}
+
+	PolicyUpdateStats PPO::updateRecurrentNetwork(const RLTrainingData& data, const Matrix& advantages, const std::vector<size_t>& batchSizes)
+	{
+		BASEML_PROFILE_SCOPE("PPO::updateRecurrentNetwork");
+
+		// One forward pass of the core over the segments feeds both heads
+		const Matrix& features = recurrentCore.forwardPropagate(data.observations, batchSizes, &data.segmentStates);
+
+		const Matrix& currentActionMeans = actorNetwork.forwardPropagate(features);
+		criticNetwork.forwardPropagate(features);
+
+		// Gradients of the policy head
+		Matrix gradients(data.actions.rowsCount(), data.actions.columnsCount());
+		Matrix logStdGradients;
+
+		PolicyUpdateStats stats = computePolicyGradients(currentActionMeans, data, advantages, gradients, logStdGradients);
+
+		actorNetwork.calculateGradients(gradients);
+
+		// Gradients of the value head
+		criticNetwork.calculateGradientsToTarget(data.rtgs);
+
+		stats.valueLoss = criticNetwork.calculateSumLoss(data.rtgs);
+
+		// Gradients of the combined loss with respect to the outputs of the core, back propagated through the time 
+		// of the segments. These have to be calculated before the heads are updated.
+		Matrix coreGradients = actorNetwork.calculateInputGradients() + criticNetwork.calculateInputGradients() * valueLossCoefficient;
+
+		recurrentCore.calculateGradients(coreGradients);
+
+		// Update parameters
+		applyUpdate({ &actorNetwork, &criticNetwork }, &logStdGradients, data.observations.columnsCount(), &recurrentCore);
+
+		return stats;
+	}
+
+	void PPO::logIterationMetrics()
+	{
+		Utils::MetricsLogger* logger = getMetricsLogger();
+
+		if (!logger)
+			return;
+
+		const IterationTimings& timings = lastTimings;
+		double updateSeconds = timings.policyUpdate + timings.valueFit;
+		double iterationSeconds = timings.collection + timings.advantage + updateSeconds + timings.checkpoint;
+
+		logger->log(Utils::MetricsRecord("ppo_iteration", timestepsLearned)
+			.add("average_episode_reward", lastEpisodeStats.averageReward)
+			.add("average_episode_length", lastEpisodeStats.averageLength)
+			.add("episodes", (double)lastEpisodeStats.episodes)
+			.add("policy_loss", lastPolicyStats.policyLoss)
+			.add("value_loss", lastPolicyStats.valueLoss)
+			.add("approx_kl", lastPolicyStats.approxKL)
+			.add("clip_fraction", lastPolicyStats.clipFraction)
+			.add("entropy", lastPolicyStats.entropy)
+			.add("environment_steps_per_second", timings.collection > 0.0 ? timings.environmentSteps / timings.collection : 0.0)
+			.add("update_samples_per_second", updateSeconds > 0.0 ? timings.updateSamples / updateSeconds : 0.0)
+			.add("iteration_seconds", iterationSeconds));
 	}
 
 	void PPO::save()
 	{
-		actorNetwork.saveToFile(actorNetFile.c_str());
+		BASEML_PROFILE_SCOPE("PPO::save");
+
+		std::ofstream afile(actorNetFile, std::ios::binary | std::ios::out);
+
+		if (sharedTrunk)
+		{
+			// The actor file holds the trunk followed by the policy head
+			trunkNetwork.save(afile);
+			actorNetwork.save(afile);
+		}
+		else if (recurrent)
+		{
+			// The actor file holds the recurrent core followed by the policy head
+			recurrentCore.save(afile);
+			actorNetwork.save(afile);
+		}
+		else
+		{
+			actorNetwork.save(afile);
+		}
+
+		// The actor needs the observation statistics to turn observations into actions, so they are saved with it
+		saveObservationNormalization(afile);
+
+		afile.close();
 
 		std::ofstream ofile;
 
@@ -334,6 +1506,9 @@ namespace BaseML::RL
 
 		ofile.write(reinterpret_cast<const char*>(&timestepsLearned), sizeof(timestepsLearned));
 		criticNetwork.save(ofile);
+		actionLogStd.save(ofile);
+		observationStats.save(ofile);
+		rewardStats.save(ofile);
 
 		ofile.close();
 	}
@@ -0,0 +1,189 @@
+#include "Policy.h"
+
+#include <fstream>
+#include <utility>
+
+#include "UtilsFunctions.h"
+#include "Profiler.h"
+
+namespace BaseML::RL
+{
+	Policy::Policy()
+		:structure(Structure::Actor), observationNormalization(false)
+	{
+	}
+
+	Policy::Policy(NeuralNetwork actor, const Utils::RunningStatistics* observationStats)
+		:structure(Structure::Actor), head(std::move(actor)), observationNormalization(observationStats != nullptr)
+	{
+		if (observationStats)
+			this->observationStats = *observationStats;
+	}
+
+	Policy::Policy(NeuralNetwork trunk, NeuralNetwork head, const Utils::RunningStatistics* observationStats)
+		:structure(Structure::SharedTrunk), trunk(std::move(trunk)), head(std::move(head)), observationNormalization(observationStats != nullptr)
+	{
+		if (observationStats)
+			this->observationStats = *observationStats;
+	}
+
+	Policy::Policy(RecurrentLayer core, NeuralNetwork head, const Utils::RunningStatistics* observationStats)
+		:structure(Structure::Recurrent), head(std::move(head)), core(std::move(core)), observationNormalization(observationStats != nullptr)
+	{
+		if (observationStats)
+			this->observationStats = *observationStats;
+	}
+
+	Policy::Structure Policy::getStructure() const
+	{
+		return structure;
+	}
+
+	size_t Policy::getObservationDimension() const
+	{
+		switch (structure)
+		{
+		case Structure::SharedTrunk:
+			return trunk.getInputCount();
+		case Structure::Recurrent:
+			return core.getInputCount();
+		default:
+			return head.getInputCount();
+		}
+	}
+
+	size_t Policy::getActionDimension() const
+	{
+		return head.getOutputCount();
+	}
+
+	size_t Policy::getStateSize() const
+	{
+		return structure == Structure::Recurrent ? core.getStateSize() : 0;
+	}
+
+	size_t Policy::getInputCount() const
+	{
+		return getObservationDimension() + getStateSize();
+	}
+
+	size_t Policy::getOutputCount() const
+	{
+		return getActionDimension() + getStateSize();
+	}
+
+	void Policy::normalizeObservations(Matrix& observations) const
+	{
+		if (observationNormalization)
+			observationStats.normalize(observations);
+	}
+
+	const Matrix& Policy::infer(const Matrix& inputs, PolicyWorkspace& workspace) const
+	{
+		BASEML_PROFILE_SCOPE("Policy::infer");
+
+		const size_t observationDimension = getObservationDimension();
+		const size_t stateSize = getStateSize();
+		const size_t batchSize = inputs.columnsCount();
+
+		// The observations are copied, so they can be normalized without changing the inputs
+		if (workspace.observations.rowsCount() != observationDimension || workspace.observations.columnsCount() != batchSize)
+			workspace.observations = Matrix(observationDimension, batchSize);
+
+		for (size_t i = 0; i < observationDimension; i++)
+		{
+			for (size_t j = 0; j < batchSize; j++)
+				workspace.observations(i, j) = inputs(i, j);
+		}
+
+		normalizeObservations(workspace.observations);
+
+		if (structure == Structure::Actor)
+			return head.infer(workspace.observations, workspace.head);
+
+		if (structure == Structure::SharedTrunk)
+			return head.infer(trunk.infer(workspace.observations, workspace.trunk), workspace.head);
+
+		// The states follow the observations in the inputs, and the new states follow the actions in the outputs
+		if (workspace.states.rowsCount() != stateSize || workspace.states.columnsCount() != batchSize)
+			workspace.states = Matrix(stateSize, batchSize, Matrix::Layout::ColumnMajor);
+
+		for (size_t j = 0; j < batchSize; j++)
+		{
+			for (size_t i = 0; i < stateSize; i++)
+				workspace.states(i, j) = inputs(observationDimension + i, j);
+		}
+
+		core.step(workspace.observations, workspace.states, workspace.coreOutputs);
+
+		const Matrix& actions = head.infer(workspace.coreOutputs, workspace.head);
+		const size_t actionDimension = actions.rowsCount();
+
+		if (workspace.outputs.rowsCount() != actionDimension + stateSize || workspace.outputs.columnsCount() != batchSize)
+			workspace.outputs = Matrix(actionDimension + stateSize, batchSize, Matrix::Layout::ColumnMajor);
+
+		for (size_t j = 0; j < batchSize; j++)
+		{
+			for (size_t i = 0; i < actionDimension; i++)
+				workspace.outputs(i, j) = actions(i, j);
+
+			for (size_t i = 0; i < stateSize; i++)
+				workspace.outputs(actionDimension + i, j) = workspace.states(i, j);
+		}
+
+		return workspace.outputs;
+	}
+
+	bool Policy::loadFromFile(const char* fileName, Structure structure, float(*outputActivationFunction)(float),
+		float(*outputActivationFunctionDerivative)(float))
+	{
+		try {
+			std::ifstream ifile(fileName, std::ios::binary | std::ios::in);
+
+			if (!ifile)
+				return false;
+
+			// The networks are loaded with the activation functions PPO gives them in every mode
+			if (structure == Structure::SharedTrunk)
+			{
+				trunk.load(ifile, &Utils::leakyReLU, &Utils::leakyReLUDerivative, &Utils::leakyReLU, &Utils::leakyReLUDerivative);
+				head.load(ifile, &Utils::linear, &Utils::linearDerivative, &Utils::linear, &Utils::linearDerivative);
+			}
+			else if (structure == Structure::Recurrent)
+			{
+				core.load(ifile);
+				head.load(ifile, &Utils::leakyReLU, &Utils::leakyReLUDerivative, &Utils::linear, &Utils::linearDerivative);
+			}
+			else
+			{
+				head.load(ifile, &Utils::leakyReLU, &Utils::leakyReLUDerivative, outputActivationFunction, outputActivationFunctionDerivative);
+			}
+
+			if (!ifile)
+				return false;
+
+			this->structure = structure;
+
+			// Files saved before the observation statistics were saved with the actor end after the networks
+			observationNormalization = false;
+			observationStats = Utils::RunningStatistics(getObservationDimension());
+
+			if (ifile.peek() != std::ifstream::traits_type::eof())
+			{
+				uint8_t normalize;
+
+				ifile.read(reinterpret_cast<char*>(&normalize), sizeof(normalize));
+				observationStats.load(ifile);
+
+				observationNormalization = normalize != 0;
+			}
+
+			ifile.close();
+		}
+		catch (...) {
+			return false;
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,356 @@
+#include "Profiler.h"
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <map>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+
+namespace BaseML::Utils
+{
+	namespace
+	{
+		struct EntryKey
+		{
+			const char* name;
+			long long id;
+
+			bool operator==(const EntryKey& other) const
+			{
+				return name == other.name && id == other.id;
+			}
+		};
+
+		struct EntryKeyHash
+		{
+			size_t operator()(const EntryKey& key) const
+			{
+				return std::hash<const void*>()(key.name) ^ (std::hash<long long>()(key.id) * 31);
+			}
+		};
+
+		struct EntryStats
+		{
+			uint64_t calls = 0;
+			int64_t nanoseconds = 0, maxNanoseconds = 0;
+			double flops = 0.0, bytes = 0.0;
+		};
+
+		// A call of a scope, with the times in nanoseconds since the start of the trace
+		struct TraceEvent
+		{
+			const char* name;
+			long long id;
+			int64_t start, duration;
+		};
+
+		// The data recorded by one thread. Only the thread writes to it, the mutex only contends with readers.
+		struct ThreadProfile
+		{
+			std::mutex mutex;
+			size_t index; // Order of registration, used as the thread id of the trace
+			std::string name;
+			std::unordered_map<EntryKey, EntryStats, EntryKeyHash> entries;
+			std::vector<TraceEvent> events;
+			uint64_t allocations = 0, allocatedBytes = 0;
+		};
+
+		int64_t toNanoseconds(Profiler::Clock::time_point time)
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+		}
+
+		struct ProfilerState
+		{
+			std::mutex mutex; // Guards the list of threads
+			std::vector<std::shared_ptr<ThreadProfile>> threads;
+
+			std::atomic<int64_t> startTime; // Nanoseconds since the epoch of the clock
+			std::atomic<bool> tracing{ false };
+			std::atomic<size_t> maxEventsPerThread{ 0 };
+
+			std::atomic<int64_t> summaryInterval{ 0 }, nextSummary{ 0 }; // Nanoseconds
+			std::atomic<std::ostream*> summaryOut{ nullptr };
+
+			ProfilerState()
+				:startTime(toNanoseconds(Profiler::Clock::now()))
+			{
+			}
+		};
+
+		ProfilerState& getState()
+		{
+			static ProfilerState state;
+
+			return state;
+		}
+
+		ThreadProfile& getThreadProfile()
+		{
+			thread_local std::shared_ptr<ThreadProfile> profile;
+
+			if (!profile)
+			{
+				ProfilerState& state = getState();
+				std::lock_guard<std::mutex> lock(state.mutex);
+
+				profile = std::make_shared<ThreadProfile>();
+				profile->index = state.threads.size();
+				profile->name = "thread " + std::to_string(profile->index);
+
+				state.threads.push_back(profile);
+			}
+
+			return *profile;
+		}
+
+		// Returns a copy of the list of threads, so their data can be read without holding the lock of the list
+		std::vector<std::shared_ptr<ThreadProfile>> getThreads()
+		{
+			ProfilerState& state = getState();
+			std::lock_guard<std::mutex> lock(state.mutex);
+
+			return state.threads;
+		}
+
+		void writeEscaped(std::ostream& out, const std::string& text)
+		{
+			for (char c : text)
+			{
+				if (c == '"' || c == '\\')
+					out << '\\';
+
+				out << c;
+			}
+		}
+	}
+
+	void ProfileSummary::print(std::ostream& out) const
+	{
+		std::ios::fmtflags flags = out.flags();
+
+		out << "Profile of " << threads << " threads over " << std::fixed << std::setprecision(3) << elapsedSeconds << " s" << std::endl;
+		out << std::left << std::setw(40) << "scope" << std::right << std::setw(10) << "calls" << std::setw(12) << "total ms"
+			<< std::setw(12) << "avg us" << std::setw(12) << "max us" << std::setw(10) << "GFLOP/s" << std::setw(10) << "GB/s" << std::endl;
+
+		for (const ProfileEntry& entry : entries)
+		{
+			std::string name = entry.id < 0 ? entry.name : entry.name + "[" + std::to_string(entry.id) + "]";
+
+			out << std::left << std::setw(40) << name << std::right << std::setw(10) << entry.calls
+				<< std::setw(12) << std::setprecision(3) << entry.seconds * 1.0e3
+				<< std::setw(12) << entry.seconds * 1.0e6 / (double)entry.calls
+				<< std::setw(12) << entry.maxSeconds * 1.0e6;
+
+			if (entry.flops > 0.0 || entry.bytes > 0.0)
+			{
+				out << std::setw(10) << std::setprecision(2) << entry.flops / entry.seconds * 1.0e-9
+					<< std::setw(10) << entry.bytes / entry.seconds * 1.0e-9;
+			}
+
+			out << std::endl;
+		}
+
+		out << "Allocations: " << allocations << " (" << std::setprecision(1) << (double)allocatedBytes / (1024.0 * 1024.0) << " MB)" << std::endl;
+
+		out.flags(flags);
+	}
+
+	bool Profiler::isEnabled()
+	{
+#ifdef BASEML_ENABLE_PROFILING
+		return true;
+#else
+		return false;
+#endif // BASEML_ENABLE_PROFILING
+	}
+
+	void Profiler::record(const char* name, long long id, double flops, double bytes, Clock::time_point start, Clock::time_point end)
+	{
+		ProfilerState& state = getState();
+		ThreadProfile& profile = getThreadProfile();
+
+		int64_t startNanoseconds = toNanoseconds(start), endNanoseconds = toNanoseconds(end);
+		int64_t duration = endNanoseconds - startNanoseconds;
+
+		{
+			std::lock_guard<std::mutex> lock(profile.mutex);
+
+			EntryStats& stats = profile.entries[{ name, id }];
+
+			stats.calls++;
+			stats.nanoseconds += duration;
+			stats.maxNanoseconds = std::max(stats.maxNanoseconds, duration);
+			stats.flops += flops;
+			stats.bytes += bytes;
+
+			if (state.tracing.load(std::memory_order_relaxed) && profile.events.size() < state.maxEventsPerThread.load(std::memory_order_relaxed))
+				profile.events.push_back({ name, id, startNanoseconds - state.startTime.load(std::memory_order_relaxed), duration });
+		}
+
+		// Periodic summary. Only the thread that moves the time of the next summary forward prints it.
+		int64_t interval = state.summaryInterval.load(std::memory_order_relaxed);
+
+		if (interval > 0)
+		{
+			int64_t next = state.nextSummary.load(std::memory_order_relaxed);
+
+			if (endNanoseconds >= next && state.nextSummary.compare_exchange_strong(next, endNanoseconds + interval))
+			{
+				std::ostream* out = state.summaryOut.load();
+
+				if (out)
+					printSummary(*out);
+			}
+		}
+	}
+
+	void Profiler::countAllocation(size_t bytes)
+	{
+		ThreadProfile& profile = getThreadProfile();
+		std::lock_guard<std::mutex> lock(profile.mutex);
+
+		profile.allocations++;
+		profile.allocatedBytes += bytes;
+	}
+
+	void Profiler::setThreadName(const std::string& name)
+	{
+		ThreadProfile& profile = getThreadProfile();
+		std::lock_guard<std::mutex> lock(profile.mutex);
+
+		profile.name = name;
+	}
+
+	ProfileSummary Profiler::getSummary()
+	{
+		ProfilerState& state = getState();
+
+		ProfileSummary summary;
+		summary.allocations = 0;
+		summary.allocatedBytes = 0;
+		summary.threads = 0;
+		summary.elapsedSeconds = (double)(toNanoseconds(Clock::now()) - state.startTime.load()) * 1.0e-9;
+
+		// Scopes are merged by their text, since the same literal may have a different address in every
+		// translation unit
+		std::map<std::pair<std::string, long long>, ProfileEntry> merged;
+
+		for (const std::shared_ptr<ThreadProfile>& profile : getThreads())
+		{
+			std::lock_guard<std::mutex> lock(profile->mutex);
+
+			if (profile->entries.empty() && profile->allocations == 0)
+				continue;
+
+			summary.threads++;
+			summary.allocations += profile->allocations;
+			summary.allocatedBytes += profile->allocatedBytes;
+
+			for (const auto& [key, stats] : profile->entries)
+			{
+				auto [position, inserted] = merged.try_emplace({ key.name, key.id }, ProfileEntry{ key.name, key.id, 0, 0.0, 0.0, 0.0, 0.0 });
+				ProfileEntry& entry = position->second;
+
+				entry.calls += stats.calls;
+				entry.seconds += (double)stats.nanoseconds * 1.0e-9;
+				entry.maxSeconds = std::max(entry.maxSeconds, (double)stats.maxNanoseconds * 1.0e-9);
+				entry.flops += stats.flops;
+				entry.bytes += stats.bytes;
+			}
+		}
+
+		for (auto& [key, entry] : merged)
+			summary.entries.push_back(std::move(entry));
+
+		std::sort(summary.entries.begin(), summary.entries.end(),
+			[](const ProfileEntry& a, const ProfileEntry& b) { return a.seconds > b.seconds; });
+
+		return summary;
+	}
+
+	void Profiler::printSummary(std::ostream& out)
+	{
+		getSummary().print(out);
+	}
+
+	void Profiler::setSummaryInterval(double seconds, std::ostream& out)
+	{
+		ProfilerState& state = getState();
+		int64_t interval = (int64_t)(seconds * 1.0e9);
+
+		state.summaryOut.store(&out);
+		state.nextSummary.store(toNanoseconds(Clock::now()) + interval);
+		state.summaryInterval.store(interval);
+	}
+
+	void Profiler::setTracing(bool enabled, size_t maxEventsPerThread)
+	{
+		ProfilerState& state = getState();
+
+		state.maxEventsPerThread.store(maxEventsPerThread);
+		state.tracing.store(enabled);
+	}
+
+	bool Profiler::writeChromeTrace(const char* path)
+	{
+		std::ofstream out(path);
+
+		if (!out)
+			return false;
+
+		out << "{\"traceEvents\":[\n";
+
+		bool first = true;
+
+		for (const std::shared_ptr<ThreadProfile>& profile : getThreads())
+		{
+			std::lock_guard<std::mutex> lock(profile->mutex);
+
+			// Name the track of the thread
+			out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << profile->index << ",\"args\":{\"name\":\"";
+			writeEscaped(out, profile->name);
+			out << "\"}}";
+
+			first = false;
+
+			// Complete events, with the times in microseconds
+			for (const TraceEvent& event : profile->events)
+			{
+				out << ",\n{\"name\":\"";
+				writeEscaped(out, event.name);
+				out << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << profile->index << std::fixed << std::setprecision(3)
+					<< ",\"ts\":" << (double)event.start * 1.0e-3 << ",\"dur\":" << (double)event.duration * 1.0e-3;
+
+				if (event.id >= 0)
+					out << ",\"args\":{\"id\":" << event.id << "}";
+
+				out << "}";
+			}
+		}
+
+		out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+		return out.good();
+	}
+
+	void Profiler::reset()
+	{
+		ProfilerState& state = getState();
+
+		for (const std::shared_ptr<ThreadProfile>& profile : getThreads())
+		{
+			std::lock_guard<std::mutex> lock(profile->mutex);
+
+			profile->entries.clear();
+			profile->events.clear();
+			profile->allocations = 0;
+			profile->allocatedBytes = 0;
+		}
+
+		state.startTime.store(toNanoseconds(Clock::now()));
+	}
+}
@@ -0,0 +1,689 @@
+#include "RecurrentLayer.h"
+
+#include <vector>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+#include "MatrixArena.h"
+#include "UtilsRandom.h"
+#include "Profiler.h"
+
+namespace BaseML
+{
+	namespace
+	{
+		inline float sigmoid(float x)
+		{
+			return 1.0f / (1.0f + std::exp(-x));
+		}
+	}
+
+	RecurrentLayer::RecurrentLayer()
+		:cell(Cell::LSTM), inputCount(0), hiddenCount(0), gateCount(0), inputRef(nullptr)
+	{
+	}
+
+	RecurrentLayer::RecurrentLayer(Cell cellType, size_t numInputs, size_t numHidden)
+		:cell(cellType), inputCount(numInputs), hiddenCount(numHidden), gateCount(cellType == Cell::LSTM ? 4 : 3), inputRef(nullptr)
+	{
+		const size_t gateRows = gateCount * hiddenCount;
+		const size_t biasCount = cell == Cell::LSTM ? gateRows : gateRows + hiddenCount;
+
+		inputWeights = Matrix(gateRows, inputCount, Matrix::Layout::ColumnMajor);
+		recurrentWeights = Matrix(gateRows, hiddenCount, Matrix::Layout::ColumnMajor);
+		biases = Matrix(biasCount, 1);
+
+		// Initialize the weights with random values and the biases with zeros
+		for (size_t i = 0; i < inputWeights.size(); i++)
+			inputWeights(i) = Utils::initFromNumInputs(numInputs);
+
+		for (size_t i = 0; i < recurrentWeights.size(); i++)
+			recurrentWeights(i) = Utils::initFromNumInputs(numHidden);
+
+		biases.clear();
+
+		// A forget gate that starts open lets the gradients flow through long sequences early in training
+		if (cell == Cell::LSTM)
+		{
+			for (size_t i = hiddenCount; i < 2 * hiddenCount; i++)
+				biases(i) = 1.0f;
+		}
+
+		// Initialize Adam Optimizer matrices
+		mInputWeights = Matrix(gateRows, inputCount, Matrix::Layout::ColumnMajor);
+		vInputWeights = Matrix(gateRows, inputCount, Matrix::Layout::ColumnMajor);
+		mRecurrentWeights = Matrix(gateRows, hiddenCount, Matrix::Layout::ColumnMajor);
+		vRecurrentWeights = Matrix(gateRows, hiddenCount, Matrix::Layout::ColumnMajor);
+		mBiases = Matrix(biasCount, 1);
+		vBiases = Matrix(biasCount, 1);
+
+		mInputWeights.clear();
+		vInputWeights.clear();
+		mRecurrentWeights.clear();
+		vRecurrentWeights.clear();
+		mBiases.clear();
+		vBiases.clear();
+	}
+
+	RecurrentLayer::Cell RecurrentLayer::getCell() const
+	{
+		return cell;
+	}
+
+	size_t RecurrentLayer::getInputCount() const
+	{
+		return inputCount;
+	}
+
+	size_t RecurrentLayer::getOutputCount() const
+	{
+		return hiddenCount;
+	}
+
+	size_t RecurrentLayer::getStateSize() const
+	{
+		return cell == Cell::LSTM ? 2 * hiddenCount : hiddenCount;
+	}
+
+	const Matrix& RecurrentLayer::getOutputs() const
+	{
+		return outputs;
+	}
+
+	const float* RecurrentLayer::previousHidden(size_t t, size_t column) const
+	{
+		if (t == 0)
+			return &initialStates(0, column);
+
+		return &outputs(0, timestepOffsets[t - 1] + column);
+	}
+
+	void RecurrentLayer::projectInputs(const Matrix& inputs, float* destination) const
+	{
+		const size_t gateRows = gateCount * hiddenCount;
+		const size_t count = inputs.columnsCount();
+		const float* weights = &inputWeights(0, 0);
+
+		BASEML_PROFILE_OPERATION("RecurrentLayer::projectInputs", 2 * gateRows * inputCount * count,
+			(gateRows * inputCount + (inputCount + gateRows) * count) * sizeof(float));
+
+		// One pass over the inputs of all of the timesteps: every column of the projections is the biases plus the
+		// columns of the weights scaled by the inputs of its data point, so the inner loop runs over all of the gates
+		#pragma omp parallel for if (gateRows * inputCount * count >= 32768)
+		for (int j = 0; j < (int)count; j++)
+		{
+			float* column = destination + j * gateRows;
+
+			std::copy(&biases(0), &biases(0) + gateRows, column);
+
+			for (size_t k = 0; k < inputCount; k++)
+			{
+				const float input = inputs(k, j);
+				const float* weightsColumn = weights + k * gateRows;
+
+				#pragma omp simd
+				for (size_t r = 0; r < gateRows; r++)
+				{
+					column[r] += input * weightsColumn[r];
+				}
+			}
+		}
+	}
+
+	void RecurrentLayer::recurrentStep(float* gateValues, const float* previousHidden, const float* previousCell, float* hidden,
+		float* cellState, float* recurrentPart) const
+	{
+		const size_t gateRows = gateCount * hiddenCount;
+		const size_t h = hiddenCount;
+		const float* weights = &recurrentWeights(0, 0);
+
+		// The recurrent part of an LSTM layer is added to the input projections directly. A GRU layer keeps it apart
+		// because the reset gate only scales the recurrent part of the candidate.
+		float* target = gateValues;
+
+		if (cell == Cell::GRU)
+		{
+			std::copy(&biases(gateRows), &biases(gateRows) + h, recurrentPart + 2 * h);
+			std::fill(recurrentPart, recurrentPart + 2 * h, 0.0f);
+
+			target = recurrentPart;
+		}
+
+		for (size_t k = 0; k < h; k++)
+		{
+			const float state = previousHidden[k];
+			const float* weightsColumn = weights + k * gateRows;
+
+			#pragma omp simd
+			for (size_t r = 0; r < gateRows; r++)
+			{
+				target[r] += state * weightsColumn[r];
+			}
+		}
+
+		// The gate kernel: the activation functions of all of the gates and the new state in one pass
+		if (cell == Cell::LSTM)
+		{
+			for (size_t u = 0; u < h; u++)
+			{
+				float inputGate = sigmoid(gateValues[u]);
+				float forgetGate = sigmoid(gateValues[h + u]);
+				float candidate = std::tanh(gateValues[2 * h + u]);
+				float outputGate = sigmoid(gateValues[3 * h + u]);
+
+				float newCell = forgetGate * previousCell[u] + inputGate * candidate;
+
+				cellState[u] = newCell;
+				hidden[u] = outputGate * std::tanh(newCell);
+
+				gateValues[u] = inputGate;
+				gateValues[h + u] = forgetGate;
+				gateValues[2 * h + u] = candidate;
+				gateValues[3 * h + u] = outputGate;
+			}
+		}
+		else
+		{
+			for (size_t u = 0; u < h; u++)
+			{
+				float resetGate = sigmoid(gateValues[u] + recurrentPart[u]);
+				float updateGate = sigmoid(gateValues[h + u] + recurrentPart[h + u]);
+				float candidate = std::tanh(gateValues[2 * h + u] + resetGate * recurrentPart[2 * h + u]);
+
+				cellState[u] = recurrentPart[2 * h + u];
+				hidden[u] = (1.0f - updateGate) * candidate + updateGate * previousHidden[u];
+
+				gateValues[u] = resetGate;
+				gateValues[h + u] = updateGate;
+				gateValues[2 * h + u] = candidate;
+			}
+		}
+	}
+
+	const Matrix& RecurrentLayer::forwardPropagate(const Matrix& inputs, const std::vector<size_t>& sizes, const Matrix* states)
+	{
+		BASEML_PROFILE_SCOPE("RecurrentLayer::forwardPropagate");
+
+		const size_t gateRows = gateCount * hiddenCount;
+
+		batchSizes = sizes;
+		timestepOffsets.resize(batchSizes.size());
+
+		size_t count = 0;
+
+		for (size_t t = 0; t < batchSizes.size(); t++)
+		{
+			timestepOffsets[t] = count;
+			count += batchSizes[t];
+		}
+
+#ifdef DEBUG
+		if (inputs.rowsCount() != inputCount || inputs.columnsCount() != count || batchSizes.empty())
+		{
+			std::cout << "Invalid input size for recurrent layer" << std::endl;
+			throw std::runtime_error("Invalid input size for recurrent layer");
+		}
+
+		for (size_t t = 1; t < batchSizes.size(); t++)
+		{
+			if (batchSizes[t] > batchSizes[t - 1])
+			{
+				std::cout << "The sequences of a recurrent layer should be sorted by decreasing length" << std::endl;
+				throw std::runtime_error("The sequences of a recurrent layer should be sorted by decreasing length");
+			}
+		}
+#endif // DEBUG
+
+		const size_t sequences = batchSizes[0];
+
+		inputRef = &inputs;
+
+		// The values are kept between batches, so they don't come from an arena
+		if (outputs.columnsCount() != count)
+		{
+			MatrixArena::HeapScope heap;
+
+			gates = Matrix(gateRows, count, Matrix::Layout::ColumnMajor);
+			outputs = Matrix(hiddenCount, count, Matrix::Layout::ColumnMajor);
+			cellValues = Matrix(hiddenCount, count, Matrix::Layout::ColumnMajor);
+		}
+
+		if (initialStates.columnsCount() != sequences)
+		{
+			MatrixArena::HeapScope heap;
+			initialStates = Matrix(getStateSize(), sequences, Matrix::Layout::ColumnMajor);
+		}
+
+		if (states)
+			initialStates.copyFrom(*states);
+		else
+			initialStates.clear();
+
+		// The input projections of all of the timesteps in one pass
+		projectInputs(inputs, &gates(0, 0));
+
+		// The timesteps run in order, each one parallel over its sequences
+		#pragma omp parallel if (sequences * gateRows * hiddenCount >= 32768)
+		{
+			std::vector<float> recurrentPart(cell == Cell::GRU ? gateRows : 0);
+
+			for (size_t t = 0; t < batchSizes.size(); t++)
+			{
+				const size_t offset = timestepOffsets[t];
+
+				#pragma omp for
+				for (int b = 0; b < (int)batchSizes[t]; b++)
+				{
+					const float* previousCell = t == 0 ? &initialStates(hiddenCount, b) : &cellValues(0, timestepOffsets[t - 1] + b);
+
+					recurrentStep(&gates(0, offset + b), previousHidden(t, b), cell == Cell::LSTM ? previousCell : nullptr,
+						&outputs(0, offset + b), &cellValues(0, offset + b), recurrentPart.data());
+				}
+			}
+		}
+
+		return outputs;
+	}
+
+	void RecurrentLayer::step(const Matrix& inputs, Matrix& states, Matrix& stepOutputs) const
+	{
+		const size_t gateRows = gateCount * hiddenCount;
+		const size_t count = inputs.columnsCount();
+
+		if (states.getLayout() != Matrix::Layout::ColumnMajor)
+			states = states.toLayout(Matrix::Layout::ColumnMajor);
+
+		if (stepOutputs.rowsCount() != hiddenCount || stepOutputs.columnsCount() != count)
+			stepOutputs = Matrix(hiddenCount, count);
+
+		Matrix projections(gateRows, count, Matrix::Layout::ColumnMajor);
+		projectInputs(inputs, &projections(0, 0));
+
+		#pragma omp parallel if (count * gateRows * hiddenCount >= 32768)
+		{
+			std::vector<float> recurrentPart(cell == Cell::GRU ? gateRows : 0), candidateParts(hiddenCount);
+
+			#pragma omp for
+			for (int b = 0; b < (int)count; b++)
+			{
+				// The new state is written over the old one
+				float* state = &states(0, b);
+				float* cellState = cell == Cell::LSTM ? state + hiddenCount : candidateParts.data();
+
+				recurrentStep(&projections(0, b), state, cellState, state, cellState, recurrentPart.data());
+
+				for (size_t u = 0; u < hiddenCount; u++)
+					stepOutputs(u, b) = state[u];
+			}
+		}
+	}
+
+	void RecurrentLayer::calculateGradients(const Matrix& outputGradients)
+	{
+		BASEML_PROFILE_SCOPE("RecurrentLayer::calculateGradients");
+
+		const size_t gateRows = gateCount * hiddenCount;
+		const size_t h = hiddenCount;
+		const size_t count = outputs.columnsCount();
+		const size_t sequences = batchSizes[0];
+
+#ifdef DEBUG
+		if (outputGradients.rowsCount() != hiddenCount || outputGradients.columnsCount() != count)
+		{
+			std::cout << "Invalid gradients size for recurrent layer" << std::endl;
+			throw std::runtime_error("Invalid gradients size for recurrent layer");
+		}
+#endif // DEBUG
+
+		if (gateGradients.columnsCount() != count)
+		{
+			MatrixArena::HeapScope heap;
+
+			gateGradients = Matrix(gateRows, count, Matrix::Layout::ColumnMajor);
+			candidateGradients = Matrix(cell == Cell::GRU ? h : 0, count, Matrix::Layout::ColumnMajor);
+		}
+
+		// The gradients with respect to the state of every sequence, carried from each timestep to the one before it
+		Matrix carried(getStateSize(), sequences, Matrix::Layout::ColumnMajor);
+		carried.clear();
+
+		const float* weights = &recurrentWeights(0, 0);
+
+		#pragma omp parallel if (sequences * gateRows * hiddenCount >= 32768)
+		{
+			std::vector<float> hiddenGradients(h);
+
+			for (size_t t = batchSizes.size(); t-- > 0;)
+			{
+				const size_t offset = timestepOffsets[t];
+
+				// A sequence only takes part from its last timestep backwards, until then its carried gradients stay zero
+				#pragma omp for
+				for (int b = 0; b < (int)batchSizes[t]; b++)
+				{
+					const size_t column = offset + b;
+
+					const float* gateValues = &gates(0, column);
+					float* gradients = &gateGradients(0, column);
+					float* carriedHidden = &carried(0, b);
+
+					for (size_t u = 0; u < h; u++)
+						hiddenGradients[u] = outputGradients(u, column) + carriedHidden[u];
+
+					if (cell == Cell::LSTM)
+					{
+						const float* cellState = &cellValues(0, column);
+						const float* previousCell = t == 0 ? &initialStates(h, b) : &cellValues(0, timestepOffsets[t - 1] + b);
+						float* carriedCell = &carried(h, b);
+
+						for (size_t u = 0; u < h; u++)
+						{
+							float inputGate = gateValues[u], forgetGate = gateValues[h + u];
+							float candidate = gateValues[2 * h + u], outputGate = gateValues[3 * h + u];
+							float cellActivation = std::tanh(cellState[u]);
+
+							float cellGradient = hiddenGradients[u] * outputGate * (1.0f - cellActivation * cellActivation) + carriedCell[u];
+
+							gradients[u] = cellGradient * candidate * inputGate * (1.0f - inputGate);
+							gradients[h + u] = cellGradient * previousCell[u] * forgetGate * (1.0f - forgetGate);
+							gradients[2 * h + u] = cellGradient * inputGate * (1.0f - candidate * candidate);
+							gradients[3 * h + u] = hiddenGradients[u] * cellActivation * outputGate * (1.0f - outputGate);
+
+							carriedCell[u] = cellGradient * forgetGate;
+						}
+
+						// The gradients of the previous hidden state are the transposed recurrent weights times the gate gradients
+						for (size_t k = 0; k < h; k++)
+						{
+							const float* weightsColumn = weights + k * gateRows;
+							float sum = 0.0f;
+
+							#pragma omp simd reduction(+:sum)
+							for (size_t r = 0; r < gateRows; r++)
+							{
+								sum += weightsColumn[r] * gradients[r];
+							}
+
+							carriedHidden[k] = sum;
+						}
+					}
+					else
+					{
+						const float* previous = previousHidden(t, b);
+						const float* candidateParts = &cellValues(0, column);
+						float* recurrentGradients = &candidateGradients(0, column);
+
+						for (size_t u = 0; u < h; u++)
+						{
+							float resetGate = gateValues[u], updateGate = gateValues[h + u], candidate = gateValues[2 * h + u];
+
+							float candidateGradient = hiddenGradients[u] * (1.0f - updateGate) * (1.0f - candidate * candidate);
+
+							gradients[u] = candidateGradient * candidateParts[u] * resetGate * (1.0f - resetGate);
+							gradients[h + u] = hiddenGradients[u] * (previous[u] - candidate) * updateGate * (1.0f - updateGate);
+							gradients[2 * h + u] = candidateGradient;
+
+							recurrentGradients[u] = candidateGradient * resetGate;
+						}
+
+						// The previous hidden state reaches the new one directly (through the update gate) and through the
+						// recurrent weights of the reset and update gates and of the candidate
+						for (size_t k = 0; k < h; k++)
+						{
+							const float* weightsColumn = weights + k * gateRows;
+							float sum = 0.0f;
+
+							#pragma omp simd reduction(+:sum)
+							for (size_t r = 0; r < 2 * h; r++)
+							{
+								sum += weightsColumn[r] * gradients[r];
+							}
+
+							#pragma omp simd reduction(+:sum)
+							for (size_t u = 0; u < h; u++)
+							{
+								sum += weightsColumn[2 * h + u] * recurrentGradients[u];
+							}
+
+							carriedHidden[k] = sum + hiddenGradients[k] * gateValues[h + k];
+						}
+					}
+				}
+			}
+		}
+	}
+
+	Matrix RecurrentLayer::calculateInputGradients() const
+	{
+		const size_t gateRows = gateCount * hiddenCount;
+		const size_t count = gateGradients.columnsCount();
+		const float* weights = &inputWeights(0, 0);
+
+		Matrix inputGradients(inputCount, count, Matrix::Layout::ColumnMajor);
+
+		#pragma omp parallel for if (gateRows * inputCount * count >= 32768)
+		for (int j = 0; j < (int)count; j++)
+		{
+			const float* gradients = &gateGradients(0, j);
+
+			for (size_t k = 0; k < inputCount; k++)
+			{
+				const float* weightsColumn = weights + k * gateRows;
+				float sum = 0.0f;
+
+				#pragma omp simd reduction(+:sum)
+				for (size_t r = 0; r < gateRows; r++)
+				{
+					sum += weightsColumn[r] * gradients[r];
+				}
+
+				inputGradients(k, j) = sum;
+			}
+		}
+
+		return inputGradients;
+	}
+
+	void RecurrentLayer::accumulateParameterGradients(float* dest, float scale) const
+	{
+		const size_t gateRows = gateCount * hiddenCount;
+		const size_t h = hiddenCount;
+		const size_t count = gateGradients.columnsCount();
+		const Matrix& inputs = *inputRef;
+
+		float* inputWeightsGrads = dest;
+		float* recurrentWeightsGrads = dest + inputWeights.size();
+		float* biasesGrads = recurrentWeightsGrads + recurrentWeights.size();
+
+		// Input weights: column k is the sum over the data points of input k times the gate gradients
+		#pragma omp parallel for if (gateRows * inputCount * count >= 32768)
+		for (int k = 0; k < (int)inputCount; k++)
+		{
+			float* gradsColumn = inputWeightsGrads + k * gateRows;
+
+			for (size_t j = 0; j < count; j++)
+			{
+				const float input = inputs(k, j) * scale;
+				const float* gradients = &gateGradients(0, j);
+
+				#pragma omp simd
+				for (size_t r = 0; r < gateRows; r++)
+				{
+					gradsColumn[r] += input * gradients[r];
+				}
+			}
+		}
+
+		// Recurrent weights: column k is the sum of hidden unit k of the previous timestep times the gradients of the
+		// recurrent part of the gates
+		#pragma omp parallel for if (gateRows * h * count >= 32768)
+		for (int k = 0; k < (int)h; k++)
+		{
+			float* gradsColumn = recurrentWeightsGrads + k * gateRows;
+
+			for (size_t t = 0; t < batchSizes.size(); t++)
+			{
+				for (size_t b = 0; b < batchSizes[t]; b++)
+				{
+					const size_t column = timestepOffsets[t] + b;
+					const float state = previousHidden(t, b)[k] * scale;
+					const float* gradients = &gateGradients(0, column);
+
+					if (cell == Cell::LSTM)
+					{
+						#pragma omp simd
+						for (size_t r = 0; r < gateRows; r++)
+						{
+							gradsColumn[r] += state * gradients[r];
+						}
+					}
+					else
+					{
+						const float* recurrentGradients = &candidateGradients(0, column);
+
+						#pragma omp simd
+						for (size_t r = 0; r < 2 * h; r++)
+						{
+							gradsColumn[r] += state * gradients[r];
+						}
+
+						#pragma omp simd
+						for (size_t u = 0; u < h; u++)
+						{
+							gradsColumn[2 * h + u] += state * recurrentGradients[u];
+						}
+					}
+				}
+			}
+		}
+
+		// Biases
+		for (size_t j = 0; j < count; j++)
+		{
+			const float* gradients = &gateGradients(0, j);
+
+			for (size_t r = 0; r < gateRows; r++)
+				biasesGrads[r] += gradients[r] * scale;
+
+			if (cell == Cell::GRU)
+			{
+				for (size_t u = 0; u < h; u++)
+					biasesGrads[gateRows + u] += candidateGradients(u, j) * scale;
+			}
+		}
+	}
+
+	void RecurrentLayer::adamGradientDescent(float learningRate, size_t timestep, float beta1, float beta2, float epsilon)
+	{
+		std::vector<float> gradients(getParameterCount(), 0.0f);
+
+		accumulateParameterGradients(gradients.data(), 1.0f / gateGradients.columnsCount());
+		adamUpdate(gradients.data(), learningRate, timestep, beta1, beta2, epsilon);
+	}
+
+	void RecurrentLayer::adamUpdate(const float* gradients, float learningRate, size_t timestep, float beta1, float beta2, float epsilon)
+	{
+		// Reads the gradients and reads and writes the parameters and both moments
+		BASEML_PROFILE_OPERATION("RecurrentLayer::adamUpdate", 10 * getParameterCount(), 7 * getParameterCount() * sizeof(float));
+
+		// Zero bias correction factors
+		const float mCorrection = 1.0f / (1.0f - std::pow(beta1, (float)timestep));
+		const float vCorrection = 1.0f / (1.0f - std::pow(beta2, (float)timestep));
+
+		// The parameters are updated matrix by matrix, in the order of getParameters()
+		Matrix* parameters[] = { &inputWeights, &recurrentWeights, &biases };
+		Matrix* firstMoments[] = { &mInputWeights, &mRecurrentWeights, &mBiases };
+		Matrix* secondMoments[] = { &vInputWeights, &vRecurrentWeights, &vBiases };
+
+		for (int p = 0; p < 3; p++)
+		{
+			Matrix& values = *parameters[p];
+			Matrix& m = *firstMoments[p];
+			Matrix& v = *secondMoments[p];
+
+			#pragma omp parallel for if (values.size() >= 32768)
+			for (int i = 0; i < (int)values.size(); i++)
+			{
+				float grad = gradients[i];
+
+				m(i) = m(i) * beta1 + grad * (1.0f - beta1);
+				v(i) = v(i) * beta2 + grad * grad * (1.0f - beta2);
+
+				values(i) = values(i) - m(i) * mCorrection * (learningRate / (std::sqrt(v(i) * vCorrection) + epsilon));
+			}
+
+			gradients += values.size();
+		}
+	}
+
+	size_t RecurrentLayer::getParameterCount() const
+	{
+		return inputWeights.size() + recurrentWeights.size() + biases.size();
+	}
+
+	void RecurrentLayer::getParameters(float* dest) const
+	{
+		for (const Matrix* parameters : { &inputWeights, &recurrentWeights, &biases })
+		{
+			std::copy(&(*parameters)(0), &(*parameters)(0) + parameters->size(), dest);
+			dest += parameters->size();
+		}
+	}
+
+	void RecurrentLayer::setParameters(const float* src)
+	{
+		for (Matrix* parameters : { &inputWeights, &recurrentWeights, &biases })
+		{
+			std::copy(src, src + parameters->size(), &(*parameters)(0));
+			src += parameters->size();
+		}
+	}
+
+	void RecurrentLayer::addParameterGradients(float* dest) const
+	{
+		accumulateParameterGradients(dest, 1.0f);
+	}
+
+	void RecurrentLayer::applyParameterGradients(const float* gradients, float learningRate, size_t timestep, float beta1, float beta2, float epsilon)
+	{
+		adamUpdate(gradients, learningRate, timestep, beta1, beta2, epsilon);
+	}
+
+	void RecurrentLayer::save(std::ofstream& outFile)
+	{
+		int cellType = (int)cell;
+
+		outFile.write(reinterpret_cast<const char*>(&cellType), sizeof(cellType));
+		outFile.write(reinterpret_cast<const char*>(&inputCount), sizeof(inputCount));
+		outFile.write(reinterpret_cast<const char*>(&hiddenCount), sizeof(hiddenCount));
+
+		inputWeights.save(outFile);
+		recurrentWeights.save(outFile);
+		biases.save(outFile);
+	}
+
+	void RecurrentLayer::load(std::ifstream& inFile)
+	{
+		int cellType;
+		size_t numInputs, numHidden;
+
+		inFile.read(reinterpret_cast<char*>(&cellType), sizeof(cellType));
+		inFile.read(reinterpret_cast<char*>(&numInputs), sizeof(numInputs));
+		inFile.read(reinterpret_cast<char*>(&numHidden), sizeof(numHidden));
+
+		if (!inFile || (cellType != (int)Cell::LSTM && cellType != (int)Cell::GRU))
+			throw std::runtime_error("Invalid recurrent layer in the file");
+
+		// Start from a new layer of the saved shape (with fresh optimizer moments) and read its parameters
+		*this = RecurrentLayer((Cell)cellType, numInputs, numHidden);
+
+		inputWeights.load(inFile);
+		recurrentWeights.load(inFile);
+		biases.load(inFile);
+
+		// Matrices are loaded row-major
+		inputWeights = inputWeights.toLayout(Matrix::Layout::ColumnMajor);
+		recurrentWeights = recurrentWeights.toLayout(Matrix::Layout::ColumnMajor);
+	}
+}
@@ -0,0 +1,188 @@
+#include "ResidualLayer.h"
+
+#include <vector>
+#include <fstream>
+
+#include "MatrixArena.h"
+
+namespace BaseML
+{
+	ResidualLayer::ResidualLayer()
+		:block()
+	{
+	}
+
+	ResidualLayer::ResidualLayer(size_t size, float(*activationFunction)(float), float(*activationFunctionDerivative)(float))
+		:block(size, size, activationFunction, activationFunctionDerivative)
+	{
+	}
+
+	void ResidualLayer::setActivationFunction(float(*activationFunction)(float), float(*activationFunctionDerivative)(float))
+	{
+		block.setActivationFunction(activationFunction, activationFunctionDerivative);
+	}
+
+	size_t ResidualLayer::getInputCount() const
+	{
+		return block.getInputCount();
+	}
+
+	size_t ResidualLayer::getOutputCount() const
+	{
+		return block.getOutputCount();
+	}
+
+	size_t ResidualLayer::getCurrentBatchSize() const
+	{
+		return block.getCurrentBatchSize();
+	}
+
+	const Matrix& ResidualLayer::getOutputs() const
+	{
+		return outputs;
+	}
+
+	const Layer& ResidualLayer::getBlock() const
+	{
+		return block;
+	}
+
+	void ResidualLayer::addSkip(const Matrix& inputs, Matrix& outputs)
+	{
+		if (inputs.getLayout() == outputs.getLayout())
+		{
+			#pragma omp parallel for if (outputs.size() >= 32768)
+			for (int i = 0; i < (int)outputs.size(); i++)
+			{
+				outputs(i) += inputs(i);
+			}
+
+			return;
+		}
+
+		#pragma omp parallel for if (outputs.size() >= 32768)
+		for (int i = 0; i < (int)outputs.rowsCount(); i++)
+		{
+			for (size_t j = 0; j < outputs.columnsCount(); j++)
+			{
+				outputs(i, j) += inputs(i, j);
+			}
+		}
+	}
+
+	void ResidualLayer::calculateOutputs(const Matrix* inputs)
+	{
+		block.calculateOutputs(inputs);
+
+		// The outputs of the dense part are kept for its backward pass, so the sum is written to a buffer of its
+		// own (reused between batches)
+		const Matrix& blockOutputs = block.getOutputs();
+
+		if (outputs.rowsCount() != blockOutputs.rowsCount() || outputs.columnsCount() != blockOutputs.columnsCount() ||
+			outputs.getLayout() != blockOutputs.getLayout())
+		{
+			MatrixArena::HeapScope heap;
+			outputs = Matrix(blockOutputs.rowsCount(), blockOutputs.columnsCount(), blockOutputs.getLayout());
+		}
+
+		outputs.copyFrom(blockOutputs);
+		addSkip(*inputs, outputs);
+	}
+
+	void ResidualLayer::calculateOutputs(const Matrix& inputs, Matrix& outputs) const
+	{
+		block.calculateOutputs(inputs, outputs);
+		addSkip(inputs, outputs);
+	}
+
+	void ResidualLayer::calculateLastLayerGradientsToTarget(const Matrix& expectedOutputs, float(*lossFunctionDerivative)(float, float))
+	{
+		if (outputGradients.rowsCount() != outputs.rowsCount() || outputGradients.columnsCount() != outputs.columnsCount() ||
+			outputGradients.getLayout() != outputs.getLayout())
+		{
+			MatrixArena::HeapScope heap;
+			outputGradients = Matrix(outputs.rowsCount(), outputs.columnsCount(), outputs.getLayout());
+		}
+
+		#pragma omp parallel for if (outputs.size() >= 32768)
+		for (int i = 0; i < (int)outputs.rowsCount(); i++)
+		{
+			for (size_t j = 0; j < outputs.columnsCount(); j++)
+			{
+				outputGradients(i, j) = (*lossFunctionDerivative)(outputs(i, j), expectedOutputs(i, j));
+			}
+		}
+
+		block.calculateLastLayerGradients(outputGradients);
+	}
+
+	void ResidualLayer::calculateLastLayerGradients(const Matrix& externalGradients)
+	{
+		// The gradients of the outputs are kept for the skip connection's part of the input gradients
+		if (outputGradients.rowsCount() != outputs.rowsCount() || outputGradients.columnsCount() != outputs.columnsCount() ||
+			outputGradients.getLayout() != outputs.getLayout())
+		{
+			MatrixArena::HeapScope heap;
+			outputGradients = Matrix(outputs.rowsCount(), outputs.columnsCount(), outputs.getLayout());
+		}
+
+		outputGradients.copyFrom(externalGradients);
+
+		block.calculateLastLayerGradients(externalGradients);
+	}
+
+	Matrix ResidualLayer::calculateInputGradients() const
+	{
+		// The gradients through the dense part plus the gradients through the skip connection
+		Matrix inputGradients = block.calculateInputGradients();
+
+		addSkip(outputGradients, inputGradients);
+
+		return inputGradients;
+	}
+
+	void ResidualLayer::adamGradientDescent(float learningRate, size_t timestep, float beta1, float beta2, float epsilon)
+	{
+		block.adamGradientDescent(learningRate, timestep, beta1, beta2, epsilon);
+	}
+
+	size_t ResidualLayer::getParameterCount() const
+	{
+		return block.getParameterCount();
+	}
+
+	void ResidualLayer::getParameters(float* dest) const
+	{
+		block.getParameters(dest);
+	}
+
+	void ResidualLayer::setParameters(const float* src)
+	{
+		block.setParameters(src);
+	}
+
+	void ResidualLayer::getParameterSpans(std::vector<std::span<float>>& spans)
+	{
+		block.getParameterSpans(spans);
+	}
+
+	void ResidualLayer::addParameterGradients(float* dest) const
+	{
+		block.addParameterGradients(dest);
+	}
+
+	void ResidualLayer::applyParameterGradients(const float* gradients, float learningRate, size_t timestep, float beta1, float beta2, float epsilon)
+	{
+		block.applyParameterGradients(gradients, learningRate, timestep, beta1, beta2, epsilon);
+	}
+
+	void ResidualLayer::save(std::ofstream& outFile)
+	{
+		block.save(outFile);
+	}
+
+	void ResidualLayer::load(std::ifstream& inFile, float(*activationFunction)(float), float(*activationFunctionDerivative)(float))
+	{
+		block.load(inFile, activationFunction, activationFunctionDerivative);
+	}
+}
@@ -0,0 +1,315 @@
+#include "RolloutFile.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace BaseML::RL
+{
+	namespace
+	{
+		uint64_t alignOffset(uint64_t offset)
+		{
+			return (offset + RolloutFileHeader::ALIGNMENT - 1) & ~(uint64_t)(RolloutFileHeader::ALIGNMENT - 1);
+		}
+
+		// Round to the nearest bfloat16 (ties to even)
+		uint16_t toBFloat16(float value)
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+
+			// Keep NaNs NaN after the truncation
+			if ((bits & 0x7fffffff) > 0x7f800000)
+				return (uint16_t)((bits >> 16) | 0x40);
+
+			bits += 0x7fff + ((bits >> 16) & 1);
+
+			return (uint16_t)(bits >> 16);
+		}
+
+		float fromBFloat16(uint16_t value)
+		{
+			uint32_t bits = (uint32_t)value << 16;
+
+			float result;
+			std::memcpy(&result, &bits, sizeof(result));
+
+			return result;
+		}
+
+		size_t getColumnRows(const RolloutFileHeader& header, RolloutColumn column)
+		{
+			switch (column)
+			{
+			case RolloutColumn::Observations:
+				return header.observationDimension;
+			case RolloutColumn::Actions:
+				return header.actionDimension;
+			default:
+				return 1;
+			}
+		}
+	}
+
+	// RolloutWriter
+
+	RolloutWriter::RolloutWriter(const char* path, size_t observationDimension, size_t actionDimension, bool bfloat16, bool append)
+		:header{ RolloutFileHeader::MAGIC, RolloutFileHeader::VERSION, observationDimension, actionDimension,
+		bfloat16 ? RolloutFileHeader::BFloat16 : RolloutFileHeader::Float32, 0, 0, alignOffset(sizeof(RolloutFileHeader)), 0 }
+	{
+		if (append)
+			file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+
+		if (file.is_open())
+		{
+			// Continue the existing file. The new chunks are written after its index.
+			RolloutFileHeader existing;
+
+			if (!file.read(reinterpret_cast<char*>(&existing), sizeof(existing)) || existing.magic != RolloutFileHeader::MAGIC ||
+				existing.version != RolloutFileHeader::VERSION)
+				throw std::runtime_error(std::string("Not a valid rollout file: ") + path);
+
+			if (existing.observationDimension != observationDimension || existing.actionDimension != actionDimension ||
+				existing.valueType != header.valueType)
+				throw std::runtime_error(std::string("The rollout file doesn't match the appended data: ") + path);
+
+			chunks.resize(existing.chunkCount);
+
+			file.seekg(existing.indexOffset);
+			file.read(reinterpret_cast<char*>(chunks.data()), chunks.size() * sizeof(RolloutChunkEntry));
+
+			if (!file)
+				throw std::runtime_error(std::string("Failed to read the index of rollout file ") + path);
+
+			header = existing;
+		}
+		else
+		{
+			file.clear();
+			file.open(path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+
+			if (!file)
+				throw std::runtime_error(std::string("Failed to create rollout file ") + path);
+
+			writeIndex();
+		}
+	}
+
+	uint64_t RolloutWriter::writeColumn(const Matrix& values)
+	{
+		// The file stores the values row by row
+		if (values.getLayout() != Matrix::Layout::RowMajor)
+			return writeColumn(values.toLayout(Matrix::Layout::RowMajor));
+
+		static const char padding[RolloutFileHeader::ALIGNMENT] = {};
+
+		uint64_t position = (uint64_t)file.tellp();
+		uint64_t offset = alignOffset(position);
+
+		file.write(padding, offset - position);
+
+		if (header.valueType == RolloutFileHeader::Float32)
+		{
+			file.write(reinterpret_cast<const char*>(&values(0)), values.size() * sizeof(float));
+		}
+		else
+		{
+			conversionBuffer.resize(values.size());
+
+			for (size_t i = 0; i < values.size(); i++)
+				conversionBuffer[i] = toBFloat16(values(i));
+
+			file.write(reinterpret_cast<const char*>(conversionBuffer.data()), conversionBuffer.size() * sizeof(uint16_t));
+		}
+
+		return offset;
+	}
+
+	void RolloutWriter::writeIndex()
+	{
+		uint64_t position = (uint64_t)file.tellp();
+
+		// The index of an empty file directly follows the header
+		if (chunks.empty())
+			position = alignOffset(sizeof(RolloutFileHeader));
+
+		static const char padding[RolloutFileHeader::ALIGNMENT] = {};
+
+		header.indexOffset = alignOffset(position);
+		header.chunkCount = chunks.size();
+
+		file.seekp(position);
+		file.write(padding, header.indexOffset - position);
+		file.write(reinterpret_cast<const char*>(chunks.data()), chunks.size() * sizeof(RolloutChunkEntry));
+
+		// The header is only changed once the new index is complete
+		file.flush();
+
+		file.seekp(0);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(padding, alignOffset(sizeof(header)) - sizeof(header));
+
+		file.flush();
+
+		if (!file)
+			throw std::runtime_error("Failed to write the rollout file");
+	}
+
+	void RolloutWriter::append(const RLTrainingData& data)
+	{
+		const Matrix* columns[] = { &data.observations, &data.actions, &data.rewards, &data.logProbabilities, &data.dones };
+
+		RolloutChunkEntry chunk;
+		chunk.count = data.observations.columnsCount();
+
+		for (size_t c = 0; c < (size_t)RolloutColumn::Count; c++)
+		{
+			if (columns[c]->rowsCount() != getColumnRows(header, (RolloutColumn)c) || columns[c]->columnsCount() != chunk.count)
+				throw std::invalid_argument("The rollout data doesn't match the dimensions of the rollout file");
+		}
+
+		if (chunk.count == 0)
+			return;
+
+		// The new chunk starts after the current index, which stays valid until the header points to the new one
+		file.seekp(header.indexOffset + header.chunkCount * sizeof(RolloutChunkEntry));
+
+		for (size_t c = 0; c < (size_t)RolloutColumn::Count; c++)
+			chunk.columnOffsets[c] = writeColumn(*columns[c]);
+
+		file.flush();
+
+		chunks.push_back(chunk);
+		header.dataPointCount += chunk.count;
+
+		writeIndex();
+	}
+
+	size_t RolloutWriter::getChunkCount() const
+	{
+		return chunks.size();
+	}
+
+	void RolloutWriter::close()
+	{
+		file.close();
+	}
+
+	// RolloutReader
+
+	RolloutReader::RolloutReader(const char* path)
+		:file(path, true)
+	{
+		if (file.size() < sizeof(header))
+			throw std::runtime_error(std::string("Not a valid rollout file: ") + path);
+
+		std::memcpy(&header, file.getData(), sizeof(header));
+
+		if (header.magic != RolloutFileHeader::MAGIC || header.version != RolloutFileHeader::VERSION)
+			throw std::runtime_error(std::string("Not a valid rollout file: ") + path);
+
+		const uint64_t fileSize = file.size();
+
+		if (header.valueType != RolloutFileHeader::Float32 && header.valueType != RolloutFileHeader::BFloat16)
+			throw std::runtime_error(std::string("Not a valid rollout file: ") + path);
+
+		// The sizes are compared by division, so corrupted values can't make the sums wrap around
+		if (header.indexOffset > fileSize || header.chunkCount > (fileSize - header.indexOffset) / sizeof(RolloutChunkEntry))
+			throw std::runtime_error(std::string("Rollout file is truncated: ") + path);
+
+		chunks = reinterpret_cast<const RolloutChunkEntry*>(file.getData() + header.indexOffset);
+
+		// Every column of every chunk should be inside the file before any of them is read
+		if (header.observationDimension > fileSize || header.actionDimension > fileSize)
+			throw std::runtime_error(std::string("Not a valid rollout file: ") + path);
+
+		const uint64_t valueSize = isBFloat16() ? sizeof(uint16_t) : sizeof(float);
+		uint64_t dataPoints = 0;
+
+		for (size_t chunk = 0; chunk < header.chunkCount; chunk++)
+		{
+			const RolloutChunkEntry& entry = chunks[chunk];
+
+			for (size_t column = 0; column < (size_t)RolloutColumn::Count; column++)
+			{
+				const uint64_t offset = entry.columnOffsets[column];
+				const uint64_t rowBytes = getColumnRows(header, (RolloutColumn)column) * valueSize;
+
+				if (offset > fileSize || offset % valueSize != 0 || (rowBytes != 0 && entry.count > (fileSize - offset) / rowBytes))
+					throw std::runtime_error(std::string("Rollout file has an invalid chunk: ") + path);
+			}
+
+			dataPoints += entry.count;
+		}
+
+		if (dataPoints != header.dataPointCount)
+			throw std::runtime_error(std::string("Rollout file has an invalid chunk: ") + path);
+	}
+
+	size_t RolloutReader::getObservationDimension() const
+	{
+		return header.observationDimension;
+	}
+
+	size_t RolloutReader::getActionDimension() const
+	{
+		return header.actionDimension;
+	}
+
+	bool RolloutReader::isBFloat16() const
+	{
+		return header.valueType == RolloutFileHeader::BFloat16;
+	}
+
+	size_t RolloutReader::getChunkCount() const
+	{
+		return header.chunkCount;
+	}
+
+	size_t RolloutReader::getChunkSize(size_t chunk) const
+	{
+		return chunks[chunk].count;
+	}
+
+	size_t RolloutReader::size() const
+	{
+		return header.dataPointCount;
+	}
+
+	Matrix RolloutReader::getColumn(size_t chunk, RolloutColumn column) const
+	{
+		if (chunk >= header.chunkCount)
+			throw std::out_of_range("Rollout chunk index out of range");
+
+		const size_t rows = getColumnRows(header, column);
+		const size_t count = chunks[chunk].count;
+
+		char* values = file.getWritableData() + chunks[chunk].columnOffsets[(size_t)column];
+
+		if (header.valueType == RolloutFileHeader::Float32)
+			return Matrix::view(reinterpret_cast<float*>(values), rows, count);
+
+		Matrix result(rows, count);
+		const uint16_t* stored = reinterpret_cast<const uint16_t*>(values);
+
+		#pragma omp parallel for
+		for (long long i = 0; i < (long long)result.size(); i++)
+			result(i) = fromBFloat16(stored[i]);
+
+		return result;
+	}
+
+	RLTrainingData RolloutReader::readChunk(size_t chunk) const
+	{
+		RLTrainingData data;
+
+		data.observations = getColumn(chunk, RolloutColumn::Observations);
+		data.actions = getColumn(chunk, RolloutColumn::Actions);
+		data.rewards = getColumn(chunk, RolloutColumn::Rewards);
+		data.logProbabilities = getColumn(chunk, RolloutColumn::LogProbabilities);
+		data.dones = getColumn(chunk, RolloutColumn::Dones);
+
+		return data;
+	}
+}
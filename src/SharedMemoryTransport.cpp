@@ -0,0 +1,238 @@
+#include "SharedMemoryTransport.h"
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif // __linux__
+
+namespace BaseML
+{
+	namespace
+	{
+		constexpr size_t CACHE_LINE_SIZE = 64;
+		constexpr uint32_t INITIALIZED_MAGIC = 0x42534d54;
+
+		size_t alignToCacheLine(size_t size)
+		{
+			return (size + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+		}
+	}
+
+	struct SharedMemoryTransport::Header
+	{
+		alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> initialized; // Set by rank 0 when the segment is ready
+		int32_t ownerProcessId; // The process of rank 0, written before 'initialized'
+		alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> arrived; // Number of processes waiting at the barrier
+		alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> generation; // Incremented every time the barrier opens
+	};
+
+	SharedMemoryTransport::SharedMemoryTransport(const char* name, size_t rank, size_t worldSize, size_t slotBytes)
+		:name(name), rank(rank), worldSize(worldSize), slotBytes(slotBytes & ~(CACHE_LINE_SIZE - 1)), sharedMemory(nullptr), sharedMemorySize(0)
+	{
+		if (rank >= worldSize)
+			throw std::invalid_argument("The rank should be smaller than the world size");
+
+		if (this->slotBytes == 0)
+			throw std::invalid_argument("The shared memory slots are too small");
+
+		// POSIX shared memory names start with a slash
+		if (this->name.empty() || this->name[0] != '/')
+			this->name = "/" + this->name;
+
+		// A slot for every process and a slot for the results
+		sharedMemorySize = alignToCacheLine(sizeof(Header)) + (worldSize + 1) * this->slotBytes;
+
+#ifdef __linux__
+		int fd;
+
+		if (rank == 0)
+		{
+			// A segment with this name may belong to another run, or be left by a run that didn't exit cleanly and
+			// already have other processes attached to it, so it is never reused
+			fd = shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+
+			if (fd < 0 && errno == EEXIST)
+				throw std::runtime_error("Shared memory segment " + this->name + " already exists. Use a name unique to the training run.");
+
+			if (fd >= 0 && ftruncate(fd, sharedMemorySize) != 0)
+			{
+				::close(fd);
+				shm_unlink(this->name.c_str());
+				fd = -1;
+			}
+
+			if (fd < 0)
+				throw std::runtime_error("Failed to create shared memory segment " + this->name);
+		}
+		else
+		{
+			// Wait until rank 0 created the segment and set its size
+			struct stat info;
+
+			while ((fd = shm_open(this->name.c_str(), O_RDWR, 0600)) < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size < sharedMemorySize)
+			{
+				if (fd >= 0)
+					::close(fd);
+
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+
+		sharedMemory = mmap(nullptr, sharedMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+
+		if (sharedMemory == MAP_FAILED)
+		{
+			sharedMemory = nullptr;
+
+			if (rank == 0)
+				shm_unlink(this->name.c_str());
+
+			throw std::runtime_error("Failed to map shared memory segment " + this->name);
+		}
+
+		if (rank == 0)
+		{
+			new (sharedMemory) Header{ {0}, (int32_t)getpid(), {0}, {0} };
+			getHeader()->initialized.store(INITIALIZED_MAGIC, std::memory_order_release);
+		}
+		else
+		{
+			while (getHeader()->initialized.load(std::memory_order_acquire) != INITIALIZED_MAGIC)
+				std::this_thread::yield();
+
+			// A segment whose rank 0 exited is left by an earlier run, and nobody else would arrive at its barrier
+			if (::kill(getHeader()->ownerProcessId, 0) != 0 && errno == ESRCH)
+			{
+				munmap(sharedMemory, sharedMemorySize);
+				sharedMemory = nullptr;
+
+				throw std::runtime_error("Shared memory segment " + this->name + " was left by an earlier run");
+			}
+		}
+
+		// Wait until all of the processes are attached. The name isn't needed after that.
+		barrier();
+
+		if (rank == 0)
+			shm_unlink(this->name.c_str());
+#else
+		throw std::runtime_error("SharedMemoryTransport is only supported on Linux");
+#endif // __linux__
+	}
+
+	SharedMemoryTransport::~SharedMemoryTransport()
+	{
+#ifdef __linux__
+		if (sharedMemory)
+			munmap(sharedMemory, sharedMemorySize);
+#endif // __linux__
+	}
+
+	size_t SharedMemoryTransport::getRank() const
+	{
+		return rank;
+	}
+
+	size_t SharedMemoryTransport::getWorldSize() const
+	{
+		return worldSize;
+	}
+
+	SharedMemoryTransport::Header* SharedMemoryTransport::getHeader() const
+	{
+		return static_cast<Header*>(sharedMemory);
+	}
+
+	char* SharedMemoryTransport::getSlot(size_t slotRank) const
+	{
+		return static_cast<char*>(sharedMemory) + alignToCacheLine(sizeof(Header)) + slotRank * slotBytes;
+	}
+
+	void SharedMemoryTransport::barrier()
+	{
+		Header* header = getHeader();
+
+		uint32_t generation = header->generation.load(std::memory_order_acquire);
+
+		if (header->arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == worldSize)
+		{
+			// The last process to arrive opens the barrier
+			header->arrived.store(0, std::memory_order_relaxed);
+			header->generation.fetch_add(1, std::memory_order_release);
+		}
+		else
+		{
+			while (header->generation.load(std::memory_order_acquire) == generation)
+				std::this_thread::yield();
+		}
+	}
+
+	void SharedMemoryTransport::allReduceElements(void* data, size_t count, ElementType type)
+	{
+		const size_t size = elementSize(type);
+		const size_t chunkCount = slotBytes / size;
+
+		char* bytes = static_cast<char*>(data);
+		char* results = getSlot(worldSize);
+
+		for (size_t offset = 0; offset < count; offset += chunkCount)
+		{
+			size_t chunk = std::min(chunkCount, count - offset);
+
+			std::memcpy(getSlot(rank), bytes + offset * size, chunk * size);
+
+			barrier();
+
+			// Sum this process's share of the chunk over all of the slots, in rank order
+			size_t begin = chunk * rank / worldSize;
+			size_t end = chunk * (rank + 1) / worldSize;
+
+			std::memcpy(results + begin * size, getSlot(0) + begin * size, (end - begin) * size);
+
+			for (size_t r = 1; r < worldSize; r++)
+				addElements(results + begin * size, getSlot(r) + begin * size, end - begin, type);
+
+			barrier();
+
+			std::memcpy(bytes + offset * size, results, chunk * size);
+
+			// The slots are overwritten by the next chunk
+			barrier();
+		}
+	}
+
+	void SharedMemoryTransport::broadcastBytes(void* data, size_t bytes, size_t root)
+	{
+		char* buffer = static_cast<char*>(data);
+		char* results = getSlot(worldSize);
+
+		for (size_t offset = 0; offset < bytes; offset += slotBytes)
+		{
+			size_t chunk = std::min(slotBytes, bytes - offset);
+
+			if (rank == root)
+				std::memcpy(results, buffer + offset, chunk);
+
+			barrier();
+
+			if (rank != root)
+				std::memcpy(buffer + offset, results, chunk);
+
+			barrier();
+		}
+	}
+}
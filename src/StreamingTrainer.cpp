@@ -0,0 +1,164 @@
+#include "StreamingTrainer.h"
+
+#include <numeric>
+#include <stdexcept>
+
+#include "UtilsRandom.h"
+#include "Profiler.h"
+
+namespace BaseML
+{
+	StreamingTrainer::StreamingTrainer(NeuralNetwork& network, DatasetSource& source, size_t minibatchSize, bool shuffle)
+		:network(network), source(source), minibatchSize(minibatchSize), shuffle(shuffle), stopPrefetch(false)
+	{
+		if (minibatchSize == 0)
+			throw std::invalid_argument("The mini-batch size should be positive");
+
+		if (source.getInputDimension() != network.getInputCount() || source.getOutputDimension() != network.getOutputCount())
+			throw std::invalid_argument("The dimensions of the dataset don't match the network");
+	}
+
+	void StreamingTrainer::prefetch()
+	{
+		BASEML_PROFILE_THREAD_NAME("prefetch");
+
+		try
+		{
+			size_t batchIndex = 0;
+
+			for (size_t begin = 0; begin < order.size(); begin += minibatchSize, batchIndex++)
+			{
+				size_t count = std::min(minibatchSize, order.size() - begin);
+				Batch& batch = buffers[batchIndex % 2];
+
+				// Wait until the network is done with the buffer
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					bufferChanged.wait(lock, [this, &batch] { return !batch.ready || stopPrefetch; });
+
+					if (stopPrefetch)
+						return;
+				}
+
+				// Only the last mini-batch can be smaller
+				if (batch.inputs.columnsCount() != count)
+				{
+					batch.inputs = Matrix(source.getInputDimension(), count);
+					batch.expectedOutputs = Matrix(source.getOutputDimension(), count);
+				}
+
+				{
+					BASEML_PROFILE_SCOPE("DatasetSource::readBatch");
+					source.readBatch(order.data() + begin, count, batch.inputs, batch.expectedOutputs);
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					batch.ready = true;
+					batch.last = begin + count == order.size();
+				}
+
+				bufferChanged.notify_all();
+			}
+		}
+		catch (...)
+		{
+			// Passed to the training thread, which rethrows it
+			std::lock_guard<std::mutex> lock(mutex);
+			prefetchError = std::current_exception();
+			bufferChanged.notify_all();
+		}
+	}
+
+	float StreamingTrainer::trainEpoch(float learningRate)
+	{
+		const size_t dataPoints = source.size();
+
+		if (dataPoints == 0)
+			return 0.0f;
+
+		if (shuffle)
+			Utils::randomChunkedPermutation(order, dataPoints, source.getChunkSize());
+		else
+		{
+			order.resize(dataPoints);
+			std::iota(order.begin(), order.end(), 0);
+		}
+
+		for (Batch& batch : buffers)
+			batch.ready = false;
+
+		prefetchError = nullptr;
+		stopPrefetch = false;
+
+		std::thread prefetchThread(&StreamingTrainer::prefetch, this);
+
+		// Stops the prefetch thread and waits for it when training throws, since destroying a thread that wasn't
+		// joined terminates the program
+		struct PrefetchJoiner
+		{
+			StreamingTrainer& trainer;
+			std::thread& thread;
+
+			~PrefetchJoiner()
+			{
+				if (!thread.joinable())
+					return;
+
+				{
+					std::lock_guard<std::mutex> lock(trainer.mutex);
+					trainer.stopPrefetch = true;
+				}
+
+				trainer.bufferChanged.notify_all();
+				thread.join();
+			}
+		} joiner{ *this, prefetchThread };
+
+		double sumLoss = 0.0;
+		size_t batchIndex = 0;
+		bool done = false;
+
+		while (!done)
+		{
+			Batch& batch = buffers[batchIndex % 2];
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				bufferChanged.wait(lock, [this, &batch] { return batch.ready || prefetchError; });
+
+				if (!batch.ready)
+					break;
+			}
+
+			float loss = network.learn(batch.inputs, batch.expectedOutputs, learningRate);
+			sumLoss += (double)loss * batch.inputs.columnsCount();
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				done = batch.last;
+				batch.ready = false;
+			}
+
+			bufferChanged.notify_all();
+			batchIndex++;
+		}
+
+		prefetchThread.join();
+
+		if (prefetchError)
+			std::rethrow_exception(prefetchError);
+
+		return (float)(sumLoss / dataPoints);
+	}
+
+	float StreamingTrainer::train(size_t epochs, float learningRate)
+	{
+		float loss = 0.0f;
+
+		for (size_t epoch = 0; epoch < epochs; epoch++)
+			loss = trainEpoch(learningRate);
+
+		return loss;
+	}
+}
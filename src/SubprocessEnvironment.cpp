@@ -0,0 +1,646 @@
+#include "SubprocessEnvironment.h"
+
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <new>
+#include <cerrno>
+
+#include <omp.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#endif // __linux__
+
+namespace BaseML::RL
+{
+	struct SubprocessEnvironment::ChannelHeader
+	{
+		alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> commandsWritten; // Written by the parent
+		alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> commandsDone; // Written by the worker
+	};
+
+	namespace
+	{
+		// The beginning of every ring slot
+		struct SlotHeader
+		{
+			int command;
+			int argument;
+			int finished; // Set by the worker: 1 if its environment is finished
+		};
+
+		size_t alignToCacheLine(size_t size)
+		{
+			return (size + 63) & ~(size_t)63;
+		}
+
+		// Platform specific helpers. Only Linux is supported, other platforms fail when the workers are created.
+
+		int createEvent()
+		{
+#ifdef __linux__
+			int fd = eventfd(0, 0);
+
+			if (fd < 0)
+				throw std::runtime_error("Failed to create eventfd");
+
+			return fd;
+#else
+			throw std::runtime_error("SubprocessEnvironment is only supported on Linux");
+#endif // __linux__
+		}
+
+		void notifyEvent(int fd)
+		{
+#ifdef __linux__
+			uint64_t one = 1;
+
+			while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR)
+			{
+			}
+#endif // __linux__
+		}
+
+		// Blocks until the event is notified. Returns false if the event can't be read.
+		bool waitEvent(int fd)
+		{
+#ifdef __linux__
+			uint64_t value;
+
+			while (read(fd, &value, sizeof(value)) < 0)
+			{
+				if (errno != EINTR)
+					return false;
+			}
+#endif // __linux__
+
+			return true;
+		}
+
+		void closeEvent(int fd)
+		{
+#ifdef __linux__
+			if (fd >= 0)
+				::close(fd);
+#endif // __linux__
+		}
+
+		void* mapSharedMemory(size_t size)
+		{
+#ifdef __linux__
+			void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+			if (memory == MAP_FAILED)
+				throw std::runtime_error("Failed to map shared memory");
+
+			return memory;
+#else
+			throw std::runtime_error("SubprocessEnvironment is only supported on Linux");
+#endif // __linux__
+		}
+
+		void unmapSharedMemory(void* memory, size_t size)
+		{
+#ifdef __linux__
+			if (memory != nullptr)
+				munmap(memory, size);
+#endif // __linux__
+		}
+
+		// Copy the columns [firstColumn, firstColumn + count) of 'source' to 'dest', row after row
+		void copyColumnsFrom(const Matrix& source, size_t firstColumn, size_t count, float* dest)
+		{
+			for (size_t i = 0; i < source.rowsCount(); i++)
+			{
+				if (source.getLayout() == Matrix::Layout::RowMajor)
+				{
+					std::memcpy(dest + i * count, &source(i, firstColumn), count * sizeof(float));
+				}
+				else
+				{
+					for (size_t j = 0; j < count; j++)
+						dest[i * count + j] = source(i, firstColumn + j);
+				}
+			}
+		}
+
+		// Copy 'source' (rows of 'count' values) to the columns [firstColumn, firstColumn + count) of 'dest'
+		void copyColumnsTo(const float* source, size_t firstColumn, size_t count, Matrix& dest)
+		{
+			for (size_t i = 0; i < dest.rowsCount(); i++)
+			{
+				if (dest.getLayout() == Matrix::Layout::RowMajor)
+				{
+					std::memcpy(&dest(i, firstColumn), source + i * count, count * sizeof(float));
+				}
+				else
+				{
+					for (size_t j = 0; j < count; j++)
+						dest(i, firstColumn + j) = source[i * count + j];
+				}
+			}
+		}
+	}
+
+	SubprocessEnvironment::SubprocessEnvironment(EnvironmentFactory factory, size_t numWorkers)
+		:SubprocessEnvironment(factory, numWorkers, factory())
+	{
+	}
+
+	SubprocessEnvironment::SubprocessEnvironment(EnvironmentFactory& factory, size_t numWorkers, std::unique_ptr<Environment> probe)
+		:Environment(probe->getObservationDimension(), probe->getActionDimension()), playersPerWorker(probe->getPlayerCount()),
+		statesValid(false), initialized(false)
+	{
+		// Name the players of every worker
+		for (size_t w = 0; w < numWorkers; w++)
+		{
+			for (const std::string& player : probe->getPlayers())
+			{
+				players.push_back(std::to_string(w) + "/" + player);
+			}
+		}
+
+		// The probe isn't needed anymore. Destroy it before forking so the workers don't inherit it.
+		probe.reset();
+
+		size_t numPlayers = players.size();
+
+		states.assign(numPlayers, Matrix(obsDim, 1));
+		rewards.assign(numPlayers, 0.0f);
+		dones.assign(numPlayers, 0);
+
+		pendingActions = Matrix(actDim, numPlayers);
+		pendingActions.clear();
+
+		// Layout of a ring slot
+		actionsOffset = alignToCacheLine(sizeof(SlotHeader));
+		observationsOffset = actionsOffset + alignToCacheLine(actDim * playersPerWorker * sizeof(float));
+		rewardsOffset = observationsOffset + alignToCacheLine(obsDim * playersPerWorker * sizeof(float));
+		donesOffset = rewardsOffset + alignToCacheLine(playersPerWorker * sizeof(float));
+		slotSize = donesOffset + alignToCacheLine(playersPerWorker);
+
+		size_t sharedMemorySize = alignToCacheLine(sizeof(ChannelHeader)) + RING_SLOTS * slotSize;
+
+#ifdef __linux__
+		int parentId = getpid();
+#endif // __linux__
+
+		try {
+			for (size_t w = 0; w < numWorkers; w++)
+			{
+				// The worker is added before its resources are created, so they are released if creating one fails
+				workers.push_back({ -1, -1, -1, nullptr, sharedMemorySize, 0, false });
+
+				Worker& worker = workers.back();
+
+				worker.commandEvent = createEvent();
+				worker.resultEvent = createEvent();
+				worker.sharedMemory = mapSharedMemory(sharedMemorySize);
+
+				new (worker.sharedMemory) ChannelHeader{ {0}, {0} };
+
+#ifdef __linux__
+				int processId = fork();
+
+				if (processId < 0)
+					throw std::runtime_error("Failed to fork environment worker");
+
+				if (processId == 0)
+				{
+					// Exit together with the parent, even if it is killed. It may have died before the signal was set.
+					if (prctl(PR_SET_PDEATHSIG, SIGKILL) != 0 || getppid() != parentId)
+						_exit(1);
+
+					// The threads of the parent's OpenMP pool don't exist in the worker, so it runs its environment
+					// on one thread
+					omp_set_num_threads(1);
+
+					// The channels of the workers forked before this one belong to them
+					for (size_t k = 0; k < w; k++)
+					{
+						closeEvent(workers[k].commandEvent);
+						closeEvent(workers[k].resultEvent);
+						unmapSharedMemory(workers[k].sharedMemory, workers[k].sharedMemorySize);
+					}
+
+					// The worker never returns from workerMain()
+					workerMain(factory, worker, obsDim, actDim, playersPerWorker, actionsOffset, observationsOffset, rewardsOffset, donesOffset, slotSize);
+				}
+
+				worker.processId = processId;
+#endif // __linux__
+			}
+		}
+		catch (...) {
+			stopWorkers(true);
+			throw;
+		}
+	}
+
+	SubprocessEnvironment::~SubprocessEnvironment()
+	{
+		// Workers that exited can't take the Exit command, and the ones left are killed instead
+		bool exitSent = true;
+
+		try {
+			sendToAll(Command::Exit);
+		}
+		catch (...) {
+			exitSent = false;
+		}
+
+		stopWorkers(!exitSent);
+	}
+
+	void SubprocessEnvironment::stopWorkers(bool kill)
+	{
+		for (Worker& worker : workers)
+		{
+#ifdef __linux__
+			if (worker.processId > 0)
+			{
+				if (kill)
+					::kill(worker.processId, SIGKILL);
+
+				waitpid(worker.processId, nullptr, 0);
+			}
+#endif // __linux__
+
+			closeEvent(worker.commandEvent);
+			closeEvent(worker.resultEvent);
+			unmapSharedMemory(worker.sharedMemory, worker.sharedMemorySize);
+		}
+
+		workers.clear();
+	}
+
+	void SubprocessEnvironment::waitForResult(Worker& worker)
+	{
+#ifdef __linux__
+		pollfd event = { worker.resultEvent, POLLIN, 0 };
+
+		while (true)
+		{
+			int ready = poll(&event, 1, WORKER_CHECK_MILLISECONDS);
+
+			if (ready > 0)
+			{
+				if (!waitEvent(worker.resultEvent))
+					throw std::runtime_error("Failed to wait for environment worker");
+
+				return;
+			}
+
+			if (ready < 0 && errno != EINTR)
+				throw std::runtime_error("Failed to wait for environment worker");
+
+			// No result yet: make sure that the worker is still running (a worker that exited is reaped here)
+			if (waitpid(worker.processId, nullptr, WNOHANG) == worker.processId)
+			{
+				worker.processId = -1;
+				throw std::runtime_error("Environment worker exited");
+			}
+		}
+#endif // __linux__
+	}
+
+	char* SubprocessEnvironment::getSlot(const Worker& worker, uint64_t commandIndex) const
+	{
+		return static_cast<char*>(worker.sharedMemory) + alignToCacheLine(sizeof(ChannelHeader)) + (commandIndex % RING_SLOTS) * slotSize;
+	}
+
+	void SubprocessEnvironment::sendToAll(Command command, const Matrix* actions, int argument)
+	{
+		for (size_t w = 0; w < workers.size(); w++)
+		{
+			Worker& worker = workers[w];
+			ChannelHeader* header = static_cast<ChannelHeader*>(worker.sharedMemory);
+
+			// Wait for a free slot in the ring
+			while (worker.commandsSent - header->commandsDone.load(std::memory_order_acquire) >= RING_SLOTS)
+				waitForResult(worker);
+
+			char* slot = getSlot(worker, worker.commandsSent);
+			SlotHeader* slotHeader = reinterpret_cast<SlotHeader*>(slot);
+
+			slotHeader->command = (int)command;
+			slotHeader->argument = argument;
+
+			if (actions != nullptr)
+			{
+				// Copy the actions of the worker's players (a contiguous range of columns)
+				copyColumnsFrom(*actions, w * playersPerWorker, playersPerWorker, reinterpret_cast<float*>(slot + actionsOffset));
+			}
+
+			worker.commandsSent++;
+			header->commandsWritten.store(worker.commandsSent, std::memory_order_release);
+
+			notifyEvent(worker.commandEvent);
+		}
+	}
+
+	void SubprocessEnvironment::waitForAll(EnvironmentBatch* batch)
+	{
+		if (batch != nullptr)
+			prepareBatch(*batch);
+
+		for (size_t w = 0; w < workers.size(); w++)
+		{
+			Worker& worker = workers[w];
+			ChannelHeader* header = static_cast<ChannelHeader*>(worker.sharedMemory);
+
+			while (header->commandsDone.load(std::memory_order_acquire) < worker.commandsSent)
+				waitForResult(worker);
+
+			const char* slot = getSlot(worker, worker.commandsSent - 1);
+			const float* slotRewards = reinterpret_cast<const float*>(slot + rewardsOffset);
+			const unsigned char* slotDones = reinterpret_cast<const unsigned char*>(slot + donesOffset);
+
+			worker.finished = reinterpret_cast<const SlotHeader*>(slot)->finished != 0;
+
+			size_t first = w * playersPerWorker;
+
+			std::memcpy(&rewards[first], slotRewards, playersPerWorker * sizeof(float));
+			std::memcpy(&dones[first], slotDones, playersPerWorker);
+
+			if (batch != nullptr)
+			{
+				copyColumnsTo(reinterpret_cast<const float*>(slot + observationsOffset), first, playersPerWorker, batch->observations);
+
+				std::memcpy(&batch->rewards(first), slotRewards, playersPerWorker * sizeof(float));
+				std::memcpy(&batch->dones[first], slotDones, playersPerWorker);
+			}
+		}
+
+		statesValid = false;
+	}
+
+	void SubprocessEnvironment::cacheStates() const
+	{
+		for (size_t w = 0; w < workers.size(); w++)
+		{
+			const Worker& worker = workers[w];
+
+			if (worker.commandsSent == 0)
+				continue;
+
+			const float* slotObservations = reinterpret_cast<const float*>(getSlot(worker, worker.commandsSent - 1) + observationsOffset);
+
+			for (size_t p = 0; p < playersPerWorker; p++)
+			{
+				Matrix& state = states[w * playersPerWorker + p];
+
+				for (size_t i = 0; i < obsDim; i++)
+				{
+					state(i) = slotObservations[i * playersPerWorker + p];
+				}
+			}
+		}
+
+		statesValid = true;
+	}
+
+	void SubprocessEnvironment::workerMain(EnvironmentFactory& factory, Worker worker, size_t obsDim, size_t actDim,
+		size_t numPlayers, size_t actionsOffset, size_t observationsOffset, size_t rewardsOffset, size_t donesOffset, size_t slotSize)
+	{
+#ifdef __linux__
+		// The worker runs a copy of the parent's code, so it must never return or throw into it. It exits on any
+		// error and the parent finds out that it is not running.
+		try {
+			std::unique_ptr<Environment> environment = factory();
+
+			ChannelHeader* header = static_cast<ChannelHeader*>(worker.sharedMemory);
+			char* ring = static_cast<char*>(worker.sharedMemory) + alignToCacheLine(sizeof(ChannelHeader));
+
+			Matrix action(actDim, 1);
+			uint64_t commandsDone = 0;
+
+			while (true)
+			{
+				if (!waitEvent(worker.commandEvent))
+					_exit(1);
+
+				uint64_t commandsWritten = header->commandsWritten.load(std::memory_order_acquire);
+
+				while (commandsDone < commandsWritten)
+				{
+					char* slot = ring + (commandsDone % RING_SLOTS) * slotSize;
+					SlotHeader* slotHeader = reinterpret_cast<SlotHeader*>(slot);
+
+					float* slotActions = reinterpret_cast<float*>(slot + actionsOffset);
+					float* slotObservations = reinterpret_cast<float*>(slot + observationsOffset);
+					float* slotRewards = reinterpret_cast<float*>(slot + rewardsOffset);
+					unsigned char* slotDones = reinterpret_cast<unsigned char*>(slot + donesOffset);
+
+					Command command = (Command)slotHeader->command;
+					bool stepped = false;
+
+					switch (command)
+					{
+					case Command::Initialize:
+						if (!environment->isInitialized())
+							environment->initialize(slotHeader->argument != 0);
+						break;
+
+					case Command::Reset:
+						environment->reset();
+						break;
+
+					case Command::Step:
+						// A finished environment isn't updated until it is reset
+						if (!environment->isFinished())
+						{
+							for (size_t p = 0; p < numPlayers; p++)
+							{
+								for (size_t i = 0; i < actDim; i++)
+								{
+									action(i) = slotActions[i * numPlayers + p];
+								}
+
+								environment->setPlayerAction(p, action);
+							}
+
+							environment->update();
+							stepped = true;
+						}
+						break;
+
+					case Command::Render:
+						environment->render();
+						break;
+
+					case Command::Close:
+						if (environment->isInitialized())
+							environment->close();
+						break;
+
+					case Command::Exit:
+						if (environment->isInitialized())
+							environment->close();
+						break;
+					}
+
+					// Write the results
+					if (environment->isInitialized() && command != Command::Close && command != Command::Exit)
+					{
+						for (size_t p = 0; p < numPlayers; p++)
+						{
+							const Matrix& state = environment->getPlayerState(p);
+
+							for (size_t i = 0; i < obsDim; i++)
+							{
+								slotObservations[i * numPlayers + p] = state(i);
+							}
+
+							slotRewards[p] = stepped ? environment->getPlayerReward(p) : 0.0f;
+							slotDones[p] = environment->isPlayerFinished(p) ? 1 : 0;
+						}
+
+						slotHeader->finished = environment->isFinished() ? 1 : 0;
+					}
+
+					commandsDone++;
+					header->commandsDone.store(commandsDone, std::memory_order_release);
+
+					notifyEvent(worker.resultEvent);
+
+					if (command == Command::Exit)
+						_exit(0);
+				}
+			}
+		}
+		catch (...) {
+			_exit(1);
+		}
+#else
+		std::abort();
+#endif // __linux__
+	}
+
+	const std::vector<std::string>& SubprocessEnvironment::getPlayers() const
+	{
+		return players;
+	}
+
+	void SubprocessEnvironment::update()
+	{
+		sendToAll(Command::Step, &pendingActions);
+		waitForAll(nullptr);
+	}
+
+	const Matrix& SubprocessEnvironment::getState(const char* playerId) const
+	{
+		return getPlayerState(getPlayerIndex(playerId));
+	}
+
+	void SubprocessEnvironment::setAction(const char* playerId, const Matrix& action)
+	{
+		setPlayerAction(getPlayerIndex(playerId), action);
+	}
+
+	float SubprocessEnvironment::getReward(const char* playerId) const
+	{
+		return getPlayerReward(getPlayerIndex(playerId));
+	}
+
+	void SubprocessEnvironment::initialize(bool renderMode)
+	{
+		sendToAll(Command::Initialize, nullptr, renderMode ? 1 : 0);
+		waitForAll(nullptr);
+
+		initialized = true;
+	}
+
+	bool SubprocessEnvironment::isInitialized()
+	{
+		return initialized;
+	}
+
+	bool SubprocessEnvironment::isFinished()
+	{
+		for (const Worker& worker : workers)
+		{
+			if (!worker.finished)
+				return false;
+		}
+
+		return true;
+	}
+
+	void SubprocessEnvironment::close()
+	{
+		sendToAll(Command::Close);
+		waitForAll(nullptr);
+
+		initialized = false;
+	}
+
+	void SubprocessEnvironment::reset()
+	{
+		sendToAll(Command::Reset);
+		waitForAll(nullptr);
+	}
+
+	void SubprocessEnvironment::render()
+	{
+		sendToAll(Command::Render);
+		waitForAll(nullptr);
+	}
+
+	const Matrix& SubprocessEnvironment::getPlayerState(size_t playerIndex) const
+	{
+		if (!statesValid)
+			cacheStates();
+
+		return states[playerIndex];
+	}
+
+	void SubprocessEnvironment::setPlayerAction(size_t playerIndex, const Matrix& action)
+	{
+		for (size_t i = 0; i < actDim; i++)
+		{
+			pendingActions(i, playerIndex) = action(i);
+		}
+	}
+
+	float SubprocessEnvironment::getPlayerReward(size_t playerIndex) const
+	{
+		return rewards[playerIndex];
+	}
+
+	bool SubprocessEnvironment::isPlayerFinished(size_t playerIndex)
+	{
+		return dones[playerIndex] != 0;
+	}
+
+	void SubprocessEnvironment::observeBatch(EnvironmentBatch& batch)
+	{
+		// The observations of the last command are still in the ring slots
+		prepareBatch(batch);
+
+		for (size_t w = 0; w < workers.size(); w++)
+		{
+			const Worker& worker = workers[w];
+
+			if (worker.commandsSent == 0)
+				continue;
+
+			const float* slotObservations = reinterpret_cast<const float*>(getSlot(worker, worker.commandsSent - 1) + observationsOffset);
+
+			copyColumnsTo(slotObservations, w * playersPerWorker, playersPerWorker, batch.observations);
+		}
+	}
+
+	void SubprocessEnvironment::stepBatch(const Matrix& actions, EnvironmentBatch& batch)
+	{
+		sendToAll(Command::Step, &actions);
+		waitForAll(&batch);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,253 @@
+#include "TcpTransport.h"
+
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif // __linux__
+
+namespace BaseML
+{
+	namespace
+	{
+#ifdef __linux__
+		sockaddr_in makeAddress(const char* host, unsigned short port)
+		{
+			sockaddr_in address{};
+
+			address.sin_family = AF_INET;
+			address.sin_port = htons(port);
+
+			if (inet_pton(AF_INET, host, &address.sin_addr) != 1)
+				throw std::invalid_argument(std::string("Invalid address: ") + host);
+
+			return address;
+		}
+
+		// Disable Nagle's algorithm, the messages are sent whole and the peer waits for them
+		void setNoDelay(int socket)
+		{
+			int one = 1;
+			setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		}
+#endif // __linux__
+	}
+
+	TcpTransport::TcpTransport(size_t rank, size_t worldSize, unsigned short port, const char* host)
+		:rank(rank), worldSize(worldSize)
+	{
+		if (rank >= worldSize)
+			throw std::invalid_argument("The rank should be smaller than the world size");
+
+#ifdef __linux__
+		sockaddr_in address = makeAddress(host, port);
+
+		// The sockets that aren't in 'sockets' yet, closed with 'sockets' if connecting fails
+		int listener = -1, connection = -1;
+
+		try {
+			if (rank == 0)
+			{
+				sockets.assign(worldSize, -1);
+
+				listener = socket(AF_INET, SOCK_STREAM, 0);
+				int one = 1;
+
+				if (listener < 0)
+					throw std::runtime_error("Failed to listen on port " + std::to_string(port));
+
+				setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+				if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, (int)worldSize) != 0)
+					throw std::runtime_error("Failed to listen on port " + std::to_string(port));
+
+				// Every process introduces itself with its rank
+				for (size_t i = 1; i < worldSize; i++)
+				{
+					connection = accept(listener, nullptr, nullptr);
+
+					if (connection < 0)
+						throw std::runtime_error("Failed to accept a connection");
+
+					setNoDelay(connection);
+
+					uint32_t peerRank;
+					receiveAll(connection, &peerRank, sizeof(peerRank));
+
+					if (peerRank == 0 || peerRank >= worldSize || sockets[peerRank] >= 0)
+						throw std::runtime_error("Invalid rank received from a connecting process");
+
+					sockets[peerRank] = connection;
+					connection = -1;
+				}
+
+				::close(listener);
+				listener = -1;
+			}
+			else
+			{
+				auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CONNECT_TIMEOUT_MS);
+
+				// Rank 0 might not be listening yet
+				while (true)
+				{
+					connection = socket(AF_INET, SOCK_STREAM, 0);
+
+					if (connection >= 0 && connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+						break;
+
+					if (connection >= 0)
+						::close(connection);
+
+					connection = -1;
+
+					if (std::chrono::steady_clock::now() > deadline)
+						throw std::runtime_error("Failed to connect to the process of rank 0");
+
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				}
+
+				setNoDelay(connection);
+
+				uint32_t ownRank = (uint32_t)rank;
+				sendAll(connection, &ownRank, sizeof(ownRank));
+
+				sockets.push_back(connection);
+				connection = -1;
+			}
+		}
+		catch (...) {
+			// The destructor doesn't run when the constructor throws
+			for (int socket : { listener, connection })
+			{
+				if (socket >= 0)
+					::close(socket);
+			}
+
+			for (int socket : sockets)
+			{
+				if (socket >= 0)
+					::close(socket);
+			}
+
+			throw;
+		}
+#else
+		throw std::runtime_error("TcpTransport is only supported on Linux");
+#endif // __linux__
+	}
+
+	TcpTransport::~TcpTransport()
+	{
+#ifdef __linux__
+		for (int socket : sockets)
+		{
+			if (socket >= 0)
+				::close(socket);
+		}
+#endif // __linux__
+	}
+
+	size_t TcpTransport::getRank() const
+	{
+		return rank;
+	}
+
+	size_t TcpTransport::getWorldSize() const
+	{
+		return worldSize;
+	}
+
+	void TcpTransport::sendAll(int socket, const void* data, size_t bytes)
+	{
+#ifdef __linux__
+		const char* buffer = static_cast<const char*>(data);
+
+		while (bytes > 0)
+		{
+			ssize_t sent = send(socket, buffer, bytes, MSG_NOSIGNAL);
+
+			if (sent <= 0)
+				throw std::runtime_error("Failed to send data to a process");
+
+			buffer += sent;
+			bytes -= sent;
+		}
+#endif // __linux__
+	}
+
+	void TcpTransport::receiveAll(int socket, void* data, size_t bytes)
+	{
+#ifdef __linux__
+		char* buffer = static_cast<char*>(data);
+
+		while (bytes > 0)
+		{
+			ssize_t received = recv(socket, buffer, bytes, 0);
+
+			if (received <= 0)
+				throw std::runtime_error("Failed to receive data from a process");
+
+			buffer += received;
+			bytes -= received;
+		}
+#endif // __linux__
+	}
+
+	void TcpTransport::allReduceElements(void* data, size_t count, ElementType type)
+	{
+		const size_t bytes = count * elementSize(type);
+
+		if (rank != 0)
+		{
+			sendAll(sockets[0], data, bytes);
+			receiveAll(sockets[0], data, bytes);
+
+			return;
+		}
+
+		// Rank 0 sums the buffers in rank order and sends the result back
+		receiveBuffer.resize(bytes);
+
+		for (size_t r = 1; r < worldSize; r++)
+		{
+			receiveAll(sockets[r], receiveBuffer.data(), bytes);
+			addElements(data, receiveBuffer.data(), count, type);
+		}
+
+		for (size_t r = 1; r < worldSize; r++)
+			sendAll(sockets[r], data, bytes);
+	}
+
+	void TcpTransport::broadcastBytes(void* data, size_t bytes, size_t root)
+	{
+		if (root != 0)
+		{
+			// The data is relayed through rank 0
+			if (rank == root)
+				sendAll(sockets[0], data, bytes);
+			else if (rank == 0)
+				receiveAll(sockets[root], data, bytes);
+		}
+
+		if (rank == 0)
+		{
+			for (size_t r = 1; r < worldSize; r++)
+			{
+				if (r != root)
+					sendAll(sockets[r], data, bytes);
+			}
+		}
+		else if (rank != root)
+		{
+			receiveAll(sockets[0], data, bytes);
+		}
+	}
+}
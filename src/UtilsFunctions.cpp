@@ -16,6 +16,16 @@ namespace BaseML::Utils
         return neuronOutput * (1.0f - neuronOutput);
     }
 
+    float linear(float input)
+    {
+        return input;
+    }
+
+    float linearDerivative(float)
+    {
+        return 1.0f;
+    }
+
     float leakyReLU(float input)
     {
         if (input > 0.0f)
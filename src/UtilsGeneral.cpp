@@ -1,6 +1,7 @@
 #include "UtilsGeneral.h"
 
 #include <cmath>
+#include <algorithm>
 
 #include "Matrix.h"
 
@@ -11,20 +12,26 @@ namespace BaseML::Utils
 		if (mat.size() == 0)
 			return mat;
 
-		float mean = 0.0f, variance = 0.0f, stddev;
+		// Two passes (mean first, then the squared distances from it) are used instead of the sum of squares, 
+		// which loses precision when the mean is large compared to the standard deviation
+		double sum = 0.0, squaredDistances = 0.0;
 
+		#pragma omp parallel for reduction(+:sum)
 		for (int i = 0; i < mat.size(); i++)
 		{
-			mean += mat(i);
-			variance += mat(i) * mat(i);
+			sum += mat(i);
 		}
 
-		mean /= mat.size();
+		float mean = (float)(sum / mat.size());
 
-		variance /= mat.size();
-		variance -= mean * mean;
+		#pragma omp parallel for reduction(+:squaredDistances)
+		for (long long i = 0; i < (long long)mat.size(); i++)
+		{
+			float diff = mat(i) - mean;
+			squaredDistances += diff * diff;
+		}
 
-		stddev = std::sqrt(variance);
+		float stddev = (float)std::sqrt(squaredDistances / mat.size());
 
 		Matrix norm(mat);
 
@@ -36,4 +43,190 @@ namespace BaseML::Utils
 
 		return norm;
 	}
+
+	RunningStatistics::RunningStatistics(size_t dimension)
+		:count(0.0), mean(dimension, 0.0), m2(dimension, 0.0)
+	{
+	}
+
+	size_t RunningStatistics::getDimension() const
+	{
+		return mean.size();
+	}
+
+	double RunningStatistics::getCount() const
+	{
+		return count;
+	}
+
+	float RunningStatistics::getMean(size_t row) const
+	{
+		return (float)mean[row];
+	}
+
+	float RunningStatistics::getVariance(size_t row) const
+	{
+		if (count < 2.0)
+			return 1.0f;
+
+		return (float)(m2[row] / count);
+	}
+
+	void RunningStatistics::merge(double otherCount, const double* otherMean, const double* otherM2)
+	{
+		if (otherCount == 0.0)
+			return;
+
+		double totalCount = count + otherCount;
+
+		for (size_t i = 0; i < mean.size(); i++)
+		{
+			double delta = otherMean[i] - mean[i];
+
+			mean[i] += delta * (otherCount / totalCount);
+			m2[i] += otherM2[i] + delta * delta * (count * otherCount / totalCount);
+		}
+
+		count = totalCount;
+	}
+
+	void RunningStatistics::update(const Matrix& data)
+	{
+#ifdef DEBUG
+		if (data.rowsCount() != mean.size())
+		{
+			std::cout << "Invalid data size for running statistics" << std::endl;
+			throw std::runtime_error("Invalid data size for running statistics");
+		}
+#endif // DEBUG
+
+		const size_t dimension = mean.size();
+
+		#pragma omp parallel
+		{
+			// Welford's algorithm over the columns given to this thread
+			std::vector<double> threadMean(dimension, 0.0), threadM2(dimension, 0.0);
+			double threadCount = 0.0;
+
+			#pragma omp for schedule(static)
+			for (long long j = 0; j < (long long)data.columnsCount(); j++)
+			{
+				threadCount += 1.0;
+
+				for (size_t i = 0; i < dimension; i++)
+				{
+					double delta = data(i, j) - threadMean[i];
+
+					threadMean[i] += delta / threadCount;
+					threadM2[i] += delta * (data(i, j) - threadMean[i]);
+				}
+			}
+
+			// Chan's formula combines the statistics of the threads
+			#pragma omp critical
+			{
+				merge(threadCount, threadMean.data(), threadM2.data());
+			}
+		}
+	}
+
+	void RunningStatistics::merge(const RunningStatistics& other)
+	{
+		merge(other.count, other.mean.data(), other.m2.data());
+	}
+
+	size_t RunningStatistics::getStateSize() const
+	{
+		return 1 + 2 * mean.size();
+	}
+
+	void RunningStatistics::getState(double* dest) const
+	{
+		dest[0] = count;
+
+		std::copy(mean.begin(), mean.end(), dest + 1);
+		std::copy(m2.begin(), m2.end(), dest + 1 + mean.size());
+	}
+
+	void RunningStatistics::mergeState(const double* src)
+	{
+		merge(src[0], src + 1, src + 1 + mean.size());
+	}
+
+	void RunningStatistics::normalize(Matrix& data, float clip) const
+	{
+		const size_t dimension = mean.size();
+
+		std::vector<float> means(dimension), invStddevs(dimension);
+
+		for (size_t i = 0; i < dimension; i++)
+		{
+			means[i] = getMean(i);
+			invStddevs[i] = 1.0f / std::sqrt(getVariance(i) + EPSILON);
+		}
+
+		if (data.getLayout() == Matrix::Layout::ColumnMajor)
+		{
+			// Data point by data point, over contiguous memory
+			#pragma omp parallel for
+			for (long long j = 0; j < (long long)data.columnsCount(); j++)
+			{
+				float* column = &data(0, j);
+
+				for (size_t i = 0; i < dimension; i++)
+				{
+					column[i] = std::clamp((column[i] - means[i]) * invStddevs[i], -clip, clip);
+				}
+			}
+
+			return;
+		}
+
+		#pragma omp parallel for
+		for (long long i = 0; i < (long long)dimension; i++)
+		{
+			for (size_t j = 0; j < data.columnsCount(); j++)
+			{
+				data(i, j) = std::clamp((data(i, j) - means[i]) * invStddevs[i], -clip, clip);
+			}
+		}
+	}
+
+	void RunningStatistics::scale(Matrix& data) const
+	{
+		#pragma omp parallel for
+		for (long long i = 0; i < (long long)mean.size(); i++)
+		{
+			float invStddev = 1.0f / std::sqrt(getVariance(i) + EPSILON);
+
+			for (size_t j = 0; j < data.columnsCount(); j++)
+			{
+				data(i, j) *= invStddev;
+			}
+		}
+	}
+
+	void RunningStatistics::save(std::ofstream& outFile) const
+	{
+		size_t dimension = mean.size();
+
+		outFile.write(reinterpret_cast<const char*>(&dimension), sizeof(dimension));
+		outFile.write(reinterpret_cast<const char*>(&count), sizeof(count));
+		outFile.write(reinterpret_cast<const char*>(mean.data()), dimension * sizeof(double));
+		outFile.write(reinterpret_cast<const char*>(m2.data()), dimension * sizeof(double));
+	}
+
+	void RunningStatistics::load(std::ifstream& inFile)
+	{
+		size_t dimension;
+
+		inFile.read(reinterpret_cast<char*>(&dimension), sizeof(dimension));
+		inFile.read(reinterpret_cast<char*>(&count), sizeof(count));
+
+		mean.resize(dimension);
+		m2.resize(dimension);
+
+		inFile.read(reinterpret_cast<char*>(mean.data()), dimension * sizeof(double));
+		inFile.read(reinterpret_cast<char*>(m2.data()), dimension * sizeof(double));
+	}
 }
\ No newline at end of file
@@ -2,41 +2,174 @@
 
 #include <random>
 #include <cmath>
+#include <numeric>
+#include <algorithm>
 
 namespace BaseML::Utils
 {
+    std::array<uint32_t, 4> Philox4x32::generate(uint64_t seed, uint64_t stream, uint64_t counter)
+    {
+        uint32_t c0 = (uint32_t)counter, c1 = (uint32_t)(counter >> 32);
+        uint32_t c2 = (uint32_t)stream, c3 = (uint32_t)(stream >> 32);
+        uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+
+        for (int round = 0; round < ROUNDS; round++)
+        {
+            uint64_t product0 = (uint64_t)MULTIPLIER_0 * c0;
+            uint64_t product1 = (uint64_t)MULTIPLIER_1 * c2;
+
+            uint32_t hi0 = (uint32_t)(product0 >> 32), lo0 = (uint32_t)product0;
+            uint32_t hi1 = (uint32_t)(product1 >> 32), lo1 = (uint32_t)product1;
+
+            c0 = hi1 ^ c1 ^ k0;
+            c1 = lo1;
+            c2 = hi0 ^ c3 ^ k1;
+            c3 = lo0;
+
+            // Bump the key
+            k0 += WEYL_0;
+            k1 += WEYL_1;
+        }
+
+        return { c0, c1, c2, c3 };
+    }
+
     GaussianSampler::GaussianSampler(float stddev)
-        :gen(std::random_device{}()), distrib(0.0f, stddev)
+        :GaussianSampler(stddev, ((uint64_t)std::random_device{}() << 32) | std::random_device{}())
     {
     }
 
-    float GaussianSampler::getSigma()
+    GaussianSampler::GaussianSampler(float stddev, uint64_t seed, uint64_t stream)
+        :sigma(stddev), seed(seed), stream(stream), offset(0)
     {
-        return distrib.stddev();
+    }
+
+    void GaussianSampler::boxMuller(const std::array<uint32_t, 4>& bits, float* dest)
+    {
+        // Map the integers to uniform floats in (0, 1]. Use the top 24 bits (the float mantissa size) 
+        // and shift by half a step so that the logarithm below never sees 0.
+        constexpr float scale = 1.0f / 16777216.0f;
+
+        float u[4];
+
+        for (int i = 0; i < 4; i++)
+        {
+            u[i] = ((bits[i] >> 8) + 0.5f) * scale;
+        }
+
+        for (int i = 0; i < 4; i += 2)
+        {
+            float radius = std::sqrt(-2.0f * std::log(u[i]));
+            float angle = 2.0f * PI * u[i + 1];
+
+            dest[i] = radius * std::cos(angle);
+            dest[i + 1] = radius * std::sin(angle);
+        }
+    }
+
+    float GaussianSampler::getSigma() const
+    {
+        return sigma;
+    }
+
+    void GaussianSampler::setOffset(uint64_t newOffset)
+    {
+        offset = newOffset;
+    }
+
+    uint64_t GaussianSampler::getOffset() const
+    {
+        return offset;
     }
 
     float GaussianSampler::sample(float mean)
     {
-        return mean + distrib(gen);
+        float normals[4];
+
+        boxMuller(Philox4x32::generate(seed, stream, offset), normals);
+        offset++;
+
+        return mean + sigma * normals[0];
     }
 
     Matrix GaussianSampler::sample(const Matrix& mean)
     {
         Matrix sample(mean);
 
+        int numBlocks = (int)((sample.size() + 3) / 4);
+
+        // Every block of 4 samples depends only on its counter, so blocks can be generated in any order
         #pragma omp parallel for
-        for (int i = 0; i < sample.size(); i++)
+        for (int block = 0; block < numBlocks; block++)
         {
-            sample(i) += distrib(gen);
+            float normals[4];
+
+            boxMuller(Philox4x32::generate(seed, stream, offset + block), normals);
+
+            size_t first = (size_t)block * 4;
+            size_t count = std::min<size_t>(4, sample.size() - first);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                sample(first + i) += sigma * normals[i];
+            }
+        }
+
+        offset += numBlocks;
+
+        return sample;
+    }
+
+    Matrix GaussianSampler::sample(const Matrix& mean, const Matrix& logStddevs)
+    {
+#ifdef DEBUG
+        if (logStddevs.size() != mean.rowsCount())
+        {
+            std::cout << "Invalid sizes in sampling with per-row deviations" << std::endl;
+            throw std::runtime_error("Invalid sizes in sampling");
+        }
+#endif // DEBUG
+
+        Matrix sample(mean);
+
+        std::vector<float> stddevs(logStddevs.size());
+
+        for (size_t i = 0; i < stddevs.size(); i++)
+        {
+            stddevs[i] = std::exp(logStddevs(i));
         }
 
+        const size_t rows = sample.rowsCount(), cols = sample.columnsCount();
+        const bool rowMajor = sample.getLayout() == Matrix::Layout::RowMajor;
+        int numBlocks = (int)((sample.size() + 3) / 4);
+
+        #pragma omp parallel for
+        for (int block = 0; block < numBlocks; block++)
+        {
+            float normals[4];
+
+            boxMuller(Philox4x32::generate(seed, stream, offset + block), normals);
+
+            size_t first = (size_t)block * 4;
+            size_t count = std::min<size_t>(4, sample.size() - first);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                size_t row = rowMajor ? (first + i) / cols : (first + i) % rows;
+
+                sample(first + i) += stddevs[row] * normals[i];
+            }
+        }
+
+        offset += numBlocks;
+
         return sample;
     }
 
     float GaussianSampler::logProbabiltiy(float mean, float sample)
     {
         float diff = sample - mean;
-        return -std::log(distrib.stddev() * std::sqrt(2.0f * PI)) - 0.5f * (diff * diff) / (distrib.stddev() * distrib.stddev());
+        return -std::log(sigma * std::sqrt(2.0f * PI)) - 0.5f * (diff * diff) / (sigma * sigma);
     }
 
     float GaussianSampler::logProbabiltiy(const Matrix& mean, const Matrix& sample)
@@ -51,12 +184,12 @@ namespace BaseML::Utils
 
         float logProbability = 0.0f;
 
-        float sharedPart = std::log(distrib.stddev() * std::sqrt(2.0f * PI));
+        float sharedPart = std::log(sigma * std::sqrt(2.0f * PI));
 
         for (int i = 0; i < sample.size(); i++)
         {
             float diff = sample(i) - mean(i);
-            logProbability += -sharedPart - 0.5f * (diff * diff) / (distrib.stddev() * distrib.stddev());
+            logProbability += -sharedPart - 0.5f * (diff * diff) / (sigma * sigma);
         }
 
         return logProbability;
@@ -74,19 +207,89 @@ namespace BaseML::Utils
 
         Matrix logProbs(1, samples.columnsCount());
 
-        float sharedPart = std::log(distrib.stddev() * std::sqrt(2.0f * PI));
+        // The normalization term and the variance are the same for every element
+        const float sharedPart = samples.rowsCount() * std::log(sigma * std::sqrt(2.0f * PI));
+        const float invVariance = 1.0f / (sigma * sigma);
+
+        #pragma omp parallel for
+        for (int i = 0; i < samples.columnsCount(); i++)
+        {
+            float squaredDistance = 0.0f;
+
+            for (int j = 0; j < samples.rowsCount(); j++)
+            {
+                float diff = samples(j, i) - means(j, i);
+                squaredDistance += diff * diff;
+            }
+
+            logProbs(i) = -sharedPart - 0.5f * squaredDistance * invVariance;
+        }
+
+        return logProbs;
+    }
+
+    float GaussianSampler::logProbabiltiy(const Matrix& mean, const Matrix& sample, const Matrix& logStddevs)
+    {
+#ifdef DEBUG
+        if (mean.size() != sample.size() || logStddevs.size() != sample.rowsCount())
+        {
+            std::cout << "Invalid sizes in log probability calculation" << std::endl;
+            throw std::runtime_error("Invalid sizes in log probability");
+        }
+#endif // DEBUG
+
+        float logProbability = 0.0f;
+
+        const float halfLog2Pi = 0.5f * std::log(2.0f * PI);
+
+        for (int i = 0; i < sample.rowsCount(); i++)
+        {
+            float invVariance = std::exp(-2.0f * logStddevs(i));
+
+            for (int j = 0; j < sample.columnsCount(); j++)
+            {
+                float diff = sample(i, j) - mean(i, j);
+                logProbability += -logStddevs(i) - halfLog2Pi - 0.5f * (diff * diff) * invVariance;
+            }
+        }
+
+        return logProbability;
+    }
+
+    Matrix GaussianSampler::batchLogProbabilities(const Matrix& means, const Matrix& samples, const Matrix& logStddevs)
+    {
+#ifdef DEBUG
+        if (means.rowsCount() != samples.rowsCount() || means.columnsCount() != samples.columnsCount() 
+            || logStddevs.size() != samples.rowsCount())
+        {
+            std::cout << "Invalid sizes in log probability calculation" << std::endl;
+            throw std::runtime_error("Invalid sizes in log probability");
+        }
+#endif // DEBUG
+
+        Matrix logProbs(1, samples.columnsCount());
+
+        std::vector<float> invVariances(samples.rowsCount());
+        float sharedPart = samples.rowsCount() * 0.5f * std::log(2.0f * PI);
 
+        for (int j = 0; j < samples.rowsCount(); j++)
+        {
+            invVariances[j] = std::exp(-2.0f * logStddevs(j));
+            sharedPart += logStddevs(j);
+        }
+
+        #pragma omp parallel for
         for (int i = 0; i < samples.columnsCount(); i++)
         {
-            float logProbability = 0.0f;
+            float squaredDistance = 0.0f;
 
             for (int j = 0; j < samples.rowsCount(); j++)
             {
                 float diff = samples(j, i) - means(j, i);
-                logProbability += -sharedPart - 0.5f * (diff * diff) / (distrib.stddev() * distrib.stddev());
+                squaredDistance += diff * diff * invVariances[j];
             }
 
-            logProbs(i) = logProbability;
+            logProbs(i) = -sharedPart - 0.5f * squaredDistance;
         }
 
         return logProbs;
@@ -108,4 +311,49 @@ namespace BaseML::Utils
         float limit = std::sqrt(6.0f / inputNum);
         return getRandomFloat(-limit, limit);
     }
-}
\ No newline at end of file
+
+    void randomPermutation(std::vector<size_t>& indices, size_t count)
+    {
+        static std::random_device rd;
+        static std::mt19937 gen(rd());
+
+        indices.resize(count);
+        std::iota(indices.begin(), indices.end(), 0);
+        std::shuffle(indices.begin(), indices.end(), gen);
+    }
+
+    void randomChunkedPermutation(std::vector<size_t>& indices, size_t count, size_t chunkSize)
+    {
+        static std::random_device rd;
+        static std::mt19937 gen(rd());
+
+        if (chunkSize == 0 || chunkSize >= count)
+        {
+            randomPermutation(indices, count);
+            return;
+        }
+
+        size_t numChunks = (count + chunkSize - 1) / chunkSize;
+
+        std::vector<size_t> chunkOrder(numChunks);
+        std::iota(chunkOrder.begin(), chunkOrder.end(), 0);
+        std::shuffle(chunkOrder.begin(), chunkOrder.end(), gen);
+
+        indices.resize(count);
+
+        auto position = indices.begin();
+
+        for (size_t chunk : chunkOrder)
+        {
+            size_t begin = chunk * chunkSize;
+            size_t end = std::min(begin + chunkSize, count);
+
+            auto chunkBegin = position;
+
+            for (size_t i = begin; i < end; i++)
+                *(position++) = i;
+
+            std::shuffle(chunkBegin, position, gen);
+        }
+    }
+}
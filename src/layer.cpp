@@ -6,8 +6,10 @@
 #include <cmath>
 #include <fstream>
 
+#include "MatrixArena.h"
 #include "UtilsFunctions.h"
 #include "UtilsRandom.h"
+#include "Profiler.h"
 
 namespace BaseML
 {
@@ -129,20 +131,108 @@ namespace BaseML
 		// Update batch size according to the input
 		batchSize = inputs->columnsCount();
 
-		// Reset outputs and resize to fit the input
-		outputs = Matrix(outputCount, batchSize);
+		// The outputs of the layer follow the layout of its inputs
+		if (outputs.getLayout() != inputs->getLayout())
+		{
+			MatrixArena::HeapScope heap;
+			outputs = Matrix(outputCount, batchSize, inputs->getLayout());
+		}
 
-		// Multiply and add matrices to calculate the activation of each neuron.
-		// The result for each neuron is the sum of activations in the previous layer 
-		// weighted by the weights of the connections to each neuron on the previous 
-		// layer.
-		outputs = (weights * (*inputs)).addToColumns(biases);
+		calculateOutputs(*inputs, outputs);
+	}
 
-		// Pass the results through the activation function
-		#pragma omp parallel for
-		for (int i = 0; i < outputs.size(); i++)
+	void Layer::calculateOutputs(const Matrix& inputs, Matrix& outputs) const
+	{
+		const size_t batch = inputs.columnsCount();
+
+		BASEML_PROFILE_OPERATION("Layer::calculateOutputs", 2.0 * outputCount * inputCount * batch,
+			(weights.size() + inputs.size() + outputCount * batch) * sizeof(float));
+
+		// Resize the outputs to fit the input (in the layout of the input). The outputs are kept between batches, 
+		// so they don't come from an arena.
+		if (outputs.rowsCount() != outputCount || outputs.columnsCount() != batch)
 		{
-			outputs(i) = (*activationFunc)(outputs(i));
+			MatrixArena::HeapScope heap;
+			outputs = Matrix(outputCount, batch, inputs.getLayout());
+		}
+
+		// The activation of each neuron is the sum of activations in the previous layer weighted by the weights 
+		// of the connections to the neuron, plus its bias.
+		if (inputs.getLayout() == Matrix::Layout::ColumnMajor)
+		{
+			// The inputs of every data point are contiguous, so every output is the dot product of a row of the 
+			// weights and a column of the inputs. Parallel over the data points.
+			#pragma omp parallel for if (outputCount * batch * inputCount >= 32768)
+			for (int j = 0; j < batch; j++)
+			{
+				const float* inputColumn = &inputs(0, j);
+
+				for (size_t i = 0; i < outputCount; i++)
+				{
+					const float* weightsRow = &weights(i, 0);
+					float sum = 0.0f;
+
+					#pragma omp simd reduction(+:sum)
+					for (size_t k = 0; k < inputCount; k++)
+					{
+						sum += weightsRow[k] * inputColumn[k];
+					}
+
+					outputs(i, j) = (*activationFunc)(sum + biases(i));
+				}
+			}
+
+			return;
+		}
+
+		if (outputs.getLayout() == Matrix::Layout::ColumnMajor)
+		{
+			// Row-major inputs into column-major outputs (only when the caller's outputs are column-major)
+			#pragma omp parallel for if (outputCount * batch * inputCount >= 32768)
+			for (int j = 0; j < batch; j++)
+			{
+				for (size_t i = 0; i < outputCount; i++)
+				{
+					float sum = 0.0f;
+
+					for (size_t k = 0; k < inputCount; k++)
+					{
+						sum += weights(i, k) * inputs(k, j);
+					}
+
+					outputs(i, j) = (*activationFunc)(sum + biases(i));
+				}
+			}
+
+			return;
+		}
+
+		// Every output row accumulates rows of the input scaled by one weight, so the inner loop runs over 
+		// contiguous memory. Small batches (like single inference requests) are computed on the calling thread.
+		#pragma omp parallel for if (outputCount * batch * inputCount >= 32768)
+		for (int i = 0; i < outputCount; i++)
+		{
+			float* outputRow = &outputs(i, 0);
+
+			std::fill(outputRow, outputRow + batch, 0.0f);
+
+			for (size_t k = 0; k < inputCount; k++)
+			{
+				const float weight = weights(i, k);
+				const float* inputRow = &inputs(k, 0);
+
+				#pragma omp simd
+				for (int j = 0; j < batch; j++)
+				{
+					outputRow[j] += weight * inputRow[j];
+				}
+			}
+
+			// Add the bias and pass the results through the activation function
+			for (size_t j = 0; j < batch; j++)
+			{
+				outputRow[j] = (*activationFunc)(outputRow[j] + biases(i));
+			}
 		}
 	}
 
@@ -156,14 +246,27 @@ namespace BaseML
 		}
 #endif // DEBUG
 
-		// Reset gradients and resize to fit the output
-		gradients = Matrix(outputCount, batchSize);
+		resizeGradients();
 
 		// The Last layer bases its gradients on the loss function directly
-		#pragma omp parallel for
-		for (int i = 0; i < gradients.size(); i++)
+		if (expectedOutputs.getLayout() == outputs.getLayout())
+		{
+			#pragma omp parallel for
+			for (int i = 0; i < gradients.size(); i++)
+			{
+				gradients(i) = (*lossFunctionDerivative)(outputs(i), expectedOutputs(i)) * (*activationFuncDerivative)(outputs(i));
+			}
+		}
+		else
 		{
-			gradients(i) = (*lossFunctionDerivative)(outputs(i), expectedOutputs(i)) * (*activationFuncDerivative)(outputs(i));
+			#pragma omp parallel for
+			for (int i = 0; i < outputCount; i++)
+			{
+				for (size_t j = 0; j < batchSize; j++)
+				{
+					gradients(i, j) = (*lossFunctionDerivative)(outputs(i, j), expectedOutputs(i, j)) * (*activationFuncDerivative)(outputs(i, j));
+				}
+			}
 		}
 	}
 
@@ -177,38 +280,144 @@ namespace BaseML
 		}
 #endif // DEBUG
 
-		// Reset gradients and resize to fit the output
-		gradients = Matrix(outputCount, batchSize);
+		resizeGradients();
 
 		// The Last layer bases its gradients on the loss function directly
-		#pragma omp parallel for
-		for (int i = 0; i < gradients.size(); i++)
+		if (externalGradients.getLayout() == outputs.getLayout())
+		{
+			#pragma omp parallel for
+			for (int i = 0; i < gradients.size(); i++)
+			{
+				gradients(i) = externalGradients(i) * (*activationFuncDerivative)(outputs(i));
+			}
+		}
+		else
 		{
-			gradients(i) = externalGradients(i) * (*activationFuncDerivative)(outputs(i));
+			#pragma omp parallel for
+			for (int i = 0; i < outputCount; i++)
+			{
+				for (size_t j = 0; j < batchSize; j++)
+				{
+					gradients(i, j) = externalGradients(i, j) * (*activationFuncDerivative)(outputs(i, j));
+				}
+			}
 		}
 	}
 
 	void Layer::calculateGradients(const Layer& nextLayer)
 	{
-		// Reset gradients and resize to fit the output
-		gradients = Matrix(outputCount, batchSize);
+		resizeGradients();
+
+		const Matrix& nextGradients = nextLayer.getGradients();
+		const size_t nextCount = nextLayer.outputCount;
 
-		// Multiply nextLayer's weights (the weights connecting this layer of neurons and
+		// Multiply the transpose of nextLayer's weights (the weights connecting this layer of neurons and
 		// the next later of neurons) with nextLayer's gradients. The result for each neuron 
 		// will be the sum of gradients in the next layer weighted by their corresponding 
 		// weights. This is the first part of the derivative.
-		gradients = nextLayer.weights.transpose() * nextLayer.getGradients();
-
-		// Add the derivative of the activation function to each neuron's gradient.
+		// Then add the derivative of the activation function to each neuron's gradient.
 		// This is the second part of the derivative and the last shared part of the 
 		// derivative shared by both the weights and the biases
-		#pragma omp parallel for
-		for (int i = 0; i < gradients.size(); i++)
+		if (gradients.getLayout() == Matrix::Layout::ColumnMajor && nextGradients.getLayout() == Matrix::Layout::ColumnMajor)
+		{
+			// The gradients of every data point are contiguous: its column accumulates rows of the weights 
+			// scaled by the gradients of the next layer. Parallel over the data points.
+			#pragma omp parallel for if (nextCount * outputCount * batchSize >= 32768)
+			for (int j = 0; j < batchSize; j++)
+			{
+				float* gradientsColumn = &gradients(0, j);
+				const float* outputsColumn = &outputs(0, j);
+				const float* nextColumn = &nextGradients(0, j);
+
+				std::fill(gradientsColumn, gradientsColumn + outputCount, 0.0f);
+
+				for (size_t i = 0; i < nextCount; i++)
+				{
+					const float nextGradient = nextColumn[i];
+					const float* weightsRow = &nextLayer.weights(i, 0);
+
+					#pragma omp simd
+					for (size_t k = 0; k < outputCount; k++)
+					{
+						gradientsColumn[k] += nextGradient * weightsRow[k];
+					}
+				}
+
+				for (size_t k = 0; k < outputCount; k++)
+				{
+					gradientsColumn[k] *= (*activationFuncDerivative)(outputsColumn[k]);
+				}
+			}
+
+			return;
+		}
+
+		if (gradients.getLayout() != nextGradients.getLayout())
 		{
-			gradients(i) = gradients(i) * (*activationFuncDerivative)(outputs(i));
+			#pragma omp parallel for if (nextCount * outputCount * batchSize >= 32768)
+			for (int k = 0; k < outputCount; k++)
+			{
+				for (size_t j = 0; j < batchSize; j++)
+				{
+					float sum = 0.0f;
+
+					for (size_t i = 0; i < nextCount; i++)
+					{
+						sum += nextLayer.weights(i, k) * nextGradients(i, j);
+					}
+
+					gradients(k, j) = sum * (*activationFuncDerivative)(outputs(k, j));
+				}
+			}
+
+			return;
+		}
+
+		// Every row accumulates rows of the next layer's gradients scaled by one weight, so the inner loop 
+		// runs over contiguous memory and the weights don't need to be transposed.
+		#pragma omp parallel for if (nextCount * outputCount * batchSize >= 32768)
+		for (int k = 0; k < outputCount; k++)
+		{
+			float* gradientsRow = &gradients(k, 0);
+			const float* outputsRow = &outputs(k, 0);
+
+			std::fill(gradientsRow, gradientsRow + batchSize, 0.0f);
+
+			for (size_t i = 0; i < nextCount; i++)
+			{
+				const float weight = nextLayer.weights(i, k);
+				const float* nextRow = &nextGradients(i, 0);
+
+				#pragma omp simd
+				for (int j = 0; j < batchSize; j++)
+				{
+					gradientsRow[j] += weight * nextRow[j];
+				}
+			}
+
+			for (size_t j = 0; j < batchSize; j++)
+			{
+				gradientsRow[j] *= (*activationFuncDerivative)(outputsRow[j]);
+			}
 		}
 	}
 
+	void Layer::resizeGradients()
+	{
+		if (gradients.rowsCount() != outputCount || gradients.columnsCount() != batchSize || gradients.getLayout() != outputs.getLayout())
+		{
+			MatrixArena::HeapScope heap;
+			gradients = Matrix(outputCount, batchSize, outputs.getLayout());
+		}
+	}
+
+	Matrix Layer::calculateInputGradients() const
+	{
+		// The same sum of gradients weighted by the connections that calculateGradients() computes for 
+		// the previous layer, without an activation function to differentiate
+		return weights.transpose() * gradients;
+	}
+
 	void Layer::gradientDescent(float learningRate)
 	{
 		// Complete the gradient calculation, multiply by the learning-rate and subtract from
@@ -226,42 +435,88 @@ namespace BaseML
 		// Complete the gradient calculation for the weights and biases.
 		Matrix weightsGrads = (gradients * (*inputRef).transpose()) * (1.0f / batchSize);
 		Matrix biasesGrads = gradients.sumRows() * (1.0f / batchSize);
-		
-		// Calculate m_t using m_t-1
-		mWeights = mWeights * beta1 + weightsGrads * (1.0f - beta1);
-		mBiases = mBiases * beta1 + biasesGrads * (1.0f - beta1);
-
-		// Square the gradients
-		auto square = [](float x) { return x * x; };
 
-		weightsGrads.applyToElements(square);
-		biasesGrads.applyToElements(square);
-
-		// Calculate v_t using v_t-1
-		vWeights = vWeights * beta2 + weightsGrads * (1.0f - beta2);
-		vBiases = vBiases * beta2 + biasesGrads * (1.0f - beta2);
+		adamUpdate(&weightsGrads(0), &biasesGrads(0), learningRate, timestep, beta1, beta2, epsilon);
+	}
 
-		// Zero bias correction
-		Matrix mWeightsCorrected = mWeights * (1.0f / (1.0f - std::powf(beta1, timestep)));
-		Matrix mBiasesCorrected = mBiases * (1.0f / (1.0f - std::powf(beta1, timestep)));
+	void Layer::adamUpdate(const float* weightsGrads, const float* biasesGrads, float learningRate, size_t timestep,
+		float beta1, float beta2, float epsilon)
+	{
+		// Reads the gradients and reads and writes the parameters and both moments
+		BASEML_PROFILE_OPERATION("Layer::adamUpdate", 10 * getParameterCount(), 7 * getParameterCount() * sizeof(float));
 
-		Matrix vWeightsCorrected = vWeights * (1.0f / (1.0f - std::powf(beta2, timestep)));
-		Matrix vBiasesCorrected = vBiases * (1.0f / (1.0f - std::powf(beta2, timestep)));
+		// Zero bias correction factors
+		const float mCorrection = 1.0f / (1.0f - std::pow(beta1, (float)timestep));
+		const float vCorrection = 1.0f / (1.0f - std::pow(beta2, (float)timestep));
 
-		// Update parameters
+		// Calculate m_t and v_t using m_t-1 and v_t-1 and update the parameters in the same pass
 		#pragma omp parallel for
 		for (int i = 0; i < weights.size(); i++)
 		{
-			weights(i) = weights(i) - mWeightsCorrected(i) * (learningRate / (std::sqrtf(vWeightsCorrected(i)) + epsilon));
+			float grad = weightsGrads[i];
+
+			mWeights(i) = mWeights(i) * beta1 + grad * (1.0f - beta1);
+			vWeights(i) = vWeights(i) * beta2 + grad * grad * (1.0f - beta2);
+
+			weights(i) = weights(i) - mWeights(i) * mCorrection * (learningRate / (std::sqrt(vWeights(i) * vCorrection) + epsilon));
 		}
 
-		#pragma omp parallel for
 		for (int i = 0; i < biases.size(); i++)
 		{
-			biases(i) = biases(i) - mBiasesCorrected(i) * (learningRate / (std::sqrtf(vBiasesCorrected(i)) + epsilon));
+			float grad = biasesGrads[i];
+
+			mBiases(i) = mBiases(i) * beta1 + grad * (1.0f - beta1);
+			vBiases(i) = vBiases(i) * beta2 + grad * grad * (1.0f - beta2);
+
+			biases(i) = biases(i) - mBiases(i) * mCorrection * (learningRate / (std::sqrt(vBiases(i) * vCorrection) + epsilon));
+		}
+	}
+
+	size_t Layer::getParameterCount() const
+	{
+		return weights.size() + biases.size();
+	}
+
+	void Layer::getParameters(float* dest) const
+	{
+		std::copy(&weights(0), &weights(0) + weights.size(), dest);
+		std::copy(&biases(0), &biases(0) + biases.size(), dest + weights.size());
+	}
+
+	void Layer::setParameters(const float* src)
+	{
+		std::copy(src, src + weights.size(), &weights(0));
+		std::copy(src + weights.size(), src + weights.size() + biases.size(), &biases(0));
+	}
+
+	void Layer::getParameterSpans(std::vector<std::span<float>>& spans)
+	{
+		spans.emplace_back(&weights(0), weights.size());
+		spans.emplace_back(&biases(0), biases.size());
+	}
+
+	void Layer::addParameterGradients(float* dest) const
+	{
+		Matrix weightsGrads = gradients * (*inputRef).transpose();
+		Matrix biasesGrads = gradients.sumRows();
+
+		#pragma omp parallel for
+		for (int i = 0; i < weightsGrads.size(); i++)
+		{
+			dest[i] += weightsGrads(i);
+		}
+
+		for (int i = 0; i < biasesGrads.size(); i++)
+		{
+			dest[weightsGrads.size() + i] += biasesGrads(i);
 		}
 	}
 
+	void Layer::applyParameterGradients(const float* gradients, float learningRate, size_t timestep, float beta1, float beta2, float epsilon)
+	{
+		adamUpdate(gradients, gradients + weights.size(), learningRate, timestep, beta1, beta2, epsilon);
+	}
+
 	void Layer::save(std::ofstream& outFile)
 	{
 		outFile.write(reinterpret_cast<const char*>(&inputCount), sizeof(inputCount));
@@ -1,5 +1,8 @@
 #include "Matrix.h"
 
+#include "MatrixArena.h"
+#include "Profiler.h"
+
 namespace BaseML
 {
     Matrix::Matrix()
@@ -7,10 +10,10 @@ namespace BaseML
     {
     }
 
-    Matrix::Matrix(size_t numOfRows, size_t numOfCols)
-        : rows(numOfRows), cols(numOfCols)
+    Matrix::Matrix(size_t numOfRows, size_t numOfCols, Layout layout)
+        : rows(numOfRows), cols(numOfCols), layout(layout)
     {
-        data = new float[rows * cols];
+        data = allocate(rows * cols);
     }
 
     Matrix::Matrix(std::initializer_list<std::initializer_list<float>> init, bool transposed)
@@ -27,7 +30,7 @@ namespace BaseML
                 }
             }
 
-            data = new float[rows * cols];
+            data = allocate(rows * cols);
 
             size_t row = 0;
             for (const auto& innerList : init) {
@@ -51,7 +54,7 @@ namespace BaseML
                 }
             }
 
-            data = new float[rows * cols];
+            data = allocate(rows * cols);
 
             size_t col = 0;
             for (const auto& innerList : init) {
@@ -78,7 +81,7 @@ namespace BaseML
             cols = init.size();
         }
 
-        data = new float[rows * cols];
+        data = allocate(rows * cols);
 
         std::copy(init.begin(), init.end(), data);
     }
@@ -97,7 +100,7 @@ namespace BaseML
                 }
             }
 
-            data = new float[rows * cols];
+            data = allocate(rows * cols);
 
             size_t row = 0;
             for (const auto& innerVec : vec) {
@@ -121,7 +124,7 @@ namespace BaseML
                 }
             }
 
-            data = new float[rows * cols];
+            data = allocate(rows * cols);
 
             size_t col = 0;
             for (const auto& innerVec : vec) {
@@ -148,37 +151,90 @@ namespace BaseML
             cols = vec.size();
         }
 
-        data = new float[rows * cols];
+        data = allocate(rows * cols);
 
         std::copy(vec.begin(), vec.end(), data);
     }
 
+    float* Matrix::allocate(size_t count)
+    {
+        MatrixArena* arena = MatrixArena::getActive();
+
+        if (arena)
+            return arena->allocate(count, block);
+
+        BASEML_PROFILE_ALLOCATION(count * sizeof(float));
+
+        block = nullptr;
+        return new float[count];
+    }
+
+    void Matrix::release()
+    {
+        if (!ownsData)
+            return;
+
+        if (block)
+            MatrixArena::release(block);
+        else
+            delete[] data;
+
+        block = nullptr;
+    }
+
+    Matrix Matrix::view(float* data, size_t numOfRows, size_t numOfCols, Layout layout)
+    {
+        Matrix mat;
+
+        mat.rows = numOfRows;
+        mat.cols = numOfCols;
+        mat.data = data;
+        mat.layout = layout;
+        mat.ownsData = false;
+
+        return mat;
+    }
+
+    bool Matrix::isView() const
+    {
+        return !ownsData;
+    }
+
+    bool Matrix::isArenaAllocated() const
+    {
+        return block != nullptr;
+    }
+
     Matrix::~Matrix()
     {
-        delete[] data;
+        release();
     }
 
     Matrix::Matrix(const Matrix& other)
-        : rows(other.rows), cols(other.cols)
+        : rows(other.rows), cols(other.cols), layout(other.layout)
     {
-        data = new float[rows * cols];
+        data = allocate(rows * cols);
         std::copy(other.data, other.data + (rows * cols), data);
     }
 
     Matrix::Matrix(Matrix&& other) noexcept
-        : rows(other.rows), cols(other.cols), data(other.data)
+        : rows(other.rows), cols(other.cols), data(other.data), layout(other.layout), ownsData(other.ownsData), block(other.block)
     {
         other.data = nullptr; // Nullify the pointer to avoid double deletion
+        other.ownsData = true;
+        other.block = nullptr;
     }
 
     Matrix& Matrix::operator=(const Matrix& other)
     {
         if (this != &other) {
-            delete[] data; // Free existing memory
+            release(); // Free existing memory
 
             rows = other.rows;
             cols = other.cols;
-            data = new float[rows * cols]; // Allocate new memory
+            layout = other.layout;
+            data = allocate(rows * cols); // Allocate new memory
+            ownsData = true;
 
             std::copy(other.data, other.data + (rows * cols), data);
         }
@@ -189,13 +245,18 @@ namespace BaseML
     Matrix& Matrix::operator=(Matrix&& other) noexcept
     {
         if (this != &other) {
-            delete[] data; // Free existing memory
+            release(); // Free existing memory
 
             rows = other.rows;
             cols = other.cols;
             data = other.data;
+            layout = other.layout;
+            ownsData = other.ownsData;
+            block = other.block;
 
             other.data = nullptr; // Nullify the pointer to avoid double deletion
+            other.ownsData = true;
+            other.block = nullptr;
         }
 
         return *this;
@@ -203,12 +264,12 @@ namespace BaseML
 
     float& Matrix::operator()(size_t row, size_t col)
     {
-        return data[row * cols + col];
+        return layout == Layout::RowMajor ? data[row * cols + col] : data[col * rows + row];
     }
 
     const float& Matrix::operator()(size_t row, size_t col) const
     {
-        return data[row * cols + col];
+        return layout == Layout::RowMajor ? data[row * cols + col] : data[col * rows + row];
     }
 
     float& Matrix::operator()(size_t index)
@@ -223,7 +284,9 @@ namespace BaseML
 
     Matrix Matrix::operator+(const Matrix& other) const
     {
-        Matrix newMat(rows, cols);
+        BASEML_PROFILE_OPERATION("Matrix::operator+", size(), 3 * size() * sizeof(float));
+
+        Matrix newMat(rows, cols, layout);
 
 #ifdef DEBUG
         if (size() != other.size())
@@ -233,12 +296,24 @@ namespace BaseML
         }
 #endif // DEBUG
 
-        #pragma omp parallel for collapse(2)
-        for (int i = 0; i < rows; i++)
+        if (other.layout == layout)
         {
-            for (int j = 0; j < cols; j++)
+            // Both matrices store the elements in the same order
+            #pragma omp parallel for
+            for (long long i = 0; i < (long long)size(); i++)
+            {
+                newMat.data[i] = data[i] + other.data[i];
+            }
+        }
+        else
+        {
+            #pragma omp parallel for collapse(2)
+            for (int i = 0; i < rows; i++)
             {
-                newMat(i, j) = (*this)(i, j) + other(i, j);
+                for (int j = 0; j < cols; j++)
+                {
+                    newMat(i, j) = (*this)(i, j) + other(i, j);
+                }
             }
         }
 
@@ -247,7 +322,9 @@ namespace BaseML
 
     Matrix Matrix::operator-(const Matrix& other) const
     {
-        Matrix newMat(rows, cols);
+        BASEML_PROFILE_OPERATION("Matrix::operator-", size(), 3 * size() * sizeof(float));
+
+        Matrix newMat(rows, cols, layout);
 
 #ifdef DEBUG
         if (size() != other.size())
@@ -257,12 +334,24 @@ namespace BaseML
         }
 #endif // DEBUG
 
-        #pragma omp parallel for collapse(2)
-        for (int i = 0; i < rows; i++)
+        if (other.layout == layout)
         {
-            for (int j = 0; j < cols; j++)
+            // Both matrices store the elements in the same order
+            #pragma omp parallel for
+            for (long long i = 0; i < (long long)size(); i++)
             {
-                newMat(i, j) = (*this)(i, j) - other(i, j);
+                newMat.data[i] = data[i] - other.data[i];
+            }
+        }
+        else
+        {
+            #pragma omp parallel for collapse(2)
+            for (int i = 0; i < rows; i++)
+            {
+                for (int j = 0; j < cols; j++)
+                {
+                    newMat(i, j) = (*this)(i, j) - other(i, j);
+                }
             }
         }
 
@@ -271,15 +360,14 @@ namespace BaseML
 
     Matrix Matrix::operator*(float operand) const
     {
-        Matrix newMat(rows, cols);
+        BASEML_PROFILE_OPERATION("Matrix::operator*(scalar)", size(), 2 * size() * sizeof(float));
 
-        #pragma omp parallel for collapse(2)
-        for (int i = 0; i < rows; i++)
+        Matrix newMat(rows, cols, layout);
+
+        #pragma omp parallel for
+        for (long long i = 0; i < (long long)size(); i++)
         {
-            for (int j = 0; j < cols; j++)
-            {
-                newMat(i, j) = (*this)(i, j) * operand;
-            }
+            newMat.data[i] = data[i] * operand;
         }
 
         return newMat;
@@ -287,6 +375,9 @@ namespace BaseML
 
     Matrix Matrix::operator*(const Matrix& other) const
     {
+        BASEML_PROFILE_OPERATION("Matrix::operator*", 2.0 * rows * cols * other.cols,
+            (size() + other.size() + rows * other.cols) * sizeof(float));
+
         Matrix newMat(rows, other.cols);
 
 #ifdef DEBUG
@@ -298,16 +389,58 @@ namespace BaseML
         }
 #endif // DEBUG
 
-        #pragma omp parallel for collapse(2)
-        for (int i = 0; i < newMat.rows; i++)
+        // Rows of a column-major left operand are strided, so it is converted once (a cost of one pass over 
+        // it against the cost of the product)
+        if (layout == Layout::ColumnMajor && other.layout == Layout::ColumnMajor)
+            return toLayout(Layout::RowMajor) * other;
+
+        const size_t inner = cols, outerCols = other.cols;
+
+        if (other.layout == Layout::RowMajor)
         {
-            for (int j = 0; j < newMat.cols; j++)
+            // Every row of the result accumulates rows of 'other' scaled by one element of this Matrix, so the 
+            // inner loop runs over contiguous memory
+            #pragma omp parallel for if (rows * inner * outerCols >= 32768)
+            for (long long i = 0; i < (long long)rows; i++)
             {
-                newMat(i, j) = 0.0f;
+                float* resultRow = newMat.data + i * outerCols;
+
+                std::fill(resultRow, resultRow + outerCols, 0.0f);
 
-                for (int k = 0; k < cols; k++)
+                for (size_t k = 0; k < inner; k++)
                 {
-                    newMat(i, j) += (*this)(i, k) * other(k, j);
+                    const float value = (*this)(i, k);
+                    const float* otherRow = other.data + k * outerCols;
+
+                    #pragma omp simd
+                    for (size_t j = 0; j < outerCols; j++)
+                    {
+                        resultRow[j] += value * otherRow[j];
+                    }
+                }
+            }
+        }
+        else
+        {
+            // Every element of the result is the dot product of a row of this Matrix and a column of 'other', 
+            // which are both contiguous
+            #pragma omp parallel for if (rows * inner * outerCols >= 32768)
+            for (long long i = 0; i < (long long)rows; i++)
+            {
+                const float* row = data + i * inner;
+
+                for (size_t j = 0; j < outerCols; j++)
+                {
+                    const float* column = other.data + j * inner;
+                    float sum = 0.0f;
+
+                    #pragma omp simd reduction(+:sum)
+                    for (size_t k = 0; k < inner; k++)
+                    {
+                        sum += row[k] * column[k];
+                    }
+
+                    newMat.data[i * outerCols + j] = sum;
                 }
             }
         }
@@ -330,9 +463,71 @@ namespace BaseML
         return rows * cols;
     }
 
+    Matrix::Layout Matrix::getLayout() const
+    {
+        return layout;
+    }
+
+    Matrix Matrix::toLayout(Layout newLayout) const
+    {
+        if (newLayout == layout)
+            return *this;
+
+        Matrix newMat(rows, cols, newLayout);
+        newMat.copyFrom(*this);
+
+        return newMat;
+    }
+
+    void Matrix::copyFrom(const Matrix& other)
+    {
+#ifdef DEBUG
+        if (rows != other.rows || cols != other.cols)
+        {
+            std::cout << "Invalid sizes in Matrix copy" << std::endl;
+            throw std::runtime_error("Invalid matrix copy");
+        }
+#endif // DEBUG
+
+        if (other.layout == layout)
+        {
+            std::copy(other.data, other.data + size(), data);
+            return;
+        }
+
+        BASEML_PROFILE_OPERATION("Matrix::copyFrom", 0, 2 * size() * sizeof(float));
+
+        // The stored order is transposed: 'outer' x 'inner' elements become 'inner' x 'outer'. Done in tiles 
+        // that fit in the L1 cache, so both the reads and the writes use whole cache lines.
+        const size_t outer = other.layout == Layout::RowMajor ? rows : cols;
+        const size_t inner = other.layout == Layout::RowMajor ? cols : rows;
+        const size_t TILE = 32;
+
+        #pragma omp parallel for if (size() >= 32768)
+        for (long long tileStart = 0; tileStart < (long long)outer; tileStart += TILE)
+        {
+            const size_t tileEnd = std::min<size_t>(tileStart + TILE, outer);
+
+            for (size_t innerStart = 0; innerStart < inner; innerStart += TILE)
+            {
+                const size_t innerEnd = std::min(innerStart + TILE, inner);
+
+                for (size_t i = tileStart; i < tileEnd; i++)
+                {
+                    for (size_t j = innerStart; j < innerEnd; j++)
+                    {
+                        data[j * outer + i] = other.data[i * inner + j];
+                    }
+                }
+            }
+        }
+    }
+
     Matrix Matrix::transpose() const
     {
-        Matrix newMat(cols, rows);
+        BASEML_PROFILE_OPERATION("Matrix::transpose", 0, 2 * size() * sizeof(float));
+
+        Matrix newMat(cols, rows, layout);
 
         #pragma omp parallel for collapse(2)
         for (int i = 0; i < rows; i++)
@@ -348,6 +543,8 @@ namespace BaseML
 
     Matrix& Matrix::addToColumns(const Matrix& columnVec)
     {
+        BASEML_PROFILE_OPERATION("Matrix::addToColumns", size(), (2 * size() + rows) * sizeof(float));
+
 #ifdef DEBUG
         if (columnVec.cols != 1 || rows != columnVec.rows)
         {
@@ -356,12 +553,30 @@ namespace BaseML
         }
 #endif // DEBUG
 
-        #pragma omp parallel for collapse(2)
-        for (int i = 0; i < rows; i++)
+        if (layout == Layout::RowMajor)
         {
+            #pragma omp parallel for collapse(2)
+            for (int i = 0; i < rows; i++)
+            {
+                for (int j = 0; j < cols; j++)
+                {
+                    (*this)(i, j) += columnVec(i);
+                }
+            }
+        }
+        else
+        {
+            // Every column is contiguous
+            #pragma omp parallel for
             for (int j = 0; j < cols; j++)
             {
-                (*this)(i, j) += columnVec(i);
+                float* column = data + (size_t)j * rows;
+
+                #pragma omp simd
+                for (int i = 0; i < rows; i++)
+                {
+                    column[i] += columnVec(i);
+                }
             }
         }
 
@@ -370,16 +585,40 @@ namespace BaseML
 
     Matrix Matrix::sumRows() const
     {
+        BASEML_PROFILE_OPERATION("Matrix::sumRows", size(), (size() + rows) * sizeof(float));
+
         Matrix newMat(rows, 1);
 
-        #pragma omp parallel for
-        for (int i = 0; i < rows; i++)
+        if (layout == Layout::RowMajor)
         {
-            newMat(i, 0) = 0.0f;
+            #pragma omp parallel for
+            for (int i = 0; i < rows; i++)
+            {
+                newMat(i, 0) = 0.0f;
 
-            for (int j = 0; j < cols; j++)
+                for (int j = 0; j < cols; j++)
+                {
+                    newMat(i, 0) += (*this)(i, j);
+                }
+            }
+        }
+        else
+        {
+            // Add the columns one after the other, so the sums are accumulated in the same order as in a row-major 
+            // Matrix and the memory is read contiguously
+            float* sums = newMat.data;
+
+            std::fill(sums, sums + rows, 0.0f);
+
+            for (size_t j = 0; j < cols; j++)
             {
-                newMat(i, 0) += (*this)(i, j);
+                const float* column = data + j * rows;
+
+                #pragma omp simd
+                for (size_t i = 0; i < rows; i++)
+                {
+                    sums[i] += column[i];
+                }
             }
         }
 
@@ -388,7 +627,9 @@ namespace BaseML
 
     Matrix Matrix::multElementwise(const Matrix& other) const
     {
-        Matrix newMat(rows, cols);
+        BASEML_PROFILE_OPERATION("Matrix::multElementwise", size(), 3 * size() * sizeof(float));
+
+        Matrix newMat(rows, cols, layout);
 
 #ifdef DEBUG
         if (size() != other.size())
@@ -398,44 +639,103 @@ namespace BaseML
         }
 #endif // DEBUG
 
-        #pragma omp parallel for collapse(2)
-        for (int i = 0; i < rows; i++)
+        if (other.layout == layout)
         {
-            for (int j = 0; j < cols; j++)
+            // Both matrices store the elements in the same order
+            #pragma omp parallel for
+            for (long long i = 0; i < (long long)size(); i++)
+            {
+                newMat.data[i] = data[i] * other.data[i];
+            }
+        }
+        else
+        {
+            #pragma omp parallel for collapse(2)
+            for (int i = 0; i < rows; i++)
             {
-                newMat(i, j) = (*this)(i, j) * other(i, j);
+                for (int j = 0; j < cols; j++)
+                {
+                    newMat(i, j) = (*this)(i, j) * other(i, j);
+                }
             }
         }
 
         return newMat;
     }
 
-    void Matrix::applyToElements(float(*func)(float))
+    Matrix Matrix::gatherColumns(const size_t* columnIndices, size_t count) const
     {
-        #pragma omp parallel for collapse(2)
-        for (int i = 0; i < rows; i++)
+        BASEML_PROFILE_OPERATION("Matrix::gatherColumns", 0, (2 * rows * count) * sizeof(float) + count * sizeof(size_t));
+
+        Matrix newMat(rows, count, layout);
+
+#ifdef DEBUG
+        for (size_t j = 0; j < count; j++)
         {
-            for (int j = 0; j < cols; j++)
+            if (columnIndices[j] >= cols)
             {
-                (*this)(i, j) = func((*this)(i, j));
+                std::cout << "Invalid column index in gatherColumns" << std::endl;
+                throw std::runtime_error("Invalid column index");
             }
         }
+#endif // DEBUG
+
+        if (layout == Layout::RowMajor)
+        {
+            #pragma omp parallel for
+            for (int i = 0; i < rows; i++)
+            {
+                for (int j = 0; j < count; j++)
+                {
+                    newMat(i, j) = (*this)(i, columnIndices[j]);
+                }
+            }
+        }
+        else
+        {
+            // Every column is copied as a whole
+            #pragma omp parallel for
+            for (long long j = 0; j < (long long)count; j++)
+            {
+                const float* column = data + columnIndices[j] * rows;
+
+                std::copy(column, column + rows, newMat.data + j * rows);
+            }
+        }
+
+        return newMat;
+    }
+
+    void Matrix::applyToElements(float(*func)(float))
+    {
+        BASEML_PROFILE_OPERATION("Matrix::applyToElements", size(), 2 * size() * sizeof(float));
+
+        #pragma omp parallel for
+        for (long long i = 0; i < (long long)size(); i++)
+        {
+            data[i] = func(data[i]);
+        }
     }
 
     void Matrix::clear()
     {
-        #pragma omp parallel for collapse(2)
-        for (int i = 0; i < rows; i++)
+        BASEML_PROFILE_OPERATION("Matrix::clear", 0, size() * sizeof(float));
+
+        #pragma omp parallel for
+        for (long long i = 0; i < (long long)size(); i++)
         {
-            for (int j = 0; j < cols; j++)
-            {
-                (*this)(i, j) = 0.0f;
-            }
+            data[i] = 0.0f;
         }
     }
 
     void Matrix::save(std::ofstream& outFile)
     {
+        if (layout != Layout::RowMajor)
+        {
+            toLayout(Layout::RowMajor).save(outFile);
+            return;
+        }
+
         outFile.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
         outFile.write(reinterpret_cast<const char*>(&cols), sizeof(cols));
         outFile.write(reinterpret_cast<const char*>(data), rows * cols * sizeof(float));
@@ -443,12 +743,15 @@ namespace BaseML
 
     void Matrix::load(std::ifstream& inFile)
     {
-        delete[] data; // Free existing memory
+        release(); // Free existing memory
+
+        ownsData = true;
+        layout = Layout::RowMajor;
 
         inFile.read(reinterpret_cast<char*>(&rows), sizeof(rows));
         inFile.read(reinterpret_cast<char*>(&cols), sizeof(cols));
 
-        data = new float[rows * cols]; // Allocate memory for data from disk
+        data = allocate(rows * cols); // Allocate memory for data from disk
 
         inFile.read(reinterpret_cast<char*>(data), rows * cols * sizeof(float));
     }
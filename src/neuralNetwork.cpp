@@ -4,114 +4,193 @@
 
 #include <vector>
 #include <cstdlib>
+#include <algorithm>
 #include <ctime>
 #include <string>
 #include <format>
+#include <stdexcept>
+#include <utility>
+#include <type_traits>
 
+#include "MatrixArena.h"
 #include "UtilsFunctions.h"
+#include "Profiler.h"
 
 namespace BaseML
 {
+	namespace
+	{
+		// Combines lambdas into one visitor for std::visit
+		template <typename... Functions>
+		struct Overloaded : Functions...
+		{
+			using Functions::operator()...;
+		};
+
+		template <typename... Functions>
+		Overloaded(Functions...) -> Overloaded<Functions...>;
+
+		// Returns an empty layer of the type at 'index' in NetworkLayer
+		template <size_t... Indices>
+		NetworkLayer createLayer(size_t index, std::index_sequence<Indices...>)
+		{
+			NetworkLayer layer;
+
+			if (!((index == Indices && (layer.emplace<Indices>(), true)) || ...))
+				throw std::runtime_error("Unknown layer type");
+
+			return layer;
+		}
+
+		// Set the activation function of a layer that has one
+		void setLayerActivationFunction(NetworkLayer& layer, float(*activationFunction)(float), float(*activationFunctionDerivative)(float))
+		{
+			std::visit([&](auto& l)
+			{
+				if constexpr (ActivatedLayerType<std::decay_t<decltype(l)>>)
+					l.setActivationFunction(activationFunction, activationFunctionDerivative);
+			}, layer);
+		}
+	}
+
 	NeuralNetwork::NeuralNetwork()
-		:lossFunc(nullptr), lossFuncDerivative(nullptr), networkInput(), learningTimestep(1)
+		:lossFunc(nullptr), lossFuncDerivative(nullptr), networkInput(), learningTimestep(1), layout(Matrix::Layout::RowMajor)
 	{
 	}
 
 	NeuralNetwork::NeuralNetwork(std::initializer_list<size_t> layerSizes)
-		:lossFunc(&Utils::squareError), lossFuncDerivative(&Utils::squareErrorDerivative), networkInput(), learningTimestep(1)
+		:lossFunc(&Utils::squareError), lossFuncDerivative(&Utils::squareErrorDerivative), networkInput(), learningTimestep(1), layout(Matrix::Layout::RowMajor)
 	{
 		layers.reserve(layerSizes.size() - 1);
 
 		for (auto layerSize = layerSizes.begin() + 1; layerSize < layerSizes.end() - 1; layerSize++)
 		{
-			layers.emplace_back(*(layerSize - 1), *layerSize);
+			layers.emplace_back(std::in_place_type<Layer>, *(layerSize - 1), *layerSize);
 		}
 
-		layers.emplace_back(*(layerSizes.end() - 2), *(layerSizes.end() - 1), &Utils::sigmoid, &Utils::sigmoidDerivative);
+		layers.emplace_back(std::in_place_type<Layer>, *(layerSizes.end() - 2), *(layerSizes.end() - 1), &Utils::sigmoid, &Utils::sigmoidDerivative);
 	}
 
 	NeuralNetwork::NeuralNetwork(std::initializer_list<size_t> layerSizes, float(*hiddenActFunc)(float), float(*hiddenActFuncDerivative)(float), float(*outputActFunc)(float), float(*outputActFuncDerivative)(float))
-		:lossFunc(&Utils::squareError), lossFuncDerivative(&Utils::squareErrorDerivative), networkInput(), learningTimestep(1)
+		:lossFunc(&Utils::squareError), lossFuncDerivative(&Utils::squareErrorDerivative), networkInput(), learningTimestep(1), layout(Matrix::Layout::RowMajor)
 	{
 		layers.reserve(layerSizes.size() - 1);
 
 		for (auto layerSize = layerSizes.begin() + 1; layerSize < layerSizes.end() - 1; layerSize++)
 		{
-			layers.emplace_back(*(layerSize - 1), *layerSize, hiddenActFunc, hiddenActFuncDerivative);
+			layers.emplace_back(std::in_place_type<Layer>, *(layerSize - 1), *layerSize, hiddenActFunc, hiddenActFuncDerivative);
 		}
 
-		layers.emplace_back(*(layerSizes.end() - 2), *(layerSizes.end() - 1), outputActFunc, outputActFuncDerivative);
+		layers.emplace_back(std::in_place_type<Layer>, *(layerSizes.end() - 2), *(layerSizes.end() - 1), outputActFunc, outputActFuncDerivative);
 	}
 
 	NeuralNetwork::NeuralNetwork(std::initializer_list<size_t> layerSizes, float(*activationFunction)(float), float(*activationFunctionDerivative)(float))
-		:lossFunc(&Utils::squareError), lossFuncDerivative(&Utils::squareErrorDerivative), networkInput(), learningTimestep(1)
+		:lossFunc(&Utils::squareError), lossFuncDerivative(&Utils::squareErrorDerivative), networkInput(), learningTimestep(1), layout(Matrix::Layout::RowMajor)
 	{
 		layers.reserve(layerSizes.size() - 1);
 
 		for (auto layerSize = layerSizes.begin() + 1; layerSize < layerSizes.end(); layerSize++)
 		{
-			layers.emplace_back(*(layerSize - 1), *layerSize, activationFunction, activationFunctionDerivative);
+			layers.emplace_back(std::in_place_type<Layer>, *(layerSize - 1), *layerSize, activationFunction, activationFunctionDerivative);
 		}
 	}
 
 	NeuralNetwork::NeuralNetwork(std::initializer_list<size_t> layerSizes, float(*activationFunction)(float), float(*activationFunctionDerivative)(float), 
 		float(*lossFunction)(float, float), float(*lossFunctionDerivative)(float, float))
-		:lossFunc(lossFunction), lossFuncDerivative(lossFunctionDerivative), networkInput(), learningTimestep(1)
+		:lossFunc(lossFunction), lossFuncDerivative(lossFunctionDerivative), networkInput(), learningTimestep(1), layout(Matrix::Layout::RowMajor)
 	{
 		layers.reserve(layerSizes.size() - 1);
 
 		for (auto layerSize = layerSizes.begin() + 1; layerSize < layerSizes.end(); layerSize++)
 		{
-			layers.emplace_back(*(layerSize - 1), *layerSize, activationFunction, activationFunctionDerivative);
+			layers.emplace_back(std::in_place_type<Layer>, *(layerSize - 1), *layerSize, activationFunction, activationFunctionDerivative);
 		}
 	}
 
+	NeuralNetwork::NeuralNetwork(std::vector<NetworkLayer> networkLayers, float(*lossFunction)(float, float), float(*lossFunctionDerivative)(float, float))
+		:layers(std::move(networkLayers)), lossFunc(lossFunction), lossFuncDerivative(lossFunctionDerivative), networkInput(), learningTimestep(1), 
+		layout(Matrix::Layout::RowMajor)
+	{
+		if (layers.empty())
+			throw std::invalid_argument("Cannot create a network without layers");
+
+		for (size_t i = 1; i < layers.size(); i++)
+		{
+			size_t previousOutputs = std::visit([](const auto& layer) { return layer.getOutputCount(); }, layers[i - 1]);
+			size_t inputs = std::visit([](const auto& layer) { return layer.getInputCount(); }, layers[i]);
+
+			if (previousOutputs != inputs)
+				throw std::invalid_argument("The inputs of every layer should be the outputs of the previous layer");
+		}
+	}
+
+	void NeuralNetwork::addLayer(NetworkLayer layer)
+	{
+		if (!layers.empty() && std::visit([](const auto& l) { return l.getInputCount(); }, layer) != getOutputCount())
+			throw std::invalid_argument("The inputs of every layer should be the outputs of the previous layer");
+
+		layers.push_back(std::move(layer));
+	}
+
 	void NeuralNetwork::setOutputActivationFunction(float(*activationFunction)(float), float(*activationFunctionDerivative)(float))
 	{
-		layers[layers.size() - 1].setActivationFunction(activationFunction, activationFunctionDerivative);
+		setLayerActivationFunction(layers[layers.size() - 1], activationFunction, activationFunctionDerivative);
 	}
 
 	void NeuralNetwork::setHiddenActivationFunction(float(*activationFunction)(float), float(*activationFunctionDerivative)(float))
 	{
 		for (auto layer = layers.begin(); layer < layers.end() - 1; layer++)
 		{
-			layer->setActivationFunction(activationFunction, activationFunctionDerivative);
+			setLayerActivationFunction(*layer, activationFunction, activationFunctionDerivative);
 		}
 	}
 
-	const std::vector<Layer>& NeuralNetwork::getLayers() const
+	const std::vector<NetworkLayer>& NeuralNetwork::getLayers() const
 	{
 		return layers;
 	}
 
+	void NeuralNetwork::setLayout(Matrix::Layout newLayout)
+	{
+		layout = newLayout;
+	}
+
+	Matrix::Layout NeuralNetwork::getLayout() const
+	{
+		return layout;
+	}
+
 	size_t NeuralNetwork::getInputCount() const
 	{
-		return layers[0].getInputCount();
+		return std::visit([](const auto& layer) { return layer.getInputCount(); }, layers[0]);
 	}
 
 	size_t NeuralNetwork::getOutputCount() const
 	{
-		return layers[layers.size() - 1].getOutputCount();
+		return std::visit([](const auto& layer) { return layer.getOutputCount(); }, layers[layers.size() - 1]);
 	}
 
 	const Matrix& NeuralNetwork::getOutput() const
 	{
-		return layers[layers.size() - 1].getOutputs();
+		return std::visit([](const auto& layer) -> const Matrix& { return layer.getOutputs(); }, layers[layers.size() - 1]);
 	}
 
-	int NeuralNetwork::getClassify()
+	int NeuralNetwork::getClassify() const
 	{
-		int maxIndex = 0;
-		float maxOutput = 0.0f;
+		return classify(getOutput());
+	}
 
-		auto outputs = getOutput();
+	int NeuralNetwork::classify(const Matrix& outputs, size_t column)
+	{
+		int maxIndex = 0;
+		float maxOutput = outputs(0, column);
 
-		for (int i = 0; i < outputs.rowsCount(); i++)
+		for (int i = 1; i < outputs.rowsCount(); i++)
 		{
-			if (outputs(i, 0) > maxOutput)
+			if (outputs(i, column) > maxOutput)
 			{
 				maxIndex = i;
-				maxOutput = outputs(i, 0);
+				maxOutput = outputs(i, column);
 			}
 		}
 
@@ -120,69 +199,215 @@ namespace BaseML
 
 	const Matrix& NeuralNetwork::forwardPropagate(const Matrix& inputs)
 	{
-		networkInput = inputs;
+		// The input is kept for the backward pass in a buffer that is reused between batches (and so doesn't 
+		// come from a MatrixArena), in the layout of the network
+		if (networkInput.rowsCount() != inputs.rowsCount() || networkInput.columnsCount() != inputs.columnsCount() ||
+			networkInput.getLayout() != layout)
+		{
+			MatrixArena::HeapScope heap;
+			networkInput = Matrix(inputs.rowsCount(), inputs.columnsCount(), layout);
+		}
 
-		layers[0].calculateOutputs(&networkInput);
+		networkInput.copyFrom(inputs);
 
-		for (int i = 1; i < layers.size(); i++)
+		const Matrix* layerInput = &networkInput;
+
+		for (int i = 0; i < layers.size(); i++)
 		{
-			layers[i].calculateOutputs(&(layers[i - 1].getOutputs()));
+			BASEML_PROFILE_SCOPE_ID("Layer forward", i);
+
+			layerInput = std::visit([&](auto& layer) -> const Matrix*
+			{
+				layer.calculateOutputs(layerInput);
+				return &layer.getOutputs();
+			}, layers[i]);
 		}
 
-		return layers[layers.size() - 1].getOutputs();
+		return *layerInput;
+	}
+
+	const Matrix& NeuralNetwork::infer(const Matrix& inputs, InferenceWorkspace& workspace) const
+	{
+		workspace.activations.resize(layers.size());
+
+		const Matrix* layerInput = &inputs;
+
+		for (size_t i = 0; i < layers.size(); i++)
+		{
+			BASEML_PROFILE_SCOPE_ID("Layer inference", i);
+
+			std::visit([&](const auto& layer) { layer.calculateOutputs(*layerInput, workspace.activations[i]); }, layers[i]);
+			layerInput = &workspace.activations[i];
+		}
+
+		return *layerInput;
+	}
+
+	const Matrix& InferenceWorkspace::getOutput() const
+	{
+		if (activations.empty())
+			throw std::runtime_error("The inference workspace has no output before the first pass");
+
+		return activations.back();
 	}
 
 	float NeuralNetwork::calculateSumLoss(const Matrix& expectedOutputs)
 	{
 		float sumLoss = 0.0f;
 
-		Layer& lastLayer = layers[layers.size() - 1];
+		const Matrix& outputs = getOutput();
+		const size_t batchSize = outputs.columnsCount();
 
-		for (int i = 0; i < lastLayer.getOutputs().size(); i++)
+		if (outputs.getLayout() != expectedOutputs.getLayout())
 		{
-			sumLoss += (*lossFunc)((lastLayer.getOutputs())(i), expectedOutputs(i));
+			for (int i = 0; i < outputs.rowsCount(); i++)
+			{
+				for (int j = 0; j < outputs.columnsCount(); j++)
+				{
+					sumLoss += (*lossFunc)(outputs(i, j), expectedOutputs(i, j));
+				}
+			}
+
+			return (sumLoss / batchSize);
+		}
+
+		for (int i = 0; i < outputs.size(); i++)
+		{
+			sumLoss += (*lossFunc)(outputs(i), expectedOutputs(i));
 		}
 
-		return (sumLoss / lastLayer.getCurrentBatchSize()); // if multiple data points in the batch, return the average loss
+		return (sumLoss / batchSize); // if multiple data points in the batch, return the average loss
 	}
 
 	void NeuralNetwork::backPropagationToTarget(const Matrix& expectedOutputs, float learningRate)
 	{
-		// Calculate gradients
-		layers[layers.size() - 1].calculateLastLayerGradientsToTarget(expectedOutputs, lossFuncDerivative);
+		calculateGradientsToTarget(expectedOutputs);
+		applyGradients(learningRate);
+	}
 
+	void NeuralNetwork::backPropagation(const Matrix& externalGradients, float learningRate)
+	{
+		calculateGradients(externalGradients);
+		applyGradients(learningRate);
+	}
+
+	void NeuralNetwork::calculateGradientsToTarget(const Matrix& expectedOutputs)
+	{
+		{
+			BASEML_PROFILE_SCOPE_ID("Layer backward", layers.size() - 1);
+			std::visit([&](auto& layer) { layer.calculateLastLayerGradientsToTarget(expectedOutputs, lossFuncDerivative); }, layers[layers.size() - 1]);
+		}
+
+		calculateHiddenGradients();
+	}
+
+	void NeuralNetwork::calculateGradients(const Matrix& externalGradients)
+	{
+		{
+			BASEML_PROFILE_SCOPE_ID("Layer backward", layers.size() - 1);
+			std::visit([&](auto& layer) { layer.calculateLastLayerGradients(externalGradients); }, layers[layers.size() - 1]);
+		}
+
+		calculateHiddenGradients();
+	}
+
+	void NeuralNetwork::calculateHiddenGradients()
+	{
 		for (int i = layers.size() - 2; i >= 0; i--)
 		{
-			layers[i].calculateGradients(layers[i + 1]);
+			BASEML_PROFILE_SCOPE_ID("Layer backward", i);
+
+			std::visit(Overloaded{
+				// Between dense layers the gradients of the next layer's inputs are computed inside the kernel of this layer
+				[](Layer& layer, const Layer& nextLayer) { layer.calculateGradients(nextLayer); },
+				[](auto& layer, const auto& nextLayer) { layer.calculateLastLayerGradients(nextLayer.calculateInputGradients()); }
+			}, layers[i], layers[i + 1]);
 		}
+	}
 
-		// Update parameters
-		layers[0].adamGradientDescent(learningRate, learningTimestep);
+	Matrix NeuralNetwork::calculateInputGradients() const
+	{
+		return std::visit([](const auto& layer) { return layer.calculateInputGradients(); }, layers[0]);
+	}
 
-		for (int i = 1; i < layers.size(); i++)
+	void NeuralNetwork::applyGradients(float learningRate)
+	{
+		for (int i = 0; i < layers.size(); i++)
 		{
-			layers[i].adamGradientDescent(learningRate, learningTimestep);
+			BASEML_PROFILE_SCOPE_ID("Layer optimizer", i);
+			std::visit([&](auto& layer) { layer.adamGradientDescent(learningRate, learningTimestep); }, layers[i]);
 		}
 
 		learningTimestep++;
 	}
 
-	void NeuralNetwork::backPropagation(const Matrix& externalGradients, float learningRate)
+	size_t NeuralNetwork::getParameterCount() const
 	{
-		// Calculate gradients
-		layers[layers.size() - 1].calculateLastLayerGradients(externalGradients);
+		size_t count = 0;
 
-		for (int i = layers.size() - 2; i >= 0; i--)
+		for (const NetworkLayer& layer : layers)
+			count += std::visit([](const auto& l) { return l.getParameterCount(); }, layer);
+
+		return count;
+	}
+
+	void NeuralNetwork::getParameters(float* dest) const
+	{
+		for (const NetworkLayer& layer : layers)
 		{
-			layers[i].calculateGradients(layers[i + 1]);
+			std::visit([&](const auto& l)
+			{
+				l.getParameters(dest);
+				dest += l.getParameterCount();
+			}, layer);
 		}
+	}
 
-		// Update parameters
-		layers[0].adamGradientDescent(learningRate, learningTimestep);
+	void NeuralNetwork::setParameters(const float* src)
+	{
+		for (NetworkLayer& layer : layers)
+		{
+			std::visit([&](auto& l)
+			{
+				l.setParameters(src);
+				src += l.getParameterCount();
+			}, layer);
+		}
+	}
+
+	std::vector<std::span<float>> NeuralNetwork::getParameterSpans()
+	{
+		std::vector<std::span<float>> spans;
 
-		for (int i = 1; i < layers.size(); i++)
+		for (NetworkLayer& layer : layers)
+			std::visit([&](auto& l) { l.getParameterSpans(spans); }, layer);
+
+		return spans;
+	}
+
+	void NeuralNetwork::addParameterGradients(float* dest) const
+	{
+		for (const NetworkLayer& layer : layers)
 		{
-			layers[i].adamGradientDescent(learningRate, learningTimestep);
+			std::visit([&](const auto& l)
+			{
+				l.addParameterGradients(dest);
+				dest += l.getParameterCount();
+			}, layer);
+		}
+	}
+
+	void NeuralNetwork::applyParameterGradients(const float* gradients, float learningRate)
+	{
+		for (size_t i = 0; i < layers.size(); i++)
+		{
+			BASEML_PROFILE_SCOPE_ID("Layer optimizer", i);
+
+			std::visit([&](auto& layer)
+			{
+				layer.applyParameterGradients(gradients, learningRate, learningTimestep);
+				gradients += layer.getParameterCount();
+			}, layers[i]);
 		}
 
 		learningTimestep++;
@@ -212,11 +437,23 @@ namespace BaseML
 	{
 		int numOfLayers = layers.size();
 
-		outFile.write(reinterpret_cast<const char*>(&numOfLayers), sizeof(numOfLayers));
+		// Files of dense networks don't have layer types. A negative number of layers marks a file with the type 
+		// (the index in NetworkLayer) of every layer before it.
+		bool denseOnly = std::all_of(layers.begin(), layers.end(), [](const NetworkLayer& layer) { return std::holds_alternative<Layer>(layer); });
+
+		int layerCountField = denseOnly ? numOfLayers : -numOfLayers;
+
+		outFile.write(reinterpret_cast<const char*>(&layerCountField), sizeof(layerCountField));
 
 		for (int i = 0; i < numOfLayers; i++)
 		{
-			layers[i].save(outFile);
+			if (!denseOnly)
+			{
+				int layerType = layers[i].index();
+				outFile.write(reinterpret_cast<const char*>(&layerType), sizeof(layerType));
+			}
+
+			std::visit([&](auto& layer) { layer.save(outFile); }, layers[i]);
 		}
 	}
 
@@ -265,14 +502,34 @@ namespace BaseML
 
 		inFile.read(reinterpret_cast<char*>(&numOfLayers), sizeof(numOfLayers));
 
-		layers = std::vector<Layer>(numOfLayers);
+		const bool typedLayers = numOfLayers < 0;
+
+		if (typedLayers)
+			numOfLayers = -numOfLayers;
+
+		layers.clear();
+		layers.reserve(numOfLayers);
 
-		for (int i = 0; i < numOfLayers - 1; i++)
+		for (int i = 0; i < numOfLayers; i++)
 		{
-			layers[i].load(inFile, hiddenActFunc, hiddenActFuncDerivative);
-		}
+			int layerType = 0;
+
+			if (typedLayers)
+				inFile.read(reinterpret_cast<char*>(&layerType), sizeof(layerType));
+
+			layers.push_back(createLayer(layerType, std::make_index_sequence<std::variant_size_v<NetworkLayer>>()));
 
-		layers[numOfLayers - 1].load(inFile, activationFunction, activationFunctionDerivative);
+			const bool lastLayer = i == numOfLayers - 1;
+
+			std::visit([&](auto& layer)
+			{
+				// Layers without an activation function only read their parameters
+				if constexpr (ActivatedLayerType<std::decay_t<decltype(layer)>>)
+					layer.load(inFile, lastLayer ? activationFunction : hiddenActFunc, lastLayer ? activationFunctionDerivative : hiddenActFuncDerivative);
+				else
+					layer.load(inFile);
+			}, layers.back());
+		}
 	}
 
 	bool NeuralNetwork::loadFromFile(const char* fileName, float (*hiddenActFunc)(float), float (*hiddenActFuncDerivative)(float),
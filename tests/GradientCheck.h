@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "Matrix.h"
+#include "NeuralNetwork.h"
+#include "UtilsFunctions.h"
+
+namespace BaseML::Tests
+{
+	// Step of the central differences. Large enough for the rounding errors of float forward passes to stay
+	// small next to the differences, and the activation functions of the checked layers are smooth.
+	constexpr float GRADIENT_CHECK_STEP = 1.0e-2f;
+
+	// Largest relative error allowed between the computed and the numerical derivatives
+	constexpr double GRADIENT_CHECK_TOLERANCE = 2.0e-2;
+
+	// Returns the largest relative error between 'gradients' and the derivatives of 'loss' with respect to
+	// 'values' estimated by central differences. Every value is moved in both directions and restored, and
+	// 'apply' is called after every change so the values reach whatever 'loss' computes them from.
+	inline double gradientError(std::vector<float>& values, const std::vector<float>& gradients, const std::function<double()>& loss,
+		const std::function<void()>& apply = [] {})
+	{
+		double maxError = 0.0;
+
+		for (size_t i = 0; i < values.size(); i++)
+		{
+			const float original = values[i];
+
+			values[i] = original + GRADIENT_CHECK_STEP;
+			apply();
+			double lossPlus = loss();
+
+			values[i] = original - GRADIENT_CHECK_STEP;
+			apply();
+			double lossMinus = loss();
+
+			values[i] = original;
+			apply();
+
+			double numerical = (lossPlus - lossMinus) / (2.0 * GRADIENT_CHECK_STEP);
+			double error = std::abs(numerical - gradients[i]) / (std::abs(numerical) + std::abs(gradients[i]) + 1.0e-2);
+
+			maxError = std::max(maxError, error);
+		}
+
+		return maxError;
+	}
+
+	// A smooth activation function for the networks of the gradient checks (leaky ReLU has a kink at 0)
+	inline float tanhActivation(float input)
+	{
+		return std::tanh(input);
+	}
+
+	inline float tanhDerivative(float neuronOutput)
+	{
+		return 1.0f - neuronOutput * neuronOutput;
+	}
+
+	// Replace the (randomly initialized) parameters of 'network' with uniform random values in [-scale, scale)
+	inline void randomizeParameters(NeuralNetwork& network, std::mt19937& generator, float scale = 0.5f)
+	{
+		std::uniform_real_distribution<float> distribution(-scale, scale);
+		std::vector<float> parameters(network.getParameterCount());
+
+		for (float& parameter : parameters)
+			parameter = distribution(generator);
+
+		network.setParameters(parameters.data());
+	}
+
+	// The largest relative errors of the gradients of a network
+	struct NetworkGradientErrors
+	{
+		double parameters;
+		double inputs;
+	};
+
+	// Returns the largest relative errors of the gradients that 'network' computes for its parameters and for
+	// its inputs, for the sum of the square errors between its outputs and 'targets' over the batch 'inputs'
+	inline NetworkGradientErrors networkGradientErrors(NeuralNetwork& network, Matrix inputs, const Matrix& targets)
+	{
+		auto loss = [&] {
+			const Matrix& outputs = network.forwardPropagate(inputs);
+			double sum = 0.0;
+
+			for (size_t i = 0; i < targets.rowsCount(); i++)
+			{
+				for (size_t j = 0; j < targets.columnsCount(); j++)
+					sum += Utils::squareError(outputs(i, j), targets(i, j));
+			}
+
+			return sum;
+		};
+
+		loss();
+		network.calculateGradientsToTarget(targets);
+
+		std::vector<float> parameters(network.getParameterCount()), parameterGradients(network.getParameterCount(), 0.0f);
+		network.getParameters(parameters.data());
+		network.addParameterGradients(parameterGradients.data());
+
+		Matrix inputGradients = network.calculateInputGradients();
+
+		NetworkGradientErrors errors;
+		errors.parameters = gradientError(parameters, parameterGradients, loss, [&] { network.setParameters(parameters.data()); });
+
+		std::vector<float> inputValues, inputValueGradients;
+		const size_t columns = inputs.columnsCount();
+
+		for (size_t i = 0; i < inputs.rowsCount(); i++)
+		{
+			for (size_t j = 0; j < columns; j++)
+			{
+				inputValues.push_back(inputs(i, j));
+				inputValueGradients.push_back(inputGradients(i, j));
+			}
+		}
+
+		errors.inputs = gradientError(inputValues, inputValueGradients, loss, [&] {
+			for (size_t i = 0; i < inputs.rowsCount(); i++)
+			{
+				for (size_t j = 0; j < columns; j++)
+					inputs(i, j) = inputValues[i * columns + j];
+			}
+		});
+
+		return errors;
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "Matrix.h"
+
+namespace BaseML::Tests
+{
+	// Number of checks that failed in the test program
+	inline int failedChecks = 0;
+
+	// Record a failed check and print 'description' if 'condition' is false
+	inline void check(bool condition, const std::string& description)
+	{
+		if (condition)
+			return;
+
+		std::cout << "FAILED: " << description << std::endl;
+		failedChecks++;
+	}
+
+	// Returns the exit code of the test program: 0 if all of the checks passed
+	inline int result()
+	{
+		if (failedChecks == 0)
+			std::cout << "All checks passed" << std::endl;
+		else
+			std::cout << failedChecks << " checks failed" << std::endl;
+
+		return failedChecks == 0 ? 0 : 1;
+	}
+
+	// Returns a matrix of uniform random values in [-scale, scale). The tests use generators with fixed seeds
+	// so every run checks the same values.
+	inline Matrix randomMatrix(size_t rows, size_t columns, std::mt19937& generator, float scale = 1.0f,
+		Matrix::Layout layout = Matrix::Layout::RowMajor)
+	{
+		std::uniform_real_distribution<float> distribution(-scale, scale);
+		Matrix result(rows, columns, layout);
+
+		for (size_t i = 0; i < result.size(); i++)
+			result(i) = distribution(generator);
+
+		return result;
+	}
+}
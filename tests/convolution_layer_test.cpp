@@ -0,0 +1,99 @@
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+#include "Matrix.h"
+#include "NeuralNetwork.h"
+#include "UtilsFunctions.h"
+
+#include "TestUtils.h"
+#include "GradientCheck.h"
+
+using namespace BaseML;
+
+namespace
+{
+	// Compare the gradients of 'network' over a random batch with central differences
+	void checkGradients(NeuralNetwork& network, size_t inputCount, size_t outputCount, size_t batchSize, std::mt19937& generator,
+		const std::string& name)
+	{
+		Tests::randomizeParameters(network, generator);
+
+		Matrix inputs = Tests::randomMatrix(inputCount, batchSize, generator);
+		Matrix targets = Tests::randomMatrix(outputCount, batchSize, generator);
+
+		Tests::NetworkGradientErrors errors = Tests::networkGradientErrors(network, inputs, targets);
+
+		Tests::check(errors.parameters <= Tests::GRADIENT_CHECK_TOLERANCE,
+			name + ": gradients of the parameters (relative error " + std::to_string(errors.parameters) + ")");
+		Tests::check(errors.inputs <= Tests::GRADIENT_CHECK_TOLERANCE,
+			name + ": gradients of the inputs (relative error " + std::to_string(errors.inputs) + ")");
+	}
+
+	// Strided and padded 1D convolutions, stacked
+	void testConv1DGradients()
+	{
+		std::mt19937 generator(49);
+
+		NeuralNetwork network({ Conv1DLayer(2, 11, 4, 3, 2, 1, &Tests::tanhActivation, &Tests::tanhDerivative),
+			Conv1DLayer(4, 6, 3, 2, 1, 0, &Tests::tanhActivation, &Tests::tanhDerivative),
+			Layer(15, 3, &Utils::linear, &Utils::linearDerivative) });
+
+		checkGradients(network, 22, 3, 5, generator, "1D convolutions");
+	}
+
+	// A strided and padded 2D convolution on non-square images, between dense layers, in both layouts
+	void testConv2DGradients()
+	{
+		std::mt19937 generator(490);
+
+		NeuralNetwork network({ Conv2DLayer(3, 7, 6, 5, 3, 2, 1, &Tests::tanhActivation, &Tests::tanhDerivative),
+			Layer(5 * 4 * 3, 4, &Tests::tanhActivation, &Tests::tanhDerivative),
+			Conv1DLayer(1, 4, 2, 2, 1, 0, &Utils::linear, &Utils::linearDerivative) });
+
+		checkGradients(network, 126, 6, 4, generator, "2D convolution");
+
+		NeuralNetwork columnMajor({ Layer(10, 12, &Tests::tanhActivation, &Tests::tanhDerivative),
+			Conv2DLayer(3, 2, 2, 2, 2, 1, 1, &Tests::tanhActivation, &Tests::tanhDerivative),
+			Layer(18, 2, &Utils::linear, &Utils::linearDerivative) });
+
+		columnMajor.setLayout(Matrix::Layout::ColumnMajor);
+
+		checkGradients(columnMajor, 10, 2, 3, generator, "2D convolution in the column-major layout");
+	}
+
+	// Returns true if 'create' throws std::invalid_argument
+	bool throwsInvalidArgument(const std::function<void()>& create)
+	{
+		try {
+			create();
+		}
+		catch (const std::invalid_argument&) {
+			return true;
+		}
+
+		return false;
+	}
+
+	// Check that the constructors reject shapes without outputs
+	void testShapeValidation()
+	{
+		Tests::check(throwsInvalidArgument([] { Conv1DLayer(1, 8, 2, 3, 0); }), "1D: a stride of 0 throws");
+		Tests::check(throwsInvalidArgument([] { Conv1DLayer(1, 8, 2, 0); }), "1D: an empty kernel throws");
+		Tests::check(throwsInvalidArgument([] { Conv1DLayer(1, 4, 2, 7, 1, 1); }), "1D: a kernel longer than the padded sequences throws");
+		Tests::check(throwsInvalidArgument([] { Conv2DLayer(1, 5, 3, 2, 4); }), "2D: a kernel wider than the grids throws");
+		Tests::check(throwsInvalidArgument([] { Conv2DLayer(1, 5, 5, 2, 3, 0); }), "2D: a stride of 0 throws");
+
+		Tests::check(!throwsInvalidArgument([] { Conv1DLayer(1, 4, 2, 6, 1, 1); }), "1D: a kernel as long as the padded sequences is valid");
+		Tests::check(Conv2DLayer(1, 4, 4, 2, 4).getOutputCount() == 2, "2D: a kernel as large as the grids has one output per filter");
+	}
+}
+
+int main()
+{
+	testConv1DGradients();
+	testConv2DGradients();
+	testShapeValidation();
+
+	return Tests::result();
+}
@@ -0,0 +1,155 @@
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Matrix.h"
+#include "NeuralNetwork.h"
+#include "Policy.h"
+#include "InferenceServer.h"
+#include "UtilsFunctions.h"
+#include "UtilsGeneral.h"
+
+#include "TestUtils.h"
+
+using namespace BaseML;
+
+namespace
+{
+	// Returns a policy of a network with parameters from a fixed seed and observation normalization
+	RL::Policy makePolicy(std::mt19937& generator)
+	{
+		NeuralNetwork actor({ 6, 16, 3 }, &Utils::leakyReLU, &Utils::leakyReLUDerivative, &Utils::linear, &Utils::linearDerivative);
+
+		std::vector<float> parameters(actor.getParameterCount());
+		std::uniform_real_distribution<float> distribution(-0.5f, 0.5f);
+
+		for (float& parameter : parameters)
+			parameter = distribution(generator);
+
+		actor.setParameters(parameters.data());
+
+		Utils::RunningStatistics statistics(6);
+		statistics.update(Tests::randomMatrix(6, 100, generator, 3.0f));
+
+		return RL::Policy(std::move(actor), &statistics);
+	}
+
+	// Returns true if 'output' is within 'tolerance' of the output of 'policy' for 'input' alone
+	bool matchesPolicy(const RL::Policy& policy, const Matrix& input, const Matrix& output, float tolerance)
+	{
+		RL::PolicyWorkspace workspace;
+		const Matrix& expected = policy.infer(input, workspace);
+
+		if (output.rowsCount() != expected.rowsCount() || output.columnsCount() != 1)
+			return false;
+
+		for (size_t i = 0; i < expected.rowsCount(); i++)
+		{
+			if (std::abs(output(i) - expected(i)) > tolerance * (1.0f + std::abs(expected(i))))
+				return false;
+		}
+
+		return true;
+	}
+
+	// Check that requests submitted from many threads and answered in batches get the outputs of the policy
+	void testBatchedResults()
+	{
+		std::mt19937 generator(39);
+		const RL::Policy policy = makePolicy(generator);
+
+		const size_t threads = 4, requestsPerThread = 300;
+
+		std::vector<Matrix> inputs;
+
+		for (size_t r = 0; r < threads * requestsPerThread; r++)
+			inputs.push_back(Tests::randomMatrix(6, 1, generator, 3.0f));
+
+		std::vector<Matrix> outputs(inputs.size());
+
+		{
+			InferenceServer server(policy, 16, std::chrono::microseconds(500), 2);
+			std::vector<std::thread> clients;
+
+			for (size_t t = 0; t < threads; t++)
+			{
+				clients.emplace_back([&, t] {
+					std::vector<std::future<Matrix>> results;
+
+					for (size_t r = t * requestsPerThread; r < (t + 1) * requestsPerThread; r++)
+						results.push_back(server.submit(inputs[r]));
+
+					for (size_t r = 0; r < requestsPerThread; r++)
+						outputs[t * requestsPerThread + r] = results[r].get();
+				});
+			}
+
+			for (std::thread& client : clients)
+				client.join();
+
+			Tests::check(server.getAverageBatchSize() >= 1.0f && server.getAverageBatchSize() <= 16.0f, "the batches are at most the maximum size");
+		}
+
+		bool same = true;
+
+		for (size_t r = 0; r < inputs.size(); r++)
+			same = same && matchesPolicy(policy, inputs[r], outputs[r], 1.0e-5f);
+
+		Tests::check(same, "batched results match Policy::infer() for every request");
+	}
+
+	// Check that a request that no other request joins is answered when its deadline passes
+	void testDeadlineFlush()
+	{
+		std::mt19937 generator(390);
+		const RL::Policy policy = makePolicy(generator);
+
+		InferenceServer server(policy, 64, std::chrono::milliseconds(2), 1);
+
+		Matrix input = Tests::randomMatrix(6, 1, generator);
+		std::future<Matrix> result = server.submit(input);
+
+		bool ready = result.wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+		Tests::check(ready, "a lone request is answered after the maximum latency");
+
+		if (ready)
+			Tests::check(matchesPolicy(policy, input, result.get(), 1.0e-5f), "the lone request gets the output of the policy");
+
+		Tests::check(server.getAverageBatchSize() == 1.0f, "the lone request is a batch of its own");
+	}
+
+	// Check that stopping the server completes the requests submitted before
+	void testStopCompletesRequests()
+	{
+		std::mt19937 generator(391);
+		const RL::Policy policy = makePolicy(generator);
+
+		std::vector<std::future<Matrix>> results;
+
+		{
+			InferenceServer server(policy, 8, std::chrono::milliseconds(50), 2);
+
+			for (int r = 0; r < 100; r++)
+				results.push_back(server.submit(Tests::randomMatrix(6, 1, generator)));
+		}
+
+		bool completed = true;
+
+		for (std::future<Matrix>& result : results)
+			completed = completed && result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+
+		Tests::check(completed, "all of the requests are completed when the server stops");
+	}
+}
+
+int main()
+{
+	testBatchedResults();
+	testDeadlineFlush();
+	testStopCompletesRequests();
+
+	return Tests::result();
+}
@@ -0,0 +1,142 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Matrix.h"
+#include "MatrixArena.h"
+#include "NeuralNetwork.h"
+#include "RecurrentLayer.h"
+#include "PPO.h"
+#include "BenchmarkEnvironments.h"
+#include "UtilsFunctions.h"
+
+#include "TestUtils.h"
+
+using namespace BaseML;
+
+namespace
+{
+	// Check that matrices that outlive a scope keep their values and are counted as escaped blocks, and that
+	// HeapScope allocates from the heap
+	void testEscapedMatrices()
+	{
+		MatrixArena arena(4096);
+		Matrix escaped;
+
+		for (int iteration = 0; iteration < 4; iteration++)
+		{
+			MatrixArena::Scope scope(arena);
+
+			Matrix temporary(50, 50);
+
+			for (size_t i = 0; i < temporary.size(); i++)
+				temporary(i) = 2.0f;
+
+			Tests::check(temporary.isArenaAllocated(), "matrices inside a scope come from the arena");
+
+			{
+				MatrixArena::HeapScope heap;
+				Matrix buffer(3, 3);
+
+				Tests::check(!buffer.isArenaAllocated(), "matrices inside a HeapScope come from the heap");
+			}
+
+			if (iteration == 1)
+				escaped = temporary * 3.0f;
+		}
+
+		Tests::check(arena.getEscapedBlockCount() == 1, "a matrix that outlives its scope is counted as an escaped block");
+		Tests::check(escaped(0) == 6.0f && escaped(2499) == 6.0f, "an escaped matrix keeps its values");
+		Tests::check(!Matrix(2, 2).isArenaAllocated(), "matrices outside of a scope come from the heap");
+	}
+
+	// Run 'step' in a new scope of 'arena' several times and check that no block escaped and that the arena
+	// stopped growing after the first steps
+	template <typename Step>
+	void checkNoEscapes(const char* name, Step step)
+	{
+		MatrixArena arena(4096);
+		size_t capacity = 0;
+
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			{
+				MatrixArena::Scope scope(arena);
+				step();
+			}
+
+			if (iteration == 3)
+				capacity = arena.getCapacity();
+		}
+
+		Tests::check(arena.getEscapedBlockCount() == 0, std::string(name) + ": no block escapes a scope");
+		Tests::check(arena.getCapacity() == capacity, std::string(name) + ": the arena stops growing");
+	}
+
+	// Training steps of networks of every layer type allocate their long-lived buffers from the heap
+	void testTrainingInScopes()
+	{
+		std::mt19937 generator(46);
+
+		Matrix inputs = Tests::randomMatrix(18, 32, generator);
+		Matrix targets = Tests::randomMatrix(2, 32, generator);
+
+		NeuralNetwork dense({ 18, 16, 2 });
+		checkNoEscapes("dense network", [&] { dense.learn(inputs, targets, 0.001f); });
+
+		NeuralNetwork mixed({ Conv1DLayer(2, 9, 3, 3, 1, 1), NormalizationLayer(27), ResidualLayer(27),
+			Layer(27, 2, &Utils::linear, &Utils::linearDerivative) });
+		checkNoEscapes("mixed network", [&] { mixed.learn(inputs, targets, 0.001f); });
+
+		Matrix images = Tests::randomMatrix(2 * 6 * 6, 16, generator);
+		Matrix imageTargets = Tests::randomMatrix(2, 16, generator);
+
+		NeuralNetwork convolution({ Conv2DLayer(2, 6, 6, 4, 3), Layer(64, 2, &Utils::linear, &Utils::linearDerivative) });
+		checkNoEscapes("2D convolution network", [&] { convolution.learn(images, imageTargets, 0.001f); });
+
+		// Sequences of lengths 4, 3 and 2, packed timestep by timestep
+		RecurrentLayer recurrent(RecurrentLayer::Cell::LSTM, 5, 8);
+		std::vector<size_t> batchSizes = { 3, 3, 2, 1 };
+		Matrix sequences = Tests::randomMatrix(5, 9, generator);
+		Matrix outputGradients = Tests::randomMatrix(8, 9, generator);
+
+		checkNoEscapes("recurrent layer", [&] {
+			recurrent.forwardPropagate(sequences, batchSizes);
+			recurrent.calculateGradients(outputGradients);
+			recurrent.adamGradientDescent(0.001f, 1);
+		});
+	}
+
+	// The temporary matrices of the training iterations of PPO, in every mode, don't outlive their iteration
+	void testPPOIterations()
+	{
+		for (int mode = 0; mode < 3; mode++)
+		{
+			RL::PPO ppo(std::make_unique<RL::CartPoleEnvironment>(2), "matrix_arena_test_critic.nn", "matrix_arena_test_actor.nn",
+				0.003f, 0.95f, 0.2f, 400, 100, 2);
+
+			ppo.setMetricsLogger(nullptr);
+			ppo.setTrainAllPlayers(true);
+			ppo.setObservationNormalization(true);
+
+			if (mode == 1)
+				ppo.setSharedTrunkLayers({ 4, 16, 16 });
+			else if (mode == 2)
+				ppo.setRecurrentCore(RecurrentLayer::Cell::GRU, 8, 8);
+
+			ppo.learn(2000);
+
+			Tests::check(ppo.getIterationArena().getEscapedBlockCount() == 0,
+				"PPO mode " + std::to_string(mode) + ": no block escapes a training iteration");
+		}
+	}
+}
+
+int main()
+{
+	testEscapedMatrices();
+	testTrainingInScopes();
+	testPPOIterations();
+
+	return Tests::result();
+}
@@ -0,0 +1,101 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MPSCQueue.h"
+
+#include "TestUtils.h"
+
+using namespace BaseML;
+
+namespace
+{
+	struct Item : Utils::MPSCNode
+	{
+		size_t producer = 0, sequence = 0;
+	};
+
+	// Check that the nodes pushed by many threads at once are all popped once, in the order of every producer,
+	// while the consumer pops at the same time
+	void testManyProducers()
+	{
+		const size_t producers = 4, itemsPerProducer = 200000;
+
+		std::vector<Item> items(producers * itemsPerProducer);
+		std::vector<std::thread> threads;
+
+		Utils::MPSCQueue queue;
+
+		for (size_t p = 0; p < producers; p++)
+		{
+			threads.emplace_back([&, p] {
+				for (size_t i = 0; i < itemsPerProducer; i++)
+				{
+					Item& item = items[p * itemsPerProducer + i];
+
+					item.producer = p;
+					item.sequence = i;
+
+					queue.push(&item);
+				}
+			});
+		}
+
+		std::vector<size_t> nextSequence(producers, 0);
+		size_t popped = 0;
+		bool ordered = true;
+
+		while (popped < producers * itemsPerProducer)
+		{
+			Utils::MPSCNode* node = queue.pop();
+
+			if (!node)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			const Item* item = static_cast<const Item*>(node);
+
+			ordered = ordered && item->sequence == nextSequence[item->producer];
+			nextSequence[item->producer] = item->sequence + 1;
+			popped++;
+		}
+
+		for (std::thread& thread : threads)
+			thread.join();
+
+		Tests::check(ordered, "the nodes of every producer are popped once and in order");
+		Tests::check(queue.pop() == nullptr, "the queue is empty after all of the nodes were popped");
+
+		for (size_t p = 0; p < producers; p++)
+			Tests::check(nextSequence[p] == itemsPerProducer, "all of the nodes of producer " + std::to_string(p) + " are popped");
+	}
+
+	// Check that a queue emptied by the consumer takes new nodes (the stub is pushed back behind the last node)
+	void testReuseAfterEmpty()
+	{
+		Utils::MPSCQueue queue;
+		Item items[3];
+
+		Tests::check(queue.pop() == nullptr, "a new queue is empty");
+
+		queue.push(&items[0]);
+		Tests::check(queue.pop() == &items[0] && queue.pop() == nullptr, "a single node is popped");
+
+		queue.push(&items[1]);
+		queue.push(&items[2]);
+		queue.push(&items[0]);
+
+		bool inOrder = queue.pop() == &items[1] && queue.pop() == &items[2] && queue.pop() == &items[0];
+		Tests::check(inOrder && queue.pop() == nullptr, "nodes pushed after the queue was empty are popped in order");
+	}
+}
+
+int main()
+{
+	testReuseAfterEmpty();
+	testManyProducers();
+
+	return Tests::result();
+}
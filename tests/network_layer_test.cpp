@@ -0,0 +1,137 @@
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Matrix.h"
+#include "NeuralNetwork.h"
+#include "UtilsFunctions.h"
+
+#include "TestUtils.h"
+#include "GradientCheck.h"
+
+using namespace BaseML;
+
+namespace
+{
+	// Compare the gradients of 'network' over a random batch with central differences
+	void checkGradients(NeuralNetwork& network, size_t inputCount, size_t outputCount, size_t batchSize, std::mt19937& generator,
+		const std::string& name)
+	{
+		Matrix inputs = Tests::randomMatrix(inputCount, batchSize, generator);
+		Matrix targets = Tests::randomMatrix(outputCount, batchSize, generator);
+
+		Tests::NetworkGradientErrors errors = Tests::networkGradientErrors(network, inputs, targets);
+
+		Tests::check(errors.parameters <= Tests::GRADIENT_CHECK_TOLERANCE,
+			name + ": gradients of the parameters (relative error " + std::to_string(errors.parameters) + ")");
+		Tests::check(errors.inputs <= Tests::GRADIENT_CHECK_TOLERANCE,
+			name + ": gradients of the inputs (relative error " + std::to_string(errors.inputs) + ")");
+	}
+
+	// Normalization and residual layers between dense layers, in both layouts, and a normalization layer as the
+	// last layer of a network
+	void testNormalizationResidualGradients()
+	{
+		std::mt19937 generator(50);
+
+		NeuralNetwork network({ Layer(6, 8, &Tests::tanhActivation, &Tests::tanhDerivative), NormalizationLayer(8),
+			ResidualLayer(8, &Tests::tanhActivation, &Tests::tanhDerivative), ResidualLayer(8, &Tests::tanhActivation, &Tests::tanhDerivative),
+			NormalizationLayer(8), Layer(8, 3, &Utils::linear, &Utils::linearDerivative) });
+
+		Tests::randomizeParameters(network, generator);
+		checkGradients(network, 6, 3, 5, generator, "normalization and residual layers");
+
+		network.setLayout(Matrix::Layout::ColumnMajor);
+		checkGradients(network, 6, 3, 4, generator, "normalization and residual layers in the column-major layout");
+
+		NeuralNetwork normalizationLast({ Layer(4, 5, &Tests::tanhActivation, &Tests::tanhDerivative),
+			ResidualLayer(5, &Tests::tanhActivation, &Tests::tanhDerivative), NormalizationLayer(5) });
+
+		Tests::randomizeParameters(normalizationLast, generator);
+		checkGradients(normalizationLast, 4, 5, 3, generator, "normalization as the last layer");
+	}
+
+	// Check that a network of every type of layer is loaded back with the same layers and parameters
+	void testMixedSaveLoad()
+	{
+		std::mt19937 generator(500);
+
+		NeuralNetwork network({ Conv1DLayer(2, 9, 3, 3, 1, 1, &Tests::tanhActivation, &Tests::tanhDerivative), NormalizationLayer(27) });
+		network.addLayer(ResidualLayer(27, &Tests::tanhActivation, &Tests::tanhDerivative));
+		network.addLayer(Conv2DLayer(3, 3, 3, 2, 2, 1, 0, &Tests::tanhActivation, &Tests::tanhDerivative));
+		network.addLayer(Layer(8, 2, &Utils::linear, &Utils::linearDerivative));
+
+		Tests::randomizeParameters(network, generator);
+		network.saveToFile("network_layer_test.nn");
+
+		NeuralNetwork loaded;
+		bool success = loaded.loadFromFile("network_layer_test.nn", &Tests::tanhActivation, &Tests::tanhDerivative,
+			&Utils::linear, &Utils::linearDerivative);
+
+		Tests::check(success, "the mixed network is loaded");
+		Tests::check(loaded.getParameterCount() == network.getParameterCount(), "the loaded network has the same number of parameters");
+
+		std::vector<float> parameters(network.getParameterCount()), loadedParameters(loaded.getParameterCount());
+		network.getParameters(parameters.data());
+		loaded.getParameters(loadedParameters.data());
+
+		Tests::check(parameters == loadedParameters, "loaded parameters");
+
+		Matrix inputs = Tests::randomMatrix(18, 6, generator);
+
+		Matrix outputs = network.forwardPropagate(inputs);
+		const Matrix& loadedOutputs = loaded.forwardPropagate(inputs);
+
+		bool same = outputs.rowsCount() == loadedOutputs.rowsCount() && outputs.columnsCount() == loadedOutputs.columnsCount();
+
+		for (size_t i = 0; same && i < outputs.rowsCount(); i++)
+		{
+			for (size_t j = 0; j < outputs.columnsCount(); j++)
+				same = same && outputs(i, j) == loadedOutputs(i, j);
+		}
+
+		Tests::check(same, "the loaded network computes the same outputs");
+	}
+
+	// Check that networks of dense layers are still saved in the original format, which starts with the number of
+	// layers, and that layers whose inputs don't match the previous outputs are rejected
+	void testDenseFormatAndSizes()
+	{
+		NeuralNetwork dense({ 3, 4, 2 });
+		dense.saveToFile("network_layer_test_dense.nn");
+
+		int layerCount = 0;
+
+		{
+			std::ifstream inFile("network_layer_test_dense.nn", std::ios::binary | std::ios::in);
+			inFile.read(reinterpret_cast<char*>(&layerCount), sizeof(layerCount));
+		}
+
+		Tests::check(layerCount == 2, "a dense network file starts with the number of layers");
+
+		NeuralNetwork loaded;
+		Tests::check(loaded.loadFromFile("network_layer_test_dense.nn") && loaded.getParameterCount() == dense.getParameterCount(),
+			"a dense network is loaded");
+
+		bool threw = false;
+
+		try {
+			dense.addLayer(Layer(5, 1));
+		}
+		catch (const std::invalid_argument&) {
+			threw = true;
+		}
+
+		Tests::check(threw, "adding a layer whose inputs don't match the outputs of the network throws");
+	}
+}
+
+int main()
+{
+	testNormalizationResidualGradients();
+	testMixedSaveLoad();
+	testDenseFormatAndSizes();
+
+	return Tests::result();
+}
@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Matrix.h"
+#include "PPO.h"
+#include "BenchmarkEnvironments.h"
+
+#include "TestUtils.h"
+#include "GradientCheck.h"
+
+using namespace BaseML;
+
+namespace BaseML::RL
+{
+	// Reaches the fused policy gradient kernel of PPO
+	struct PPOTestAccess
+	{
+		static void setActionLogStd(PPO& ppo, const std::vector<float>& logStd)
+		{
+			for (size_t j = 0; j < logStd.size(); j++)
+				ppo.actionLogStd(j) = logStd[j];
+		}
+
+		static float getClipThreshold(const PPO& ppo)
+		{
+			return ppo.clipThreshold;
+		}
+
+		static PolicyUpdateStats computePolicyGradients(const PPO& ppo, const Matrix& actionMeans, const RLTrainingData& data,
+			const Matrix& advantages, Matrix& gradients, Matrix& logStdGradients)
+		{
+			return ppo.computePolicyGradients(actionMeans, data, advantages, gradients, logStdGradients);
+		}
+	};
+}
+
+namespace
+{
+	const double LOG_2_PI = std::log(2.0 * 3.14159265358979);
+
+	// The PPO-Clip objective and its gradients computed one step at a time in double precision
+	struct Reference
+	{
+		double policyLoss = 0.0, clipFraction = 0.0, approxKL = 0.0;
+		std::vector<double> meanGradients; // Not averaged over the batch, like the gradients of the kernel
+		std::vector<double> logStdGradients; // Averaged over the batch
+
+		Reference(const Matrix& means, const std::vector<float>& logStd, const RL::RLTrainingData& data, const Matrix& advantages,
+			double clip)
+			:meanGradients(means.size(), 0.0), logStdGradients(logStd.size(), 0.0)
+		{
+			const size_t actionDim = means.rowsCount(), batchSize = means.columnsCount();
+
+			for (size_t i = 0; i < batchSize; i++)
+			{
+				double logProbability = 0.0;
+
+				for (size_t j = 0; j < actionDim; j++)
+				{
+					double diff = (double)data.actions(j, i) - means(j, i);
+					double variance = std::exp(2.0 * logStd[j]);
+
+					logProbability -= logStd[j] + 0.5 * LOG_2_PI + 0.5 * diff * diff / variance;
+				}
+
+				double logRatio = logProbability - data.logProbabilities(i);
+				double ratio = std::exp(logRatio);
+				double advantage = advantages(i);
+
+				double objective = std::min(ratio * advantage, std::clamp(ratio, 1.0 - clip, 1.0 + clip) * advantage);
+
+				policyLoss -= objective / batchSize;
+				approxKL += ((ratio - 1.0) - logRatio) / batchSize;
+				clipFraction += (ratio > 1.0 + clip || ratio < 1.0 - clip) ? 1.0 / batchSize : 0.0;
+
+				// The unclipped term is the smaller one, or the ratio is inside the clip range
+				bool active = (advantage > 0 && ratio < 1.0 + clip) || (advantage < 0 && ratio > 1.0 - clip);
+
+				if (!active)
+					continue;
+
+				for (size_t j = 0; j < actionDim; j++)
+				{
+					double diff = (double)data.actions(j, i) - means(j, i);
+					double variance = std::exp(2.0 * logStd[j]);
+
+					// Derivatives of the loss (the negative objective) through the log probability
+					meanGradients[j * batchSize + i] = -advantage * ratio * diff / variance;
+					logStdGradients[j] -= advantage * ratio * (diff * diff / variance - 1.0) / batchSize;
+				}
+			}
+		}
+	};
+
+	// Compare the fused kernel with the reference on a batch that isn't a multiple of the kernel's block, with
+	// data points on both sides of the clip range and advantages of both signs, and check the gradients of the
+	// kernel with central differences of the reference objective
+	void testPolicyGradients()
+	{
+		const size_t actionDim = 3, batchSize = 150;
+		const std::vector<float> logStd = { -0.5f, -0.2f, 0.1f };
+
+		RL::PPO ppo(std::make_unique<RL::PointMassEnvironment>(actionDim), "ppo_policy_gradient_test_critic.nn",
+			"ppo_policy_gradient_test_actor.nn");
+
+		RL::PPOTestAccess::setActionLogStd(ppo, logStd);
+		const double clip = RL::PPOTestAccess::getClipThreshold(ppo);
+
+		std::mt19937 generator(28);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+		Matrix means = Tests::randomMatrix(actionDim, batchSize, generator);
+		Matrix advantages(1, batchSize);
+
+		RL::RLTrainingData data;
+		data.actions = Matrix(actionDim, batchSize);
+		data.logProbabilities = Matrix(1, batchSize);
+
+		// The old log probabilities put the ratios at these values, far enough from the ends of the clip range
+		// (0.8 and 1.2) for the central differences not to cross them
+		const double ratios[] = { 0.5, 0.7, 0.95, 1.05, 1.4, 2.0 };
+
+		for (size_t i = 0; i < batchSize; i++)
+		{
+			double logProbability = 0.0;
+
+			for (size_t j = 0; j < actionDim; j++)
+			{
+				float stddev = std::exp(logStd[j]);
+				data.actions(j, i) = means(j, i) + 2.0f * stddev * unit(generator);
+
+				double diff = (double)data.actions(j, i) - means(j, i);
+				logProbability -= logStd[j] + 0.5 * LOG_2_PI + 0.5 * diff * diff / (stddev * stddev);
+			}
+
+			data.logProbabilities(i) = (float)(logProbability - std::log(ratios[i % std::size(ratios)]));
+
+			float magnitude = 0.2f + 1.8f * std::abs(unit(generator));
+			advantages(i) = unit(generator) < 0.0f ? -magnitude : magnitude;
+		}
+
+		Matrix gradients(actionDim, batchSize), logStdGradients;
+		RL::PolicyUpdateStats stats = RL::PPOTestAccess::computePolicyGradients(ppo, means, data, advantages, gradients, logStdGradients);
+
+		Reference reference(means, logStd, data, advantages, clip);
+
+		Tests::check(reference.clipFraction > 0.3 && reference.clipFraction < 0.9, "the batch has clipped and unclipped data points");
+		Tests::check(std::abs(stats.clipFraction - reference.clipFraction) <= 1.0e-6, "clip fraction matches the reference");
+		Tests::check(std::abs(stats.policyLoss - reference.policyLoss) <= 1.0e-4 * (1.0 + std::abs(reference.policyLoss)),
+			"policy loss matches the reference");
+		Tests::check(std::abs(stats.approxKL - reference.approxKL) <= 1.0e-4 * (1.0 + std::abs(reference.approxKL)),
+			"KL estimate matches the reference");
+
+		double maxDifference = 0.0;
+
+		for (size_t j = 0; j < actionDim; j++)
+		{
+			for (size_t i = 0; i < batchSize; i++)
+			{
+				double expected = reference.meanGradients[j * batchSize + i];
+				maxDifference = std::max(maxDifference, std::abs(gradients(j, i) - expected) / (1.0 + std::abs(expected)));
+			}
+
+			maxDifference = std::max(maxDifference, std::abs(logStdGradients(j) - reference.logStdGradients[j]) /
+				(1.0 + std::abs(reference.logStdGradients[j])));
+		}
+
+		Tests::check(maxDifference <= 1.0e-4, "gradients match the reference (difference " + std::to_string(maxDifference) + ")");
+
+		// The gradients of the means are those of the sum of the losses of the data points, and the gradients of
+		// the log standard deviations are those of the average
+		std::vector<float> meanValues, meanGradients;
+
+		for (size_t j = 0; j < actionDim; j++)
+		{
+			for (size_t i = 0; i < batchSize; i++)
+			{
+				meanValues.push_back(means(j, i));
+				meanGradients.push_back(gradients(j, i));
+			}
+		}
+
+		std::vector<float> logStdValues = logStd, logStdGradientValues(actionDim);
+
+		for (size_t j = 0; j < actionDim; j++)
+			logStdGradientValues[j] = logStdGradients(j);
+
+		auto averageLoss = [&] {
+			Matrix perturbedMeans(actionDim, batchSize);
+
+			for (size_t k = 0; k < meanValues.size(); k++)
+				perturbedMeans(k / batchSize, k % batchSize) = meanValues[k];
+
+			return Reference(perturbedMeans, logStdValues, data, advantages, clip).policyLoss;
+		};
+
+		double meanError = Tests::gradientError(meanValues, meanGradients, [&] { return averageLoss() * batchSize; });
+		double logStdError = Tests::gradientError(logStdValues, logStdGradientValues, averageLoss);
+
+		Tests::check(meanError <= Tests::GRADIENT_CHECK_TOLERANCE,
+			"gradients of the means (relative error " + std::to_string(meanError) + ")");
+		Tests::check(logStdError <= Tests::GRADIENT_CHECK_TOLERANCE,
+			"gradients of the log standard deviations (relative error " + std::to_string(logStdError) + ")");
+	}
+}
+
+int main()
+{
+	testPolicyGradients();
+
+	return Tests::result();
+}
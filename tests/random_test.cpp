@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <omp.h>
+
+#include "Matrix.h"
+#include "UtilsRandom.h"
+
+#include "TestUtils.h"
+
+using namespace BaseML;
+
+namespace
+{
+	// Check Philox4x32-10 against the known answers of the Random123 reference implementation. The counter
+	// words are (counter, stream) and the key words are the seed, low halves first.
+	void testPhiloxKnownAnswers()
+	{
+		struct KnownAnswer
+		{
+			uint64_t seed, stream, counter;
+			std::array<uint32_t, 4> expected;
+		};
+
+		const KnownAnswer answers[] = {
+			{ 0, 0, 0, { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 } },
+			{ ~0ull, ~0ull, ~0ull, { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd } },
+			{ 0x299f31d0a4093822, 0x0370734413198a2e, 0x85a308d3243f6a88, { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 } }
+		};
+
+		for (const KnownAnswer& answer : answers)
+		{
+			Tests::check(Utils::Philox4x32::generate(answer.seed, answer.stream, answer.counter) == answer.expected,
+				"Philox4x32-10 matches the reference for seed " + std::to_string(answer.seed));
+		}
+	}
+
+	// Returns true if the matrices hold the same bits
+	bool sameBits(const Matrix& a, const Matrix& b)
+	{
+		return a.size() == b.size() && std::memcmp(&a(0), &b(0), a.size() * sizeof(float)) == 0;
+	}
+
+	// Check that the samples depend only on (seed, stream, offset) and not on the number of threads
+	void testSamplesDontDependOnThreads()
+	{
+		std::mt19937 generator(27);
+
+		// Not a multiple of the 4 samples of a block
+		Matrix means = Tests::randomMatrix(7, 1001, generator);
+		Matrix columnMajorMeans = means.toLayout(Matrix::Layout::ColumnMajor);
+		Matrix logStddevs = Tests::randomMatrix(7, 1, generator, 0.5f);
+
+		const int maxThreads = std::max(omp_get_max_threads(), 4);
+
+		Matrix samples[2], rowSamples[2], columnMajorRowSamples[2];
+		uint64_t offsets[2];
+
+		for (int run = 0; run < 2; run++)
+		{
+			omp_set_num_threads(run == 0 ? 1 : maxThreads);
+
+			Utils::GaussianSampler sampler(0.3f, 1234, 5);
+			sampler.setOffset(17);
+
+			samples[run] = sampler.sample(means);
+			rowSamples[run] = sampler.sample(means, logStddevs);
+			columnMajorRowSamples[run] = sampler.sample(columnMajorMeans, logStddevs);
+
+			offsets[run] = sampler.getOffset();
+		}
+
+		omp_set_num_threads(maxThreads);
+
+		Tests::check(sameBits(samples[0], samples[1]), "samples with one and with " + std::to_string(maxThreads) + " threads are equal");
+		Tests::check(sameBits(rowSamples[0], rowSamples[1]), "samples with per-row deviations don't depend on the threads");
+		Tests::check(sameBits(columnMajorRowSamples[0], columnMajorRowSamples[1]),
+			"column-major samples with per-row deviations don't depend on the threads");
+		Tests::check(offsets[0] == offsets[1] && offsets[0] == 17 + 3 * 1752, "every block of 4 samples consumes one counter value");
+
+		// A sampler moved to the same offset continues the same stream
+		Utils::GaussianSampler resumed(0.3f, 1234, 5);
+		resumed.setOffset(17 + 1752);
+
+		Tests::check(sameBits(resumed.sample(means, logStddevs), rowSamples[0]), "a sampler resumed at an offset continues the stream");
+
+		Utils::GaussianSampler otherStream(0.3f, 1234, 6);
+		otherStream.setOffset(17);
+
+		Tests::check(!sameBits(otherStream.sample(means), samples[0]), "different streams give different samples");
+	}
+}
+
+int main()
+{
+	testPhiloxKnownAnswers();
+	testSamplesDontDependOnThreads();
+
+	return Tests::result();
+}
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Matrix.h"
+#include "RecurrentLayer.h"
+
+#include "TestUtils.h"
+#include "GradientCheck.h"
+
+using namespace BaseML;
+
+namespace
+{
+	const char* cellName(RecurrentLayer::Cell cell)
+	{
+		return cell == RecurrentLayer::Cell::LSTM ? "LSTM" : "GRU";
+	}
+
+	// Returns a layer with parameters from a fixed seed, so every run checks the same layer
+	RecurrentLayer makeLayer(RecurrentLayer::Cell cell, size_t inputs, size_t hidden, std::mt19937& generator)
+	{
+		RecurrentLayer layer(cell, inputs, hidden);
+
+		std::vector<float> parameters(layer.getParameterCount());
+		std::uniform_real_distribution<float> distribution(-0.5f, 0.5f);
+
+		for (float& parameter : parameters)
+			parameter = distribution(generator);
+
+		layer.setParameters(parameters.data());
+
+		return layer;
+	}
+
+	// Compare the gradients of the parameters and of the inputs, back propagated through the time of sequences
+	// of different lengths that start from given states, with central differences
+	void testGradients(RecurrentLayer::Cell cell)
+	{
+		const std::string name = cellName(cell);
+		std::mt19937 generator(48);
+
+		const size_t inputCount = 5, hiddenCount = 7;
+		RecurrentLayer layer = makeLayer(cell, inputCount, hiddenCount, generator);
+
+		// Sequences of lengths 4, 3 and 2, packed timestep by timestep
+		const std::vector<size_t> batchSizes = { 3, 3, 2, 1 };
+		const size_t dataPoints = 9;
+
+		Matrix inputs = Tests::randomMatrix(inputCount, dataPoints, generator);
+		Matrix initialStates = Tests::randomMatrix(layer.getStateSize(), 3, generator, 0.5f, Matrix::Layout::ColumnMajor);
+
+		// The loss is a weighted sum of the outputs, so its gradients with respect to the outputs are the weights
+		Matrix lossWeights = Tests::randomMatrix(hiddenCount, dataPoints, generator);
+
+		auto loss = [&] {
+			const Matrix& outputs = layer.forwardPropagate(inputs, batchSizes, &initialStates);
+			double sum = 0.0;
+
+			for (size_t i = 0; i < hiddenCount; i++)
+			{
+				for (size_t j = 0; j < dataPoints; j++)
+					sum += (double)lossWeights(i, j) * outputs(i, j);
+			}
+
+			return sum;
+		};
+
+		loss();
+		layer.calculateGradients(lossWeights);
+
+		std::vector<float> parameters(layer.getParameterCount()), parameterGradients(layer.getParameterCount(), 0.0f);
+		layer.getParameters(parameters.data());
+		layer.addParameterGradients(parameterGradients.data());
+
+		Matrix inputGradients = layer.calculateInputGradients();
+
+		double parameterError = Tests::gradientError(parameters, parameterGradients, loss,
+			[&] { layer.setParameters(parameters.data()); });
+
+		Tests::check(parameterError <= Tests::GRADIENT_CHECK_TOLERANCE,
+			name + ": gradients of the parameters (relative error " + std::to_string(parameterError) + ")");
+
+		std::vector<float> inputValues, inputValueGradients;
+
+		for (size_t i = 0; i < inputCount; i++)
+		{
+			for (size_t j = 0; j < dataPoints; j++)
+			{
+				inputValues.push_back(inputs(i, j));
+				inputValueGradients.push_back(inputGradients(i, j));
+			}
+		}
+
+		double inputError = Tests::gradientError(inputValues, inputValueGradients, loss, [&] {
+			for (size_t i = 0; i < inputCount; i++)
+			{
+				for (size_t j = 0; j < dataPoints; j++)
+					inputs(i, j) = inputValues[i * dataPoints + j];
+			}
+		});
+
+		Tests::check(inputError <= Tests::GRADIENT_CHECK_TOLERANCE,
+			name + ": gradients of the inputs (relative error " + std::to_string(inputError) + ")");
+
+		// Running the first sequence one timestep at a time gives the outputs of the packed forward pass
+		const Matrix& outputs = layer.forwardPropagate(inputs, batchSizes, &initialStates);
+		const size_t firstSequenceColumns[] = { 0, 3, 6, 8 };
+
+		size_t first = 0;
+		Matrix state = initialStates.gatherColumns(&first, 1), stepOutputs;
+		float maxDifference = 0.0f;
+
+		for (size_t column : firstSequenceColumns)
+		{
+			layer.step(inputs.gatherColumns(&column, 1), state, stepOutputs);
+
+			for (size_t u = 0; u < hiddenCount; u++)
+				maxDifference = std::max(maxDifference, std::abs(stepOutputs(u) - outputs(u, column)));
+		}
+
+		Tests::check(maxDifference <= 1.0e-5f, name + ": step() matches the packed forward pass");
+	}
+
+	// Check that a saved layer is loaded back with the same cells and parameters
+	void testSaveLoad(RecurrentLayer::Cell cell)
+	{
+		const std::string name = cellName(cell);
+		std::mt19937 generator(480);
+
+		RecurrentLayer layer = makeLayer(cell, 4, 6, generator);
+
+		{
+			std::ofstream outFile("recurrent_layer_test.bin", std::ios::binary | std::ios::out);
+			layer.save(outFile);
+		}
+
+		RecurrentLayer loaded;
+
+		{
+			std::ifstream inFile("recurrent_layer_test.bin", std::ios::binary | std::ios::in);
+			loaded.load(inFile);
+		}
+
+		Tests::check(loaded.getCell() == cell && loaded.getInputCount() == 4 && loaded.getOutputCount() == 6, name + ": loaded shape");
+
+		std::vector<float> parameters(layer.getParameterCount()), loadedParameters(loaded.getParameterCount());
+		layer.getParameters(parameters.data());
+		loaded.getParameters(loadedParameters.data());
+
+		Tests::check(parameters == loadedParameters, name + ": loaded parameters");
+
+		const std::vector<size_t> batchSizes = { 2, 1 };
+		Matrix inputs = Tests::randomMatrix(4, 3, generator);
+
+		Matrix outputs = layer.forwardPropagate(inputs, batchSizes);
+		const Matrix& loadedOutputs = loaded.forwardPropagate(inputs, batchSizes);
+
+		bool same = true;
+
+		for (size_t i = 0; i < 6; i++)
+		{
+			for (size_t j = 0; j < 3; j++)
+				same = same && outputs(i, j) == loadedOutputs(i, j);
+		}
+
+		Tests::check(same, name + ": the loaded layer computes the same outputs");
+	}
+
+	// Check that loading a file with an unknown type of cells throws
+	void testLoadRejectsUnknownCell()
+	{
+		std::mt19937 generator(481);
+		RecurrentLayer layer = makeLayer(RecurrentLayer::Cell::GRU, 3, 4, generator);
+
+		{
+			std::ofstream outFile("recurrent_layer_test.bin", std::ios::binary | std::ios::out);
+			layer.save(outFile);
+		}
+
+		// The type of the cells is the first value in the file
+		{
+			std::fstream file("recurrent_layer_test.bin", std::ios::binary | std::ios::in | std::ios::out);
+			int unknownCell = 7;
+			file.write(reinterpret_cast<const char*>(&unknownCell), sizeof(unknownCell));
+		}
+
+		bool threw = false;
+
+		try {
+			std::ifstream inFile("recurrent_layer_test.bin", std::ios::binary | std::ios::in);
+			RecurrentLayer loaded;
+			loaded.load(inFile);
+		}
+		catch (const std::runtime_error&) {
+			threw = true;
+		}
+
+		Tests::check(threw, "loading an unknown type of cells throws");
+	}
+}
+
+int main()
+{
+	for (RecurrentLayer::Cell cell : { RecurrentLayer::Cell::LSTM, RecurrentLayer::Cell::GRU })
+	{
+		testGradients(cell);
+		testSaveLoad(cell);
+	}
+
+	testLoadRejectsUnknownCell();
+
+	return Tests::result();
+}
@@ -0,0 +1,227 @@
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Matrix.h"
+#include "RolloutFile.h"
+
+#include "TestUtils.h"
+
+using namespace BaseML;
+
+namespace
+{
+	// Returns rollouts of 'count' timesteps with random values
+	RL::RLTrainingData makeRollouts(size_t observationDimension, size_t actionDimension, size_t count, std::mt19937& generator)
+	{
+		RL::RLTrainingData data;
+
+		data.observations = Tests::randomMatrix(observationDimension, count, generator, 5.0f);
+		data.actions = Tests::randomMatrix(actionDimension, count, generator);
+		data.rewards = Tests::randomMatrix(1, count, generator, 10.0f);
+		data.logProbabilities = Tests::randomMatrix(1, count, generator, 3.0f);
+		data.dones = Matrix(1, count);
+
+		for (size_t j = 0; j < count; j++)
+			data.dones(j) = j % 7 == 6 ? 1.0f : 0.0f;
+
+		return data;
+	}
+
+	// Returns true if every value of 'read' is within 'tolerance' (relative) of the value in 'written'
+	bool matches(const Matrix& read, const Matrix& written, float tolerance)
+	{
+		if (read.rowsCount() != written.rowsCount() || read.columnsCount() != written.columnsCount())
+			return false;
+
+		for (size_t i = 0; i < written.rowsCount(); i++)
+		{
+			for (size_t j = 0; j < written.columnsCount(); j++)
+			{
+				if (std::abs(read(i, j) - written(i, j)) > tolerance * std::abs(written(i, j)))
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Check that rollouts written in several appends (one of them by a second writer) are read back unchanged
+	void testRoundTrip(bool bfloat16)
+	{
+		const std::string name = bfloat16 ? "bfloat16" : "float32";
+		const char* path = bfloat16 ? "rollout_file_test_bf16.bin" : "rollout_file_test.bin";
+
+		// bfloat16 keeps 8 significant bits
+		const float tolerance = bfloat16 ? 1.0f / 256 : 0.0f;
+
+		std::mt19937 generator(38);
+		std::vector<RL::RLTrainingData> written;
+
+		{
+			RL::RolloutWriter writer(path, 4, 2, bfloat16);
+
+			for (size_t count : { 13, 1, 100 })
+			{
+				written.push_back(makeRollouts(4, 2, count, generator));
+				writer.append(written.back());
+			}
+		}
+
+		{
+			RL::RolloutWriter writer(path, 4, 2, bfloat16, true);
+
+			written.push_back(makeRollouts(4, 2, 50, generator));
+			writer.append(written.back());
+
+			Tests::check(writer.getChunkCount() == 4, name + ": chunks after appending to the file");
+		}
+
+		RL::RolloutReader reader(path);
+
+		Tests::check(reader.getObservationDimension() == 4 && reader.getActionDimension() == 2, name + ": dimensions");
+		Tests::check(reader.isBFloat16() == bfloat16, name + ": value type");
+		Tests::check(reader.getChunkCount() == written.size() && reader.size() == 164, name + ": chunk count and size");
+
+		for (size_t c = 0; c < written.size() && c < reader.getChunkCount(); c++)
+		{
+			RL::RLTrainingData read = reader.readChunk(c);
+			const std::string chunk = name + ": chunk " + std::to_string(c);
+
+			Tests::check(reader.getChunkSize(c) == written[c].observations.columnsCount(), chunk + " size");
+			Tests::check(matches(read.observations, written[c].observations, tolerance), chunk + " observations");
+			Tests::check(matches(read.actions, written[c].actions, tolerance), chunk + " actions");
+			Tests::check(matches(read.rewards, written[c].rewards, tolerance), chunk + " rewards");
+			Tests::check(matches(read.logProbabilities, written[c].logProbabilities, tolerance), chunk + " log probabilities");
+			Tests::check(matches(read.dones, written[c].dones, 0.0f), chunk + " done flags");
+			Tests::check(read.observations.isView() == !bfloat16, chunk + " float32 columns are views of the file");
+		}
+
+		bool threw = false;
+
+		try {
+			reader.getColumn(written.size(), RL::RolloutColumn::Rewards);
+		}
+		catch (const std::out_of_range&) {
+			threw = true;
+		}
+
+		Tests::check(threw, name + ": reading a chunk past the end throws");
+	}
+
+	// Check that an append that stops before it updates the header leaves the chunks already in the file readable
+	void testInterruptedAppend()
+	{
+		std::mt19937 generator(381);
+		std::vector<RL::RLTrainingData> written;
+
+		RL::RolloutWriter writer("rollout_file_test_interrupted.bin", 3, 1);
+
+		for (size_t count : { 20, 30 })
+		{
+			written.push_back(makeRollouts(3, 1, count, generator));
+			writer.append(written.back());
+		}
+
+		RL::RolloutFileHeader header;
+
+		{
+			std::ifstream inFile("rollout_file_test_interrupted.bin", std::ios::binary | std::ios::in);
+			inFile.read(reinterpret_cast<char*>(&header), sizeof(header));
+		}
+
+		writer.append(makeRollouts(3, 1, 40, generator));
+		writer.close();
+
+		// Put the header of the file before the last append back
+		{
+			std::fstream file("rollout_file_test_interrupted.bin", std::ios::binary | std::ios::in | std::ios::out);
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		}
+
+		RL::RolloutReader reader("rollout_file_test_interrupted.bin");
+
+		Tests::check(reader.getChunkCount() == 2 && reader.size() == 50, "interrupted append: chunks before the append");
+
+		for (size_t c = 0; c < written.size() && c < reader.getChunkCount(); c++)
+		{
+			RL::RLTrainingData read = reader.readChunk(c);
+
+			Tests::check(matches(read.observations, written[c].observations, 0.0f) && matches(read.rewards, written[c].rewards, 0.0f),
+				"interrupted append: chunk " + std::to_string(c) + " is unchanged");
+		}
+	}
+
+	// Check that the reader rejects files whose chunk index points outside of the file
+	void testCorruptIndex()
+	{
+		std::mt19937 generator(380);
+
+		{
+			RL::RolloutWriter writer("rollout_file_test_source.bin", 3, 1);
+			writer.append(makeRollouts(3, 1, 20, generator));
+			writer.append(makeRollouts(3, 1, 30, generator));
+		}
+
+		std::ifstream source("rollout_file_test_source.bin", std::ios::binary | std::ios::in);
+		const std::string bytes((std::istreambuf_iterator<char>(source)), std::istreambuf_iterator<char>());
+
+		RL::RolloutFileHeader header;
+		std::memcpy(&header, bytes.data(), sizeof(header));
+
+		const size_t entriesOffset = header.indexOffset;
+		const size_t countOffset = entriesOffset + offsetof(RL::RolloutChunkEntry, count);
+		const size_t firstColumnOffset = entriesOffset + offsetof(RL::RolloutChunkEntry, columnOffsets);
+
+		struct Corruption
+		{
+			const char* description;
+			size_t position;
+			uint64_t value;
+		};
+
+		const Corruption corruptions[] = {
+			{ "a column offset past the end of the file", firstColumnOffset, bytes.size() - 8 },
+			{ "a chunk size that wraps around", countOffset, ~0ull / 2 },
+			{ "a chunk count past the end of the file", offsetof(RL::RolloutFileHeader, chunkCount), ~0ull / 8 },
+			{ "an index offset past the end of the file", offsetof(RL::RolloutFileHeader, indexOffset), bytes.size() + 64 }
+		};
+
+		for (const Corruption& corruption : corruptions)
+		{
+			std::string corrupted = bytes;
+			std::memcpy(corrupted.data() + corruption.position, &corruption.value, sizeof(corruption.value));
+
+			{
+				std::ofstream outFile("rollout_file_test_corrupt.bin", std::ios::binary | std::ios::out);
+				outFile.write(corrupted.data(), corrupted.size());
+			}
+
+			bool threw = false;
+
+			try {
+				RL::RolloutReader reader("rollout_file_test_corrupt.bin");
+			}
+			catch (const std::runtime_error&) {
+				threw = true;
+			}
+
+			Tests::check(threw, std::string("rejects ") + corruption.description);
+		}
+	}
+}
+
+int main()
+{
+	testRoundTrip(false);
+	testRoundTrip(true);
+	testInterruptedAppend();
+	testCorruptIndex();
+
+	return Tests::result();
+}
@@ -0,0 +1,135 @@
+#include <cmath>
+#include <fstream>
+#include <vector>
+
+#include "Matrix.h"
+#include "UtilsGeneral.h"
+
+#include "TestUtils.h"
+
+using namespace BaseML;
+
+namespace
+{
+	// Returns the columns [begin, end) of 'data'
+	Matrix columnRange(const Matrix& data, size_t begin, size_t end)
+	{
+		std::vector<size_t> columns;
+
+		for (size_t j = begin; j < end; j++)
+			columns.push_back(j);
+
+		return data.gatherColumns(columns.data(), columns.size());
+	}
+
+	// Check that 'statistics' match the mean and the variance of every row of 'data', computed in two passes
+	void checkMatchesData(const Utils::RunningStatistics& statistics, const Matrix& data, const std::string& name)
+	{
+		Tests::check(statistics.getCount() == (double)data.columnsCount(), name + ": count");
+
+		for (size_t i = 0; i < data.rowsCount(); i++)
+		{
+			double mean = 0.0, variance = 0.0;
+
+			for (size_t j = 0; j < data.columnsCount(); j++)
+				mean += data(i, j);
+
+			mean /= data.columnsCount();
+
+			for (size_t j = 0; j < data.columnsCount(); j++)
+				variance += (data(i, j) - mean) * (data(i, j) - mean);
+
+			variance /= data.columnsCount();
+
+			Tests::check(std::abs(statistics.getMean(i) - mean) <= 1.0e-5 * (1.0 + std::abs(mean)), name + ": mean of row " + std::to_string(i));
+			Tests::check(std::abs(statistics.getVariance(i) - variance) <= 1.0e-4 * (1.0 + variance), name + ": variance of row " + std::to_string(i));
+		}
+	}
+
+	// Check that statistics merged from parts of the data match the statistics of a single pass over it
+	void testMergeMatchesSinglePass()
+	{
+		std::mt19937 generator(34);
+
+		// A large offset in the first row tests the numerical stability of the merges
+		Matrix data = Tests::randomMatrix(3, 10001, generator);
+
+		for (size_t j = 0; j < data.columnsCount(); j++)
+			data(0, j) += 1.0e4f;
+
+		Utils::RunningStatistics singlePass(3);
+		singlePass.update(data);
+
+		checkMatchesData(singlePass, data, "single pass");
+
+		// Uneven parts, including an empty one
+		const size_t bounds[] = { 0, 1, 1, 500, 5000, 5001, 10001 };
+
+		Utils::RunningStatistics merged(3), mergedStates(3);
+
+		for (size_t p = 0; p + 1 < std::size(bounds); p++)
+		{
+			Utils::RunningStatistics part(3);
+
+			if (bounds[p + 1] > bounds[p])
+				part.update(columnRange(data, bounds[p], bounds[p + 1]));
+
+			merged.merge(part);
+
+			// The way the processes of a distributed run exchange their statistics
+			std::vector<double> state(part.getStateSize());
+			part.getState(state.data());
+			mergedStates.mergeState(state.data());
+		}
+
+		checkMatchesData(merged, data, "merge");
+		checkMatchesData(mergedStates, data, "mergeState");
+
+		for (size_t i = 0; i < 3; i++)
+		{
+			Tests::check(std::abs(merged.getMean(i) - singlePass.getMean(i)) <= 1.0e-5f * (1.0f + std::abs(singlePass.getMean(i))),
+				"merged mean matches the single pass");
+			Tests::check(std::abs(merged.getVariance(i) - singlePass.getVariance(i)) <= 1.0e-4f * (1.0f + singlePass.getVariance(i)),
+				"merged variance matches the single pass");
+		}
+	}
+
+	// Check that saved statistics are loaded back unchanged
+	void testSaveLoad()
+	{
+		std::mt19937 generator(340);
+
+		Matrix data = Tests::randomMatrix(4, 100, generator, 3.0f);
+
+		Utils::RunningStatistics statistics(4);
+		statistics.update(data);
+
+		{
+			std::ofstream outFile("statistics_test.bin", std::ios::binary | std::ios::out);
+			statistics.save(outFile);
+		}
+
+		Utils::RunningStatistics loaded;
+
+		{
+			std::ifstream inFile("statistics_test.bin", std::ios::binary | std::ios::in);
+			loaded.load(inFile);
+		}
+
+		Tests::check(loaded.getDimension() == 4 && loaded.getCount() == statistics.getCount(), "loaded dimension and count");
+
+		for (size_t i = 0; i < 4; i++)
+		{
+			Tests::check(loaded.getMean(i) == statistics.getMean(i) && loaded.getVariance(i) == statistics.getVariance(i),
+				"loaded mean and variance");
+		}
+	}
+}
+
+int main()
+{
+	testMergeMatchesSinglePass();
+	testSaveLoad();
+
+	return Tests::result();
+}
@@ -0,0 +1,164 @@
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Matrix.h"
+#include "BenchmarkEnvironments.h"
+#include "SubprocessEnvironment.h"
+
+#include "TestUtils.h"
+
+using namespace BaseML;
+
+namespace
+{
+	const size_t WORKERS = 3, PLAYERS_PER_WORKER = 2;
+
+	// A point mass environment whose updates throw after the first few
+	class ThrowingEnvironment : public RL::PointMassEnvironment
+	{
+	private:
+		int updates = 0;
+
+	public:
+		ThrowingEnvironment()
+			:RL::PointMassEnvironment(2, PLAYERS_PER_WORKER)
+		{
+		}
+
+		void update() override
+		{
+			if (++updates > 2)
+				throw std::runtime_error("Simulator failure");
+
+			RL::PointMassEnvironment::update();
+		}
+	};
+
+	// Returns true if 'batch' holds the data of the players of 'reference' starting at column 'first'
+	bool matches(const RL::EnvironmentBatch& batch, const RL::EnvironmentBatch& reference, size_t first, bool compareRewards)
+	{
+		for (size_t p = 0; p < reference.dones.size(); p++)
+		{
+			for (size_t i = 0; i < reference.observations.rowsCount(); i++)
+			{
+				if (batch.observations(i, first + p) != reference.observations(i, p))
+					return false;
+			}
+
+			if (compareRewards && (batch.rewards(first + p) != reference.rewards(p) || batch.dones[first + p] != reference.dones[p]))
+				return false;
+		}
+
+		return true;
+	}
+
+	// Check that the batched interface gives the same data as the environments simulated in this process, for
+	// buffers in both layouts
+	void testMatchesInProcess(Matrix::Layout layout)
+	{
+		const std::string name = layout == Matrix::Layout::RowMajor ? "row-major" : "column-major";
+		std::mt19937 generator(33);
+
+		RL::SubprocessEnvironment environment([] { return std::make_unique<RL::PointMassEnvironment>(2, PLAYERS_PER_WORKER, 200, 27); },
+			WORKERS);
+
+		// Every worker simulates the same environment as one of these
+		std::vector<RL::PointMassEnvironment> references;
+
+		for (size_t w = 0; w < WORKERS; w++)
+			references.emplace_back(2, PLAYERS_PER_WORKER, 200, 27);
+
+		Tests::check(environment.getPlayerCount() == WORKERS * PLAYERS_PER_WORKER, name + ": players of all of the workers");
+
+		environment.initialize();
+		environment.reset();
+
+		for (RL::PointMassEnvironment& reference : references)
+		{
+			reference.initialize();
+			reference.reset();
+		}
+
+		RL::EnvironmentBatch batch, referenceBatch;
+		batch.observations = Matrix(4, WORKERS * PLAYERS_PER_WORKER, layout);
+
+		environment.observeBatch(batch);
+
+		for (size_t w = 0; w < WORKERS; w++)
+		{
+			references[w].observeBatch(referenceBatch);
+			Tests::check(matches(batch, referenceBatch, w * PLAYERS_PER_WORKER, false), name + ": observations after a reset");
+		}
+
+		bool same = true;
+
+		for (int step = 0; step < 20; step++)
+		{
+			Matrix actions = Tests::randomMatrix(2, WORKERS * PLAYERS_PER_WORKER, generator, 1.0f, layout);
+
+			environment.stepBatch(actions, batch);
+
+			for (size_t w = 0; w < WORKERS; w++)
+			{
+				std::vector<size_t> columns;
+
+				for (size_t p = 0; p < PLAYERS_PER_WORKER; p++)
+					columns.push_back(w * PLAYERS_PER_WORKER + p);
+
+				references[w].stepBatch(actions.gatherColumns(columns.data(), columns.size()), referenceBatch);
+				same = same && matches(batch, referenceBatch, w * PLAYERS_PER_WORKER, true);
+			}
+		}
+
+		Tests::check(same, name + ": stepBatch() matches the environments simulated in this process");
+		Tests::check(batch.observations.getLayout() == layout, name + ": the observations keep their layout");
+
+		environment.observeBatch(batch);
+
+		for (size_t w = 0; w < WORKERS; w++)
+		{
+			references[w].observeBatch(referenceBatch);
+			Tests::check(matches(batch, referenceBatch, w * PLAYERS_PER_WORKER, false), name + ": observeBatch() after the steps");
+		}
+
+		environment.close();
+	}
+
+	// Check that an environment that throws in a worker makes the call that waits for it throw here
+	void testWorkerFailure()
+	{
+		RL::SubprocessEnvironment environment([] { return std::make_unique<ThrowingEnvironment>(); }, WORKERS);
+
+		environment.initialize();
+		environment.reset();
+
+		RL::EnvironmentBatch batch;
+		Matrix actions(2, WORKERS * PLAYERS_PER_WORKER);
+		actions.clear();
+
+		int failedStep = -1;
+
+		for (int step = 0; step < 5 && failedStep < 0; step++)
+		{
+			try {
+				environment.stepBatch(actions, batch);
+			}
+			catch (const std::runtime_error&) {
+				failedStep = step;
+			}
+		}
+
+		Tests::check(failedStep == 2, "a worker whose environment throws makes stepBatch() throw");
+	}
+}
+
+int main()
+{
+	testMatchesInProcess(Matrix::Layout::RowMajor);
+	testMatchesInProcess(Matrix::Layout::ColumnMajor);
+	testWorkerFailure();
+
+	return Tests::result();
+}